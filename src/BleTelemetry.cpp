@@ -0,0 +1,346 @@
+#include "BleTelemetry.h"
+
+#ifdef ENABLE_BLE
+
+#include "Bluetooth.h"
+#include "TelemetryBatch.h"
+#include "TelemetryFormat.h"
+#include "TelemetryStream.h"
+#include "TelemetryBus.h"
+#include "CANListenerTask.h"
+#include "Parameter.h"
+#include "TaskTable.h"
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLE2902.h>
+#include <BLESecurity.h>
+#include <cstring>
+#include <climits>
+
+#ifdef ENABLE_BLUETOOTH
+#error "Bluetooth Serial and BLE telemetry cannot run together, comment out ENABLE_BLUETOOTH in Bluetooth.h"
+#endif
+
+static_assert(NUM_TELEMETRY_FIELDS <= 32, "The field mask of a batch holds 32 fields");
+
+// Largest notification, the ATT header takes 3 bytes of the MTU
+#define BLE_PAYLOAD_MAX (BLE_MTU - 3)
+
+// Notification bits of the BLE task, set from the Bluedroid callbacks
+#define BLE_EVENT_CONNECTION    (1UL << 0)
+#define BLE_EVENT_CONFIG        (1UL << 1)
+#define BLE_EVENT_PARAMETER     (1UL << 2)
+
+#define BLE_CONFIG_SIZE         7
+#define BLE_PARAMETER_WRITE     5
+
+TaskHandle_t bleTaskHandle = NULL;
+BLEServer *bleServer = NULL;
+BLECharacteristic *telemetryCharacteristic = NULL;
+BLE2902 telemetryNotifyDescriptor;
+BLESecurity bleSecurity;
+portMUX_TYPE bleMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Configuration, written by the config characteristic and read by the task under bleMux
+uint8_t bleRateHz = BLE_DEFAULT_RATE_HZ;
+uint16_t bleMaxDelayMs = BLE_DEFAULT_MAX_DELAY_MS;
+uint32_t bleFieldMask = 0;
+volatile bool bleConnected = false;
+
+// A parameter write waiting for the task, NVS is not written from the Bluetooth stack
+int blePendingIndex = -1;
+int32_t blePendingValue = 0;
+
+BleTelemetryStats bleStats = {false, false, 0, BLE_DEFAULT_RATE_HZ, 0, 0, 0, 0};
+
+// Only used by the BLE task
+uint8_t bleBatchBuffer[BLE_PAYLOAD_MAX];
+uint8_t bleSampleBuffer[BLE_PAYLOAD_MAX];
+
+void bleTelemetryTask(void *parameter);
+
+void notifyBleTask(uint32_t events) {
+    if (bleTaskHandle != NULL) {
+        xTaskNotify(bleTaskHandle, events, eSetBits);
+    }
+}
+
+// Default fields, the same as the stream command
+uint32_t defaultBleFieldMask() {
+    char fields[] = STREAM_DEFAULT_FIELDS;
+    uint32_t mask = 0;
+    char *save;
+    for (char *name = strtok_r(fields, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        TelemetryFieldId id = findTelemetryField(name);
+        if (id != NUM_TELEMETRY_FIELDS) {
+            mask |= 1UL << id;
+        }
+    }
+    return mask;
+}
+
+class BleServerCallbacks : public BLEServerCallbacks {
+    void onConnect(BLEServer *server) override {
+        bleConnected = true;
+        notifyBleTask(BLE_EVENT_CONNECTION);
+    }
+
+    void onDisconnect(BLEServer *server) override {
+        bleConnected = false;
+        notifyBleTask(BLE_EVENT_CONNECTION);
+        // Advertising stops with a connection, be findable again
+        BLEDevice::startAdvertising();
+    }
+};
+
+class SchemaCallbacks : public BLECharacteristicCallbacks {
+    void onRead(BLECharacteristic *characteristic) override {
+        uint8_t schema[BLE_PAYLOAD_MAX];
+        portENTER_CRITICAL(&bleMux);
+        uint32_t fieldMask = bleFieldMask;
+        portEXIT_CRITICAL(&bleMux);
+        // Longer schemas are read in several requests by the client
+        size_t length = packTelemetrySchema(schema, sizeof(schema), fieldMask);
+        characteristic->setValue(schema, length);
+    }
+};
+
+class ConfigCallbacks : public BLECharacteristicCallbacks {
+    void onRead(BLECharacteristic *characteristic) override {
+        uint8_t config[BLE_CONFIG_SIZE];
+        portENTER_CRITICAL(&bleMux);
+        config[0] = bleRateHz;
+        memcpy(config + 1, &bleMaxDelayMs, sizeof(bleMaxDelayMs));
+        memcpy(config + 3, &bleFieldMask, sizeof(bleFieldMask));
+        portEXIT_CRITICAL(&bleMux);
+        characteristic->setValue(config, sizeof(config));
+    }
+
+    void onWrite(BLECharacteristic *characteristic) override {
+        std::string value = characteristic->getValue();
+        if (value.size() != BLE_CONFIG_SIZE) {
+            return;
+        }
+        const uint8_t *config = (const uint8_t *)value.data();
+        uint16_t maxDelayMs;
+        uint32_t fieldMask;
+        memcpy(&maxDelayMs, config + 1, sizeof(maxDelayMs));
+        memcpy(&fieldMask, config + 3, sizeof(fieldMask));
+        fieldMask &= (1UL << NUM_TELEMETRY_FIELDS) - 1;
+        if (config[0] == 0 || config[0] > BLE_MAX_RATE_HZ || fieldMask == 0) {
+            return;
+        }
+        portENTER_CRITICAL(&bleMux);
+        bleRateHz = config[0];
+        bleMaxDelayMs = maxDelayMs;
+        bleFieldMask = fieldMask;
+        portEXIT_CRITICAL(&bleMux);
+        notifyBleTask(BLE_EVENT_CONFIG);
+    }
+};
+
+class CanStatsCallbacks : public BLECharacteristicCallbacks {
+    void onRead(BLECharacteristic *characteristic) override {
+        CanStats stats = getCanStats();
+        uint32_t sinceLastFrame = stats.lastFrameMillis ? millis() - stats.lastFrameMillis : 0;
+        uint32_t values[4] = {stats.received, sinceLastFrame, stats.rxMissed, stats.busErrors};
+        characteristic->setValue((uint8_t *)values, sizeof(values));
+    }
+};
+
+class ParameterCallbacks : public BLECharacteristicCallbacks {
+    void onRead(BLECharacteristic *characteristic) override {
+        uint8_t values[1 + BLE_PAYLOAD_MAX / 4 * 4];
+        int count = NUM_PARAMETERS < BLE_PAYLOAD_MAX / 4 ? NUM_PARAMETERS : BLE_PAYLOAD_MAX / 4;
+        values[0] = count;
+        for (int i = 0; i < count; i++) {
+            int32_t value = parameterValues[i];
+            memcpy(values + 1 + i * 4, &value, sizeof(value));
+        }
+        characteristic->setValue(values, 1 + count * 4);
+    }
+
+    void onWrite(BLECharacteristic *characteristic) override {
+        std::string value = characteristic->getValue();
+        if (value.size() != BLE_PARAMETER_WRITE) {
+            return;
+        }
+        portENTER_CRITICAL(&bleMux);
+        blePendingIndex = (uint8_t)value[0];
+        memcpy(&blePendingValue, value.data() + 1, sizeof(blePendingValue));
+        portEXIT_CRITICAL(&bleMux);
+        notifyBleTask(BLE_EVENT_PARAMETER);
+    }
+};
+
+BleServerCallbacks bleServerCallbacks;
+SchemaCallbacks schemaCallbacks;
+ConfigCallbacks configCallbacks;
+CanStatsCallbacks canStatsCallbacks;
+ParameterCallbacks parameterCallbacks;
+
+BLECharacteristic *addCharacteristic(BLEService *service, const char *uuid, uint32_t properties,
+                                     BLECharacteristicCallbacks *callbacks) {
+    BLECharacteristic *characteristic = service->createCharacteristic(uuid, properties);
+    if (callbacks != NULL) {
+        characteristic->setCallbacks(callbacks);
+    }
+    return characteristic;
+}
+
+void initializeBleTelemetry() {
+    bleFieldMask = defaultBleFieldMask();
+
+    BLEDevice::init(BLE_DEVICE_NAME);
+    BLEDevice::setMTU(BLE_MTU);
+    bleSecurity.setStaticPIN(BLE_PASSKEY);
+    bleSecurity.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_MITM_BOND);
+    bleServer = BLEDevice::createServer();
+    bleServer->setCallbacks(&bleServerCallbacks);
+
+    // Two handles per characteristic, one more for the notify descriptor
+    BLEService *service = bleServer->createService(BLEUUID(BLE_SERVICE_UUID), 16);
+    telemetryCharacteristic = addCharacteristic(service, BLE_TELEMETRY_UUID, BLECharacteristic::PROPERTY_NOTIFY, NULL);
+    telemetryCharacteristic->addDescriptor(&telemetryNotifyDescriptor);
+    addCharacteristic(service, BLE_SCHEMA_UUID, BLECharacteristic::PROPERTY_READ, &schemaCallbacks);
+    addCharacteristic(service, BLE_CONFIG_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE, &configCallbacks);
+    addCharacteristic(service, BLE_CAN_STATS_UUID, BLECharacteristic::PROPERTY_READ, &canStatsCallbacks);
+    BLECharacteristic *parameters = addCharacteristic(service, BLE_PARAMETERS_UUID,
+        BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE, &parameterCallbacks);
+    // Bluedroid refuses parameter writes over a link that was not paired
+    // with the passkey, the client then pairs and bonds for next time
+    parameters->setAccessPermissions(ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENC_MITM);
+    service->start();
+
+    BLEAdvertising *advertising = BLEDevice::getAdvertising();
+    advertising->addServiceUUID(BLE_SERVICE_UUID);
+    BLEDevice::startAdvertising();
+
+    createTask(TASK_BLE, bleTelemetryTask, &bleTaskHandle);
+}
+
+BleTelemetryStats getBleTelemetryStats() {
+    portENTER_CRITICAL(&bleMux);
+    BleTelemetryStats stats = bleStats;
+    portEXIT_CRITICAL(&bleMux);
+    return stats;
+}
+
+// Send the batch when it has samples
+void sendBleBatch(TelemetryBatch &batch) {
+    if (telemetryBatchCount(batch) == 0) {
+        return;
+    }
+    telemetryCharacteristic->setValue(batch.buffer, batch.length);
+    telemetryCharacteristic->notify();
+
+    portENTER_CRITICAL(&bleMux);
+    bleStats.notifications++;
+    bleStats.bytes += batch.length;
+    portEXIT_CRITICAL(&bleMux);
+}
+
+void bleTelemetryTask(void *parameter) {
+    TelemetryBatch batch;
+    uint16_t sequence = 0;
+    TickType_t nextSample = xTaskGetTickCount();
+    bool batchOpen = false;
+
+    for (;;) {
+        bool sending = bleConnected && telemetryNotifyDescriptor.getNotifications();
+
+        // Sleep until the next sample, or until a client or a setting changes
+        TickType_t timeout = portMAX_DELAY;
+        if (sending) {
+            int32_t remaining = (int32_t)(nextSample - xTaskGetTickCount());
+            timeout = remaining > 0 ? remaining : 0;
+        } else {
+            markTaskIdle(TASK_BLE);
+        }
+        uint32_t events = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &events, timeout);
+        countTaskWakeup(TASK_BLE);
+
+        if (events & BLE_EVENT_PARAMETER) {
+            portENTER_CRITICAL(&bleMux);
+            int index = blePendingIndex;
+            int32_t value = blePendingValue;
+            blePendingIndex = -1;
+            portEXIT_CRITICAL(&bleMux);
+            if (index >= 0) {
+                setParameter(index, value);
+            }
+        }
+
+        portENTER_CRITICAL(&bleMux);
+        uint32_t fieldMask = bleFieldMask;
+        uint8_t rateHz = bleRateHz;
+        uint16_t maxDelayMs = bleMaxDelayMs;
+        portEXIT_CRITICAL(&bleMux);
+
+        if (events & (BLE_EVENT_CONNECTION | BLE_EVENT_CONFIG)) {
+            // A new client or new fields, start a fresh batch
+            batchOpen = false;
+            nextSample = xTaskGetTickCount();
+        }
+
+        sending = bleConnected && telemetryNotifyDescriptor.getNotifications();
+        uint16_t mtu = bleConnected ? bleServer->getPeerMTU(bleServer->getConnId()) : 0;
+        if (!sending || (int32_t)(nextSample - xTaskGetTickCount()) > 0) {
+            portENTER_CRITICAL(&bleMux);
+            bleStats.connected = bleConnected;
+            bleStats.subscribed = sending;
+            bleStats.mtu = mtu;
+            portEXIT_CRITICAL(&bleMux);
+            continue;
+        }
+
+        // One sample into the batch, the batch goes out when full or when its first sample gets too old
+        size_t payload = mtu > 3 ? mtu - 3 : 0;
+        if (payload > BLE_PAYLOAD_MAX) {
+            payload = BLE_PAYLOAD_MAX;
+        }
+        size_t sampleSize = telemetryValuesSize(fieldMask);
+        if (payload < TELEMETRY_BATCH_HEADER + 2 + sampleSize) {
+            // The fields do not fit the negotiated MTU, wait for a new config
+            nextSample = xTaskGetTickCount() + pdMS_TO_TICKS(1000);
+            continue;
+        }
+
+        Telemetry snapshot;
+        readTelemetry(snapshot);
+        uint32_t now = millis();
+        packTelemetryValues(bleSampleBuffer, snapshot, fieldMask);
+        if (!batchOpen) {
+            startTelemetryBatch(batch, bleBatchBuffer, payload, sequence++, fieldMask, sampleSize);
+            batchOpen = true;
+        }
+        if (!addTelemetrySample(batch, now, bleSampleBuffer)) {
+            sendBleBatch(batch);
+            startTelemetryBatch(batch, bleBatchBuffer, payload, sequence++, fieldMask, sampleSize);
+            addTelemetrySample(batch, now, bleSampleBuffer);
+        }
+        if (telemetryBatchFull(batch) || now - batch.firstMillis >= maxDelayMs) {
+            sendBleBatch(batch);
+            batchOpen = false;
+        }
+
+        portENTER_CRITICAL(&bleMux);
+        bleStats.connected = true;
+        bleStats.subscribed = true;
+        bleStats.mtu = mtu;
+        bleStats.rateHz = rateHz;
+        bleStats.fieldMask = fieldMask;
+        bleStats.samples++;
+        portEXIT_CRITICAL(&bleMux);
+
+        // Steady rate, but after falling behind start afresh instead of bursting
+        TickType_t period = pdMS_TO_TICKS(1000 / rateHz);
+        nextSample += period;
+        if ((int32_t)(xTaskGetTickCount() - nextSample) > (int32_t)period) {
+            nextSample = xTaskGetTickCount();
+        }
+    }
+}
+
+#endif // ENABLE_BLE
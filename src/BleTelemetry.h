@@ -0,0 +1,74 @@
+#ifndef BLE_TELEMETRY_H
+#define BLE_TELEMETRY_H
+
+#include <Arduino.h>
+
+// Define to run a BLE GATT telemetry service instead of Bluetooth Serial.
+// Bluetooth Serial releases the BLE controller memory at start, so comment
+// out ENABLE_BLUETOOTH in Bluetooth.h as well.
+// #define ENABLE_BLE
+
+#define BLE_DEVICE_NAME "Green-ESP32"
+
+// GATT service and characteristics, all little endian:
+// telemetry   notify  batches of samples, layout in TelemetryBatch.h
+// schema      read    field count, then id, type, scale (u16), name length and name of each streamed field
+// config      read, write  u8 rate (Hz), u16 longest batch delay (ms), u32 field mask
+// can stats   read    u32 frames, u32 ms since the last frame, u32 missed frames, u32 bus errors
+// parameters  read    u8 count, then the value (i32) of each parameter
+//             write   u8 index, i32 value, only over a link paired with BLE_PASSKEY
+#define BLE_SERVICE_UUID            "6e1a0000-4f3c-4b9e-9a57-1d2c3e4f5a60"
+#define BLE_TELEMETRY_UUID          "6e1a0001-4f3c-4b9e-9a57-1d2c3e4f5a60"
+#define BLE_SCHEMA_UUID             "6e1a0002-4f3c-4b9e-9a57-1d2c3e4f5a60"
+#define BLE_CONFIG_UUID             "6e1a0003-4f3c-4b9e-9a57-1d2c3e4f5a60"
+#define BLE_CAN_STATS_UUID          "6e1a0004-4f3c-4b9e-9a57-1d2c3e4f5a60"
+#define BLE_PARAMETERS_UUID         "6e1a0005-4f3c-4b9e-9a57-1d2c3e4f5a60"
+
+// Six digit passkey a client enters to pair. Pairing, and bonding for the
+// next connections, is needed to write parameters. There is no default, a
+// BLE build needs a private one kept out of the repo, e.g. in the
+// PLATFORMIO_BUILD_FLAGS environment variable: -DBLE_PASSKEY=<six digits>.
+// Do not start it with 0, that makes it octal.
+#ifdef ENABLE_BLE
+  #ifndef BLE_PASSKEY
+    #error "Set a private passkey with -DBLE_PASSKEY=<six digits>"
+  #elif BLE_PASSKEY < 100000 || BLE_PASSKEY > 999999
+    #error "BLE_PASSKEY must have six digits"
+  #endif
+#endif
+
+// Samples per second and the longest a sample waits for its batch to fill
+#define BLE_DEFAULT_RATE_HZ         10
+#define BLE_MAX_RATE_HZ             100
+#define BLE_DEFAULT_MAX_DELAY_MS    500
+
+// MTU asked for at connection, phones usually agree to 185 or more
+#define BLE_MTU                     247
+
+#ifdef ENABLE_BLE
+  #define BLE_TASK_STACK 3072
+#else
+  #define BLE_TASK_STACK 0
+#endif
+
+struct BleTelemetryStats {
+    bool connected;
+    bool subscribed;        // The client enabled telemetry notifications
+    uint16_t mtu;
+    uint8_t rateHz;
+    uint32_t fieldMask;
+    uint32_t notifications;
+    uint32_t samples;
+    uint32_t bytes;
+};
+
+#ifdef ENABLE_BLE
+  // Start the BLE stack, the GATT service and the telemetry task
+  void initializeBleTelemetry();
+
+  BleTelemetryStats getBleTelemetryStats();
+#else
+  inline void initializeBleTelemetry() {}
+#endif // ENABLE_BLE
+
+#endif // BLE_TELEMETRY_H
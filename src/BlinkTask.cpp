@@ -1,22 +1,29 @@
 #include "BlinkTask.h"
 #include "Parameter.h"
+#include "TaskTable.h"
 
 const int ledPin = LED_BUILTIN;
+volatile TickType_t blinkTicks = 0;   // BlinkSpeed in ticks
 
 void blinkTask(void * parameter);
 
+void onBlinkSpeedChange(ParameterId id, int32_t value) {
+    blinkTicks = pdMS_TO_TICKS(value);
+}
+
 void initializeBlinkTask() {
     pinMode(ledPin, OUTPUT);
+    onParameterChange(PARAM_BLINK_SPEED, onBlinkSpeedChange);
 
-    xTaskCreate(blinkTask, "Blink Task", 1024, NULL, 0, NULL);
+    createTask(TASK_BLINK, blinkTask);
 }
 
 void blinkTask(void * parameter) {
     for (;;) {
-        int blinkDelay = parameters[1].value;  // Get the blink speed from the new parameter
+        TickType_t blinkDelay = blinkTicks;
         digitalWrite(ledPin, HIGH);
-        vTaskDelay(blinkDelay / portTICK_PERIOD_MS);
+        vTaskDelay(blinkDelay);
         digitalWrite(ledPin, LOW);
-        vTaskDelay(blinkDelay / portTICK_PERIOD_MS);
+        vTaskDelay(blinkDelay);
     }
 }
@@ -1,13 +1,17 @@
 #include "Bluetooth.h"
 #include "Parameter.h"
+#include "OutputQueue.h"
+#include "Log.h"
 
 #ifdef ENABLE_BLUETOOTH
 
 // Bluetooth Serial instance
 BluetoothSerial SerialBT;
 bool btConnected = false;
-bool btInitialized = false;
+BTState btState = BT_OFF;
+BTStats btStats = {BT_OFF, 0, 0, 0};
 String btName = "Green-ESP32";
+TaskHandle_t btInputTask = NULL;
 
 // Forward declarations
 void onBTConnect(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
@@ -18,35 +22,48 @@ void initializeBluetooth() {
 }
 
 void turnBTOn() {
-    if (!btInitialized) {
+    if (btState == BT_PARKED) {
+        // Everything is still running, only scanning for pages and inquiries was stopped
+        unsigned long start = micros();
+        if (esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE) == ESP_OK) {
+            btState = BT_ON;
+            btStats.resumeMicros = micros() - start;
+            btStats.resumes++;
+            LOG(LOG_BT_RESUMED, btStats.resumeMicros);
+        } else {
+            LOG(LOG_BT_SCAN_MODE_FAILED);
+        }
+    } else if (btState == BT_OFF) {
+        unsigned long start = micros();
+
         // Initialize Bluetooth controller
         if (esp_bt_controller_mem_release(ESP_BT_MODE_BLE) == ESP_OK) {
-            Serial.println("Released BLE memory");
+            LOG(LOG_BT_BLE_RELEASED);
         }
 
         esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
         
         // Try to initialize with proper error handling
         if (esp_bt_controller_init(&bt_cfg) != ESP_OK) {
-            Serial.println("Bluetooth controller init failed");
+            LOG(LOG_BT_CONTROLLER_FAILED, "init");
             return;
         }
         
         if (esp_bt_controller_enable(ESP_BT_MODE_CLASSIC_BT) != ESP_OK) {
-            Serial.println("Bluetooth controller enable failed");
+            LOG(LOG_BT_CONTROLLER_FAILED, "enable");
             esp_bt_controller_deinit();
             return;
         }
         
         if (esp_bluedroid_init() != ESP_OK) {
-            Serial.println("Bluedroid init failed");
+            LOG(LOG_BT_BLUEDROID_FAILED, "init");
             esp_bt_controller_disable();
             esp_bt_controller_deinit();
             return;
         }
         
         if (esp_bluedroid_enable() != ESP_OK) {
-            Serial.println("Bluedroid enable failed");
+            LOG(LOG_BT_BLUEDROID_FAILED, "enable");
             esp_bluedroid_deinit();
             esp_bt_controller_disable();
             esp_bt_controller_deinit();
@@ -56,55 +73,98 @@ void turnBTOn() {
         // Now initialize the Serial BT interface
         if (SerialBT.begin(btName)) {
             SerialBT.register_callback(onBTConnect);
-            btInitialized = true;
-            Serial.println("Bluetooth Serial started. Name: " + btName);
+            btState = BT_ON;
+            btStats.startMicros = micros() - start;
+            LOG(LOG_BT_STARTED, btStats.startMicros / 1000, btName.c_str());
         } else {
             // Clean up if SerialBT fails
-            Serial.println("Bluetooth Serial initialization failed");
+            LOG(LOG_BT_SERIAL_FAILED);
             esp_bluedroid_disable();
             esp_bluedroid_deinit();
             esp_bt_controller_disable();
             esp_bt_controller_deinit();
         }
     } else {
-        Serial.println("Bluetooth is already turned on");
+        LOG(LOG_BT_ALREADY_ON);
+    }
+}
+
+void parkBT() {
+    if (btState != BT_ON) {
+        LOG(LOG_BT_ALREADY_OFF);
+        return;
+    }
+    if (btConnected) {
+        SerialBT.disconnect();
+    }
+    // Without page and inquiry scans the radio is idle between the controller's sleep periods
+    if (esp_bt_gap_set_scan_mode(ESP_BT_NON_CONNECTABLE, ESP_BT_NON_DISCOVERABLE) == ESP_OK) {
+        btState = BT_PARKED;
+        btConnected = false;
+        LOG(LOG_BT_PARKED);
+    } else {
+        LOG(LOG_BT_SCAN_MODE_FAILED);
+    }
+    if (btInputTask != NULL) {
+        xTaskNotifyGive(btInputTask);
     }
 }
 
 void turnBTOff() {
-    if (btInitialized) {
+    if (btState != BT_OFF) {
         // End Bluetooth Serial
         SerialBT.end();
         
-        // Additional power-saving measures
+        // Additional power-saving measures. The controller memory is not released,
+        // esp_bt_mem_release() is one way and Bluetooth could never start again.
         esp_bluedroid_disable();
         esp_bluedroid_deinit();
         esp_bt_controller_disable();
         esp_bt_controller_deinit();
-        esp_bt_mem_release(ESP_BT_MODE_CLASSIC_BT);
         
-        btInitialized = false;
+        btState = BT_OFF;
         btConnected = false;
-        Serial.println("Bluetooth radio completely powered off and memory released");
+        LOG(LOG_BT_POWERED_OFF);
+        if (btInputTask != NULL) {
+            xTaskNotifyGive(btInputTask);
+        }
     } else {
-        Serial.println("Bluetooth is already turned off");
+        LOG(LOG_BT_ALREADY_OFF);
     }
 }
 
 void onBTConnect(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
     if (event == ESP_SPP_SRV_OPEN_EVT) {
-        Serial.println("Bluetooth client connected");
+        LOG(LOG_BT_CONNECTED);
         btConnected = true;
         
         // Send welcome message
-        SerialBT.println("\nWelcome to Green-ESP32 CLI");
-        SerialBT.println("Type 'help' for available commands");
+        BTOut.println("\nWelcome to Green-ESP32 CLI");
+        BTOut.println("Type 'help' for available commands");
     } else if (event == ESP_SPP_CLOSE_EVT) {
-        Serial.println("Bluetooth client disconnected");
+        LOG(LOG_BT_DISCONNECTED);
         btConnected = false;
+    } else if (event != ESP_SPP_DATA_IND_EVT) {
+        return;
+    }
+
+    // New data is already in the SerialBT receive queue. The input task also
+    // learns about connects and disconnects this way, to start or end its session.
+    if (btInputTask != NULL) {
+        xTaskNotifyGive(btInputTask);
     }
 }
 
+void setBTInputTask(TaskHandle_t task) {
+    btInputTask = task;
+}
+
+BTStats getBTStats() {
+    BTStats stats = btStats;
+    stats.state = btState;
+    return stats;
+}
+
 bool isBTConnected() {
     return btConnected;
 }
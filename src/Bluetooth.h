@@ -11,25 +11,52 @@
   #include "BluetoothSerial.h"
   #include "esp_bt.h"
   #include "esp_bt_main.h"
+  #include "esp_gap_bt_api.h"
+
+  enum BTState {
+      BT_OFF,       // Controller stopped, turning on takes seconds
+      BT_PARKED,    // Controller running but not discoverable or connectable
+      BT_ON         // Discoverable and connectable
+  };
+
+  struct BTStats {
+      BTState state;
+      uint32_t startMicros;     // Last full start from BT_OFF
+      uint32_t resumeMicros;    // Last resume from BT_PARKED
+      uint32_t resumes;
+  };
 
   // Initialize Bluetooth
   void initializeBluetooth();
 
-  // Turn Bluetooth on/off
+  // Turn Bluetooth on, from BT_OFF with a full start or from BT_PARKED with a fast resume
   void turnBTOn();
+
+  // Drop the client and stop being discoverable and connectable, but keep the
+  // controller running so turnBTOn() resumes in milliseconds
+  void parkBT();
+
+  // Stop the controller and Bluedroid completely
   void turnBTOff();
 
+  BTStats getBTStats();
+
   // Check if Bluetooth is connected
   bool isBTConnected();
 
+  // Task to notify when Bluetooth Serial data is received or a client connects or disconnects
+  void setBTInputTask(TaskHandle_t task);
+
   // External Bluetooth Serial instance for CLI
   extern BluetoothSerial SerialBT;
 #else
   // Stub functions when Bluetooth is disabled
   inline void initializeBluetooth() {}
   inline void turnBTOn() {}
+  inline void parkBT() {}
   inline void turnBTOff() {}
   inline bool isBTConnected() { return false; }
+  inline void setBTInputTask(TaskHandle_t task) {}
 #endif // ENABLE_BLUETOOTH
 
 #endif // BLUETOOTH_H
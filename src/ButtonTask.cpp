@@ -2,6 +2,8 @@
 #include "Semaphores.h"
 #include "PinAssignments.h"
 #include "PulseCounterTask.h"
+#include "TaskTable.h"
+#include "Trace.h"
 
 // function prototypes
 void buttonISR();
@@ -18,10 +20,11 @@ void initializeButtonTask() {
     attachInterrupt(digitalPinToInterrupt(BUTTONPIN), buttonISR, CHANGE);
 
     // start task
-    xTaskCreate(ButtonTask, "Button Task", 2048, NULL, 4, NULL);
+    createTask(TASK_BUTTON, ButtonTask);
 }
 
 void IRAM_ATTR buttonISR() {
+    TRACE(TRACE_BUTTON_ISR, digitalRead(BUTTONPIN));
     unsigned long currentTime = millis();
     if ((currentTime - lastDebounceTime) > debounceDelay) { // Check if debounce period has passed
         if (digitalRead(BUTTONPIN) == HIGH) {
@@ -37,6 +40,7 @@ void IRAM_ATTR buttonISR() {
 void ButtonTask(void * parameter) {
     for (;;) {
         if (xSemaphoreTake(buttonSemaphore, portMAX_DELAY) == pdTRUE) {
+            countTaskWakeup(TASK_BUTTON);
             unsigned long currentTime = millis();
             unsigned long pressDuration = currentTime - buttonPressTime;
             if (buttonPressed && (pressDuration > debounceDelay)) {
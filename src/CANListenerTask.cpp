@@ -7,11 +7,29 @@
 #include "GaugeControl.h"
 #include "Bluetooth.h" // Include Bluetooth.h to get access to SerialBT
 #include "HelperTasks.h" // Include HelperTasks.h for lamp control
+#include "SpeedFusion.h"
+#include "TaskTable.h"
+#include "Trace.h"
+#include "TelemetryBus.h"
+#include <cstring>
+#include "Log.h"
 
 Telemetry telemetryData;
-bool monitorCAN = false;
-uint32_t filterCANID = 0;
 CanFrame rxFrame;
+uint32_t rxFrameMicros = 0;    // micros() when rxFrame was received
+uint32_t canFramesReceived = 0;
+uint32_t canLastFrameMillis = 0;
+
+struct CanMonitor {
+    Print *output;      // NULL for a free slot
+    uint32_t filterID;
+};
+
+CanMonitor canMonitors[CAN_MAX_MONITORS];
+portMUX_TYPE canMonitorMux = portMUX_INITIALIZER_UNLOCKED;
+
+// The receive call blocks until a frame arrives, the timeout only bounds the wait on a silent bus
+#define CAN_RX_TIMEOUT_MS 1000
 
 // Helper function to send a CAN frame
 void sendCANFrame(uint32_t identifier, bool extd, uint8_t dlc, uint8_t* data) {
@@ -29,7 +47,7 @@ void sendCANFrame(uint32_t identifier, bool extd, uint8_t dlc, uint8_t* data) {
 
 // Forward declarations
 void CanListenerTask(void * parameter);
-void LogCanMessage(Stream &stream);
+void LogCanMessage(Print &stream);
 void HandleCanMessage();
 void onMotorOff();
 void onMotorON();
@@ -41,35 +59,43 @@ Timer readyTimer(5000, onReadyOff); // 5000 milliseconds timeout
 void initializeCANListenerTask() {
     // Initialize the CAN controller at 250 kbps
     if(ESP32Can.begin(ESP32Can.convertSpeed(250), CAN_TX_PIN, CAN_RX_PIN, 10, 10)) {
-        Serial.println("CAN bus started!");
+        LOG(LOG_CAN_STARTED);
     } else {
-        Serial.println("Starting CAN failed!");
+        LOG(LOG_CAN_FAILED);
         return;
     }
 
-    xTaskCreate(CanListenerTask, "CAN Listener Task", 4096 * 8, NULL, 2, NULL);
+    createTask(TASK_CAN_LISTENER, CanListenerTask);
 }
 
 void CanListenerTask(void * parameter) {
     for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(1)); // 100Hz polling rate
-
-        // Try to read a CAN frame with a timeout of 1ms
-        if(ESP32Can.readFrame(rxFrame, 1)) {
-            if (monitorCAN && (filterCANID == 0 || rxFrame.identifier == filterCANID)) {
-                LogCanMessage(Serial);  // Log to hardware Serial
-#ifdef ENABLE_BLUETOOTH
-                if (isBTConnected()) {  // If Bluetooth is connected, also log there
-                    LogCanMessage(SerialBT);
+        // Sleep in the driver until a CAN frame is received
+        bool received = ESP32Can.readFrame(rxFrame, CAN_RX_TIMEOUT_MS);
+        countTaskWakeup(TASK_CAN_LISTENER);
+        if(received) {
+            rxFrameMicros = micros();
+            canFramesReceived++;
+            canLastFrameMillis = millis();
+            TRACE(TRACE_CAN_RX, rxFrame.identifier);
+            // Printed from a copy, an output may be removed while the frame is printed
+            CanMonitor monitors[CAN_MAX_MONITORS];
+            portENTER_CRITICAL(&canMonitorMux);
+            memcpy(monitors, canMonitors, sizeof(monitors));
+            portEXIT_CRITICAL(&canMonitorMux);
+            for (int i = 0; i < CAN_MAX_MONITORS; i++) {
+                if (monitors[i].output != NULL && (monitors[i].filterID == 0 || rxFrame.identifier == monitors[i].filterID)) {
+                    LogCanMessage(*monitors[i].output);
                 }
-#endif
             }
+            TRACE(TRACE_CAN_DECODE_BEGIN, rxFrame.identifier);
             HandleCanMessage();
+            TRACE(TRACE_CAN_DECODE_END, rxFrame.identifier);
         }
     }
 }
 
-void LogCanMessage(Stream &stream) {
+void LogCanMessage(Print &stream) {
     stream.print("ID: ");
     stream.print(rxFrame.identifier, HEX);
     stream.print(" DLC: ");
@@ -82,29 +108,69 @@ void LogCanMessage(Stream &stream) {
     stream.println();
 }
 
-void setCANMonitoring(bool state, uint32_t filterID) {
-    monitorCAN = state;
-    filterCANID = filterID;
+CanStats getCanStats() {
+    CanStats stats;
+    stats.received = canFramesReceived;
+    stats.lastFrameMillis = canLastFrameMillis;
+    stats.rxMissed = ESP32Can.rxMissedCounter();
+    stats.busErrors = ESP32Can.busErrCounter();
+    return stats;
+}
+
+bool addCANMonitor(Print &output, uint32_t filterID) {
+    bool added = false;
+    portENTER_CRITICAL(&canMonitorMux);
+    // An output already monitoring only gets its filter replaced
+    int slot = -1;
+    for (int i = 0; i < CAN_MAX_MONITORS; i++) {
+        if (canMonitors[i].output == &output) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && canMonitors[i].output == NULL) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        canMonitors[slot].output = &output;
+        canMonitors[slot].filterID = filterID;
+        added = true;
+    }
+    portEXIT_CRITICAL(&canMonitorMux);
+    return added;
+}
+
+void removeCANMonitor(Print &output) {
+    portENTER_CRITICAL(&canMonitorMux);
+    for (int i = 0; i < CAN_MAX_MONITORS; i++) {
+        if (canMonitors[i].output == &output) {
+            canMonitors[i].output = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&canMonitorMux);
 }
 
-int CANMonitoring() {
-    return monitorCAN;
+bool isCANMonitor(Print &output) {
+    bool found = false;
+    portENTER_CRITICAL(&canMonitorMux);
+    for (int i = 0; i < CAN_MAX_MONITORS; i++) {
+        if (canMonitors[i].output == &output) {
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&canMonitorMux);
+    return found;
 }
 
 void onMotorOff() {
     // Implement what happens when the motor is considered "off"
-    Serial.println("Motor is off");
-#ifdef ENABLE_BLUETOOTH
-    if (isBTConnected()) {
-        SerialBT.println("Motor is off");
-    }
-#endif
+    LOG(LOG_MOTOR_OFF);
 
     setRunningLamp(false); // Turn off the running lamp using the helper function
     
     // if the mode is ready, change it to empty, otherwise, do nothing
     if (currentDisplayMode == READY) {
-        currentDisplayMode = EMPTY;
+        setDisplayMode(EMPTY);
     }
     readyTimer.stop(); // Stop the ready timer
     readyTimer.reset(); // Reset the ready timer
@@ -112,23 +178,18 @@ void onMotorOff() {
 
 void onMotorON() {
     // Implement what happens when the motor is considered "on"
-    Serial.println("Motor is on");
-#ifdef ENABLE_BLUETOOTH
-    if (isBTConnected()) {
-        SerialBT.println("Motor is on");
-    }
-#endif
+    LOG(LOG_MOTOR_ON);
 
     setRunningLamp(true); // Turn on the running lamp using the helper function
     
-    currentDisplayMode = READY;
+    setDisplayMode(READY);
     readyTimer.start(); // Start the ready timer
 }
 
 void onReadyOff() {
     // If the mode is ready, change it to empty, otherwise, do nothing
     if (currentDisplayMode == READY) {
-        currentDisplayMode = START;
+        setDisplayMode(START);
     }
 }
 
@@ -136,6 +197,8 @@ void HandleCanMessage() {
     uint32_t canId = rxFrame.identifier;
     int dlc = rxFrame.data_length_code;
     uint8_t* msgData = rxFrame.data;
+    Telemetry frame;                    // Written back in one step, so no subscriber sees half a frame
+    readTelemetry(frame);
 
     if (canId == 0x06) {
         // check if the message is valid
@@ -149,15 +212,17 @@ void HandleCanMessage() {
         if (ignore) return;
 
         // Motor temperature: (0 to 255) - 40 [C]
-        telemetryData.motorTemp = msgData[0] - 40;
+        frame.motorTemp = msgData[0] - 40;
         // Inverter temperature: (0 to 255) - 40 [C]
-        telemetryData.inverterTemp = msgData[1] - 40;
+        frame.inverterTemp = msgData[1] - 40;
         // Motor RPM: (0 to 65535) [RPM]
-        telemetryData.rpm = (msgData[3] << 8) + msgData[2];
+        frame.rpm = (msgData[3] << 8) + msgData[2];
         // Motor (DC) voltage: (0 to 65535) / 10 [V]
-        telemetryData.DCVoltage = ((msgData[5] << 8) + msgData[4]) / 10.0;
+        frame.DCVoltage = ((msgData[5] << 8) + msgData[4]) / 10.0;
         // Motor (DC) current: (0 to 65535) / 10 [A]
-        telemetryData.DCCurrent = (int16_t)((msgData[7] << 8) + msgData[6]) / 10.0;
+        frame.DCCurrent = (int16_t)((msgData[7] << 8) + msgData[6]) / 10.0;
+
+        updateFusionFromRpm(frame.rpm);
 
     } else if (canId == 0x42) {
         // Motor is "on". Start or reset the timer.
@@ -169,53 +234,60 @@ void HandleCanMessage() {
                 motorTimer.reset();
             }
         }
-        telemetryData.powerUnitFlags = (msgData[1] << 8) + msgData[0];
-        telemetryData.motorFlags = (msgData[3] << 8) + msgData[2];
+        frame.powerUnitFlags = (msgData[1] << 8) + msgData[0];
+        frame.motorFlags = (msgData[3] << 8) + msgData[2];
     } else if ((canId & 0xFFFF0000) == 0x19B50000) {
         // Handel EMUS messages (0x19B5xxxx)
         uint16_t canAddr = canId & 0xFFFF;
         switch (canAddr) {
             case 0x0000:
                 // Handle 0x99B50000 Overall Parameters
-                telemetryData.BMSInputSignalFlags = msgData[0];
-                telemetryData.BMSOutputSignalFlags = msgData[1];
-                telemetryData.BMSNumberOfCells = (msgData[2] << 8) + msgData[7];
-                telemetryData.BMSChargingState = msgData[3];
-                telemetryData.BMSCsDuration = (msgData[4] << 8) + msgData[5];
-                telemetryData.BMSLastChargingError = msgData[6];
+                frame.BMSInputSignalFlags = msgData[0];
+                frame.BMSOutputSignalFlags = msgData[1];
+                frame.BMSNumberOfCells = (msgData[2] << 8) + msgData[7];
+                frame.BMSChargingState = msgData[3];
+                frame.BMSCsDuration = (msgData[4] << 8) + msgData[5];
+                frame.BMSLastChargingError = msgData[6];
                 break;
             case 0x0007:
                 // Handle 0x99B50007 Diagnostics Codes
-                telemetryData.BMSProtectionFlags = (msgData[3] << 24) + (msgData[2] << 16) + (msgData[1] << 8) + msgData[0];
-                telemetryData.BMSReductionFlags = msgData[4];
-                telemetryData.BMSBatteryStatusFlags = msgData[7];
+                frame.BMSProtectionFlags = (msgData[3] << 24) + (msgData[2] << 16) + (msgData[1] << 8) + msgData[0];
+                frame.BMSReductionFlags = msgData[4];
+                frame.BMSBatteryStatusFlags = msgData[7];
                 break;
             case 0x0002:
                 // Handle 0x99B50002 Cell Module Temperature Overall Parameters
-                telemetryData.BMSMinModTemp = msgData[0] - 100; // Convert to Celsius
-                telemetryData.BMSMaxModTemp = msgData[1] - 100; // Convert to Celsius
-                telemetryData.BMSAverageModTemp = msgData[2] - 100; // Convert to Celsius
+                frame.BMSMinModTemp = msgData[0] - 100; // Convert to Celsius
+                frame.BMSMaxModTemp = msgData[1] - 100; // Convert to Celsius
+                frame.BMSAverageModTemp = msgData[2] - 100; // Convert to Celsius
                 break;
             case 0x0008:
                 // Handle 0x99B50008 Cell Temperature Overall Parameters
-                telemetryData.BMSMinCellTemp = msgData[0] - 100; // Convert to Celsius
-                telemetryData.BMSMaxCellTemp = msgData[1] - 100; // Convert to Celsius
-                telemetryData.BMSAverageCellTemp = msgData[2] - 100; // Convert to Celsius
+                frame.BMSMinCellTemp = msgData[0] - 100; // Convert to Celsius
+                frame.BMSMaxCellTemp = msgData[1] - 100; // Convert to Celsius
+                frame.BMSAverageCellTemp = msgData[2] - 100; // Convert to Celsius
                 break;
             case 0x0500:
                 // Handle 0x99B50500 State of Charge parameters
-                telemetryData.Current = (msgData[0] << 8) + msgData[1];
-                telemetryData.Charge = (msgData[2] << 8) + msgData[3];
-                telemetryData.SoC = (msgData[5] << 8) + msgData[6];
+                frame.Current = (msgData[0] << 8) + msgData[1];
+                frame.Charge = (msgData[2] << 8) + msgData[3];
+                frame.SoC = (msgData[5] << 8) + msgData[6];
                 break;
             case 0x0600:
                 // Handle 0x99B50600 Energy Parameters
-                telemetryData.BMSConsumptionEstimate = (msgData[0] << 8) + msgData[1];
-                telemetryData.BMSEstimatedEnergy = (msgData[2] << 8) + msgData[3];
-                telemetryData.BMSEstimatedDistanceLeft = (msgData[4] << 8) + msgData[5];
-                telemetryData.BMSDistanceTraveled = (msgData[6] << 8) + msgData[7];
+                frame.BMSConsumptionEstimate = (msgData[0] << 8) + msgData[1];
+                frame.BMSEstimatedEnergy = (msgData[2] << 8) + msgData[3];
+                frame.BMSEstimatedDistanceLeft = (msgData[4] << 8) + msgData[5];
+                frame.BMSDistanceTraveled = (msgData[6] << 8) + msgData[7];
             default:
                 break;
         }
     }
+
+    // Only the signal groups this frame changed are published. The speed is
+    // written and published by the speed fusion itself.
+    uint32_t changedTopics = writeTelemetry(frame, TOPIC_ALL & ~TOPIC_SPEED);
+    if (changedTopics != 0) {
+        publishTelemetry(changedTopics, rxFrameMicros);
+    }
 }
\ No newline at end of file
@@ -6,10 +6,22 @@
 
 void initializeCANListenerTask();
 
-extern bool monitorCAN;
-extern uint32_t filterCANID;
+struct CanStats {
+    uint32_t received;          // Frames since boot
+    uint32_t lastFrameMillis;   // millis() of the last frame, 0 before the first
+    uint32_t rxMissed;          // Frames lost to a full driver queue
+    uint32_t busErrors;
+};
 
-void setCANMonitoring(bool state, uint32_t filterID = 0);
-int CANMonitoring();
+CanStats getCanStats();
+
+// Outputs that can monitor CAN frames at the same time, one per CLI session
+#define CAN_MAX_MONITORS 2
+
+// Print received frames with identifier filterID, or all frames for 0, to output.
+// Returns false when every monitor slot is taken.
+bool addCANMonitor(Print &output, uint32_t filterID = 0);
+void removeCANMonitor(Print &output);
+bool isCANMonitor(Print &output);
 
 #endif // CAN_LISTENER_TASK_H
@@ -7,60 +7,52 @@
 #include "CANListenerTask.h"
 #include "driveTelemetry.h"
 #include "Bluetooth.h"
-#include <Preferences.h>
-
-// Predefine commands as constants for consistency and easy modification
-const String CMD_HELP = "help";
-const String CMD_ECHO = "echo ";
-const String CMD_PARAM = "p";
-const String CMD_SPEED = "s";
-const String CMD_SYS = "sys";
-const String CMD_TRIP = "trip";
-const String CMD_RESET = "reset";
-const String CMD_GAUGE = "g";
-const String CMD_START_MONITOR = "canmonitor";
-const String CMD_STOP_MONITOR = "stopmonitor";
-const String CMD_IGNITION = "ignition";
-
-// Command descriptions
-const String HELP_TEXT = "Available commands:\n"
-                         "  off                     - Turns off the cluster.\n"
-                         "  on                      - Turns on the cluster.\n"
-                         "  echo [text]             - Echoes the text back to the serial output.\n"
-                         "  help                    - Displays this help message.\n"
-                         "  p [subcommand]          - Parameter command. Type 'p help' for more information.\n"
-                         "  reset                   - Resets the ESP32.\n"
-                         "  ready                   - Displays the ready screen.\n"
-                         "  s                       - Prints the current speed measurement.\n"
-                         "  sys                     - Displays system information.\n"
-                         "  trip [subcommand]       - Trip odometer command. Type 'trip help' for more information.\n"
-                         "  canmonitor [id]         - Starts monitoring CAN messages. Type 'canmonitor help' for more info.\n"
-                         "  stopmonitor             - Stops monitoring CAN messages.\n"
-                         "  telemetry               - Displays the telemetry data.\n"
-                         "  g [gauge_name] [pos]    - Gauge command. Type 'g help' for more information.\n"
-                         "  ignition [subcommand]   - Control ignition. Type 'ignition help' for more information.";
-
-
-const String PARAM_HELP_TEXT = "Usage: p [index] [value] | p update [index] | p clear [index]\n"
+#include "OdometerJournal.h"
+#include "SpeedFusion.h"
+#include "TaskTable.h"
+#include "MemoryBudget.h"
+#include "Trace.h"
+#include "TelemetryFormat.h"
+#include "TelemetryStream.h"
+#include "OutputQueue.h"
+#include "Log.h"
+#include "BleTelemetry.h"
+#include <cstring>
+#include <cstdlib>
+
+// Input lines are split in place on a fixed buffer, parsing a command allocates nothing
+#define CLI_MAX_LINE 128
+#define CLI_MAX_ARGS 6          // Including the command name
+#define CLI_ARGS_LINE 255       // maxArgs value: the rest of the line is passed unsplit as argv[1]
+
+const char PARAM_HELP_TEXT[] = "Usage: p [index] [value] | p update [index] | p clear [index]\n"
                                "  index: parameter index\n"
-                               "  value: new value for parameter\n"
+                               "  value: new value for parameter, within its range\n"
                                "  p update: update parameters from NVS\n"
                                "  p clear: clear NVS and reset parameters to default";
 
-const String TRIP_HELP_TEXT = "Usage: trip [subcommand]\n"
+const char TRIP_HELP_TEXT[] = "Usage: trip [subcommand]\n"
                               "  subcommand: r, reset\n"
                               "  subcommand: s, set [value] km\n"
                               "  subcommand: help";
 
-const String GAUGE_HELP_TEXT = "Usage: g [gauge_name] [position]\n"
+const char GAUGE_HELP_TEXT[] = "Usage: g [gauge_name] [position]\n"
                                "       g on  (turns all gauges on)\n"
                                "       g off (turns all gauges off)\n"
                                "       g autoupdate [on/off] (turns auto update on/off)\n"
+                               "       g ack [on/off] (sequence numbered frames with ACKs from the gauge controller)\n"
+                               "       g link [reset] (shows link quality counters and round-trip times)\n"
+                               "       g baud [auto/base] (negotiate a faster link rate, or return to 9600)\n"
                                "  gauge_name: Speedometer, Tachometer, Dynamometer, Chargeometer, Thermometer\n"
                                "  position: Position to set for the gauge\n"
                                "  Example: 'g Speedometer 50' sets the Speedometer to 50km/h\n";
 
-const String IGNITION_HELP_TEXT = "Usage: ignition [subcommand]\n"
+const char TOP_HELP_TEXT[] = "Usage: top [seconds|stacks]\n"
+                            "  top            - CPU usage, state, core, priority and free stack over one second\n"
+                            "  top [seconds]  - Refreshes every [seconds] until a key is pressed\n"
+                            "  top stacks     - Stack high-water marks with a right-sized stack for each task\n";
+
+const char IGNITION_HELP_TEXT[] = "Usage: ignition [subcommand]\n"
                                   "  override on        - Enable ignition override mode\n"
                                   "  override off       - Disable ignition override mode\n"
                                   "  on                 - Turn ignition on (when override is enabled)\n"
@@ -68,138 +60,717 @@ const String IGNITION_HELP_TEXT = "Usage: ignition [subcommand]\n"
                                   "  status             - Show current ignition override status\n"
                                   "  Example: 'ignition override on' then 'ignition on/off' to test\n";
 
+const char STREAM_HELP_TEXT[] = "Usage: stream [rate] [fields] | stream stop | stream fields\n"
+                                "  stream                  - Shows whether a stream runs, its rate and packet size\n"
+                                "  stream [rate] [fields]  - Streams the fields rate times a second (1-100) as binary packets\n"
+                                "                            fields: comma separated names, or 'all' (default " STREAM_DEFAULT_FIELDS ")\n"
+                                "  stream stop             - Stops the stream\n"
+                                "  stream fields           - Lists the field names\n"
+                                "  Decode the capture with tools/stream_to_csv.py\n";
+
+const char LOG_HELP_TEXT[] = "Usage: log | log [on|off] | log [module] [level] | log all [level]\n"
+                             "  log: shows the level of each module and the record counts\n"
+                             "  log on/off: prints log lines in this session or not\n"
+                             "  module: system, can, bt, display, speed, odometer\n"
+                             "  level: off, error, warn, info, debug";
+
+const char CAN_MONITOR_HELP_TEXT[] = "Usage: canmonitor [id]\n"
+                                     "  id: CAN ID to filter for (optional)";
+
+// argv[0] is the command name, argv[1..argc-1] its arguments
+typedef void (*CommandHandler)(int argc, char **argv, Stream &stream);
+
+struct Command {
+    const char *name;
+    const char *args;       // Argument synopsis for the help text
+    const char *help;       // NULL keeps an alias out of the help text
+    uint8_t minArgs;
+    uint8_t maxArgs;        // Or CLI_ARGS_LINE
+    CommandHandler handler;
+};
+
+// One session per transport, so Serial and Bluetooth typing don't mix and each
+// has its own settings. CAN monitoring, the telemetry stream and log lines are
+// subscribed per session and end with it.
+struct CliSession {
+    const char *name;
+    OutputStream &stream;
+    OutputSink sink;
+    bool connected;     // Serial always is, Bluetooth while a client is
+    bool echo;          // Echo typed characters back
+    char buffer[CLI_MAX_LINE];
+    size_t length;
+    bool busy;          // Running a command, its input waits until the command returns
+    bool streaming;     // Telemetry stream output, echo and log lines are off meanwhile
+    bool streamEcho;    // Echo and log lines to restore when the stream stops
+    bool streamLog;
+};
+
 void cliTask(void * parameter);
-void processCharacter(char ch, String &input, Stream &stream);
-void handleInput(String input, Stream &stream);
-void handleParameterCommand(String input, Stream &stream);
-void handleSpeedCommand(Stream &stream);
-void handleInfoCommand(Stream &stream);
-void handleTripCommand(String input, Stream &stream);
-void handleGaugeCommand(String input, Stream &stream);
-void handleIgnitionCommand(String input, Stream &stream);
-void printTelemetryData(Stream &stream);
+bool serviceSessions();
+void readCommandInput(CliSession &session);
+void processCharacter(char ch, CliSession &session);
+void startSessionStream(Stream &stream, uint32_t fieldMask, uint8_t rateHz);
+void stopSessionStream();
+const Command *parseCommand(char *line, int &argc, char **argv);
+void printHelp(Stream &stream);
+bool parseOnOff(int argc, char **argv, bool &state);
+void printGaugeLinkStats(Stream &stream);
+void handleOffCommand(int argc, char **argv, Stream &stream);
+void handleOnCommand(int argc, char **argv, Stream &stream);
+void handleEchoCommand(int argc, char **argv, Stream &stream);
+void handleHelpCommand(int argc, char **argv, Stream &stream);
+void handleParameterCommand(int argc, char **argv, Stream &stream);
+void handleResetCommand(int argc, char **argv, Stream &stream);
+void handleReadyCommand(int argc, char **argv, Stream &stream);
+void handleSpeedCommand(int argc, char **argv, Stream &stream);
+void handleInfoCommand(int argc, char **argv, Stream &stream);
+void handleTripCommand(int argc, char **argv, Stream &stream);
+void handleCanMonitorCommand(int argc, char **argv, Stream &stream);
+void handleStopMonitorCommand(int argc, char **argv, Stream &stream);
+void handleTelemetryCommand(int argc, char **argv, Stream &stream);
+void handleGaugeCommand(int argc, char **argv, Stream &stream);
+void handleIgnitionCommand(int argc, char **argv, Stream &stream);
+void handleWakeupsCommand(int argc, char **argv, Stream &stream);
+void handleTasksCommand(int argc, char **argv, Stream &stream);
+void handleTopCommand(int argc, char **argv, Stream &stream);
+void handleMemCommand(int argc, char **argv, Stream &stream);
+void handleTraceCommand(int argc, char **argv, Stream &stream);
+void handleLogCommand(int argc, char **argv, Stream &stream);
+void handleSessionCommand(int argc, char **argv, Stream &stream);
+void handleBenchCommand(int argc, char **argv, Stream &stream);
+void handleStreamCommand(int argc, char **argv, Stream &stream);
+
+// The help text is generated from this table, in this order
+constexpr Command commands[] = {
+    // name          args                     help                                                                    min max
+    {"off",          "",                      "Turns off the cluster.",                                               0, 0, handleOffCommand},
+    {"on",           "",                      "Turns on the cluster.",                                                0, 0, handleOnCommand},
+    {"echo",         "[text]",                "Echoes the text back to the serial output.",                           0, CLI_ARGS_LINE, handleEchoCommand},
+    {"help",         "",                      "Displays this help message.",                                          0, 0, handleHelpCommand},
+    {"h",            "",                      NULL,                                                                   0, 0, handleHelpCommand},
+    {"p",            "[subcommand]",          "Parameter command. Type 'p help' for more information.",               0, 2, handleParameterCommand},
+    {"reset",        "",                      "Resets the ESP32.",                                                    0, 0, handleResetCommand},
+    {"ready",        "",                      "Displays the ready screen.",                                           0, 0, handleReadyCommand},
+    {"s",            "",                      "Prints the wheel, fused speed and learned RPM ratio.",                 0, 0, handleSpeedCommand},
+    {"sys",          "",                      "Displays system information.",                                         0, 0, handleInfoCommand},
+    {"trip",         "[subcommand]",          "Trip odometer command. Type 'trip help' for more information.",        0, 3, handleTripCommand},
+    {"canmonitor",   "[id]",                  "Starts monitoring CAN messages. Type 'canmonitor help' for more info.", 0, 1, handleCanMonitorCommand},
+    {"stopmonitor",  "",                      "Stops monitoring CAN messages.",                                       0, 0, handleStopMonitorCommand},
+    {"telemetry",    "[csv]",                 "Displays the telemetry data, or a CSV header and line.",               0, 1, handleTelemetryCommand},
+    {"stream",       "[rate] [fields]",       "Streams telemetry as binary packets. Type 'stream help' for more information.", 0, 2, handleStreamCommand},
+    {"g",            "[gauge_name] [pos]",    "Gauge command. Type 'g help' for more information.",                   0, 2, handleGaugeCommand},
+    {"ignition",     "[subcommand]",          "Control ignition. Type 'ignition help' for more information.",         0, 2, handleIgnitionCommand},
+    {"wakeups",      "",                      "Shows how often each task woke up since the last call.",               0, 0, handleWakeupsCommand},
+    {"tasks",        "[reset]",               "Shows core, priority, stack and period of each task and flags missed deadlines.", 0, 1, handleTasksCommand},
+    {"top",          "[seconds|stacks]",      "Shows CPU usage and free stack per task. Type 'top help' for more information.", 0, 1, handleTopCommand},
+    {"mem",          "",                      "Shows the static RAM per subsystem and the heap state.",               0, 0, handleMemCommand},
+    {"trace",        "[on|off|clear]",        "Dumps the event trace for tools/trace_to_chrome.py, or controls recording.", 0, 1, handleTraceCommand},
+    {"log",          "[module|all] [level]",  "Shows or sets the log level of each module. Type 'log help' for more information.", 0, 2, handleLogCommand},
+    {"session",      "[echo on|off]",         "Lists the CLI sessions and their subscriptions, or sets echo for this one.", 0, 2, handleSessionCommand},
+    {"clibench",     "[count]",               "Measures how many command lines per second the parser handles.",       0, 1, handleBenchCommand},
+};
+
+const int numCommands = sizeof(commands) / sizeof(commands[0]);
+
+TaskHandle_t cliTaskHandle = NULL;
+
+CliSession cliSessions[] = {
+    {"serial", SerialOut, OUTPUT_SERIAL, true, true, "", 0, false, false, false, false},
+#ifdef ENABLE_BLUETOOTH
+    {"bt", BTOut, OUTPUT_BT, false, true, "", 0, false, false, false, false},
+#endif
+};
+
+const int numCliSessions = sizeof(cliSessions) / sizeof(cliSessions[0]);
+
+void onSerialReceive() {
+    xTaskNotifyGive(cliTaskHandle);
+}
 
 void initializeCLI() {
-    Serial.begin(115200);
-    xTaskCreate(cliTask, "CLI Task", 4096, NULL, 2, NULL);
+    createTask(TASK_CLI, cliTask, &cliTaskHandle);
+
+    // Command output waits for room rather than losing its start, trace alone is larger than a ring
+    setInteractiveOutputTask(cliTaskHandle);
+
+    // Wake the CLI task when characters arrive instead of polling for them
+    Serial.onReceive(onSerialReceive);
+    setBTInputTask(cliTaskHandle);
+}
+
+// The session a command runs in, NULL for a stream that is not one
+CliSession *findSession(Stream &stream) {
+    for (int i = 0; i < numCliSessions; i++) {
+        if (&cliSessions[i].stream == &stream) {
+            return &cliSessions[i];
+        }
+    }
+    return NULL;
+}
+
+bool isSessionConnected(const CliSession &session) {
+    return session.sink != OUTPUT_BT || isBTConnected();
+}
+
+// COBS frames share the session's output ring with log lines and echo, and
+// either would break the framing, so both are off while the session streams
+void startSessionStream(Stream &stream, uint32_t fieldMask, uint8_t rateHz) {
+    stopSessionStream();    // The stream moves here, or restarts with new fields
+    CliSession *session = findSession(stream);
+    if (session != NULL) {
+        session->streaming = true;
+        session->streamEcho = session->echo;
+        session->streamLog = isLogSink(session->sink);
+        session->echo = false;
+        setLogSink(session->sink, false);
+    }
+    startTelemetryStream(stream, fieldMask, rateHz);
+}
+
+// Stop the stream and give its session back its echo and log lines
+void stopSessionStream() {
+    stopTelemetryStream();
+    for (int i = 0; i < numCliSessions; i++) {
+        CliSession &session = cliSessions[i];
+        if (session.streaming) {
+            session.streaming = false;
+            session.echo = session.streamEcho;
+            setLogSink(session.sink, session.streamLog);
+        }
+    }
+}
+
+// Stop everything the session subscribed to and forget its settings
+void resetSession(CliSession &session) {
+    removeCANMonitor(session.stream);
+    if (session.streaming) {
+        stopSessionStream();
+    }
+    setLogSink(session.sink, true);
+    session.echo = true;
+    session.length = 0;
 }
 
 void cliTask(void * parameter) {
-    String input;
     for (;;) {
-        // Check for input from hardware Serial
-        if (Serial.available() > 0) {
-            char ch = Serial.read();
-            processCharacter(ch, input, Serial);
+        // Woken by data from either transport, or a Bluetooth client coming or going
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        countTaskWakeup(TASK_CLI);
+        // A command that waits, such as top or output waiting for ring space,
+        // takes the wakeups meant for the other session, so go round again
+        // until no session has input left
+        while (serviceSessions()) {
         }
-        
-#ifdef ENABLE_BLUETOOTH
-        // Check for input from Bluetooth Serial
-        if (SerialBT.available() > 0) {
-            char ch = SerialBT.read();
-            processCharacter(ch, input, SerialBT);
+    }
+}
+
+// Follow clients coming and going, and run what was typed in each session.
+// Returns true when a session had input.
+bool serviceSessions() {
+    bool hadInput = false;
+    for (int i = 0; i < numCliSessions; i++) {
+        CliSession &session = cliSessions[i];
+        if (session.busy) {
+            continue;   // Its command called back in here, it is serviced when that returns
+        }
+        bool connected = isSessionConnected(session);
+        if (connected != session.connected) {
+            // A client that reconnects starts afresh
+            session.connected = connected;
+            resetSession(session);
+        }
+        if (connected && session.stream.available() > 0) {
+            readCommandInput(session);
+            hadInput = true;
+        }
+    }
+    return hadInput;
+}
+
+void readCommandInput(CliSession &session) {
+    Stream &stream = session.stream;
+    // Read in chunks rather than a byte at a time, a pasted script is handled in one wakeup
+    char chunk[32];
+    int available;
+    while ((available = stream.available()) > 0) {
+        if (available > (int)sizeof(chunk)) {
+            available = sizeof(chunk);
+        }
+        size_t count = stream.readBytes(chunk, available);
+        for (size_t i = 0; i < count; i++) {
+            processCharacter(chunk[i], session);
         }
-#endif
-        
-        vTaskDelay(10 / portTICK_PERIOD_MS); // Wait 10ms
     }
 }
 
-void processCharacter(char ch, String &input, Stream &stream) {
+void processCharacter(char ch, CliSession &session) {
+    Stream &stream = session.stream;
     if (ch == '\b' || ch == 127) {  // ASCII for backspace or delete
-        if (input.length() > 0) {
-            input.remove(input.length() - 1);  // Remove last character from input
-            stream.write(127);  // Send DEL character
+        if (session.length > 0) {
+            session.length--;  // Remove last character from input
+            if (session.echo) {
+                stream.write(127);  // Send DEL character
+            }
         }
     } else if (ch == '\n' || ch == '\r') {  // New line or carriage return
-        stream.println();  // Echo new line back to user immediately
-        if (input.length() > 0) {  // Only process non-empty commands
-            input.trim();
-            handleInput(input, stream);
-            input = "";  // Reset input string for next command
-        } else {
-            if (CANMonitoring() == 1) {
-                setCANMonitoring(false);
-                stream.println("CAN monitoring stopped.");
+        if (session.echo) {
+            stream.println();  // Echo new line back to user immediately
+        }
+        if (session.length > 0) {  // Only process non-empty commands
+            session.buffer[session.length] = '\0';
+            session.length = 0;  // Reset input for next command
+            session.busy = true;
+            handleInput(session.buffer, stream);
+            session.busy = false;
+        } else if (isCANMonitor(stream)) {
+            // Enter on an empty line stops this session's CAN monitor
+            removeCANMonitor(stream);
+            stream.println("CAN monitoring stopped.");
+        }
+    } else if (session.length < CLI_MAX_LINE - 1) {  // Longer lines are cut off
+        session.buffer[session.length++] = ch;  // Accumulate characters into the line
+        if (session.echo) {
+            stream.print(ch);  // Echo character back to user
+        }
+    }
+}
+
+// Returns the next space separated token and terminates it in place, NULL at
+// the end of the line. A token in double quotes may hold blanks, the quotes
+// are dropped and a missing closing quote ends it at the end of the line.
+char *nextToken(char *&cursor) {
+    while (*cursor == ' ' || *cursor == '\t') {
+        cursor++;
+    }
+    if (*cursor == '\0') {
+        return NULL;
+    }
+    if (*cursor == '"') {
+        char *token = ++cursor;
+        while (*cursor != '\0' && *cursor != '"') {
+            cursor++;
+        }
+        if (*cursor != '\0') {
+            *cursor++ = '\0';
+        }
+        return token;
+    }
+    char *token = cursor;
+    while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t') {
+        cursor++;
+    }
+    if (*cursor != '\0') {
+        *cursor++ = '\0';
+    }
+    return token;
+}
+
+// Splits line in place and looks up the command. Returns NULL with argc 0 for
+// a blank line and argc 1 for an unknown command. argc counts every token,
+// also those beyond CLI_MAX_ARGS that did not fit in argv.
+const Command *parseCommand(char *line, int &argc, char **argv) {
+    char *cursor = line;
+    argc = 0;
+    char *name = nextToken(cursor);
+    if (name == NULL) {
+        return NULL;
+    }
+    argv[argc++] = name;
+
+    const Command *command = NULL;
+    for (int i = 0; i < numCommands; i++) {
+        if (strcmp(name, commands[i].name) == 0) {
+            command = &commands[i];
+            break;
+        }
+    }
+    if (command == NULL) {
+        return NULL;
+    }
+
+    if (command->maxArgs == CLI_ARGS_LINE) {
+        // Hand over the rest of the line, without the surrounding blanks
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+        char *end = cursor + strlen(cursor);
+        while (end > cursor && (end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        if (*cursor != '\0') {
+            argv[argc++] = cursor;
+        }
+    } else {
+        char *token;
+        while ((token = nextToken(cursor)) != NULL) {
+            if (argc < CLI_MAX_ARGS) {
+                argv[argc] = token;
             }
+            argc++;
+        }
+    }
+    return command;
+}
+
+void handleInput(char *line, Stream &stream) {
+    char *argv[CLI_MAX_ARGS];
+    int argc;
+    const Command *command = parseCommand(line, argc, argv);
+    if (command == NULL) {
+        if (argc > 0) {
+            stream.println("Unknown command. Type 'help' for a list of commands.");
         }
+        return;
+    }
+
+    // Check the argument count against the table before running the handler
+    int numArgs = argc - 1;
+    if (numArgs < command->minArgs || (command->maxArgs != CLI_ARGS_LINE && numArgs > command->maxArgs)) {
+        stream.print("Usage: ");
+        stream.print(command->name);
+        stream.print(" ");
+        stream.println(command->args);
+        return;
+    }
+    command->handler(argc, argv, stream);
+}
+
+void printHelp(Stream &stream) {
+    char line[160];
+    char usage[32];
+    stream.println("Available commands:");
+    for (int i = 0; i < numCommands; i++) {
+        if (commands[i].help == NULL) {
+            continue;
+        }
+        snprintf(usage, sizeof(usage), "%s %s", commands[i].name, commands[i].args);
+        snprintf(line, sizeof(line), "  %-24s- %s", usage, commands[i].help);
+        stream.println(line);
+    }
+}
+
+// Parses a whole decimal argument, false if it is not a number
+bool parseInteger(const char *str, long &value) {
+    char *end;
+    value = strtol(str, &end, 10);
+    return end != str && *end == '\0';
+}
+
+bool isHelp(const char *arg) {
+    return strcmp(arg, "h") == 0 || strcmp(arg, "help") == 0;
+}
+
+void handleOffCommand(int argc, char **argv, Stream &stream) {
+    setDisplayMode(OFF);
+    sendStandbyCommand(false);
+}
+
+void handleOnCommand(int argc, char **argv, Stream &stream) {
+    setDisplayMode(EMPTY);
+    sendStandbyCommand(true);
+}
+
+void handleEchoCommand(int argc, char **argv, Stream &stream) {
+    stream.println(argc > 1 ? argv[1] : "");
+}
+
+void handleHelpCommand(int argc, char **argv, Stream &stream) {
+    printHelp(stream);
+}
+
+void handleResetCommand(int argc, char **argv, Stream &stream) {
+    stream.println("Restarting ESP32...");
+    commitParameters(); // Do not lose changes still in their quiet period
+    ESP.restart();
+}
+
+void handleReadyCommand(int argc, char **argv, Stream &stream) {
+    setDisplayMode(READY);
+}
+
+void handleCanMonitorCommand(int argc, char **argv, Stream &stream) {
+    if (argc > 1 && isHelp(argv[1])) {
+        stream.println(CAN_MONITOR_HELP_TEXT);
+        return;
+    }
+    uint32_t filterID = (argc > 1) ? strtoul(argv[1], nullptr, 16) : 0;
+    if (!addCANMonitor(stream, filterID)) {
+        stream.println("Error: Too many CAN monitors, increase CAN_MAX_MONITORS");
+        return;
+    }
+    stream.print("CAN monitoring started.");
+    if (filterID != 0) {
+        stream.print(" Filtering for hex ID: ");
+        stream.print(filterID, HEX);
+    }
+    stream.println();
+}
+
+void handleStopMonitorCommand(int argc, char **argv, Stream &stream) {
+    removeCANMonitor(stream);
+    stream.println("CAN monitoring stopped.");
+}
+
+void handleTelemetryCommand(int argc, char **argv, Stream &stream) {
+    Telemetry snapshot = telemetryData;     // One consistent set of values for the whole output
+    if (argc > 1 && strcmp(argv[1], "csv") == 0) {
+        printTelemetryCsv(stream, snapshot, true);
     } else {
-        input += ch;  // Accumulate characters into input string
-        stream.print(ch);  // Echo character back to user
-    }
-}
-
-void handleInput(String input, Stream &stream) {
-    input.trim(); // Trim the input first
-
-    if (input.startsWith(CMD_ECHO)) {
-        stream.println(input.substring(CMD_ECHO.length()));
-    } else if (input.startsWith(CMD_PARAM)) {
-        String paramInput = input.substring(CMD_PARAM.length());
-        paramInput.trim(); // Trim the parameter input
-        handleParameterCommand(paramInput, stream);
-    } else if (input == CMD_SYS) {
-        handleInfoCommand(stream);
-    } else if (input == CMD_SPEED) {
-        handleSpeedCommand(stream);
-    } else if (input.startsWith(CMD_TRIP)) {
-        String tripInput = input.substring(CMD_TRIP.length());
-        tripInput.trim(); // Trim the trip input
-        handleTripCommand(tripInput, stream);
-    } else if (input == "ready") {
-        currentDisplayMode = READY;
-    } else if (input == "off") {
-        currentDisplayMode = OFF;
-        sendStandbyCommand(false);
-    } else if (input == "on") {
-        currentDisplayMode = EMPTY;
-        sendStandbyCommand(true);
-    } else if (input.startsWith(CMD_GAUGE)) {
-        String gaugeInput = input.substring(CMD_GAUGE.length());
-        gaugeInput.trim(); // Trim the gauge input
-        handleGaugeCommand(gaugeInput, stream);
-    } else if (input == CMD_RESET) {
-        stream.println("Restarting ESP32...");
-        ESP.restart();
-    } else if (input == "telemetry") {
-        printTelemetryData(stream);
-    } else if (input.startsWith(CMD_IGNITION)) {
-        String ignitionInput = input.substring(CMD_IGNITION.length());
-        ignitionInput.trim(); // Trim the ignition input
-        handleIgnitionCommand(ignitionInput, stream);
-    } else if (input == "h" || input == CMD_HELP) {
-        stream.println(HELP_TEXT);
-    } else if (input.startsWith(CMD_START_MONITOR)) {
-        if (input == CMD_START_MONITOR + " h" || input == CMD_START_MONITOR + " help") {
-            stream.println("Usage: canmonitor [id]\n"
-                          "  id: CAN ID to filter for (optional)");
-            return;
+        printTelemetryDump(stream, snapshot);
+    }
+}
+
+void handleStreamCommand(int argc, char **argv, Stream &stream) {
+    char line[96];
+    if (argc == 1) {
+        TelemetryStreamStatus status = getTelemetryStreamStatus();
+        if (!status.running) {
+            stream.println("Not streaming.");
         } else {
-            String idStr = input.substring(CMD_START_MONITOR.length());
-            idStr.trim();
-            uint32_t filterID = (idStr.length() > 0) ? strtoul(idStr.c_str(), nullptr, 16) : 0;
-            setCANMonitoring(true, filterID);
-            stream.print("CAN monitoring started.");
-            if (filterID != 0) {
-                stream.print(" Filtering for hex ID: ");
-                stream.print(filterID, HEX);
+            snprintf(line, sizeof(line), "Streaming %d fields at %u Hz, %u bytes per packet (%lu B/s)",
+                     __builtin_popcount(status.fieldMask), status.rateHz, status.dataPacketBytes,
+                     (unsigned long)status.rateHz * status.dataPacketBytes);
+            stream.println(line);
+        }
+        snprintf(line, sizeof(line), "Sent %lu packets, %lu bytes", (unsigned long)status.packetsSent, (unsigned long)status.bytesSent);
+        stream.println(line);
+        return;
+    }
+    if (isHelp(argv[1])) {
+        stream.println(STREAM_HELP_TEXT);
+        return;
+    }
+    if (strcmp(argv[1], "stop") == 0) {
+        stopSessionStream();
+        stream.println("Stream stopped.");
+        return;
+    }
+    if (strcmp(argv[1], "fields") == 0) {
+        for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+            snprintf(line, sizeof(line), "  %-26s %u bytes", telemetryFields[i].key, telemetryFieldSize(telemetryFields[i].type));
+            stream.println(line);
+        }
+        return;
+    }
+
+    long rate;
+    if (!parseInteger(argv[1], rate) || rate < STREAM_MIN_RATE_HZ || rate > STREAM_MAX_RATE_HZ) {
+        stream.println("Error: Invalid rate, use 1 to 100 Hz");
+        return;
+    }
+
+    // Split the comma separated field names in a copy, the default list is constant
+    char fields[CLI_MAX_LINE];
+    strncpy(fields, argc > 2 ? argv[2] : STREAM_DEFAULT_FIELDS, sizeof(fields) - 1);
+    fields[sizeof(fields) - 1] = '\0';
+    uint32_t fieldMask = 0;
+    if (strcmp(fields, "all") == 0) {
+        fieldMask = (1UL << NUM_TELEMETRY_FIELDS) - 1;
+    } else {
+        char *save;
+        for (char *name = strtok_r(fields, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+            TelemetryFieldId id = findTelemetryField(name);
+            if (id == NUM_TELEMETRY_FIELDS) {
+                stream.print("Error: Unknown field ");
+                stream.print(name);
+                stream.println(". Type 'stream fields' for the list.");
+                return;
             }
-            stream.println();
+            fieldMask |= 1UL << id;
         }
-    } else if (input == CMD_STOP_MONITOR) {
-        setCANMonitoring(false);
-        stream.println("CAN monitoring stopped.");
+    }
+
+    snprintf(line, sizeof(line), "Streaming %d fields at %ld Hz. Type 'stream stop' to end.", __builtin_popcount(fieldMask), rate);
+    stream.println(line);
+    startSessionStream(stream, fieldMask, rate);
+}
+
+void handleWakeupsCommand(int argc, char **argv, Stream &stream) {
+    printTaskWakeups(stream);
+}
+
+void handleTasksCommand(int argc, char **argv, Stream &stream) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        resetTaskDeadlines();
+        stream.println("Task deadline statistics reset.");
+    } else {
+        printTaskDeadlines(stream);
+    }
+}
+
+void handleMemCommand(int argc, char **argv, Stream &stream) {
+    printMemoryBudget(stream);
+}
+
+void handleTraceCommand(int argc, char **argv, Stream &stream) {
+    const char *mode = argc > 1 ? argv[1] : "";
+    if (strcmp(mode, "on") == 0) {
+        setTraceRunning(true);
+        stream.println("Tracing on.");
+    } else if (strcmp(mode, "off") == 0) {
+        setTraceRunning(false);
+        stream.println("Tracing off.");
+    } else if (strcmp(mode, "clear") == 0) {
+        clearTrace();
+        stream.println("Trace cleared.");
     } else {
-        stream.println("Unknown command. Type 'help' for a list of commands.");
+        dumpTrace(stream);
     }
 }
 
-void handleSpeedCommand(Stream &stream) {
+void handleLogCommand(int argc, char **argv, Stream &stream) {
+    if (argc > 1 && isHelp(argv[1])) {
+        stream.println(LOG_HELP_TEXT);
+        return;
+    }
+
+    if (argc == 1) {
+        char line[64];
+        for (int i = 0; i < NUM_LOG_MODULES; i++) {
+            snprintf(line, sizeof(line), "  %-10s %s", logModuleNames[i], logLevelNames[logLevels[i]]);
+            stream.println(line);
+        }
+        LogStats stats = getLogStats();
+        snprintf(line, sizeof(line), "%lu records, %lu dropped, built with %s",
+                 (unsigned long)stats.written, (unsigned long)stats.dropped, logLevelNames[LOG_BUILD_LEVEL]);
+        stream.println(line);
+        return;
+    }
+
+    CliSession *session = findSession(stream);
+    if (argc == 2 && session != NULL && (strcasecmp(argv[1], "on") == 0 || strcasecmp(argv[1], "off") == 0)) {
+        bool enabled = strcasecmp(argv[1], "on") == 0;
+        setLogSink(session->sink, enabled);
+        stream.println(enabled ? "Log lines on in this session." : "Log lines off in this session.");
+        return;
+    }
+
+    LogModule module = NUM_LOG_MODULES;
+    uint8_t level;
+    if (argc != 3 || (strcasecmp(argv[1], "all") != 0 && !findLogModule(argv[1], module)) || !findLogLevel(argv[2], level)) {
+        stream.println(LOG_HELP_TEXT);
+        return;
+    }
+    setLogLevel(module, level);
+    stream.print("Log level set to ");
+    stream.println(logLevelNames[level]);
+    if (level > LOG_BUILD_LEVEL) {
+        stream.print("Messages above ");
+        stream.print(logLevelNames[LOG_BUILD_LEVEL]);
+        stream.println(" are not in this build, change LOG_BUILD_LEVEL in Log.h");
+    }
+}
+
+void handleSessionCommand(int argc, char **argv, Stream &stream) {
+    CliSession *current = findSession(stream);
+    if (argc > 1) {
+        bool state;
+        if (current == NULL || strcmp(argv[1], "echo") != 0 || !parseOnOff(argc, argv, state)) {
+            stream.println("Usage: session [echo on|off]");
+            return;
+        }
+        current->echo = state;
+        stream.println(state ? "Echo on." : "Echo off.");
+        return;
+    }
+
+    TelemetryStreamStatus streamStatus = getTelemetryStreamStatus();
+    for (int i = 0; i < numCliSessions; i++) {
+        CliSession &session = cliSessions[i];
+        char line[96];
+        snprintf(line, sizeof(line), "%c %-7s %-13s echo %-3s %s%s%s",
+                 &session == current ? '*' : ' ', session.name,
+                 session.connected ? "connected" : "not connected", session.echo ? "on" : "off",
+                 isCANMonitor(session.stream) ? " canmonitor" : "",
+                 streamStatus.running && streamStatus.output == &session.stream ? " stream" : "",
+                 isLogSink(session.sink) ? " log" : "");
+        stream.println(line);
+    }
+}
+
+// Typical lines for clibench, covering the argument shapes in the table
+const char *const BENCH_LINES[] = {
+    "p 3 120",
+    "g Speedometer 50",
+    "trip set 12 km",
+    "echo  hello world ",
+    "tasks reset",
+    "top stacks",
+    "canmonitor 99B50500",
+    "ignition override on",
+};
+
+void handleBenchCommand(int argc, char **argv, Stream &stream) {
+    long iterations = 10000;
+    if (argc > 1 && (!parseInteger(argv[1], iterations) || iterations <= 0)) {
+        stream.println("Error: Invalid count");
+        return;
+    }
+
+    // Only tokenize and look up, the handlers are not run. The copy is
+    // included since a real line is split in place as well.
+    const int numLines = sizeof(BENCH_LINES) / sizeof(BENCH_LINES[0]);
+    char line[CLI_MAX_LINE];
+    char *lineArgv[CLI_MAX_ARGS];
+    int lineArgc;
+    long parsed = 0;
+    uint32_t start = micros();
+    for (long i = 0; i < iterations; i++) {
+        strcpy(line, BENCH_LINES[i % numLines]);
+        if (parseCommand(line, lineArgc, lineArgv) != NULL) {
+            parsed++;
+        }
+    }
+    uint32_t elapsed = micros() - start;
+
+    char result[96];
+    snprintf(result, sizeof(result), "%ld lines in %lu us: %lu lines/s, %lu ns per line",
+             parsed, (unsigned long)elapsed,
+             elapsed > 0 ? (unsigned long)((uint64_t)parsed * 1000000 / elapsed) : 0UL,
+             parsed > 0 ? (unsigned long)((uint64_t)elapsed * 1000 / parsed) : 0UL);
+    stream.println(result);
+}
+
+void handleSpeedCommand(int argc, char **argv, Stream &stream) {
     uint32_t currentSpeed = getSpeed();  // Assuming getSpeed() is accessible
     stream.println("Current Speed: " + String(currentSpeed) + " Km/h");  // Adjust units if necessary
+    stream.println("Fused Speed: " + String(telemetryData.speed) + " Km/h (" + String(getFusedSpeedMmPerS()) + " mm/s)");
+    stream.println("Learned Ratio: " + String(getLearnedSpeedRatio()) + " um/rev");
+}
+
+void handleTopCommand(int argc, char **argv, Stream &stream) {
+    long seconds;
+    if (argc == 1) {
+        printTaskTop(stream, 1000);
+    } else if (isHelp(argv[1])) {
+        stream.println(TOP_HELP_TEXT);
+    } else if (strcmp(argv[1], "stacks") == 0) {
+        printStackReport(stream);
+    } else if (!parseInteger(argv[1], seconds) || seconds <= 0) {
+        stream.println("Invalid interval. Type 'top help' for more information.");
+    } else {
+        // Drop the rest of the line ending, then a key in this session ends the refresh loop
+        while (stream.peek() == '\n' || stream.peek() == '\r') {
+            stream.read();
+        }
+        CliSession *session = findSession(stream);
+        for (;;) {
+            bool woken = printTaskTop(stream, seconds * 1000);
+            if (stream.available() > 0 || (session != NULL && !isSessionConnected(*session))) {
+                break;
+            }
+            if (woken) {
+                // The wakeup was for the other session, it keeps running meanwhile
+                while (serviceSessions()) {
+                }
+            }
+            stream.println();
+        }
+    }
 }
 
-void handleInfoCommand(Stream &stream) {
+void handleInfoCommand(int argc, char **argv, Stream &stream) {
     stream.println("System Information:");
     
     // Display number of tasks
@@ -272,17 +843,91 @@ void handleInfoCommand(Stream &stream) {
     // give the auto update state of the gauges
     stream.print("Auto Update: ");
     stream.println(getAutoUpdate() ? "ON" : "OFF");
+
+    // gauge link rate and error counters
+    GaugeLinkStats gaugeLink = getGaugeLinkStats();
+    stream.print("Gauge Link Baud: ");
+    stream.print(getGaugeBaudRate());
+    stream.println(isGaugeBaudNegotiated() ? " (negotiated)" : "");
+    stream.print("Gauge Link Errors: RX ");
+    stream.print(gaugeLink.rxErrors);
+    stream.print(", UART ");
+    stream.print(gaugeLink.uartErrors);
+    stream.print(", Lost ");
+    stream.print(gaugeLink.framesLost);
+    stream.print(", Fallbacks ");
+    stream.println(gaugeLink.baudFallbacks);
     
+    // queued console output, bytes dropped when a link could not keep up
+    const char *sinkNames[NUM_OUTPUT_SINKS] = {"Serial", "Bluetooth"};
+    for (int i = 0; i < NUM_OUTPUT_SINKS; i++) {
+        OutputStats output = getOutputStats((OutputSink)i);
+        char line[112];
+        snprintf(line, sizeof(line), "Output %s: %lu written, %lu dropped, %lu max queued, %lu stalls",
+                 sinkNames[i], (unsigned long)output.written, (unsigned long)output.dropped, (unsigned long)output.highWater,
+                 (unsigned long)output.stalls);
+        stream.println(line);
+    }
+
+    CanStats can = getCanStats();
+    char canLine[96];
+    snprintf(canLine, sizeof(canLine), "CAN: %lu frames, %lu missed, %lu bus errors",
+             (unsigned long)can.received, (unsigned long)can.rxMissed, (unsigned long)can.busErrors);
+    stream.println(canLine);
+
+#ifdef ENABLE_BLE
+    BleTelemetryStats ble = getBleTelemetryStats();
+    char bleLine[128];
+    snprintf(bleLine, sizeof(bleLine), "BLE: %s%s, MTU %u, %u Hz, %lu samples in %lu notifications (%lu bytes)",
+             ble.connected ? "connected" : "advertising", ble.subscribed ? " and subscribed" : "", ble.mtu, ble.rateHz,
+             (unsigned long)ble.samples, (unsigned long)ble.notifications, (unsigned long)ble.bytes);
+    stream.println(bleLine);
+#endif
+
 #ifdef ENABLE_BLUETOOTH
     // Bluetooth status
     stream.print("Bluetooth Connected: ");
     stream.println(isBTConnected() ? "Yes" : "No");
+    BTStats bt = getBTStats();
+    const char *btStates[] = {"off", "parked", "on"};
+    char btLine[96];
+    snprintf(btLine, sizeof(btLine), "Bluetooth: %s, full start %lu ms, last resume %lu us (%lu resumes)",
+             btStates[bt.state], (unsigned long)bt.startMicros / 1000, (unsigned long)bt.resumeMicros,
+             (unsigned long)bt.resumes);
+    stream.println(btLine);
 #else
     // Bluetooth status
     stream.print("Bluetooth: ");
     stream.println("Disabled");
 #endif
 
+    // odometer journal state
+    JournalStats journal = getOdometerJournalStats();
+    stream.print("Odometer Journal: ");
+    if (journal.available) {
+        stream.print("record ");
+        stream.print(journal.sequence);
+        stream.print(", ");
+        stream.print(journal.recordsWritten);
+        stream.print(" writes, ");
+        stream.print(journal.sectorErases);
+        stream.print(" erases, ");
+        stream.print(journal.writeErrors);
+        stream.print(" errors, recovered in ");
+        stream.print(journal.recoveryMicros);
+        stream.println(" us");
+    } else {
+        stream.println("Unavailable");
+    }
+
+    // coalesced parameter writes, unchanged values are not written
+    ParameterStoreStats store = getParameterStoreStats();
+    char storeLine[112];
+    snprintf(storeLine, sizeof(storeLine), "Parameter NVS: %lu commits, %lu writes, %lu unchanged, %lu errors, pending 0x%02lx",
+             (unsigned long)store.commits, (unsigned long)store.writes, (unsigned long)store.skipped,
+             (unsigned long)store.errors, (unsigned long)store.pending);
+    stream.println(storeLine);
+
     // Display the state of the digital input pin digitalRead(IGNITION_SWITCH_PIN)
     stream.print("Ignition Switch State: ");
     if (digitalRead(IGNITION_SWITCH_PIN) == HIGH) {
@@ -292,357 +937,248 @@ void handleInfoCommand(Stream &stream) {
     }
 }
 
-void printTelemetryData(Stream &stream) {
-    String binaryString;
-    stream.println("Telemetry Data:");
-
-    stream.print("Speed: ........................ ");
-    stream.println(telemetryData.speed / 10.0, 1);
-
-    stream.print("Motor Temperature: ............ ");
-    stream.println(telemetryData.motorTemp);
-
-    stream.print("Inverter Temperature: ......... ");
-    stream.println(telemetryData.inverterTemp);
-
-    stream.print("Motor RPM: .................... ");
-    stream.println(telemetryData.rpm);
-
-    stream.print("Motor DC Voltage: ............. ");
-    stream.println(telemetryData.DCVoltage, 1); // 2 decimal places for float
-
-    stream.print("Motor DC Current: ............. ");
-    stream.println(telemetryData.DCCurrent, 1); // 2 decimal places for float
-
-    stream.print("Power Unit Flags: ............. ");
-    binaryString = String(telemetryData.powerUnitFlags, BIN);
-    while (binaryString.length() < 16) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("Motor Flags: .................. ");
-    binaryString = String(telemetryData.motorFlags, BIN);
-    while (binaryString.length() < 16) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Input Signal Flags: ....... ");
-    binaryString = String(telemetryData.BMSInputSignalFlags, BIN);
-    while (binaryString.length() < 8) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Output Signal Flags: ...... ");
-    binaryString = String(telemetryData.BMSOutputSignalFlags, BIN);
-    while (binaryString.length() < 8) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Number of Cells: .......... ");
-    stream.println(telemetryData.BMSNumberOfCells);
-
-    stream.print("BMS Charging State: ........... ");
-    switch (telemetryData.BMSChargingState) {
-        case 0:
-            stream.println("Disconnected");
-            break;
-        case 1:
-            stream.println("Pre-heat");
-            break;
-        case 2:
-            stream.println("Pre-charge");
-            break;
-        case 3:
-            stream.println("Charging");
-            break;
-        case 4:
-            stream.println("Balancing");
-            break;
-        case 5:
-            stream.println("Finished");
-            break;
-        case 6:
-            stream.println("Error");
-            break;
-        default:
-            stream.println("Unknown");
-            break;
-    }
-
-    stream.print("BMS Charging State Duration: .. ");
-    stream.print(telemetryData.BMSCsDuration);
-    stream.println(" minutes");
-
-    stream.print("BMS Last Charging Error: ...... ");
-    switch (telemetryData.BMSLastChargingError) {
-        case 0:
-            stream.println("No error");
-            break;
-        case 1:
-            stream.println("No cell comm. at start/precharge (CAN charger)");
-            break;
-        case 2:
-            stream.println("No cell comm. (Non-CAN charger)");
-            break;
-        case 3:
-            stream.println("Max charging stage duration expired");
-            break;
-        case 4:
-            stream.println("Cell comm. lost during charging/balancing (CAN charger)");
-            break;
-        case 5:
-            stream.println("Cannot set balancing threshold");
-            break;
-        case 6:
-            stream.println("Cell/module temp too high");
-            break;
-        case 7:
-            stream.println("Cell comm. lost during pre-heating (CAN charger)");
-            break;
-        case 8:
-            stream.println("Cell count mismatch");
-            break;
-        case 9:
-            stream.println("Cell over-voltage");
-            break;
-        case 10:
-            stream.println("Cell protection event (see diagnostic codes)");
-            break;
-        default:
-            stream.println("Unknown");
-            break;
-    }
-
-    stream.print("BMS Protection Flags: ......... ");
-    binaryString = String(telemetryData.BMSProtectionFlags, BIN);
-    while (binaryString.length() < 32) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Reduction Flags: .......... ");
-    binaryString = String(telemetryData.BMSReductionFlags, BIN);
-    while (binaryString.length() < 8) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Battery Status Flags: ..... ");
-    binaryString = String(telemetryData.BMSBatteryStatusFlags, BIN);
-    while (binaryString.length() < 8) {
-        binaryString = "0" + binaryString;
-    }
-    stream.println(binaryString);
-
-    stream.print("BMS Minimum Module Temperature: ");
-    stream.println(telemetryData.BMSMinModTemp);
-    stream.print("BMS Maximum Module Temperature: ");
-    stream.println(telemetryData.BMSMaxModTemp);
-    stream.print("BMS Average Module Temperature: ");
-    stream.println(telemetryData.BMSAverageModTemp);
-    stream.print("BMS Minimum Cell Temperature: . ");
-    stream.println(telemetryData.BMSMinCellTemp);
-    stream.print("BMS Maximum Cell Temperature: . ");
-    stream.println(telemetryData.BMSMaxCellTemp);
-    stream.print("BMS Average Cell Temperature: . ");
-    stream.println(telemetryData.BMSAverageCellTemp);
-
-    stream.print("BMS Current: .................. ");
-    stream.println(telemetryData.Current / 10.0, 1);
-
-    stream.print("BMS Charge: ................... ");
-    stream.println(telemetryData.Charge / 10.0, 1);
-
-    stream.print("BMS State of Charge (SoC): .... ");
-    stream.println(telemetryData.SoC / 100.0, 2);
-}
-
-void handleParameterCommand(String input, Stream &stream) {
-    if (input == "h" || input == CMD_HELP) {
-        stream.println(PARAM_HELP_TEXT);
-    } else if (input.startsWith("clear")) {
-        String indexStr = input.substring(6);
-        indexStr.trim();
-        if (indexStr.length() > 0) {
-            if (!indexStr.toInt() && indexStr != "0") {
-                stream.println("Error: Invalid index");
-                return;
-            }
-            clearNVS(indexStr.toInt(), &stream);
-        } else {
-            clearNVS(-1, &stream);
-        }
-    } else if (input.startsWith("update")) {
-        String indexStr = input.substring(7);
-        indexStr.trim();
-        if (indexStr.length() > 0) {
-            if (!indexStr.toInt() && indexStr != "0") {
-                stream.println("Error: Invalid index");
-                return;
-            }
-            updateParametersFromNVS(indexStr.toInt(), &stream);
-        } else {
-            updateParametersFromNVS(-1, &stream);
-        }
-    } else if (input == "") {
+void handleParameterCommand(int argc, char **argv, Stream &stream) {
+    long index;
+    long value;
+    if (argc == 1) {
         // List all parameters
-        for(int i = 0; i < numParameters; i++) {
-            stream.println(String(parameters[i].index) + ": " + parameters[i].name + " = " + String(parameters[i].value));
+        for(int i = 0; i < NUM_PARAMETERS; i++) {
+            getParameter(i, &stream);
         }
-    } else {
-        int valueIndex = input.indexOf(' ');
-        if (valueIndex != -1) {
-            String indexStr = input.substring(0, valueIndex);
-            String valueStr = input.substring(valueIndex + 1);
-            indexStr.trim();
-            valueStr.trim();
-            // Check for invalid input
-            if (!indexStr.toInt() && indexStr != "0") {
-                stream.println("Error: Invalid index");
-                return;
-            }
-            if (!valueStr.toInt() && valueStr != "0") {
-                stream.println("Error: Invalid value");
-                return;
-            }
-            int index = indexStr.toInt();
-            int value = valueStr.toInt();
-            setParameter(index, value, &stream);
+    } else if (isHelp(argv[1])) {
+        stream.println(PARAM_HELP_TEXT);
+    } else if (strcmp(argv[1], "clear") == 0 || strcmp(argv[1], "update") == 0) {
+        index = -1;
+        if (argc > 2 && !parseInteger(argv[2], index)) {
+            stream.println("Error: Invalid index");
+            return;
+        }
+        if (argv[1][0] == 'c') {
+            clearNVS(index, &stream);
         } else {
-            // Check for invalid index
-            if (!input.toInt() && input != "0") {
-                stream.println("Error: Invalid index");
-                return;
-            }
-            int index = input.toInt();
-            getParameter(index, &stream);
+            updateParametersFromNVS(index, &stream);
         }
+    } else if (!parseInteger(argv[1], index)) {
+        stream.println("Error: Invalid index");
+    } else if (argc == 2) {
+        getParameter(index, &stream);
+    } else if (!parseInteger(argv[2], value)) {
+        stream.println("Error: Invalid value");
+    } else {
+        setParameter(index, value, &stream);
     }
 }
 
-void handleTripCommand(String input, Stream &stream) {
-    if (input == "h" || input == CMD_HELP) {
-        stream.println(TRIP_HELP_TEXT);
-    } else if (input.startsWith("r") || input.startsWith("reset")) {
-        resetTripOdometer();
-    } else if (input.startsWith("s") || input.startsWith("set")) {
-        if (input.startsWith("set")) {
-            input = input.substring(3);
-        } else {
-            input = input.substring(1);
-        }
-        String valueStr = input;
-        valueStr.trim();
-        if (valueStr.length() > 0) {
-            if (!valueStr.toInt() && valueStr != "0") {
-                stream.println("Error: Invalid value");
-                return;
-            }
-            setTripOdometer(valueStr.toInt() * 10);
-        } else {
-            stream.println("Error: No value specified");
-        }
-    } else if (input == "") {
+void handleTripCommand(int argc, char **argv, Stream &stream) {
+    if (argc == 1) {
         char buffer[11];  // Buffer to hold formatted strings
         uint32_t tripOdometer = getTripOdometer();
         sprintf(buffer, "%03d.%d km", tripOdometer / 10, tripOdometer % 10);
         stream.println(buffer);
+    } else if (isHelp(argv[1])) {
+        stream.println(TRIP_HELP_TEXT);
+    } else if (strcmp(argv[1], "r") == 0 || strcmp(argv[1], "reset") == 0) {
+        resetTripOdometer();
+    } else if (strcmp(argv[1], "s") == 0 || strcmp(argv[1], "set") == 0) {
+        // An optional "km" after the value is ignored
+        long value;
+        if (argc < 3) {
+            stream.println("Error: No value specified");
+        } else if (!parseInteger(argv[2], value)) {
+            stream.println("Error: Invalid value");
+        } else if (value < 0 || value >= TRIP_ODOMETER_LIMIT / 10 || !setTripOdometer(value * 10)) {
+            stream.println("Error: Trip must be 0 to " + String(TRIP_ODOMETER_LIMIT / 10 - 1) + " km");
+        }
     } else {
         stream.println("Error: Invalid subcommand");
     }
 }
 
-void handleGaugeCommand(String input, Stream &stream) {
-    if (input == "h" || input == CMD_HELP) {
+// Parses "on" or "off" in any case, false if it is neither
+bool parseOnOff(int argc, char **argv, bool &state) {
+    if (argc > 2 && strcasecmp(argv[2], "on") == 0) {
+        state = true;
+        return true;
+    }
+    if (argc > 2 && strcasecmp(argv[2], "off") == 0) {
+        state = false;
+        return true;
+    }
+    return false;
+}
+
+void handleGaugeCommand(int argc, char **argv, Stream &stream) {
+    const char *subcommand = argc > 1 ? argv[1] : "";
+    bool state;
+    if (isHelp(subcommand)) {
         stream.println(GAUGE_HELP_TEXT);
-    } else if (input == "on") {
+    } else if (strcmp(subcommand, "on") == 0) {
         sendStandbyCommand(true);
-    } else if (input == "off") {
+    } else if (strcmp(subcommand, "off") == 0) {
         sendStandbyCommand(false);
-    } else if (input.startsWith("autoupdate")) {
-        String stateStr = input.substring(10);
-        stateStr.trim();
-        if (stateStr.equalsIgnoreCase("on")) {
-            enableAutoUpdate(true);
-        } else if (stateStr.equalsIgnoreCase("off")) {
-            enableAutoUpdate(false);
+    } else if (strcmp(subcommand, "autoupdate") == 0) {
+        if (parseOnOff(argc, argv, state)) {
+            enableAutoUpdate(state);
         } else {
             stream.println("Error: Invalid state. Please specify 'on' or 'off'.");
         }
+    } else if (strcmp(subcommand, "ack") == 0) {
+        if (parseOnOff(argc, argv, state)) {
+            setGaugeAckEnabled(state);
+        } else {
+            stream.println("Error: Invalid state. Please specify 'on' or 'off'.");
+        }
+    } else if (strcmp(subcommand, "baud") == 0) {
+        if (argc == 2) {
+            stream.print("Gauge link baud: ");
+            stream.print(getGaugeBaudRate());
+            stream.println(isGaugeBaudNegotiated() ? " (negotiated)" : "");
+        } else if (strcasecmp(argv[2], "auto") == 0) {
+            startGaugeBaudNegotiation();
+            stream.println("Gauge link baud negotiation started.");
+        } else if (strcasecmp(argv[2], "base") == 0) {
+            fallBackGaugeBaud();
+            stream.println("Gauge link returning to 9600 baud.");
+        } else {
+            stream.println("Error: Invalid mode. Please specify 'auto' or 'base'.");
+        }
+    } else if (strcmp(subcommand, "link") == 0) {
+        if (argc > 2 && strcmp(argv[2], "reset") == 0) {
+            resetGaugeLinkStats();
+            stream.println("Gauge link counters reset.");
+        } else {
+            printGaugeLinkStats(stream);
+        }
     } else {
-        int firstSpaceIndex = input.indexOf(' ');
-        if (firstSpaceIndex == -1) {
+        if (argc < 3) {
             stream.println("Error: Invalid gauge command. Please specify a gauge name and position.");
             return;
         }
 
-        String gaugeName = input.substring(0, firstSpaceIndex);
-        String positionStr = input.substring(firstSpaceIndex + 1);
-
-        positionStr.trim();
-        if (!positionStr.toInt() && positionStr != "0") {
+        long position;
+        if (!parseInteger(argv[2], position)) {
             stream.println("Error: Invalid position value. Please specify a position value, or use help for more information.");
             return;
         }
 
-        int position = positionStr.toInt();
-
-        if (gaugeName.equalsIgnoreCase("Speedometer")) {
+        const char *gaugeName = argv[1];
+        if (strcasecmp(gaugeName, "Speedometer") == 0) {
             Speedometer.setPosition(position);
-        } else if (gaugeName.equalsIgnoreCase("Tachometer")) {
+        } else if (strcasecmp(gaugeName, "Tachometer") == 0) {
             Tachometer.setPosition(position);
-        } else if (gaugeName.equalsIgnoreCase("Dynamometer")) {
+        } else if (strcasecmp(gaugeName, "Dynamometer") == 0) {
             Dynamometer.setPosition(position);
-        } else if (gaugeName.equalsIgnoreCase("Chargeometer")) {
+        } else if (strcasecmp(gaugeName, "Chargeometer") == 0) {
             Chargeometer.setPosition(position);
-        } else if (gaugeName.equalsIgnoreCase("Thermometer")) {
+        } else if (strcasecmp(gaugeName, "Thermometer") == 0) {
             Thermometer.setPosition(position);
         } else {
             stream.println("Error: Unknown gauge name. Available gauges: Speedometer, Tachometer, Dynamometer, Chargeometer, Thermometer.");
             return;
         }
 
-        stream.println("Gauge " + gaugeName + " set to position " + positionStr + ".");
+        char result[64];
+        snprintf(result, sizeof(result), "Gauge %s set to position %ld.", gaugeName, position);
+        stream.println(result);
+    }
+}
+
+void printGaugeLinkStats(Stream &stream) {
+    GaugeLinkStats stats = getGaugeLinkStats();
+    stream.print("Acknowledgements: ..... ");
+    stream.println(getGaugeAckEnabled() ? "ON" : "OFF");
+    stream.print("Frames Sent: .......... ");
+    stream.println(stats.framesSent);
+    stream.print("ACKs Received: ........ ");
+    stream.println(stats.acksReceived);
+    stream.print("Retransmits: .......... ");
+    stream.println(stats.retransmits);
+    stream.print("Frames Lost: .......... ");
+    stream.println(stats.framesLost);
+    stream.print("ACK Timeouts: ......... ");
+    stream.println(stats.ackTimeouts);
+    stream.print("RX Errors: ............ ");
+    stream.println(stats.rxErrors);
+    stream.print("UART Errors: .......... ");
+    stream.println(stats.uartErrors);
+    stream.print("Baud Rate: ............ ");
+    stream.print(getGaugeBaudRate());
+    stream.println(isGaugeBaudNegotiated() ? " (negotiated)" : "");
+    stream.print("Baud Switch/Fail/Fallback: ");
+    stream.print(stats.baudSwitches);
+    stream.print(" / ");
+    stream.print(stats.baudFailures);
+    stream.print(" / ");
+    stream.println(stats.baudFallbacks);
+    stream.print("Status Reports: ....... ");
+    stream.println(stats.statusReports);
+    if (stats.statusReports > 0) {
+        stream.print("Last Status: .......... ");
+        stream.println(getGaugeLastStatus());
+    }
+
+    stream.print("RTT p50/p90/p99 (us): . ");
+    if (getGaugeLinkRttSampleCount() == 0) {
+        stream.println("no samples");
+    } else {
+        stream.print(getGaugeLinkRttPercentile(50));
+        stream.print(" / ");
+        stream.print(getGaugeLinkRttPercentile(90));
+        stream.print(" / ");
+        stream.print(getGaugeLinkRttPercentile(99));
+        stream.print(" (");
+        stream.print(getGaugeLinkRttSampleCount());
+        stream.println(" samples)");
+    }
+
+    GaugeLatencyStats latency = getGaugeLatencyStats();
+    stream.print("CAN->Gauge last/avg/max (us): ");
+    if (latency.samples == 0) {
+        stream.println("no samples");
+    } else {
+        stream.print(latency.lastMicros);
+        stream.print(" / ");
+        stream.print((uint32_t)(latency.totalMicros / latency.samples));
+        stream.print(" / ");
+        stream.println(latency.maxMicros);
     }
 }
 
-void handleIgnitionCommand(String input, Stream &stream) {
-    if (input == "h" || input == "help") {
+void handleIgnitionCommand(int argc, char **argv, Stream &stream) {
+    const char *subcommand = argc > 1 ? argv[1] : "";
+    bool state;
+    if (isHelp(subcommand)) {
         stream.println(IGNITION_HELP_TEXT);
-    } else if (input.startsWith("override")) {
-        String stateStr = input.substring(8);
-        stateStr.trim();
-        if (stateStr.equalsIgnoreCase("on")) {
+    } else if (strcmp(subcommand, "override") == 0) {
+        if (!parseOnOff(argc, argv, state)) {
+            stream.println("Error: Invalid state. Please specify 'override on' or 'override off'.");
+        } else if (state) {
             setIgnitionOverride(true);
             stream.println("Ignition override mode ENABLED. Use 'ignition on/off' to control ignition state.");
-        } else if (stateStr.equalsIgnoreCase("off")) {
+        } else {
             setIgnitionOverride(false);
             stream.println("Ignition override mode DISABLED. Normal hardware ignition control restored.");
-        } else {
-            stream.println("Error: Invalid state. Please specify 'override on' or 'override off'.");
         }
-    } else if (input == "on") {
+    } else if (strcmp(subcommand, "on") == 0) {
         if (getIgnitionOverride()) {
             setIgnitionState(true);
             stream.println("Ignition turned ON (manual control)");
         } else {
             stream.println("Error: Ignition override mode is not enabled. Use 'ignition override on' first.");
         }
-    } else if (input == "off") {
+    } else if (strcmp(subcommand, "off") == 0) {
         if (getIgnitionOverride()) {
             setIgnitionState(false);
             stream.println("Ignition turned OFF (manual control)");
         } else {
             stream.println("Error: Ignition override mode is not enabled. Use 'ignition override on' first.");
         }
-    } else if (input == "status") {
-        stream.println("Ignition Override: " + String(getIgnitionOverride() ? "ENABLED" : "DISABLED"));
+    } else if (strcmp(subcommand, "status") == 0) {
+        stream.print("Ignition Override: ");
+        stream.println(getIgnitionOverride() ? "ENABLED" : "DISABLED");
         if (getIgnitionOverride()) {
-            stream.println("Manual Ignition State: " + String(getIgnitionState() ? "ON" : "OFF"));
+            stream.print("Manual Ignition State: ");
+            stream.println(getIgnitionState() ? "ON" : "OFF");
         }
         // Also show the actual hardware state
         stream.print("Hardware Ignition Pin State (analog): ");
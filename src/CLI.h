@@ -6,7 +6,7 @@
 // Initialize CLI
 void initializeCLI();
 
-// Process input for CLI
-void handleInput(String input, Stream &stream);
+// Process one line of CLI input, the line is split in place
+void handleInput(char *line, Stream &stream);
 
 #endif // CLI_H
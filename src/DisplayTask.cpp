@@ -7,6 +7,13 @@
 #include "GaugeControl.h"
 #include "Bluetooth.h"
 #include "HelperTasks.h"
+#include "OdometerJournal.h"
+#include "SpeedFusion.h"
+#include "TaskTable.h"
+#include "Trace.h"
+#include "TelemetryBus.h"
+#include "Log.h"
+#include <climits>
 
 #define X1 4    // x coordinate of the top left corner of the odometer
 #define Y1 12   // y coordinate of the top left corner of the odometer
@@ -19,6 +26,12 @@ U8G2_SSD1309_128X64_NONAME0_F_4W_HW_SPI display(U8G2_R0, DISPLAY_CHIP_SELECT_PIN
 bool ignitionOverrideEnabled = false;
 bool manualIgnitionState = false;
 
+// Copy of telemetryData taken at the start of each redraw
+Telemetry shownTelemetry;
+
+TaskHandle_t displayTaskHandle = NULL;
+TaskHandle_t turnOnTaskHandle = NULL;
+
 void displayTask(void * parameter);
 void displayModeSwichTask(void * parameter);
 void turnOnTask(void * parameter);
@@ -27,10 +40,10 @@ void drawOdometer();
 // Helper function to calculate range and consumption
 void calculateConsumptionAndRange(int &rangeInt, int &usageInt) {
     // If BMSConsumptionEstimate is valid, use it
-    if (telemetryData.BMSConsumptionEstimate != 0xFFFF && telemetryData.BMSConsumptionEstimate != 0) {
-        usageInt = telemetryData.BMSConsumptionEstimate;
+    if (shownTelemetry.BMSConsumptionEstimate != 0xFFFF && shownTelemetry.BMSConsumptionEstimate != 0) {
+        usageInt = shownTelemetry.BMSConsumptionEstimate;
         if (usageInt < 0) usageInt = 0;
-        rangeInt = (telemetryData.Charge * 10) / usageInt;
+        rangeInt = (shownTelemetry.Charge * 10) / usageInt;
     } else {
         // Use smoothed values for more stable display
         usageInt = (int)getSmoothedConsumption();
@@ -38,9 +51,9 @@ void calculateConsumptionAndRange(int &rangeInt, int &usageInt) {
         
         // Fallback if smoothed values are not available yet
         if (usageInt == 0 && rangeInt == 0) {
-            float voltage = telemetryData.DCVoltage;
-            float current = telemetryData.DCCurrent;
-            float speed = telemetryData.speed;
+            float voltage = shownTelemetry.DCVoltage;
+            float current = shownTelemetry.DCCurrent;
+            float speed = shownTelemetry.speed;
             
             if (speed > 1.0) {
                 float power = voltage * current; // Watts
@@ -52,7 +65,7 @@ void calculateConsumptionAndRange(int &rangeInt, int &usageInt) {
                 if (current <= 0.0) { // Regenerating
                     rangeInt = 999;
                 } else { // Discharging
-                    float chargeAh = telemetryData.Charge / 10.0f;
+                    float chargeAh = shownTelemetry.Charge / 10.0f;
                     float range = (chargeAh * voltage) / consumption;
                     rangeInt = (int)range;
                 }
@@ -72,7 +85,10 @@ void calculateConsumptionAndRange(int &rangeInt, int &usageInt) {
 // Ignition override control functions
 void setIgnitionOverride(bool enabled) {
     ignitionOverrideEnabled = enabled;
-    Serial.println(enabled ? "Ignition override ENABLED" : "Ignition override DISABLED");
+    LOG(LOG_IGNITION_OVERRIDE, enabled ? "ENABLED" : "DISABLED");
+    if (turnOnTaskHandle != NULL) {
+        xTaskNotifyGive(turnOnTaskHandle);
+    }
 }
 
 bool getIgnitionOverride() {
@@ -82,6 +98,9 @@ bool getIgnitionOverride() {
 void setIgnitionState(bool on) {
     manualIgnitionState = on;
     // The actual state change is handled in the turnOnTask
+    if (turnOnTaskHandle != NULL) {
+        xTaskNotifyGive(turnOnTaskHandle);
+    }
 }
 
 bool getIgnitionState() {
@@ -90,6 +109,43 @@ bool getIgnitionState() {
 
 DisplayMode currentDisplayMode = EMPTY; // Global variable to keep track of the current display mode
 
+// Task-private notification bit, above the telemetry topics
+#define DISPLAY_EVENT_MODE (1UL << TELEMETRY_TASK_BITS)
+
+// Minimum time between two redraws, changes arriving faster are merged
+#define DISPLAY_MIN_REFRESH_MS 100
+
+// Telemetry topics each display mode shows, the odometer line is on every page
+uint32_t displayModeTopics(DisplayMode mode) {
+    switch (mode) {
+        case START:
+            return TOPIC_DISTANCE | TOPIC_RANGE | TOPIC_BMS_ENERGY | TOPIC_SOC | TOPIC_POWER | TOPIC_SPEED;
+        case SOC:
+            return TOPIC_DISTANCE | TOPIC_SOC | TOPIC_POWER;
+        case SPEED:
+            return TOPIC_DISTANCE | TOPIC_SPEED | TOPIC_RPM | TOPIC_POWER;
+        case EMPTY:
+        case NOTIFICATION:
+        case READY:
+            return TOPIC_DISTANCE;
+        default:
+            return 0;
+    }
+}
+
+void setDisplayMode(DisplayMode mode) {
+    if (mode == currentDisplayMode) {
+        return;
+    }
+    currentDisplayMode = mode;
+
+    // Redraw right away and let the helper task react to the new mode
+    if (displayTaskHandle != NULL) {
+        xTaskNotify(displayTaskHandle, DISPLAY_EVENT_MODE, eSetBits);
+    }
+    notifyHelperTask(HELPER_EVENT_DISPLAY_MODE);
+}
+
 void initializeDisplayTask() {
     if (xSemaphoreTake(spiBusMutex, portMAX_DELAY)) {
         display.begin();
@@ -99,9 +155,10 @@ void initializeDisplayTask() {
         xSemaphoreGive(spiBusMutex);
     }
 
-    xTaskCreate(displayTask, "Display Task", 4096, NULL, 1, NULL);
-    xTaskCreate(displayModeSwichTask, "Display Mode Switch Task", 2048, NULL, 2, NULL);
-    xTaskCreate(turnOnTask, "Turn On Task", 2048, NULL,3, NULL);
+    createTask(TASK_DISPLAY, displayTask, &displayTaskHandle);
+    subscribeTelemetry(displayTaskHandle, TOPIC_ALL);
+    createTask(TASK_DISPLAY_MODE, displayModeSwichTask);
+    createTask(TASK_TURN_ON, turnOnTask, &turnOnTaskHandle);
 }
 
 void turnOnTask(void * parameter) {
@@ -116,13 +173,15 @@ void turnOnTask(void * parameter) {
         if (ignitionOverrideEnabled) {
             // Use manual ignition state instead of reading the pin
             if (manualIgnitionState && currentDisplayMode == OFF) {
-                currentDisplayMode = EMPTY;
+                setDisplayMode(EMPTY);
                 sendStandbyCommand(true);
-                Serial.println("Manual ignition ON");
+                LOG(LOG_MANUAL_IGNITION, "ON");
             } else if (!manualIgnitionState && currentDisplayMode != OFF) {
-                currentDisplayMode = OFF;
+                setDisplayMode(OFF);
                 sendStandbyCommand(false);
-                Serial.println("Manual ignition OFF");
+                storeLearnedSpeedRatio();
+                requestOdometerJournalWrite(true); // Also commits the changed parameters
+                LOG(LOG_MANUAL_IGNITION, "OFF");
             }
         } else {
             // Normal operation - read the analog value of the pin
@@ -130,32 +189,42 @@ void turnOnTask(void * parameter) {
             
             // Use the analog value with a threshold to determine state
             if (currentDisplayMode == OFF && analogValue > ANALOG_THRESHOLD) {
-                currentDisplayMode = EMPTY;
+                setDisplayMode(EMPTY);
                 sendStandbyCommand(true);
             } else if (analogValue <= ANALOG_THRESHOLD && currentDisplayMode != OFF) {
-                currentDisplayMode = OFF;
+                setDisplayMode(OFF);
                 sendStandbyCommand(false);
+                storeLearnedSpeedRatio();
+                requestOdometerJournalWrite(true); // Save the sub-km distance and the changed parameters while the supply is still up
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(200));
+
+        // The ignition pin has to be polled: GPIO36 gives spurious interrupts while the ADC
+        // is in use. In override mode nothing changes until the CLI notifies this task.
+        if (ignitionOverrideEnabled) {
+            markTaskIdle(TASK_TURN_ON);
+        }
+        ulTaskNotifyTake(pdTRUE, ignitionOverrideEnabled ? portMAX_DELAY : pdMS_TO_TICKS(200));
+        countTaskWakeup(TASK_TURN_ON);
     }
 }
 
 void displayModeSwichTask(void * parameter) {
     for (;;) {
         if (xSemaphoreTake(buttonStateSemaphore, portMAX_DELAY) == pdTRUE) {
+            countTaskWakeup(TASK_DISPLAY_MODE);
             if (currentDisplayMode != OFF) {
                 if (currentDisplayMode == NOTIFICATION || currentDisplayMode == READY) {
-                    currentDisplayMode = EMPTY; // Dismiss the notification
+                    setDisplayMode(EMPTY); // Dismiss the notification
                 } else {
                     if (currentDisplayMode == EMPTY) {
-                        currentDisplayMode = START;
+                        setDisplayMode(START);
                     } else  if (currentDisplayMode == START) {
-                        currentDisplayMode = SOC;
+                        setDisplayMode(SOC);
                     } else if (currentDisplayMode == SOC) {
-                        currentDisplayMode = SPEED;
+                        setDisplayMode(SPEED);
                     } else {
-                        currentDisplayMode = EMPTY;
+                        setDisplayMode(EMPTY);
                     }
                 }
             }
@@ -165,12 +234,20 @@ void displayModeSwichTask(void * parameter) {
 }
 
 void displayTask(void * parameter) {
+    TickType_t lastRedraw = xTaskGetTickCount();
+    const TickType_t minInterval = pdMS_TO_TICKS(DISPLAY_MIN_REFRESH_MS);
+    uint32_t events = DISPLAY_EVENT_MODE;   // Draw the first page without waiting
+
     for (;;) {
-        if (xSemaphoreTake(spiBusMutex, portMAX_DELAY)) {
+        // Only redraw when the mode changed or something the current page shows was published
+        bool redraw = (events & (DISPLAY_EVENT_MODE | displayModeTopics(currentDisplayMode))) != 0;
+        if (redraw && xSemaphoreTake(spiBusMutex, portMAX_DELAY)) {
             if (currentDisplayMode != OFF) {
                 // small delay to allow display to power up
                 vTaskDelay(pdMS_TO_TICKS(50));
 
+                TRACE(TRACE_RENDER_BEGIN, currentDisplayMode);
+                readTelemetry(shownTelemetry);
                 display.enableUTF8Print();
                 display.clearBuffer();
                 drawOdometer();
@@ -202,14 +279,14 @@ void displayTask(void * parameter) {
                     }
                     case SOC:
                         display.setFont(u8g2_font_6x12_tf);
-                        // draw SoC: telemetryData.SoC%
+                        // draw SoC: shownTelemetry.SoC%
                         display.drawStr(X1 + 3, Y1 + 20, "SoC: ");
-                        display.drawStr(X1 + 3 + display.getStrWidth("SoC: "), Y1 + 20, String(telemetryData.SoC).c_str());
-                        display.drawStr(X1 + 3 + display.getStrWidth("SoC: ") + display.getStrWidth(String(telemetryData.SoC).c_str()) + 1, Y1 + 20, "%");
+                        display.drawStr(X1 + 3 + display.getStrWidth("SoC: "), Y1 + 20, String(shownTelemetry.SoC).c_str());
+                        display.drawStr(X1 + 3 + display.getStrWidth("SoC: ") + display.getStrWidth(String(shownTelemetry.SoC).c_str()) + 1, Y1 + 20, "%");
                         // next line is battery voltage
                         display.drawStr(X1 + 3, Y1 + 32, "Vbat: ");
-                        display.drawStr(X1 + 3 + display.getStrWidth("Vbat: "), Y1 + 32, String(telemetryData.DCVoltage).c_str());
-                        display.drawStr(X1 + 3 + display.getStrWidth("Vbat: ") + display.getStrWidth(String(telemetryData.DCVoltage).c_str()), Y1 + 32, "V");
+                        display.drawStr(X1 + 3 + display.getStrWidth("Vbat: "), Y1 + 32, String(shownTelemetry.DCVoltage).c_str());
+                        display.drawStr(X1 + 3 + display.getStrWidth("Vbat: ") + display.getStrWidth(String(shownTelemetry.DCVoltage).c_str()), Y1 + 32, "V");
                         break;
                     case NOTIFICATION:
                         display.setFont(u8g2_font_6x12_tf);
@@ -217,15 +294,15 @@ void displayTask(void * parameter) {
                         break;
                     case SPEED:
                         display.setFont(u8g2_font_6x12_tf);
-                        // draw speed: telemetryData.speed km/h
+                        // draw speed: shownTelemetry.speed km/h
                         display.drawStr(X1 + 3, Y1 + 20, "Speed: ");
-                        display.drawStr(X1 + 3 + display.getStrWidth("Speed: "), Y1 + 20, String(telemetryData.speed).c_str());
-                        display.drawStr(X1 + 3 + display.getStrWidth("Speed: ") + display.getStrWidth(String(telemetryData.speed).c_str()) + 1, Y1 + 20, "km/h");
+                        display.drawStr(X1 + 3 + display.getStrWidth("Speed: "), Y1 + 20, String(shownTelemetry.speed).c_str());
+                        display.drawStr(X1 + 3 + display.getStrWidth("Speed: ") + display.getStrWidth(String(shownTelemetry.speed).c_str()) + 1, Y1 + 20, "km/h");
                         // next line is motor rpm
                         display.drawStr(X1 + 3, Y1 + 32, "RPM: ");
-                        display.drawStr(X1 + 3 + display.getStrWidth("RPM: "), Y1 + 32, String(telemetryData.rpm).c_str());
+                        display.drawStr(X1 + 3 + display.getStrWidth("RPM: "), Y1 + 32, String(shownTelemetry.rpm).c_str());
                         // after the rpm, draw the furrent (right aligned)
-                        display.drawStr(X2 - display.getStrWidth(String(telemetryData.DCCurrent).c_str()) - 10, Y1 + 32, String(telemetryData.DCCurrent).c_str());
+                        display.drawStr(X2 - display.getStrWidth(String(shownTelemetry.DCCurrent).c_str()) - 10, Y1 + 32, String(shownTelemetry.DCCurrent).c_str());
                         display.drawStr(X2 - 8, Y1 + 32, "A");
                         break;
                     case READY:
@@ -233,15 +310,35 @@ void displayTask(void * parameter) {
                         display.drawStr(X1 + (X2 - X1 - display.getStrWidth("Ready!")) / 2, Y1 + 27, "Ready!");
                         break;
                 }
+                TRACE(TRACE_RENDER_END, currentDisplayMode);
+
+                TRACE(TRACE_SEND_BUFFER_BEGIN, 0);
                 display.sendBuffer();
+                TRACE(TRACE_SEND_BUFFER_END, 0);
             } else {
                 // display.setPowerSave(1); // Turn off the display
                 // clear and send the emty buffer
                 display.clearBuffer();
+                TRACE(TRACE_SEND_BUFFER_BEGIN, 0);
                 display.sendBuffer();
+                TRACE(TRACE_SEND_BUFFER_END, 0);
             }
             xSemaphoreGive(spiBusMutex);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            lastRedraw = xTaskGetTickCount();
+        }
+
+        events = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &events, portMAX_DELAY);
+        countTaskWakeup(TASK_DISPLAY);
+
+        // Rate ceiling: hold back and merge whatever else changes in the meantime
+        TickType_t sinceLast = xTaskGetTickCount() - lastRedraw;
+        if (sinceLast < minInterval) {
+            vTaskDelay(minInterval - sinceLast);
+            uint32_t more = 0;
+            if (xTaskNotifyWait(0, ULONG_MAX, &more, 0) == pdTRUE) {
+                events |= more;
+            }
         }
     }
 }
@@ -252,7 +349,7 @@ void drawOdometer() {
     display.setFont(u8g2_font_6x12_tf);
 
     // Draw odometer in the top left corner
-    sprintf(buffer, "%d km", parameters[0].value);
+    sprintf(buffer, "%d km", parameterValue<PARAM_ODOMETER_COUNT>());
     display.drawStr(X1 + 1, Y1 + 8, buffer);
 
     // Draw the trip odometer in the top right corner, right aligned
@@ -27,4 +27,7 @@ enum DisplayMode {
 
 extern DisplayMode currentDisplayMode;
 
+// Change the display mode and wake the tasks that depend on it
+void setDisplayMode(DisplayMode mode);
+
 #endif // DisplayTask_h
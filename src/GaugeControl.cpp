@@ -2,6 +2,10 @@
 #include "driveTelemetry.h"
 #include "PulseCounterTask.h"
 #include "HelperTasks.h" // Include HelperTasks.h for lamp control
+#include "TaskTable.h"
+#include "Trace.h"
+#include <algorithm>
+#include <climits>
 
 // Instantiate the HardwareSerial
 HardwareSerial GaugeSerial(1);
@@ -24,16 +28,113 @@ Gauge Thermometer   ("Thermometer",     GaugeSerial, ThermometerRange);
 // variables
 bool autoUpdate = true;
 
+// Minimum time between two gauge updates, changes arriving faster are merged
+#define GAUGE_MIN_UPDATE_INTERVAL_MS 20
+
 // semaphore
 TaskHandle_t gaugeAnimatingTaskHandle = NULL;
+volatile bool gaugeAnimating = false;   // A sweep is queued or running
+TaskHandle_t gaugeControlTaskHandle = NULL;
+TaskHandle_t gaugeLinkTaskHandle = NULL;
+
+// Gauge link acknowledgement channel
+// With acks enabled every frame is sent as "<payload>#<seq>\n" and the gauge
+// controller answers "ACK:<seq>" (received), "NAK:<seq>" (rejected, resend)
+// or "STAT:<text>" (unsolicited status).
+#define GAUGE_ACK_TIMEOUT_MS    50  // Time to wait for an ACK before retrying
+#define GAUGE_MAX_RETRIES       3   // Retransmissions of a reliable frame before it counts as lost
+#define GAUGE_PENDING_SLOTS     8   // Frames that can be awaiting an ACK at once
+#define GAUGE_RTT_SAMPLES       64  // Round-trip times kept for the percentiles
+#define GAUGE_LINE_LENGTH       32  // Longest line in either direction
+
+struct PendingFrame {
+    bool inUse;
+    bool reliable;
+    uint8_t retries;
+    uint16_t seq;
+    uint32_t sentMicros;
+    char payload[GAUGE_LINE_LENGTH];
+};
+
+portMUX_TYPE gaugeLinkMux = portMUX_INITIALIZER_UNLOCKED;
+bool gaugeAckEnabled = false;
+uint16_t gaugeSeq = 0;
+PendingFrame pendingFrames[GAUGE_PENDING_SLOTS];
+GaugeLinkStats linkStats = {0};
+uint32_t rttSamples[GAUGE_RTT_SAMPLES];
+uint32_t rttSampleIndex = 0;
+uint32_t rttSampleCount = 0;
+char gaugeLastStatus[GAUGE_LINE_LENGTH] = "";
+char gaugeRxLine[GAUGE_LINE_LENGTH];    // Reply line being received
+size_t gaugeRxLength = 0;
+bool gaugeRxOverlong = false;           // Dropping the rest of an overlong line
+
+// Gauge link baud negotiation
+// The link always starts at GAUGE_BASE_BAUD. We propose a faster rate with
+// "BAUD:<rate>", the controller echoes it at the old rate and both sides
+// switch. A "PING" at the new rate must be answered with "PONG", otherwise
+// we drop back to the base rate (the controller does the same by itself when
+// no PING arrives). Once negotiated, a burst of link errors forces a fallback.
+#define GAUGE_BASE_BAUD                 9600
+#define GAUGE_BAUD_REPLY_TIMEOUT_MS     100     // Time for the echo and for the PONG
+#define GAUGE_BAUD_CHECK_INTERVAL_MS    1000    // Error check window at the negotiated rate
+#define GAUGE_BAUD_ERROR_LIMIT          5       // Link errors per window that trigger a fallback
+
+const uint32_t gaugeBaudRates[] = {115200, 57600, 38400, 19200}; // Tried fastest first
+const int numGaugeBaudRates = sizeof(gaugeBaudRates) / sizeof(gaugeBaudRates[0]);
+
+enum GaugeBaudState {
+    BAUD_BASE,          // At the base rate, nothing in progress
+    BAUD_PROPOSED,      // Waiting for the controller to echo the proposal
+    BAUD_VERIFYING,     // Switched, waiting for the PONG at the new rate
+    BAUD_NEGOTIATED     // Running at a confirmed faster rate
+};
+
+volatile GaugeBaudState gaugeBaudState = BAUD_BASE;
+volatile bool gaugeBaudNegotiationRequested = false;
+volatile bool gaugeBaudFallbackRequested = false;
+int gaugeBaudIndex = 0;
+uint32_t gaugeBaudRate = GAUGE_BASE_BAUD;
+unsigned long gaugeBaudDeadline = 0;
+uint32_t gaugeBaudErrorSnapshot = 0;
+unsigned long gaugeBaudCheckTime = 0;
+
+// CAN-frame-to-gauge latency, the bus keeps the oldest unserved frame time until the gauge task runs
+portMUX_TYPE gaugeLatencyMux = portMUX_INITIALIZER_UNLOCKED;
+GaugeLatencyStats latencyStats = {0};
+
+// Gauge task notification bit for a full refresh, next to the telemetry topics
+#define GAUGE_EVENT_REFRESH (1 << TELEMETRY_TASK_BITS)
 
 // function prototypes
 void gaugeControlTask(void * parameter);
 void gaugeAnimatingTask(void * parameter);
+void gaugeLinkTask(void * parameter);
+void updateGauges(uint32_t signals, bool force);
+void readGaugeReplies();
+void handleGaugeReply(const char *line);
+void countLinkStat(uint32_t GaugeLinkStats::*counter);
+bool checkPendingFrames();
+bool runGaugeBaudStateMachine();
+void proposeGaugeBaud();
+void switchGaugeBaud(uint32_t rate);
+void writeGaugeLine(const char *line);
 
 void initializeGaugeControl() {
     // Initialize the serial communication for gauges
-    GaugeSerial.begin(9600, SERIAL_8N1, GaugeRX, GaugeTX);
+    GaugeSerial.begin(GAUGE_BASE_BAUD, SERIAL_8N1, GaugeRX, GaugeTX);
+
+    // Listen for acknowledgements and status lines from the gauge controller
+    createTask(TASK_GAUGE_LINK, gaugeLinkTask, &gaugeLinkTaskHandle);
+    GaugeSerial.onReceive([]() {
+        xTaskNotifyGive(gaugeLinkTaskHandle);
+    });
+    GaugeSerial.onReceiveError([](hardwareSerial_error_t error) {
+        countLinkStat(&GaugeLinkStats::uartErrors);
+    });
+
+    // The sweep task sleeps until sendStandbyCommand() asks for an animation
+    createTask(TASK_GAUGE_ANIMATION, gaugeAnimatingTask, &gaugeAnimatingTaskHandle);
 
     // enable standby mode
     sendStandbyCommand(true);
@@ -45,18 +146,21 @@ void initializeGaugeControl() {
     Chargeometer.setPosition(0);
     Thermometer.setPosition(-20);
 
-    // start the gauge control task
-    xTaskCreate(gaugeControlTask, "Gauge Control Task", 4096, NULL, 1, NULL);
+    // try to move the link to a faster rate, stays at 9600 if the controller does not answer
+    startGaugeBaudNegotiation();
+
+    // start the gauge control task, woken by the telemetry behind the needles
+    createTask(TASK_GAUGE_CONTROL, gaugeControlTask, &gaugeControlTaskHandle);
+    subscribeTelemetry(gaugeControlTaskHandle, GAUGE_TOPICS);
 }
 
 void sendStandbyCommand(bool enable) {
-    GaugeSerial.print("STBY:");
-    GaugeSerial.print(enable ? '1' : '0');
-    GaugeSerial.print('\n');
+    sendGaugeFrame(GaugeSerial, enable ? "STBY:1" : "STBY:0", true);
     if (enable) {
         if (autoUpdate == false) {
-            if (gaugeAnimatingTaskHandle == NULL) {
-                xTaskCreate(gaugeAnimatingTask, "Gauge Animating Task", 4096, NULL, 4, &gaugeAnimatingTaskHandle);
+            if (!gaugeAnimating) {
+                gaugeAnimating = true;
+                xTaskNotifyGive(gaugeAnimatingTaskHandle);
             }
         }
     } else {
@@ -73,70 +177,523 @@ void sendStandbyCommand(bool enable) {
 
 void enableAutoUpdate(bool enable) {
     autoUpdate = enable;
+    if (enable) {
+        // The needles may have been moved by hand or by the animation
+        refreshGauges();
+    }
 }
 
 bool getAutoUpdate() {
     return autoUpdate;
 }
 
+void refreshGauges() {
+    if (gaugeControlTaskHandle != NULL) {
+        xTaskNotify(gaugeControlTaskHandle, GAUGE_EVENT_REFRESH, eSetBits);
+    }
+}
+
+GaugeLatencyStats getGaugeLatencyStats() {
+    portENTER_CRITICAL(&gaugeLatencyMux);
+    GaugeLatencyStats stats = latencyStats;
+    portEXIT_CRITICAL(&gaugeLatencyMux);
+    return stats;
+}
+
 void gaugeControlTask(void * parameter) {
+    TickType_t lastUpdate = xTaskGetTickCount();
+    const TickType_t minInterval = pdMS_TO_TICKS(GAUGE_MIN_UPDATE_INTERVAL_MS);
+
     for (;;) {
-        if (autoUpdate) {
-            Tachometer.setPosition(abs(telemetryData.rpm));
-            int Power = (telemetryData.DCCurrent * telemetryData.DCVoltage) / 1000; //KW
-            Dynamometer.setPosition(Power);
-            Chargeometer.setPosition(telemetryData.SoC);
-            Speedometer.setPosition(telemetryData.speed);
-            int8_t maxTempMotor = max(telemetryData.motorTemp, telemetryData.inverterTemp);
-            int8_t maxTemp = max(maxTempMotor, telemetryData.BMSMaxModTemp);
-            int gaugeTemp = max(maxTemp, telemetryData.BMSMaxCellTemp);
-            if (telemetryData.BMSMinCellTemp <= 2) {
-                gaugeTemp = telemetryData.BMSMinCellTemp;
+        // Sleep until the telemetry behind one of the gauges changes, or a refresh is asked for
+        uint32_t signals = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &signals, portMAX_DELAY);
+        countTaskWakeup(TASK_GAUGE_CONTROL);
+
+        // Rate ceiling: hold back and merge whatever else changes in the meantime
+        TickType_t sinceLast = xTaskGetTickCount() - lastUpdate;
+        if (sinceLast < minInterval) {
+            vTaskDelay(minInterval - sinceLast);
+            uint32_t more = 0;
+            if (xTaskNotifyWait(0, ULONG_MAX, &more, 0) == pdTRUE) {
+                signals |= more;
+            }
+        }
+        lastUpdate = xTaskGetTickCount();
+
+        uint32_t frameMicros = takeTelemetrySourceMicros();
+
+        if (!autoUpdate) {
+            continue;
+        }
+
+        bool refresh = (signals & GAUGE_EVENT_REFRESH) != 0;
+        updateGauges(refresh ? GAUGE_TOPICS : signals, refresh);
+
+        if (frameMicros != 0) {
+            uint32_t latency = micros() - frameMicros;
+            portENTER_CRITICAL(&gaugeLatencyMux);
+            latencyStats.samples++;
+            latencyStats.lastMicros = latency;
+            latencyStats.totalMicros += latency;
+            if (latency > latencyStats.maxMicros) {
+                latencyStats.maxMicros = latency;
             }
-            Thermometer.setPosition(gaugeTemp);
+            portEXIT_CRITICAL(&gaugeLatencyMux);
+        }
+    }
+}
+
+// Recompute only the gauges whose inputs changed
+void updateGauges(uint32_t signals, bool force) {
+    Telemetry data;
+    readTelemetry(data);
+    if (signals & TOPIC_RPM) {
+        int rpm = abs(data.rpm);
+        Tachometer.updatePosition(rpm, force);
+    }
+    if (signals & TOPIC_POWER) {
+        int Power = (data.DCCurrent * data.DCVoltage) / 1000; //KW
+        Dynamometer.updatePosition(Power, force);
+    }
+    if (signals & TOPIC_SOC) {
+        Chargeometer.updatePosition(data.SoC, force);
+    }
+    if (signals & TOPIC_SPEED) {
+        Speedometer.updatePosition(data.speed, force);
+    }
+    if (signals & TOPIC_TEMP) {
+        int8_t maxTempMotor = max(data.motorTemp, data.inverterTemp);
+        int8_t maxTemp = max(maxTempMotor, data.BMSMaxModTemp);
+        int gaugeTemp = max(maxTemp, data.BMSMaxCellTemp);
+        if (data.BMSMinCellTemp <= 2) {
+            gaugeTemp = data.BMSMinCellTemp;
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+        Thermometer.updatePosition(gaugeTemp, force);
     }
 }
 
 void gaugeAnimatingTask(void * parameter) {
-    // send the animation command
-    autoUpdate = false;
-
-    // set all gauges to min position
-    Speedometer.setPosition(Speedometer.getMinPosition());
-    Tachometer.setPosition(Tachometer.getMinPosition());
-    Dynamometer.setPosition(Dynamometer.getMinPosition());
-    Chargeometer.setPosition(Chargeometer.getMinPosition());
-    Thermometer.setPosition(Thermometer.getMinPosition());
-
-    vTaskDelay(pdMS_TO_TICKS(200));
-
-    int iMax = 20;
-    for (int i = 0; i <= iMax; i++) {
-        Chargeometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Chargeometer.getMinPosition(), Chargeometer.getMaxPosition()))));
-        Speedometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Speedometer.getMinPosition(), Speedometer.getMaxPosition()))));
-        Tachometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Tachometer.getMinPosition(), Tachometer.getMaxPosition()))));
-        Dynamometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Dynamometer.getMinPosition(), Dynamometer.getMaxPosition()))));
-        Thermometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Thermometer.getMinPosition(), Thermometer.getMaxPosition()))));
-        vTaskDelay(pdMS_TO_TICKS(2));
-    }
-
-    // short pause
-    vTaskDelay(pdMS_TO_TICKS(500));
-
-    // reverse the animation
-    for (int i = iMax; i >= 0; i--) {
-        Thermometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Thermometer.getMinPosition(), Thermometer.getMaxPosition()))));
-        Tachometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Tachometer.getMinPosition(), Tachometer.getMaxPosition()))));
-        Dynamometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Dynamometer.getMinPosition(), Dynamometer.getMaxPosition()))));
-        Speedometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Speedometer.getMinPosition(), Speedometer.getMaxPosition()))));
-        Chargeometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Chargeometer.getMinPosition(), Chargeometer.getMaxPosition()))));
-        vTaskDelay(pdMS_TO_TICKS(2));
-    }
-    autoUpdate = true;
-
-    // Delete the task at the end of its execution
-    gaugeAnimatingTaskHandle = NULL;
-    vTaskDelete(NULL);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        countTaskWakeup(TASK_GAUGE_ANIMATION);
+
+        // send the animation command
+        autoUpdate = false;
+
+        // set all gauges to min position
+        Speedometer.setPosition(Speedometer.getMinPosition());
+        Tachometer.setPosition(Tachometer.getMinPosition());
+        Dynamometer.setPosition(Dynamometer.getMinPosition());
+        Chargeometer.setPosition(Chargeometer.getMinPosition());
+        Thermometer.setPosition(Thermometer.getMinPosition());
+
+        vTaskDelay(pdMS_TO_TICKS(200));
+
+        int iMax = 20;
+        for (int i = 0; i <= iMax; i++) {
+            Chargeometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Chargeometer.getMinPosition(), Chargeometer.getMaxPosition()))));
+            Speedometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Speedometer.getMinPosition(), Speedometer.getMaxPosition()))));
+            Tachometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Tachometer.getMinPosition(), Tachometer.getMaxPosition()))));
+            Dynamometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Dynamometer.getMinPosition(), Dynamometer.getMaxPosition()))));
+            Thermometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Thermometer.getMinPosition(), Thermometer.getMaxPosition()))));
+            vTaskDelay(pdMS_TO_TICKS(2));
+        }
+
+        // short pause
+        vTaskDelay(pdMS_TO_TICKS(500));
+
+        // reverse the animation
+        for (int i = iMax; i >= 0; i--) {
+            Thermometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Thermometer.getMinPosition(), Thermometer.getMaxPosition()))));
+            Tachometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Tachometer.getMinPosition(), Tachometer.getMaxPosition()))));
+            Dynamometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Dynamometer.getMinPosition(), Dynamometer.getMaxPosition()))));
+            Speedometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Speedometer.getMinPosition(), Speedometer.getMaxPosition()))));
+            Chargeometer.setPosition(static_cast<int>(ceil(map(i, 0, iMax, Chargeometer.getMinPosition(), Chargeometer.getMaxPosition()))));
+            vTaskDelay(pdMS_TO_TICKS(2));
+        }
+        enableAutoUpdate(true);
+        gaugeAnimating = false;
+    }
+}
+
+void sendGaugeFrame(HardwareSerial &serial, const char *payload, bool reliable) {
+    char line[GAUGE_LINE_LENGTH + 8];
+    int len;
+
+    // Needle updates sent while the rate changes would be garbled, the gauges
+    // are refreshed in full once the negotiation settles
+    if (!reliable && (gaugeBaudState == BAUD_PROPOSED || gaugeBaudState == BAUD_VERIFYING)) {
+        return;
+    }
+
+    if (gaugeAckEnabled) {
+        portENTER_CRITICAL(&gaugeLinkMux);
+        uint16_t seq = gaugeSeq++;
+
+        // Use a free slot, or evict the oldest frame if all are waiting
+        int slot = 0;
+        for (int i = 0; i < GAUGE_PENDING_SLOTS; i++) {
+            if (!pendingFrames[i].inUse) {
+                slot = i;
+                break;
+            }
+            if ((int32_t)(pendingFrames[i].sentMicros - pendingFrames[slot].sentMicros) < 0) {
+                slot = i;
+            }
+        }
+        if (pendingFrames[slot].inUse) {
+            if (pendingFrames[slot].reliable) {
+                linkStats.framesLost++;
+            } else {
+                linkStats.ackTimeouts++;
+            }
+        }
+
+        PendingFrame &frame = pendingFrames[slot];
+        frame.inUse = true;
+        frame.reliable = reliable;
+        frame.retries = 0;
+        frame.seq = seq;
+        frame.sentMicros = micros();
+        strlcpy(frame.payload, payload, sizeof(frame.payload));
+        linkStats.framesSent++;
+        portEXIT_CRITICAL(&gaugeLinkMux);
+
+        len = snprintf(line, sizeof(line), "%s#%u\n", payload, seq);
+    } else {
+        len = snprintf(line, sizeof(line), "%s\n", payload);
+        countLinkStat(&GaugeLinkStats::framesSent);
+    }
+
+    // One write per line so frames from different tasks never interleave
+    len = min(len, (int)sizeof(line) - 1);
+    TRACE(TRACE_GAUGE_TX, len);
+    serial.write((const uint8_t *)line, len);
+}
+
+void gaugeLinkTask(void * parameter) {
+    bool waiting = false;
+    bool negotiating = false;
+
+    for (;;) {
+        // Sleep until bytes arrive, waking periodically only while ACKs or baud replies are outstanding
+        TickType_t timeout = portMAX_DELAY;
+        if (waiting || negotiating) {
+            timeout = pdMS_TO_TICKS(GAUGE_ACK_TIMEOUT_MS / 5);
+        } else if (gaugeBaudState == BAUD_NEGOTIATED) {
+            timeout = pdMS_TO_TICKS(GAUGE_BAUD_CHECK_INTERVAL_MS);
+        }
+        ulTaskNotifyTake(pdTRUE, timeout);
+        countTaskWakeup(TASK_GAUGE_LINK);
+
+        readGaugeReplies();
+        waiting = checkPendingFrames();
+        negotiating = runGaugeBaudStateMachine();
+    }
+}
+
+// Split the received bytes into lines and handle each complete one
+void readGaugeReplies() {
+    while (GaugeSerial.available() > 0) {
+        char ch = GaugeSerial.read();
+        if (ch == '\n') {
+            gaugeRxLine[gaugeRxLength] = '\0';
+            if (gaugeRxLength > 0 && !gaugeRxOverlong) {
+                handleGaugeReply(gaugeRxLine);
+            }
+            gaugeRxLength = 0;
+            gaugeRxOverlong = false;
+        } else if (ch != '\r' && !gaugeRxOverlong) {
+            if (gaugeRxLength < sizeof(gaugeRxLine) - 1) {
+                gaugeRxLine[gaugeRxLength++] = ch;
+            } else {
+                countLinkStat(&GaugeLinkStats::rxErrors);   // Overlong line, drop it up to the newline
+                gaugeRxOverlong = true;
+            }
+        }
+    }
+}
+
+// Bump one link counter. The UART error callback runs in the UART event task,
+// concurrently with the link task.
+void countLinkStat(uint32_t GaugeLinkStats::*counter) {
+    portENTER_CRITICAL(&gaugeLinkMux);
+    linkStats.*counter += 1;
+    portEXIT_CRITICAL(&gaugeLinkMux);
+}
+
+void handleGaugeReply(const char *line) {
+    if (strncmp(line, "BAUD:", 5) == 0) {
+        // Echo of our proposal, both sides switch now
+        if (gaugeBaudState == BAUD_PROPOSED && strtoul(line + 5, NULL, 10) == gaugeBaudRates[gaugeBaudIndex]) {
+            switchGaugeBaud(gaugeBaudRates[gaugeBaudIndex]);
+            writeGaugeLine("PING\n");
+            gaugeBaudState = BAUD_VERIFYING;
+            gaugeBaudDeadline = millis() + GAUGE_BAUD_REPLY_TIMEOUT_MS;
+        } else {
+            countLinkStat(&GaugeLinkStats::rxErrors);
+        }
+        return;
+    }
+
+    if (strcmp(line, "PONG") == 0) {
+        if (gaugeBaudState == BAUD_VERIFYING) {
+            gaugeBaudState = BAUD_NEGOTIATED;
+            countLinkStat(&GaugeLinkStats::baudSwitches);
+            GaugeLinkStats stats = getGaugeLinkStats();
+            gaugeBaudErrorSnapshot = stats.rxErrors + stats.uartErrors + stats.framesLost + stats.ackTimeouts;
+            gaugeBaudCheckTime = millis();
+            refreshGauges();
+        } else {
+            countLinkStat(&GaugeLinkStats::rxErrors);
+        }
+        return;
+    }
+
+    if (strncmp(line, "STAT:", 5) == 0) {
+        strlcpy(gaugeLastStatus, line + 5, sizeof(gaugeLastStatus));
+        countLinkStat(&GaugeLinkStats::statusReports);
+        return;
+    }
+
+    bool isAck = strncmp(line, "ACK:", 4) == 0;
+    bool isNak = strncmp(line, "NAK:", 4) == 0;
+    char *end;
+    unsigned long seq = strtoul(line + 4, &end, 10);
+    if ((!isAck && !isNak) || end == line + 4 || *end != '\0') {
+        countLinkStat(&GaugeLinkStats::rxErrors);
+        return;
+    }
+
+    uint32_t now = micros();
+    bool matched = false;
+    portENTER_CRITICAL(&gaugeLinkMux);
+    for (int i = 0; i < GAUGE_PENDING_SLOTS; i++) {
+        PendingFrame &frame = pendingFrames[i];
+        if (frame.inUse && frame.seq == seq) {
+            matched = true;
+            if (isAck) {
+                rttSamples[rttSampleIndex] = now - frame.sentMicros;
+                rttSampleIndex = (rttSampleIndex + 1) % GAUGE_RTT_SAMPLES;
+                if (rttSampleCount < GAUGE_RTT_SAMPLES) rttSampleCount++;
+                linkStats.acksReceived++;
+                frame.inUse = false;
+            } else {
+                // Let the timeout check resend it straight away
+                frame.sentMicros = now - GAUGE_ACK_TIMEOUT_MS * 1000UL;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&gaugeLinkMux);
+
+    if (!matched) {
+        countLinkStat(&GaugeLinkStats::rxErrors);   // Late or duplicate reply
+    } else if (isNak) {
+        checkPendingFrames();
+    }
+}
+
+// Retransmit or expire frames whose ACK is overdue.
+// Returns true while frames are still waiting for an ACK.
+bool checkPendingFrames() {
+    char resend[GAUGE_PENDING_SLOTS][GAUGE_LINE_LENGTH + 8];
+    int resendCount = 0;
+    bool waiting = false;
+    uint32_t now = micros();
+
+    portENTER_CRITICAL(&gaugeLinkMux);
+    for (int i = 0; i < GAUGE_PENDING_SLOTS; i++) {
+        PendingFrame &frame = pendingFrames[i];
+        if (!frame.inUse) continue;
+        if (now - frame.sentMicros < GAUGE_ACK_TIMEOUT_MS * 1000UL) {
+            waiting = true;
+            continue;
+        }
+        if (frame.reliable && frame.retries < GAUGE_MAX_RETRIES) {
+            // Resend with the same sequence number so a late ACK still matches
+            frame.retries++;
+            frame.sentMicros = now;
+            snprintf(resend[resendCount++], sizeof(resend[0]), "%s#%u\n", frame.payload, frame.seq);
+            linkStats.retransmits++;
+            linkStats.framesSent++;
+            waiting = true;
+        } else {
+            if (frame.reliable) {
+                linkStats.framesLost++;
+            } else {
+                linkStats.ackTimeouts++;
+            }
+            frame.inUse = false;
+        }
+    }
+    portEXIT_CRITICAL(&gaugeLinkMux);
+
+    for (int i = 0; i < resendCount; i++) {
+        writeGaugeLine(resend[i]);
+    }
+    return waiting;
+}
+
+void setGaugeAckEnabled(bool enable) {
+    portENTER_CRITICAL(&gaugeLinkMux);
+    gaugeAckEnabled = enable;
+    for (int i = 0; i < GAUGE_PENDING_SLOTS; i++) {
+        pendingFrames[i].inUse = false;
+    }
+    portEXIT_CRITICAL(&gaugeLinkMux);
+}
+
+bool getGaugeAckEnabled() {
+    return gaugeAckEnabled;
+}
+
+GaugeLinkStats getGaugeLinkStats() {
+    portENTER_CRITICAL(&gaugeLinkMux);
+    GaugeLinkStats stats = linkStats;
+    portEXIT_CRITICAL(&gaugeLinkMux);
+    return stats;
+}
+
+void resetGaugeLinkStats() {
+    portENTER_CRITICAL(&gaugeLinkMux);
+    linkStats = {0};
+    rttSampleIndex = 0;
+    rttSampleCount = 0;
+    portEXIT_CRITICAL(&gaugeLinkMux);
+}
+
+uint32_t getGaugeLinkRttPercentile(uint8_t percentile) {
+    uint32_t sorted[GAUGE_RTT_SAMPLES];
+    portENTER_CRITICAL(&gaugeLinkMux);
+    uint32_t count = rttSampleCount;
+    memcpy(sorted, rttSamples, count * sizeof(uint32_t));
+    portEXIT_CRITICAL(&gaugeLinkMux);
+
+    if (count == 0) return 0;
+    std::sort(sorted, sorted + count);
+    uint32_t rank = (count * min(percentile, (uint8_t)100) + 99) / 100; // Nearest-rank method
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+uint32_t getGaugeLinkRttSampleCount() {
+    return rttSampleCount;
+}
+
+const char *getGaugeLastStatus() {
+    return gaugeLastStatus;
+}
+
+// Advance the baud negotiation. Returns true while a reply is awaited.
+bool runGaugeBaudStateMachine() {
+    if (gaugeBaudFallbackRequested) {
+        gaugeBaudFallbackRequested = false;
+        gaugeBaudNegotiationRequested = false;
+        if (gaugeBaudRate != GAUGE_BASE_BAUD) {
+            // Tell the controller at the current rate, it falls back by itself if this is lost
+            writeGaugeLine("BAUD:9600\n");
+            switchGaugeBaud(GAUGE_BASE_BAUD);
+            refreshGauges();
+        }
+        gaugeBaudState = BAUD_BASE;
+    }
+
+    if (gaugeBaudNegotiationRequested) {
+        gaugeBaudNegotiationRequested = false;
+        if (gaugeBaudState == BAUD_BASE) {
+            gaugeBaudIndex = 0;
+            proposeGaugeBaud();
+        }
+    }
+
+    switch (gaugeBaudState) {
+        case BAUD_PROPOSED:
+            if ((long)(millis() - gaugeBaudDeadline) >= 0) {
+                // No echo, try the next slower rate
+                countLinkStat(&GaugeLinkStats::baudFailures);
+                gaugeBaudIndex++;
+                if (gaugeBaudIndex < numGaugeBaudRates) {
+                    proposeGaugeBaud();
+                } else {
+                    gaugeBaudState = BAUD_BASE;
+                    refreshGauges();
+                }
+            }
+            break;
+        case BAUD_VERIFYING:
+            if ((long)(millis() - gaugeBaudDeadline) >= 0) {
+                // The new rate does not work, go back to the base rate and try the next one
+                countLinkStat(&GaugeLinkStats::baudFailures);
+                switchGaugeBaud(GAUGE_BASE_BAUD);
+                gaugeBaudIndex++;
+                if (gaugeBaudIndex < numGaugeBaudRates) {
+                    proposeGaugeBaud();
+                } else {
+                    gaugeBaudState = BAUD_BASE;
+                    refreshGauges();
+                }
+            }
+            break;
+        case BAUD_NEGOTIATED: {
+            if (!hasTimePassed(gaugeBaudCheckTime, GAUGE_BAUD_CHECK_INTERVAL_MS)) {
+                break;
+            }
+            GaugeLinkStats stats = getGaugeLinkStats();
+            uint32_t errors = stats.rxErrors + stats.uartErrors + stats.framesLost + stats.ackTimeouts;
+            if (errors - gaugeBaudErrorSnapshot > GAUGE_BAUD_ERROR_LIMIT) {
+                countLinkStat(&GaugeLinkStats::baudFallbacks);
+                gaugeBaudFallbackRequested = true;
+                return runGaugeBaudStateMachine();
+            }
+            gaugeBaudErrorSnapshot = errors;
+            break;
+        }
+        case BAUD_BASE:
+            break;
+    }
+
+    return gaugeBaudState == BAUD_PROPOSED || gaugeBaudState == BAUD_VERIFYING;
+}
+
+void proposeGaugeBaud() {
+    char line[20];
+    snprintf(line, sizeof(line), "BAUD:%lu\n", (unsigned long)gaugeBaudRates[gaugeBaudIndex]);
+    writeGaugeLine(line);
+    gaugeBaudState = BAUD_PROPOSED;
+    gaugeBaudDeadline = millis() + GAUGE_BAUD_REPLY_TIMEOUT_MS;
+}
+
+void switchGaugeBaud(uint32_t rate) {
+    GaugeSerial.flush();    // Let the last bytes leave at the old rate
+    GaugeSerial.updateBaudRate(rate);
+    gaugeBaudRate = rate;
+}
+
+void writeGaugeLine(const char *line) {
+    size_t length = strlen(line);
+    TRACE(TRACE_GAUGE_TX, length);
+    GaugeSerial.write((const uint8_t *)line, length);
+}
+
+void startGaugeBaudNegotiation() {
+    gaugeBaudNegotiationRequested = true;
+    if (gaugeLinkTaskHandle != NULL) {
+        xTaskNotifyGive(gaugeLinkTaskHandle);
+    }
+}
+
+void fallBackGaugeBaud() {
+    gaugeBaudFallbackRequested = true;
+    if (gaugeLinkTaskHandle != NULL) {
+        xTaskNotifyGive(gaugeLinkTaskHandle);
+    }
+}
+
+uint32_t getGaugeBaudRate() {
+    return gaugeBaudRate;
+}
+
+bool isGaugeBaudNegotiated() {
+    return gaugeBaudState == BAUD_NEGOTIATED;
 }
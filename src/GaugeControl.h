@@ -3,6 +3,37 @@
 
 #include "PinAssignments.h"
 #include <HardwareSerial.h>
+#include "TelemetryBus.h"
+
+// Counters for the gauge link, only meaningful while acknowledgements are enabled
+struct GaugeLinkStats {
+    uint32_t framesSent;      // Frames written to the gauge controller (including retransmits)
+    uint32_t acksReceived;    // ACK replies matched to an outstanding frame
+    uint32_t retransmits;     // Reliable frames sent again after a timeout or NAK
+    uint32_t framesLost;      // Reliable frames given up on after all retries
+    uint32_t ackTimeouts;     // Unreliable frames that were never acknowledged
+    uint32_t rxErrors;        // Malformed, unknown or overlong reply lines
+    uint32_t statusReports;   // STAT lines received from the gauge controller
+    uint32_t uartErrors;      // Framing, parity, break and overflow errors from the UART
+    uint32_t baudSwitches;    // Successful baud negotiations
+    uint32_t baudFailures;    // Proposed rates that were not confirmed
+    uint32_t baudFallbacks;   // Drops back to the base rate because of link errors
+};
+
+// Telemetry topics that drive the gauges
+#define GAUGE_TOPICS (TOPIC_SPEED | TOPIC_RPM | TOPIC_POWER | TOPIC_SOC | TOPIC_TEMP)
+
+// Time from receiving a CAN frame to writing the resulting gauge bytes
+struct GaugeLatencyStats {
+    uint32_t samples;
+    uint32_t lastMicros;
+    uint32_t maxMicros;
+    uint64_t totalMicros;
+};
+
+// Send one line to the gauge controller. Reliable frames are retransmitted
+// when acknowledgements are enabled and no ACK arrives in time.
+void sendGaugeFrame(HardwareSerial &serial, const char *payload, bool reliable = false);
 
 // A helper class to manage range mappings for gauges
 class GaugeRange {
@@ -44,9 +75,21 @@ public:
         sendCommand();
     }
 
+    // Only send when the needle actually moves (or when forced), returns true if a frame was sent
+    bool updatePosition(int position, bool force = false) {
+        int newAngle = range.mapValueToAngle(position);
+        if (newAngle == angle && !force) {
+            return false;
+        }
+        angle = newAngle;
+        sendCommand();
+        return true;
+    }
+
     void sendCommand() {
-        serial->print(name + ":" + angle);
-        serial->print('\n');
+        char payload[24];
+        snprintf(payload, sizeof(payload), "%s:%d", name.c_str(), angle);
+        sendGaugeFrame(*serial, payload);
     }
     
     // Additional functions to access the range for external use
@@ -65,6 +108,25 @@ void sendStandbyCommand(bool enable);
 void enableAutoUpdate(bool enable);
 bool getAutoUpdate();
 
+// Send every needle position again, whether its telemetry changed or not
+void refreshGauges();
+GaugeLatencyStats getGaugeLatencyStats();
+
+// Gauge link acknowledgement channel
+void setGaugeAckEnabled(bool enable);
+bool getGaugeAckEnabled();
+GaugeLinkStats getGaugeLinkStats();
+void resetGaugeLinkStats();
+uint32_t getGaugeLinkRttPercentile(uint8_t percentile); // microseconds, 0 if no samples
+uint32_t getGaugeLinkRttSampleCount();
+const char *getGaugeLastStatus();
+
+// Gauge link baud negotiation
+void startGaugeBaudNegotiation();   // Try the fastest rate the controller confirms
+void fallBackGaugeBaud();           // Return to the 9600 baud base rate
+uint32_t getGaugeBaudRate();
+bool isGaugeBaudNegotiated();
+
 // Declare the gauges
 extern Gauge Speedometer;
 extern Gauge Tachometer;
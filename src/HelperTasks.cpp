@@ -3,6 +3,9 @@
 #include "Bluetooth.h"
 #include "PinAssignments.h"
 #include "driveTelemetry.h"
+#include "TaskTable.h"
+#include "Log.h"
+#include <climits>
 
 // Function prototypes
 void helperTask(void * parameter);
@@ -11,8 +14,8 @@ void manageLamps();
 void updateSmoothedValues(float instantPower, float instantSpeed, float voltage);
 void manageBrakeLight();
 
-// External telemetry data reference
-extern Telemetry telemetryData;
+// Copy of telemetryData taken for each round of events
+Telemetry helperTelemetry;
 
 // Bluetooth management variables
 DisplayMode previousDisplayMode = START;
@@ -34,6 +37,8 @@ bool valuesInitialized = false;   // Flag to track if values are initialized
 // Time between smoothed value updates (ms)
 #define VALUE_UPDATE_INTERVAL 100  // 10Hz update rate
 
+TaskHandle_t helperTaskHandle = NULL;
+
 void initializeHelperTasks() {
     // Initialize lamp pins
     pinMode(BATTERY_Lamp_PIN, OUTPUT);
@@ -46,14 +51,8 @@ void initializeHelperTasks() {
     // digitalWrite(BRAKE_LIGHT_PIN, LOW); // Make sure it's off initially
     
     // Create the helper task
-    xTaskCreate(
-        helperTask,           // Task function
-        "Helper Task",        // Name of task
-        2048,                 // Stack size of task
-        NULL,                 // Parameter of the task
-        3,                    // Priority of the task
-        NULL                  // Task handle to keep track of created task
-    );
+    createTask(TASK_HELPER, helperTask, &helperTaskHandle);
+    subscribeTelemetry(helperTaskHandle, LAMP_TOPICS);
 }
 
 bool hasTimePassed(unsigned long &lastTime, unsigned long interval) {
@@ -71,14 +70,14 @@ void manageBluetooth() {
 #ifdef ENABLE_BLUETOOTH
     // Check display mode changes
     if (currentDisplayMode == OFF && previousDisplayMode != OFF) {
-        // Display just turned off, turn off Bluetooth
-        Serial.println("Display turned OFF, turning off Bluetooth");
-        turnBTOff();
+        // Display just turned off, park Bluetooth so it resumes quickly
+        LOG(LOG_BT_DISPLAY_OFF);
+        parkBT();
         btTimerActive = false;  // Reset timer
     } 
     else if (previousDisplayMode == OFF && currentDisplayMode != OFF) {
-        // Display just turned on from OFF, turn on Bluetooth
-        Serial.println("Display turned ON, turning on Bluetooth");
+        // Display just turned on from OFF, resume Bluetooth
+        LOG(LOG_BT_DISPLAY_ON);
         turnBTOn();
         // Start the no-connection timer
         btNoConnectionTimer = millis();
@@ -89,7 +88,7 @@ void manageBluetooth() {
     if (currentDisplayMode != OFF && hasTimePassed(btLastActivityCheck, 60000)) {  // 60 seconds
         if (isBTConnected()) {
             // There is a BT connection, keep Bluetooth on
-            Serial.println("Bluetooth connection active, keeping Bluetooth on");
+            LOG(LOG_BT_KEPT_ON);
             // Reset the no-connection timer
             btNoConnectionTimer = millis();
             btTimerActive = true;
@@ -98,8 +97,8 @@ void manageBluetooth() {
             // No connection and timer is active
             unsigned long currentTime = millis();
             if (currentTime - btNoConnectionTimer >= 60000) {  // 60 seconds no connection
-                Serial.println("No Bluetooth connection for 1 minute, turning off Bluetooth");
-                turnBTOff();
+                LOG(LOG_BT_IDLE_OFF);
+                parkBT();
                 btTimerActive = false;
             }
         }
@@ -110,27 +109,46 @@ void manageBluetooth() {
 #endif // ENABLE_BLUETOOTH
 }
 
-// This is where you implement your custom periodic logic
-void periodicFunction() {
+void notifyHelperTask(uint32_t events) {
+    if (helperTaskHandle != NULL) {
+        xTaskNotify(helperTaskHandle, events, eSetBits);
+    }
+}
+
+// This is where you implement your custom event handling logic
+void handleHelperEvents(uint32_t events) {
+    readTelemetry(helperTelemetry);
+
 #ifdef ENABLE_BLUETOOTH
     // Manage Bluetooth based on display state and activity
     manageBluetooth();
 #endif
     
     // Manage all indicator lamps
-    manageLamps();
+    if (events & LAMP_TOPICS) {
+        manageLamps();
+    }
     
     // Manage the brake light
     // manageBrakeLight();
     
     // Update smoothed telemetry values
     if (currentDisplayMode != OFF && hasTimePassed(lastValueUpdate, VALUE_UPDATE_INTERVAL)) {
-        float voltage = telemetryData.DCVoltage;
-        float current = telemetryData.DCCurrent;
-        float speed = telemetryData.speed;
+        float voltage = helperTelemetry.DCVoltage;
+        float current = helperTelemetry.DCCurrent;
+        float speed = helperTelemetry.speed;
         float power = voltage * current; // Watts
         
+        int previousConsumption = (int)smoothedConsumption;
+        int previousRange = smoothedRange;
+        bool previousRegenerating = isRegenerating;
         updateSmoothedValues(power, speed, voltage);
+
+        // Tell the display when the values it shows have changed
+        if ((int)smoothedConsumption != previousConsumption || smoothedRange != previousRange ||
+            isRegenerating != previousRegenerating) {
+            publishTelemetry(TOPIC_RANGE);
+        }
     }
     
     // Add other periodic functions here
@@ -139,18 +157,18 @@ void periodicFunction() {
 // Function to manage all indicator lamps
 void manageLamps() {
     // Battery lamp control
-    if (telemetryData.BMSChargingState != 0) {
+    if (helperTelemetry.BMSChargingState != 0) {
         digitalWrite(BATTERY_Lamp_PIN, HIGH); // Turn on the battery lamp if charging
     } else {
         digitalWrite(BATTERY_Lamp_PIN, LOW); // Turn off the battery lamp if not charging
     }
     
     // Temperature lamp control
-    int8_t maxTempMotor = max(telemetryData.motorTemp, telemetryData.inverterTemp);
-    int8_t maxTemp = max(maxTempMotor, telemetryData.BMSMaxModTemp);
-    int gaugeTemp = max(maxTemp, telemetryData.BMSMaxCellTemp);
-    if (telemetryData.BMSMinCellTemp <= 2) {
-        gaugeTemp = telemetryData.BMSMinCellTemp;
+    int8_t maxTempMotor = max(helperTelemetry.motorTemp, helperTelemetry.inverterTemp);
+    int8_t maxTemp = max(maxTempMotor, helperTelemetry.BMSMaxModTemp);
+    int gaugeTemp = max(maxTemp, helperTelemetry.BMSMaxCellTemp);
+    if (helperTelemetry.BMSMinCellTemp <= 2) {
+        gaugeTemp = helperTelemetry.BMSMinCellTemp;
     }
     
     if (gaugeTemp > 70) {
@@ -160,7 +178,7 @@ void manageLamps() {
     }
     
     // SoC lamp control
-    if (telemetryData.SoC < 20) {
+    if (helperTelemetry.SoC < 20) {
         digitalWrite(SOC_Lamp_PIN, HIGH); // Turn on SOC lamp if SoC is below 20%
     } else {
         digitalWrite(SOC_Lamp_PIN, LOW); // Turn off SOC lamp
@@ -177,8 +195,8 @@ void setRunningLamp(bool state) {
 // Function to manage the brake light based on regenerative power
 void manageBrakeLight() {
     // // Calculate current power (in Watts)
-    // float voltage = telemetryData.DCVoltage;
-    // float current = telemetryData.DCCurrent;
+    // float voltage = helperTelemetry.DCVoltage;
+    // float current = helperTelemetry.DCCurrent;
     // float power = voltage * current;
     
     // // Turn on brake light when regenerative power is >= 10kW (negative power)
@@ -191,12 +209,23 @@ void manageBrakeLight() {
 }
 
 void helperTask(void * parameter) {
+    uint32_t events = LAMP_TOPICS | HELPER_EVENT_DISPLAY_MODE; // Bring everything up to date once
     for (;;) {
-        // Call the single periodic function
-        periodicFunction();
-        
-        // Delay for 10ms as requested
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+        handleHelperEvents(events);
+
+        // The smoothed values and the Bluetooth check are sampled while the display is on,
+        // otherwise sleep until the lamp inputs or the display mode change
+        TickType_t timeout = portMAX_DELAY;
+        if (currentDisplayMode != OFF) {
+            unsigned long sinceUpdate = millis() - lastValueUpdate;
+            timeout = sinceUpdate < VALUE_UPDATE_INTERVAL ? pdMS_TO_TICKS(VALUE_UPDATE_INTERVAL - sinceUpdate) : 0;
+        }
+        if (timeout == portMAX_DELAY) {
+            markTaskIdle(TASK_HELPER);
+        }
+        events = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &events, timeout);
+        countTaskWakeup(TASK_HELPER);
     }
 }
 
@@ -234,7 +263,7 @@ void updateSmoothedValues(float instantPower, float instantSpeed, float voltage)
             instantRange = 999;
         } else {
             // Calculate instant range when discharging
-            float chargeAh = telemetryData.Charge / 10.0f;
+            float chargeAh = helperTelemetry.Charge / 10.0f;
             instantRange = (int)((chargeAh * voltage) / instantConsumption);
             
             // Cap range values
@@ -2,12 +2,21 @@
 #define HELPER_TASKS_H
 
 #include <Arduino.h>
+#include "TelemetryBus.h"
 
 // Initialize helper tasks
 void initializeHelperTasks();
 
-// Periodic function to be customized
-void periodicFunction();
+// Telemetry the warning lamps follow
+#define LAMP_TOPICS (TOPIC_BMS_STATE | TOPIC_TEMP | TOPIC_SOC)
+
+// Events that wake the helper task besides its telemetry topics, set with notifyHelperTask()
+#define HELPER_EVENT_DISPLAY_MODE   (1 << TELEMETRY_TASK_BITS)    // currentDisplayMode changed
+
+void notifyHelperTask(uint32_t events);
+
+// Event handler to be customized
+void handleHelperEvents(uint32_t events);
 
 // Helper function to check if time has passed
 bool hasTimePassed(unsigned long &lastTime, unsigned long interval);
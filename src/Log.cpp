@@ -0,0 +1,140 @@
+#include "Log.h"
+#include <cstring>
+
+static_assert((LOG_CAPACITY & (LOG_CAPACITY - 1)) == 0, "LOG_CAPACITY must be a power of two");
+static_assert(LOG_MAX_ARGS == 6, "printPendingLogs passes six arguments to the format");
+
+const char *const logModuleNames[NUM_LOG_MODULES] = {
+#define LOG_MODULE_NAME(id, name) name,
+    LOG_MODULE_LIST(LOG_MODULE_NAME)
+#undef LOG_MODULE_NAME
+};
+
+const char *const logLevelNames[LOG_DEBUG + 1] = {"off", "error", "warn", "info", "debug"};
+
+// head and tail run freely, head - tail records are waiting
+LogRecord logRing[LOG_CAPACITY];
+uint32_t logHead = 0;
+uint32_t logTail = 0;
+LogStats logStats = {0, 0};
+uint8_t logSinks = (1 << NUM_OUTPUT_SINKS) - 1;
+portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t logLevels[NUM_LOG_MODULES] = {
+#define LOG_MODULE_LEVEL(id, name) LOG_DEFAULT_LEVEL,
+    LOG_MODULE_LIST(LOG_MODULE_LEVEL)
+#undef LOG_MODULE_LEVEL
+};
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&logMux);
+    bool wasEmpty = logHead == logTail;
+    if (logHead - logTail == LOG_CAPACITY) {
+        // Full, the oldest record makes room
+        logTail++;
+        logStats.dropped++;
+    }
+    LogRecord &record = logRing[logHead & (LOG_CAPACITY - 1)];
+    record.timeMs = now;
+    record.id = id;
+    record.argCount = argCount;
+    memcpy(record.args, args, argCount * sizeof(uint32_t));
+    logHead++;
+    logStats.written++;
+    portEXIT_CRITICAL(&logMux);
+
+    // The output task prints every waiting record before it sleeps
+    if (wasEmpty) {
+        wakeOutputTask();
+    }
+}
+
+void printPendingLogs() {
+    for (;;) {
+        LogRecord record;
+        portENTER_CRITICAL(&logMux);
+        if (logHead == logTail) {
+            portEXIT_CRITICAL(&logMux);
+            return;
+        }
+        record = logRing[logTail & (LOG_CAPACITY - 1)];
+        logTail++;
+        portEXIT_CRITICAL(&logMux);
+
+        // Unused arguments are never read by the format, zero them anyway
+        for (int i = record.argCount; i < LOG_MAX_ARGS; i++) {
+            record.args[i] = 0;
+        }
+
+        const LogMessage &message = logMessages[record.id];
+        // Two bytes are kept for the line end
+        char line[160];
+        const size_t textSize = sizeof(line) - 2;
+        int length = snprintf(line, textSize, "[%lu.%03lu %s%s] ",
+                              (unsigned long)(record.timeMs / 1000), (unsigned long)(record.timeMs % 1000),
+                              logModuleNames[message.module],
+                              message.level == LOG_ERROR ? " error" : message.level == LOG_WARN ? " warn" : "");
+        if (length > 0 && length < (int)textSize) {
+            snprintf(line + length, textSize - length, message.format,
+                     record.args[0], record.args[1], record.args[2],
+                     record.args[3], record.args[4], record.args[5]);
+        }
+        strcat(line, "\r\n");
+
+        for (int sink = 0; sink < NUM_OUTPUT_SINKS; sink++) {
+            if (!(logSinks & (1 << sink)) || (sink == OUTPUT_BT && !isBTConnected())) {
+                continue;
+            }
+            queueOutput((OutputSink)sink, (const uint8_t *)line, strlen(line));
+        }
+    }
+}
+
+void setLogSink(OutputSink sink, bool enabled) {
+    if (enabled) {
+        logSinks |= 1 << sink;
+    } else {
+        logSinks &= ~(1 << sink);
+    }
+}
+
+bool isLogSink(OutputSink sink) {
+    return logSinks & (1 << sink);
+}
+
+void setLogLevel(LogModule module, uint8_t level) {
+    for (int i = 0; i < NUM_LOG_MODULES; i++) {
+        if (module == NUM_LOG_MODULES || module == i) {
+            logLevels[i] = level;
+        }
+    }
+}
+
+bool findLogModule(const char *name, LogModule &module) {
+    for (int i = 0; i < NUM_LOG_MODULES; i++) {
+        if (strcasecmp(name, logModuleNames[i]) == 0) {
+            module = (LogModule)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool findLogLevel(const char *name, uint8_t &level) {
+    for (int i = 0; i <= LOG_DEBUG; i++) {
+        if (strcasecmp(name, logLevelNames[i]) == 0) {
+            level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+LogStats getLogStats() {
+    portENTER_CRITICAL(&logMux);
+    LogStats stats = logStats;
+    portEXIT_CRITICAL(&logMux);
+    return stats;
+}
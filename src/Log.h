@@ -0,0 +1,168 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+#include "OutputQueue.h"
+
+// Log levels, a module prints messages at or below its level
+#define LOG_OFF     0
+#define LOG_ERROR   1
+#define LOG_WARN    2
+#define LOG_INFO    3
+#define LOG_DEBUG   4
+
+// Messages above this level compile to nothing
+#define LOG_BUILD_LEVEL LOG_INFO
+
+// Level of every module after boot, changed at runtime with the log command
+#define LOG_DEFAULT_LEVEL LOG_INFO
+
+// Ring size in records, a power of two. Each record is 32 bytes.
+#define LOG_CAPACITY 128
+
+// Arguments a record holds, each stored as 32 bits
+#define LOG_MAX_ARGS 6
+
+// X(id, name)
+#define LOG_MODULE_LIST(X) \
+    X(LOG_MODULE_SYSTEM,    "system") \
+    X(LOG_MODULE_CAN,       "can") \
+    X(LOG_MODULE_BT,        "bt") \
+    X(LOG_MODULE_DISPLAY,   "display") \
+    X(LOG_MODULE_SPEED,     "speed") \
+    X(LOG_MODULE_ODOMETER,  "odometer")
+
+enum LogModule : uint8_t {
+#define LOG_MODULE_ENUM(id, name) id,
+    LOG_MODULE_LIST(LOG_MODULE_ENUM)
+#undef LOG_MODULE_ENUM
+    NUM_LOG_MODULES
+};
+
+// Every log message. Only the id and the arguments are recorded, the format
+// is applied later by the output task. Arguments are 32 bit integers or
+// strings that never go away (literals, globals, the task table), so use
+// %d, %u, %x and %s.
+// X(id, module, level, format)
+#define LOG_MESSAGE_LIST(X) \
+    X(LOG_TASK_EXISTS,              LOG_MODULE_SYSTEM,   LOG_ERROR, "Task already created: %s") \
+    X(LOG_TASK_FAILED,              LOG_MODULE_SYSTEM,   LOG_ERROR, "Failed to create %s") \
+    X(LOG_SEMAPHORE_FAILED,         LOG_MODULE_SYSTEM,   LOG_ERROR, "Failed to create %s") \
+    X(LOG_TOO_MANY_TIMERS,          LOG_MODULE_SYSTEM,   LOG_ERROR, "Too many timers, increase TIMER_MAX_TIMERS") \
+    X(LOG_TOO_MANY_SUBSCRIBERS,     LOG_MODULE_SYSTEM,   LOG_ERROR, "Too many telemetry subscribers, increase TELEMETRY_MAX_SUBSCRIBERS") \
+    X(LOG_TOO_MANY_PARAMETER_LISTENERS, LOG_MODULE_SYSTEM, LOG_ERROR, "Too many parameter listeners, increase PARAMETER_MAX_LISTENERS") \
+    X(LOG_CAN_STARTED,              LOG_MODULE_CAN,      LOG_INFO,  "CAN bus started!") \
+    X(LOG_CAN_FAILED,               LOG_MODULE_CAN,      LOG_ERROR, "Starting CAN failed!") \
+    X(LOG_MOTOR_OFF,                LOG_MODULE_CAN,      LOG_INFO,  "Motor is off") \
+    X(LOG_MOTOR_ON,                 LOG_MODULE_CAN,      LOG_INFO,  "Motor is on") \
+    X(LOG_BT_BLE_RELEASED,          LOG_MODULE_BT,       LOG_DEBUG, "Released BLE memory") \
+    X(LOG_BT_CONTROLLER_FAILED,     LOG_MODULE_BT,       LOG_ERROR, "Bluetooth controller %s failed") \
+    X(LOG_BT_BLUEDROID_FAILED,      LOG_MODULE_BT,       LOG_ERROR, "Bluedroid %s failed") \
+    X(LOG_BT_STARTED,               LOG_MODULE_BT,       LOG_INFO,  "Bluetooth Serial started in %u ms. Name: %s") \
+    X(LOG_BT_SERIAL_FAILED,         LOG_MODULE_BT,       LOG_ERROR, "Bluetooth Serial initialization failed") \
+    X(LOG_BT_ALREADY_ON,            LOG_MODULE_BT,       LOG_DEBUG, "Bluetooth is already turned on") \
+    X(LOG_BT_POWERED_OFF,           LOG_MODULE_BT,       LOG_INFO,  "Bluetooth controller and Bluedroid stopped") \
+    X(LOG_BT_PARKED,                LOG_MODULE_BT,       LOG_INFO,  "Bluetooth parked, not discoverable or connectable") \
+    X(LOG_BT_RESUMED,               LOG_MODULE_BT,       LOG_INFO,  "Bluetooth resumed in %u us") \
+    X(LOG_BT_SCAN_MODE_FAILED,      LOG_MODULE_BT,       LOG_ERROR, "Setting the Bluetooth scan mode failed") \
+    X(LOG_BT_ALREADY_OFF,           LOG_MODULE_BT,       LOG_DEBUG, "Bluetooth is already off or parked") \
+    X(LOG_BT_CONNECTED,             LOG_MODULE_BT,       LOG_INFO,  "Bluetooth client connected") \
+    X(LOG_BT_DISCONNECTED,          LOG_MODULE_BT,       LOG_INFO,  "Bluetooth client disconnected") \
+    X(LOG_BT_DISPLAY_OFF,           LOG_MODULE_BT,       LOG_INFO,  "Display turned OFF, parking Bluetooth") \
+    X(LOG_BT_DISPLAY_ON,            LOG_MODULE_BT,       LOG_INFO,  "Display turned ON, resuming Bluetooth") \
+    X(LOG_BT_KEPT_ON,               LOG_MODULE_BT,       LOG_DEBUG, "Bluetooth connection active, keeping Bluetooth on") \
+    X(LOG_BT_IDLE_OFF,              LOG_MODULE_BT,       LOG_INFO,  "No Bluetooth connection for 1 minute, parking Bluetooth") \
+    X(LOG_IGNITION_OVERRIDE,        LOG_MODULE_DISPLAY,  LOG_INFO,  "Ignition override %s") \
+    X(LOG_MANUAL_IGNITION,          LOG_MODULE_DISPLAY,  LOG_INFO,  "Manual ignition %s") \
+    X(LOG_PULSE_COUNTER_FAILED,     LOG_MODULE_SPEED,    LOG_ERROR, "Failed to configure pulse counter") \
+    X(LOG_JOURNAL_MISSING,          LOG_MODULE_ODOMETER, LOG_WARN,  "Odometer journal partition not found, odometer is kept in NVS only") \
+    X(LOG_JOURNAL_RECOVERED,        LOG_MODULE_ODOMETER, LOG_INFO,  "Odometer journal: %u.%03u km, trip %u m (record %u, %u us)")
+
+enum LogMessageId : uint16_t {
+#define LOG_MESSAGE_ENUM(id, module, level, format) id,
+    LOG_MESSAGE_LIST(LOG_MESSAGE_ENUM)
+#undef LOG_MESSAGE_ENUM
+    NUM_LOG_MESSAGES
+};
+
+struct LogMessage {
+    LogModule module;
+    uint8_t level;
+    const char *format;
+};
+
+constexpr LogMessage logMessages[NUM_LOG_MESSAGES] = {
+#define LOG_MESSAGE_ENTRY(id, module, level, format) {module, level, format},
+    LOG_MESSAGE_LIST(LOG_MESSAGE_ENTRY)
+#undef LOG_MESSAGE_ENTRY
+};
+
+extern const char *const logModuleNames[NUM_LOG_MODULES];
+extern const char *const logLevelNames[LOG_DEBUG + 1];
+
+struct LogRecord {
+    uint32_t timeMs;
+    uint16_t id;
+    uint8_t argCount;
+    uint32_t args[LOG_MAX_ARGS];
+};
+
+struct LogStats {
+    uint32_t written;   // Records since boot
+    uint32_t dropped;   // Records overwritten before the output task printed them
+};
+
+extern uint8_t logLevels[NUM_LOG_MODULES];
+
+// Copy a record into the ring, from any task. Never blocks.
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount);
+
+// Arguments as they are stored in a record
+template <typename T>
+inline uint32_t logArg(T value) {
+    return (uint32_t)value;
+}
+inline uint32_t logArg(const char *value) {
+    return (uint32_t)(uintptr_t)value;
+}
+uint32_t logArg(float value) = delete;
+uint32_t logArg(double value) = delete;
+
+template <typename... Args>
+inline void logMessage(LogMessageId id, Args... args) {
+    static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments, increase LOG_MAX_ARGS");
+    if (logMessages[id].level > logLevels[logMessages[id].module]) {
+        return;
+    }
+    // The leading 0 keeps the array valid when there are no arguments
+    const uint32_t values[] = {0, logArg(args)...};
+    writeLog(id, values + 1, sizeof...(args));
+}
+
+// Record a message of LOG_MESSAGE_LIST, e.g. LOG(LOG_MANUAL_IGNITION, "ON").
+// Messages above LOG_BUILD_LEVEL are dropped by the compiler.
+#define LOG(id, ...) \
+    do { \
+        if (logMessages[id].level <= LOG_BUILD_LEVEL) { \
+            logMessage(id, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+// Format every waiting record and queue it to the log sinks, called by the output task
+void printPendingLogs();
+
+// Choose the sinks that receive log lines, by default all of them.
+// Bluetooth only gets them while a client is connected.
+void setLogSink(OutputSink sink, bool enabled);
+bool isLogSink(OutputSink sink);
+
+// Set the runtime level of a module, or of all modules with NUM_LOG_MODULES
+void setLogLevel(LogModule module, uint8_t level);
+
+// Module and level by name, false when unknown
+bool findLogModule(const char *name, LogModule &module);
+bool findLogLevel(const char *name, uint8_t &level);
+
+LogStats getLogStats();
+
+#endif // LOG_H
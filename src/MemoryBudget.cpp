@@ -0,0 +1,53 @@
+#include "MemoryBudget.h"
+#include "TaskTable.h"
+#include "Semaphores.h"
+#include "Timers.h"
+#include "Parameter.h"
+#include "driveTelemetry.h"
+#include "OutputQueue.h"
+#include "Log.h"
+#include <esp_heap_caps.h>
+
+// Section boundaries from the ESP32 linker script
+extern "C" {
+    extern uint8_t _data_start, _data_end;
+    extern uint8_t _bss_start, _bss_end;
+}
+
+#define DISPLAY_BUFFER_SIZE (128 * 64 / 8)  // Full frame buffer of the 128x64 display, kept by U8g2
+
+void printBudgetLine(Stream &stream, const char *name, uint32_t bytes) {
+    char line[64];
+    snprintf(line, sizeof(line), "  %-30s %6lu", name, (unsigned long)bytes);
+    stream.println(line);
+}
+
+void printMemoryBudget(Stream &stream) {
+    stream.println("Memory budget (bytes):");
+
+    uint32_t taskRam = TASK_STACK_TOTAL + NUM_TASKS * sizeof(StaticTask_t);
+    printBudgetLine(stream, "Tasks (stacks and TCBs)", taskRam);
+    printTaskMemory(stream);
+
+    uint32_t semaphoreRam = NUM_SEMAPHORES * sizeof(StaticSemaphore_t);
+    uint32_t timerRam = TIMER_MAX_TIMERS * sizeof(Timer *);
+    uint32_t parameterRam = sizeof(parameterValues) + PARAMETER_MAX_LISTENERS * sizeof(ParameterListener);
+    printBudgetLine(stream, "Semaphores", semaphoreRam);
+    printBudgetLine(stream, "Timer service heap", timerRam);
+    printBudgetLine(stream, "Parameters", parameterRam);
+    printBudgetLine(stream, "Telemetry", sizeof(Telemetry));
+    printBudgetLine(stream, "Display frame buffer", DISPLAY_BUFFER_SIZE);
+    printBudgetLine(stream, "Output queues", OUTPUT_SERIAL_BUFFER + OUTPUT_BT_BUFFER);
+    printBudgetLine(stream, "Log ring", LOG_CAPACITY * sizeof(LogRecord));
+
+    uint32_t dataSize = &_data_end - &_data_start;
+    uint32_t bssSize = &_bss_end - &_bss_start;
+    uint32_t accounted = taskRam + semaphoreRam + timerRam + parameterRam + sizeof(Telemetry) + DISPLAY_BUFFER_SIZE +
+                         OUTPUT_SERIAL_BUFFER + OUTPUT_BT_BUFFER + LOG_CAPACITY * sizeof(LogRecord);
+    printBudgetLine(stream, "Static RAM (.data + .bss)", dataSize + bssSize);
+    printBudgetLine(stream, "  of which libraries and other", dataSize + bssSize > accounted ? dataSize + bssSize - accounted : 0);
+
+    printBudgetLine(stream, "Heap free", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    printBudgetLine(stream, "Heap minimum ever free", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    printBudgetLine(stream, "Heap largest free block", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
@@ -0,0 +1,9 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <Arduino.h>
+
+// Print the static RAM of each subsystem, the linker totals and the heap state
+void printMemoryBudget(Stream &stream);
+
+#endif // MEMORY_BUDGET_H
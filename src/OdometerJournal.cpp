@@ -0,0 +1,210 @@
+#include "OdometerJournal.h"
+#include "PulseCounterTask.h"
+#include "Parameter.h"
+#include "TaskTable.h"
+#include "Log.h"
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <climits>
+
+// Append-only odometer/trip journal in the "odojrnl" data partition.
+// Records are written one after the other; when a sector is full the next
+// one is erased and the journal wraps around the partition. The newest valid
+// record (highest sequence number, correct CRC) is the current state, so a
+// torn write or an interrupted erase only loses the record being written.
+#define JOURNAL_PARTITION_NAME  "odojrnl"
+#define JOURNAL_PARTITION_TYPE  ((esp_partition_subtype_t)0x80)
+#define JOURNAL_MAGIC           0x4F444F31  // "ODO1"
+#define JOURNAL_SECTOR_SIZE     4096
+
+// Task notification bits
+#define JOURNAL_REQUEST_RECORD  (1 << 0)
+#define JOURNAL_REQUEST_NVS     (1 << 1)
+#define JOURNAL_REQUEST_PARAMETERS (1 << 2)
+
+struct JournalRecord {
+    uint32_t magic;
+    uint32_t sequence;      // Increments with every record
+    uint32_t odometerKm;    // Whole kilometres (parameter 0)
+    uint32_t odometerMm;    // Millimetres into the current kilometre
+    uint32_t tripMm;        // Trip distance in millimetres
+    uint32_t reserved[2];
+    uint32_t crc;           // CRC32 of all fields above
+};
+
+#define RECORDS_PER_SECTOR (JOURNAL_SECTOR_SIZE / sizeof(JournalRecord))
+
+const esp_partition_t *journalPartition = NULL;
+uint32_t journalSectors = 0;
+uint32_t journalNextSlot = 0;   // Slot index over the whole partition
+JournalRecord lastRecord = {0};
+JournalStats journalStats = {0};
+TaskHandle_t journalTaskHandle = NULL;
+int32_t nvsOdometerKm = 0;      // Odometer value last seen in NVS
+
+void journalTask(void *pvParameters);
+void handleJournalRequests(uint32_t requests);
+bool readRecord(uint32_t slot, JournalRecord &record);
+bool isSlotBlank(uint32_t slot);
+bool appendRecord(uint32_t km, uint32_t odometerMm, uint32_t tripMm);
+
+uint32_t recordCrc(const JournalRecord &record) {
+    return esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(JournalRecord, crc));
+}
+
+void initializeOdometerJournal() {
+    journalPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_TYPE, JOURNAL_PARTITION_NAME);
+    if (journalPartition == NULL) {
+        LOG(LOG_JOURNAL_MISSING);
+        return;
+    }
+    journalSectors = journalPartition->size / JOURNAL_SECTOR_SIZE;
+
+    uint32_t start = micros();
+    nvsOdometerKm = parameterValue<PARAM_ODOMETER_COUNT>();
+
+    // Sectors are filled in order, so the sector whose first record is newest
+    // holds the newest record. Only that sector is scanned in full.
+    int32_t newestSector = -1;
+    uint32_t newestSequence = 0;
+    JournalRecord record;
+    for (uint32_t sector = 0; sector < journalSectors; sector++) {
+        if (readRecord(sector * RECORDS_PER_SECTOR, record) &&
+            (newestSector < 0 || (int32_t)(record.sequence - newestSequence) > 0)) {
+            newestSector = sector;
+            newestSequence = record.sequence;
+        }
+    }
+
+    bool found = false;
+    if (newestSector >= 0) {
+        uint32_t first = newestSector * RECORDS_PER_SECTOR;
+        for (uint32_t slot = first; slot < first + RECORDS_PER_SECTOR; slot++) {
+            if (readRecord(slot, record) && (!found || (int32_t)(record.sequence - lastRecord.sequence) > 0)) {
+                lastRecord = record;
+                journalNextSlot = slot + 1;
+                found = true;
+            }
+        }
+        journalNextSlot %= journalSectors * RECORDS_PER_SECTOR;
+    }
+
+    journalStats.available = true;
+    journalStats.recoveryMicros = micros() - start;
+
+    if (found) {
+        // The journal is newer than the per-km NVS value
+        restoreDistances(lastRecord.odometerKm, lastRecord.odometerMm, lastRecord.tripMm);
+        journalStats.sequence = lastRecord.sequence;
+        LOG(LOG_JOURNAL_RECOVERED, lastRecord.odometerKm, lastRecord.odometerMm / 1000, lastRecord.tripMm / 1000,
+            lastRecord.sequence, journalStats.recoveryMicros);
+    } else {
+        // Empty partition, seed it from NVS
+        appendRecord(parameterValue<PARAM_ODOMETER_COUNT>(), 0, 0);
+    }
+
+    createTask(TASK_JOURNAL, journalTask, &journalTaskHandle);
+}
+
+void requestOdometerJournalWrite(bool syncNVS) {
+    if (journalTaskHandle != NULL) {
+        xTaskNotify(journalTaskHandle, JOURNAL_REQUEST_RECORD | (syncNVS ? JOURNAL_REQUEST_NVS : 0), eSetBits);
+    }
+}
+
+bool requestParameterCommit() {
+    if (journalTaskHandle == NULL) {
+        return false;
+    }
+    xTaskNotify(journalTaskHandle, JOURNAL_REQUEST_PARAMETERS, eSetBits);
+    return true;
+}
+
+JournalStats getOdometerJournalStats() {
+    return journalStats;
+}
+
+void journalTask(void *pvParameters) {
+    for (;;) {
+        uint32_t requests = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &requests, portMAX_DELAY);
+        countTaskWakeup(TASK_JOURNAL);
+        handleJournalRequests(requests);
+    }
+}
+
+void handleJournalRequests(uint32_t requests) {
+    uint32_t km, odometerMm, tripMm;
+    getDistanceSnapshot(km, odometerMm, tripMm);
+    if (km != lastRecord.odometerKm || odometerMm != lastRecord.odometerMm || tripMm != lastRecord.tripMm) {
+        appendRecord(km, odometerMm, tripMm);
+    }
+
+    if ((requests & JOURNAL_REQUEST_NVS) && (int32_t)km != nvsOdometerKm) {
+        markParameterChanged(PARAM_ODOMETER_COUNT);
+        nvsOdometerKm = km;
+    }
+    // Ignition off commits at once, together with anything else that changed
+    if (requests & (JOURNAL_REQUEST_NVS | JOURNAL_REQUEST_PARAMETERS)) {
+        commitParameters();
+    }
+}
+
+bool readRecord(uint32_t slot, JournalRecord &record) {
+    if (esp_partition_read(journalPartition, slot * sizeof(JournalRecord), &record, sizeof(record)) != ESP_OK) {
+        return false;
+    }
+    return record.magic == JOURNAL_MAGIC && record.crc == recordCrc(record);
+}
+
+bool isSlotBlank(uint32_t slot) {
+    uint32_t words[sizeof(JournalRecord) / sizeof(uint32_t)];
+    if (esp_partition_read(journalPartition, slot * sizeof(JournalRecord), words, sizeof(words)) != ESP_OK) {
+        return false;
+    }
+    for (uint32_t word : words) {
+        if (word != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool appendRecord(uint32_t km, uint32_t odometerMm, uint32_t tripMm) {
+    uint32_t totalSlots = journalSectors * RECORDS_PER_SECTOR;
+
+    // Skip slots left dirty by a torn write, erasing each new sector before its first record
+    for (uint32_t attempts = 0; attempts < totalSlots; attempts++) {
+        if (journalNextSlot % RECORDS_PER_SECTOR == 0) {
+            if (esp_partition_erase_range(journalPartition, journalNextSlot * sizeof(JournalRecord), JOURNAL_SECTOR_SIZE) != ESP_OK) {
+                journalStats.writeErrors++;
+                return false;
+            }
+            journalStats.sectorErases++;
+        }
+        if (isSlotBlank(journalNextSlot)) {
+            break;
+        }
+        journalNextSlot = (journalNextSlot + 1) % totalSlots;
+    }
+
+    JournalRecord record = {0};
+    record.magic = JOURNAL_MAGIC;
+    record.sequence = lastRecord.sequence + 1;
+    record.odometerKm = km;
+    record.odometerMm = odometerMm;
+    record.tripMm = tripMm;
+    record.crc = recordCrc(record);
+
+    uint32_t slot = journalNextSlot;
+    journalNextSlot = (journalNextSlot + 1) % totalSlots;
+    if (esp_partition_write(journalPartition, slot * sizeof(JournalRecord), &record, sizeof(record)) != ESP_OK) {
+        journalStats.writeErrors++;
+        return false;
+    }
+
+    lastRecord = record;
+    journalStats.sequence = record.sequence;
+    journalStats.recordsWritten++;
+    return true;
+}
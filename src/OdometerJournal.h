@@ -0,0 +1,34 @@
+#ifndef ODOMETER_JOURNAL_H
+#define ODOMETER_JOURNAL_H
+
+#include <Arduino.h>
+
+// Distance between journal records, so at most this much is lost on a power cut
+#define JOURNAL_INTERVAL_MM 50000   // 50 m
+
+// Statistics of the odometer journal partition
+struct JournalStats {
+    bool available;             // Partition found and usable
+    uint32_t sequence;          // Sequence number of the newest record
+    uint32_t recordsWritten;    // Records written since boot
+    uint32_t sectorErases;      // Sector erases since boot
+    uint32_t writeErrors;       // Failed writes or erases since boot
+    uint32_t recoveryMicros;    // Time the boot scan took
+};
+
+// Scan the journal partition and restore the odometer and trip distances.
+// Call after the parameters are loaded and before the pulse counter starts.
+void initializeOdometerJournal();
+
+// Ask the background task to append a record with the current distances.
+// With syncNVS the whole-km odometer parameter is also copied to NVS (done on
+// ignition off, so NVS stays close without a write every kilometre).
+void requestOdometerJournalWrite(bool syncNVS = false);
+
+// Ask the background task to commit the changed parameters to NVS. False when
+// the task is not running because the journal partition is missing.
+bool requestParameterCommit();
+
+JournalStats getOdometerJournalStats();
+
+#endif // ODOMETER_JOURNAL_H
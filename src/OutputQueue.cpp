@@ -0,0 +1,225 @@
+#include "OutputQueue.h"
+#include "TaskTable.h"
+#include "Log.h"
+#include "Semaphores.h"
+
+static_assert((OUTPUT_SERIAL_BUFFER & (OUTPUT_SERIAL_BUFFER - 1)) == 0, "OUTPUT_SERIAL_BUFFER must be a power of two");
+static_assert((OUTPUT_BT_BUFFER & (OUTPUT_BT_BUFFER - 1)) == 0, "OUTPUT_BT_BUFFER must be a power of two");
+
+// Bytes taken from a ring per write to the port
+#define OUTPUT_CHUNK 128
+
+// head and tail run freely, head - tail bytes are waiting
+struct OutputRing {
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    bool waiting;       // The interactive task waits for room
+    bool stalled;       // It gave up waiting, and does not wait again until the port takes bytes
+    OutputStats stats;
+};
+
+uint8_t serialOutputBuffer[OUTPUT_SERIAL_BUFFER];
+uint8_t btOutputBuffer[OUTPUT_BT_BUFFER];
+
+OutputRing outputRings[NUM_OUTPUT_SINKS] = {
+    {serialOutputBuffer, OUTPUT_SERIAL_BUFFER, 0, 0, false, false, {0, 0, 0, 0}},
+    {btOutputBuffer, OUTPUT_BT_BUFFER, 0, 0, false, false, {0, 0, 0, 0}},
+};
+
+// Held only to copy bytes in or out of a ring, never while writing to a port
+portMUX_TYPE outputMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t outputTaskHandle = NULL;
+TaskHandle_t interactiveTask = NULL;
+
+OutputStream SerialOut(OUTPUT_SERIAL, Serial);
+#ifdef ENABLE_BLUETOOTH
+OutputStream BTOut(OUTPUT_BT, SerialBT);
+#endif
+ConsoleOutput ConsoleOut;
+
+void outputTask(void *parameter);
+
+void initializeOutput() {
+    Serial.begin(115200);
+    createTask(TASK_OUTPUT, outputTask, &outputTaskHandle);
+}
+
+void setInteractiveOutputTask(TaskHandle_t task) {
+    interactiveTask = task;
+}
+
+// Copy bytes into a ring, dropping the oldest ones if they do not fit. Call
+// with outputMux held. Returns true if the ring was empty.
+bool copyToRing(OutputRing &ring, const uint8_t *data, size_t length) {
+    // More than fits at once: only the end of it can survive
+    if (length > ring.size) {
+        ring.stats.dropped += length - ring.size;
+        data += length - ring.size;
+        length = ring.size;
+    }
+    bool wasEmpty = ring.head == ring.tail;
+    uint32_t waiting = ring.head - ring.tail;
+    if (waiting + length > ring.size) {
+        uint32_t overflow = waiting + length - ring.size;
+        ring.tail += overflow;
+        ring.stats.dropped += overflow;
+    }
+    uint32_t start = ring.head & (ring.size - 1);
+    uint32_t first = length < ring.size - start ? length : ring.size - start;
+    memcpy(ring.buffer + start, data, first);
+    memcpy(ring.buffer, data + first, length - first);
+    ring.head += length;
+    ring.stats.written += length;
+    if (ring.head - ring.tail > ring.stats.highWater) {
+        ring.stats.highWater = ring.head - ring.tail;
+    }
+    return wasEmpty;
+}
+
+size_t queueOutput(OutputSink sink, const uint8_t *data, size_t length) {
+    OutputRing &ring = outputRings[sink];
+    size_t queued = length;
+    bool mayWait = interactiveTask != NULL && xTaskGetCurrentTaskHandle() == interactiveTask;
+
+    for (;;) {
+        portENTER_CRITICAL(&outputMux);
+        size_t part = length;
+        if (mayWait && !ring.stalled) {
+            // Leave a quarter of the ring to the other writers, they drop bytes rather than wait
+            uint32_t limit = ring.size - ring.size / 4;
+            uint32_t waiting = ring.head - ring.tail;
+            uint32_t room = waiting < limit ? limit - waiting : 0;
+            part = length < room ? length : room;
+        }
+        bool wasEmpty = part > 0 && copyToRing(ring, data, part);
+        data += part;
+        length -= part;
+        if (length > 0) {
+            ring.waiting = true;
+        }
+        portEXIT_CRITICAL(&outputMux);
+
+        // The output task drains everything before it sleeps, so it only needs waking on the first byte
+        if (wasEmpty) {
+            wakeOutputTask();
+        }
+        if (length == 0) {
+            return queued;
+        }
+
+        // Full: wait until the output task has sent half of the ring
+        if (xSemaphoreTake(outputRoomSemaphore, pdMS_TO_TICKS(OUTPUT_WAIT_MS)) != pdTRUE) {
+            portENTER_CRITICAL(&outputMux);
+            ring.waiting = false;
+            ring.stalled = true;
+            ring.stats.stalls++;
+            portEXIT_CRITICAL(&outputMux);
+        }
+    }
+}
+
+// Move up to size bytes from the front of a ring into chunk
+size_t takeOutput(OutputSink sink, uint8_t *chunk, size_t size) {
+    OutputRing &ring = outputRings[sink];
+    portENTER_CRITICAL(&outputMux);
+    uint32_t waiting = ring.head - ring.tail;
+    size_t count = waiting < size ? waiting : size;
+    uint32_t start = ring.tail & (ring.size - 1);
+    size_t first = count < ring.size - start ? count : ring.size - start;
+    memcpy(chunk, ring.buffer + start, first);
+    memcpy(chunk + first, ring.buffer, count - first);
+    ring.tail += count;
+    if (count > 0) {
+        ring.stalled = false;
+    }
+    bool wakeWriter = ring.waiting && ring.head - ring.tail <= ring.size / 4;
+    if (wakeWriter) {
+        ring.waiting = false;
+    }
+    portEXIT_CRITICAL(&outputMux);
+
+    if (wakeWriter) {
+        xSemaphoreGive(outputRoomSemaphore);
+    }
+    return count;
+}
+
+void wakeOutputTask() {
+    if (outputTaskHandle != NULL) {
+        xTaskNotifyGive(outputTaskHandle);
+    }
+}
+
+OutputStats getOutputStats(OutputSink sink) {
+    portENTER_CRITICAL(&outputMux);
+    OutputStats stats = outputRings[sink].stats;
+    portEXIT_CRITICAL(&outputMux);
+    return stats;
+}
+
+size_t OutputStream::write(uint8_t c) {
+    return queueOutput(sink, &c, 1);
+}
+
+size_t OutputStream::write(const uint8_t *buffer, size_t size) {
+    return queueOutput(sink, buffer, size);
+}
+
+size_t ConsoleOutput::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t ConsoleOutput::write(const uint8_t *buffer, size_t size) {
+    queueOutput(OUTPUT_SERIAL, buffer, size);
+    if (isBTConnected()) {
+        queueOutput(OUTPUT_BT, buffer, size);
+    }
+    return size;
+}
+
+// Format pending log records and send one chunk per sink. Returns false when
+// there was nothing to do.
+bool sendOutput() {
+    uint8_t chunk[OUTPUT_CHUNK];
+
+    // Log records are formatted here, off the task that logged them, and queued like any other output
+    printPendingLogs();
+
+    // One chunk per sink in turn. A Bluetooth write blocks while the SPP
+    // transmit queue is full, and Serial waits with it; writers other than the
+    // interactive task never do, they only queue.
+    bool busy = false;
+    size_t count = takeOutput(OUTPUT_SERIAL, chunk, sizeof(chunk));
+    if (count > 0) {
+        Serial.write(chunk, count);
+        busy = true;
+    }
+
+    count = takeOutput(OUTPUT_BT, chunk, sizeof(chunk));
+    if (count > 0) {
+#ifdef ENABLE_BLUETOOTH
+        if (isBTConnected()) {
+            SerialBT.write(chunk, count);
+        } else
+#endif
+        {
+            // Nobody to send it to
+            portENTER_CRITICAL(&outputMux);
+            outputRings[OUTPUT_BT].stats.dropped += count;
+            portEXIT_CRITICAL(&outputMux);
+        }
+        busy = true;
+    }
+    return busy;
+}
+
+void outputTask(void *parameter) {
+    for (;;) {
+        if (!sendOutput()) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            countTaskWakeup(TASK_OUTPUT);
+        }
+    }
+}
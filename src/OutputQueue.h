@@ -0,0 +1,79 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <Arduino.h>
+#include "Bluetooth.h"
+
+// Bytes buffered per sink, powers of two. When a sink is full the oldest
+// bytes are dropped to make room, except for the interactive task.
+#define OUTPUT_SERIAL_BUFFER 4096
+#define OUTPUT_BT_BUFFER 2048
+
+// Longest the interactive task waits for room before it drops the oldest bytes like any other writer
+#define OUTPUT_WAIT_MS 500
+
+enum OutputSink {
+    OUTPUT_SERIAL,
+    OUTPUT_BT,
+    NUM_OUTPUT_SINKS
+};
+
+struct OutputStats {
+    uint32_t written;       // Bytes queued since boot
+    uint32_t dropped;       // Bytes dropped since boot, overwritten or sent while Bluetooth was down
+    uint32_t highWater;     // Most bytes ever waiting
+    uint32_t stalls;        // Waits for room given up because the port did not take any bytes
+};
+
+// A console port whose writes are queued for the output task, so a slow or
+// stalled link never blocks the writer. Reads go straight to the port.
+class OutputStream : public Stream {
+public:
+    OutputStream(OutputSink sink, Stream &port) : sink(sink), port(port) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    int available() override { return port.available(); }
+    int read() override { return port.read(); }
+    int peek() override { return port.peek(); }
+
+private:
+    OutputSink sink;
+    Stream &port;
+};
+
+// Writes to Serial, and to Bluetooth while a client is connected
+class ConsoleOutput : public Print {
+public:
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+};
+
+extern OutputStream SerialOut;
+#ifdef ENABLE_BLUETOOTH
+extern OutputStream BTOut;
+#endif
+extern ConsoleOutput ConsoleOut;
+
+// Start Serial and the output task. Call first in setup(), anything written
+// before the task runs is sent once it starts.
+void initializeOutput();
+
+// Queue bytes for a sink. Returns length. Only the interactive task ever
+// blocks, while the sink is full.
+size_t queueOutput(OutputSink sink, const uint8_t *data, size_t length);
+
+// Writes from this task wait for room in a full sink instead of dropping the
+// oldest bytes, so long command output such as a trace dump arrives whole.
+// Meant for the CLI task, which is not time critical.
+void setInteractiveOutputTask(TaskHandle_t task);
+
+OutputStats getOutputStats(OutputSink sink);
+
+// Wake the output task for work other than queued bytes, such as log records
+void wakeOutputTask();
+
+#endif // OUTPUT_QUEUE_H
@@ -1,41 +1,50 @@
 #include "Parameter.h"
 #include <nvs_flash.h>
-#include <Preferences.h>
-#ifdef ENABLE_BLUETOOTH
-#include "BluetoothSerial.h"
-#endif
+#include <nvs.h>
+#include "OdometerJournal.h"
+#include "PulseCounterTask.h"
+#include "OutputQueue.h"
+#include "Timers.h"
+#include "Log.h"
 
-// Forward declare functions and variables from OTA
-extern bool isBTConnected();
-#ifdef ENABLE_BLUETOOTH
-extern BluetoothSerial SerialBT;
-#endif
-
-Preferences preferences;
+#define PARAMETER_NAMESPACE "storage"
 
 // Helper function to print to both Serial and SerialBT
 void printToAll(const String& message, Stream* output = nullptr) {
     if (output) {
         output->println(message);
     } else {
-        Serial.println(message);
-#ifdef ENABLE_BLUETOOTH
-        if (isBTConnected()) {
-            SerialBT.println(message);
-        }
-#endif
+        ConsoleOut.println(message);
     }
 }
 
-Parameter parameters[] = {
-    // index, name, defaultValue, value     // unit
-    {0, "OdometerCount", 202600, 202600},   // Kilometers
-    {1, "BlinkSpeed", 500, 500},            // Milliseconds
-    {2, "PulseDelay", 100, 100},            // Milliseconds for the pulse counter to integrate pulses
-    {3, "SpeedFactor", 800, 800}            // mm per pulse
+int32_t parameterValues[NUM_PARAMETERS] = {
+#define PARAMETER_DEFAULT(id, type, name, unit, defaultValue, minValue, maxValue) defaultValue,
+    PARAMETER_LIST(PARAMETER_DEFAULT)
+#undef PARAMETER_DEFAULT
 };
 
-const int numParameters = sizeof(parameters) / sizeof(parameters[0]);
+#define PARAMETER_CHECK(id, type, name, unit, defaultValue, minValue, maxValue) \
+    static_assert(minValue <= defaultValue && defaultValue <= maxValue, "Default of " name " is out of range"); \
+    static_assert(sizeof(name) <= NVS_KEY_NAME_MAX_SIZE, "NVS key " name " is too long");
+PARAMETER_LIST(PARAMETER_CHECK)
+#undef PARAMETER_CHECK
+static_assert(NUM_PARAMETERS <= MAX_PARAMETERS, "Too many parameters for the dirty mask");
+
+ParameterListener parameterListeners[PARAMETER_MAX_LISTENERS];
+int parameterListenerCount = 0;
+
+// Changed parameters are collected in a dirty mask and written together once
+// nothing changed for PARAMETER_COMMIT_DELAY_MS. The values NVS holds are
+// shadowed, so a change back to the stored value costs no flash write.
+uint32_t dirtyParameters = 0;
+uint32_t storedParameters = 0;          // Bit n set when NVS holds a value for parameter n
+int32_t storedValues[MAX_PARAMETERS];   // That value
+ParameterStoreStats parameterStoreStats = {0};
+portMUX_TYPE parameterMux = portMUX_INITIALIZER_UNLOCKED;
+
+void onParameterCommitTimer();
+Timer parameterCommitTimer(PARAMETER_COMMIT_DELAY_MS, onParameterCommitTimer);
 
 void initializeParameter() {
     // Initialize NVS
@@ -50,18 +59,69 @@ void initializeParameter() {
     updateParametersFromNVS();
 }
 
+void onParameterChange(ParameterId id, ParameterCallback callback) {
+    if (parameterListenerCount >= PARAMETER_MAX_LISTENERS) {
+        LOG(LOG_TOO_MANY_PARAMETER_LISTENERS);
+        return;
+    }
+    parameterListeners[parameterListenerCount].id = id;
+    parameterListeners[parameterListenerCount].callback = callback;
+    parameterListenerCount++;
+    callback(id, parameterValues[id]);
+}
+
+bool isParameterInRange(int index, int32_t value) {
+    return value >= parameterInfo[index].minValue && value <= parameterInfo[index].maxValue;
+}
+
+// Store a value and tell the listeners when it differs
+void applyParameter(int index, int32_t value) {
+    if (parameterValues[index] == value) {
+        return;
+    }
+    if (index == PARAM_ODOMETER_COUNT) {
+        setOdometerKm(value);   // The pulse counter increments it under the distance lock
+    } else {
+        parameterValues[index] = value;
+    }
+    for (int i = 0; i < parameterListenerCount; i++) {
+        if (parameterListeners[i].id == index) {
+            parameterListeners[i].callback((ParameterId)index, value);
+        }
+    }
+}
+
+bool updateParameter(ParameterId id, int32_t value) {
+    if (id >= NUM_PARAMETERS || !isParameterInRange(id, value)) {
+        return false;
+    }
+    applyParameter(id, value);
+    markParameterChanged(id);
+    if (id == PARAM_ODOMETER_COUNT) {
+        requestOdometerJournalWrite(); // The journal overrides NVS at boot, so keep it in step
+    }
+    return true;
+}
+
 void setParameter(int index, int value, Stream *output) {
-    if (index >= 0 && index < numParameters) {
-        parameters[index].value = value;
+    if (index >= 0 && index < NUM_PARAMETERS) {
+        const ParameterInfo &info = parameterInfo[index];
+        if (!updateParameter((ParameterId)index, value)) {
+            String message = "Error: " + String(info.name) + " must be " + String(info.minValue) + " to " + String(info.maxValue) + " " + info.unit;
+            if (output) {
+                output->println(message);
+            } else {
+                printToAll(message);
+            }
+            return;
+        }
         
         // Output to specified stream if provided
         if (output) {
-            output->println("Set " + parameters[index].name + " to " + String(value));
+            output->println("Set " + String(info.name) + " to " + String(value) + " " + info.unit);
         } else {
-            printToAll("Set " + parameters[index].name + " to " + String(value));
+            printToAll("Set " + String(info.name) + " to " + String(value) + " " + info.unit);
         }
-        
-        storeParametersToNVS();
     } else {
         if (output) {
             output->println("Invalid index");
@@ -72,11 +132,12 @@ void setParameter(int index, int value, Stream *output) {
 }
 
 void getParameter(int index, Stream *output) {
-    if (index >= 0 && index < numParameters) {
+    if (index >= 0 && index < NUM_PARAMETERS) {
+        String message = String(index) + ": " + parameterInfo[index].name + " = " + String(parameterValues[index]) + " " + parameterInfo[index].unit;
         if (output) {
-            output->println(String(index) + ": " + parameters[index].name + " = " + String(parameters[index].value));
+            output->println(message);
         } else {
-            printToAll(String(index) + ": " + parameters[index].name + " = " + String(parameters[index].value));
+            printToAll(message);
         }
     } else {
         if (output) {
@@ -87,46 +148,138 @@ void getParameter(int index, Stream *output) {
     }
 }
 
-void storeParametersToNVS(int index) {
-    preferences.begin("storage", false);
-    if (index == -1) {
-        // Default case: save all parameters
-        for (int i = 0; i < numParameters; i++) {
-            preferences.putInt(parameters[i].name.c_str(), parameters[i].value);
+void markParameterChanged(int index) {
+    if (index < 0 || index >= NUM_PARAMETERS) {
+        return;
+    }
+    portENTER_CRITICAL(&parameterMux);
+    dirtyParameters |= 1UL << index;
+    portEXIT_CRITICAL(&parameterMux);
+    parameterCommitTimer.start(); // Restarts the quiet period
+}
+
+// Runs in the timer task, which services the motor timeouts and must not wait
+// for flash, so the odometer journal task does the commit
+void onParameterCommitTimer() {
+    if (!requestParameterCommit()) {
+        commitParameters(); // No journal partition, and no other task to hand it to
+    }
+}
+
+// Put the changes that did not reach flash back and try again after the
+// quiet period. A newer change to the same parameter is kept, it is dirty too.
+void retryParameterCommit(uint32_t failed) {
+    portENTER_CRITICAL(&parameterMux);
+    dirtyParameters |= failed;
+    portEXIT_CRITICAL(&parameterMux);
+    parameterCommitTimer.start();
+}
+
+void commitParameters() {
+    parameterCommitTimer.stop();
+    portENTER_CRITICAL(&parameterMux);
+    uint32_t dirty = dirtyParameters;
+    dirtyParameters = 0;
+    portEXIT_CRITICAL(&parameterMux);
+    if (dirty == 0) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    if (nvs_open(PARAMETER_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        parameterStoreStats.errors++;
+        retryParameterCommit(dirty);
+        return;
+    }
+    uint32_t written = 0;       // Bits set but not committed yet
+    uint32_t failed = 0;
+    int32_t values[MAX_PARAMETERS];
+    for (int i = 0; i < NUM_PARAMETERS; i++) {
+        uint32_t bit = 1UL << i;
+        if (!(dirty & bit)) {
+            continue;
         }
-    } else if (index >= 0 && index < numParameters) {
-        // Specific parameter case: save specified parameter
-        preferences.putInt(parameters[index].name.c_str(), parameters[index].value);
-    } else {
-        // Error case: invalid index
-        printToAll("Error: Invalid index");
+        values[i] = parameterValues[i];
+        if ((storedParameters & bit) && storedValues[i] == values[i]) {
+            parameterStoreStats.skipped++;
+            continue;
+        }
+        if (nvs_set_i32(handle, parameterInfo[i].name, values[i]) == ESP_OK) {
+            written |= bit;
+        } else {
+            failed |= bit;
+            parameterStoreStats.errors++;
+        }
+    }
+    // Nothing reaches flash before the commit, so all values land together,
+    // and the shadow only learns them once they did
+    if (written) {
+        if (nvs_commit(handle) == ESP_OK) {
+            parameterStoreStats.commits++;
+            for (int i = 0; i < NUM_PARAMETERS; i++) {
+                if (written & (1UL << i)) {
+                    storedValues[i] = values[i];
+                    parameterStoreStats.writes++;
+                }
+            }
+            storedParameters |= written;
+        } else {
+            failed |= written;
+            parameterStoreStats.errors++;
+        }
+    }
+    nvs_close(handle);
+    if (failed) {
+        retryParameterCommit(failed);
     }
-    preferences.end();
+}
+
+ParameterStoreStats getParameterStoreStats() {
+    ParameterStoreStats stats = parameterStoreStats;
+    stats.pending = dirtyParameters;
+    return stats;
 }
 
 void clearNVS(int index, Stream *output) {
-    preferences.begin("storage", false);
+    nvs_handle_t handle;
+    if (nvs_open(PARAMETER_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        parameterStoreStats.errors++;
+        if (output) {
+            output->println("Error: Opening NVS failed");
+        } else {
+            printToAll("Error: Opening NVS failed");
+        }
+        return;
+    }
     if (index == -1) {
         // Clear all parameters
-        preferences.clear();
-        for(int i = 0; i < numParameters; i++) {
-            parameters[i].value = parameters[i].defaultValue;
+        nvs_erase_all(handle);
+        for(int i = 0; i < NUM_PARAMETERS; i++) {
+            applyParameter(i, parameterInfo[i].defaultValue);
         }
+        storedParameters = 0;
+        portENTER_CRITICAL(&parameterMux);
+        dirtyParameters = 0;
+        portEXIT_CRITICAL(&parameterMux);
         
         if (output) {
             output->println("NVS cleared, default values restored");
         } else {
             printToAll("NVS cleared, default values restored");
         }
-    } else if (index >= 0 && index < numParameters) {
+    } else if (index >= 0 && index < NUM_PARAMETERS) {
         // Clear specified parameter
-        preferences.remove(parameters[index].name.c_str());
-        parameters[index].value = parameters[index].defaultValue;
+        nvs_erase_key(handle, parameterInfo[index].name);
+        applyParameter(index, parameterInfo[index].defaultValue);
+        storedParameters &= ~(1UL << index);
+        portENTER_CRITICAL(&parameterMux);
+        dirtyParameters &= ~(1UL << index);
+        portEXIT_CRITICAL(&parameterMux);
         
         if (output) {
-            output->println("Parameter " + String(index) + " (" + parameters[index].name + ") cleared, default value (" + String(parameters[index].defaultValue) + ") restored");
+            output->println("Parameter " + String(index) + " (" + parameterInfo[index].name + ") cleared, default value (" + String(parameterInfo[index].defaultValue) + ") restored");
         } else {
-            printToAll("Parameter " + String(index) + " (" + parameters[index].name + ") cleared, default value (" + String(parameters[index].defaultValue) + ") restored");
+            printToAll("Parameter " + String(index) + " (" + parameterInfo[index].name + ") cleared, default value (" + String(parameterInfo[index].defaultValue) + ") restored");
         }
     } else {
         if (output) {
@@ -135,16 +288,44 @@ void clearNVS(int index, Stream *output) {
             printToAll("Error: Invalid index");
         }
     }
-    preferences.end();
-    storeParametersToNVS();
+    // A missing key loads as the default, so nothing is written back
+    if (nvs_commit(handle) == ESP_OK) {
+        parameterStoreStats.commits++;
+    } else {
+        parameterStoreStats.errors++;
+    }
+    nvs_close(handle);
+    if (index == -1 || index == 0) {
+        requestOdometerJournalWrite(); // The journal overrides NVS at boot, so keep it in step
+    }
+}
+
+// Read one parameter and remember what NVS holds for it. A namespace that was
+// never written cannot be opened read-only, every parameter is then at its default.
+void loadParameter(nvs_handle_t handle, bool opened, int index) {
+    uint32_t bit = 1UL << index;
+    int32_t value;
+    if (opened && nvs_get_i32(handle, parameterInfo[index].name, &value) == ESP_OK) {
+        storedParameters |= bit;
+        storedValues[index] = value;
+        // A value from older firmware with a wider range falls back to the default
+        applyParameter(index, isParameterInRange(index, value) ? value : parameterInfo[index].defaultValue);
+    } else {
+        applyParameter(index, parameterInfo[index].defaultValue);
+        storedParameters &= ~bit;
+    }
+    portENTER_CRITICAL(&parameterMux);
+    dirtyParameters &= ~bit;
+    portEXIT_CRITICAL(&parameterMux);
 }
 
 void updateParametersFromNVS(int index, Stream *output) {
-    preferences.begin("storage", true);
+    nvs_handle_t handle = 0;
+    bool opened = nvs_open(PARAMETER_NAMESPACE, NVS_READONLY, &handle) == ESP_OK;
     if (index == -1) {
         // Update all parameters
-        for (int i = 0; i < numParameters; i++) {
-            parameters[i].value = preferences.getInt(parameters[i].name.c_str(), parameters[i].defaultValue);
+        for (int i = 0; i < NUM_PARAMETERS; i++) {
+            loadParameter(handle, opened, i);
         }
         
         if (output) {
@@ -152,14 +333,14 @@ void updateParametersFromNVS(int index, Stream *output) {
         } else {
             printToAll("Parameters updated from NVS");
         }
-    } else if (index >= 0 && index < numParameters) {
+    } else if (index >= 0 && index < NUM_PARAMETERS) {
         // Update specified parameter
-        parameters[index].value = preferences.getInt(parameters[index].name.c_str(), parameters[index].defaultValue);
+        loadParameter(handle, opened, index);
         
         if (output) {
-            output->println("Parameter " + String(index) + " (" + parameters[index].name + ") updated from NVS");
+            output->println("Parameter " + String(index) + " (" + parameterInfo[index].name + ") updated from NVS");
         } else {
-            printToAll("Parameter " + String(index) + " (" + parameters[index].name + ") updated from NVS");
+            printToAll("Parameter " + String(index) + " (" + parameterInfo[index].name + ") updated from NVS");
         }
     } else {
         if (output) {
@@ -168,5 +349,7 @@ void updateParametersFromNVS(int index, Stream *output) {
             printToAll("Error: Invalid index");
         }
     }
-    preferences.end();
+    if (opened) {
+        nvs_close(handle);
+    }
 }
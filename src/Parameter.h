@@ -3,24 +3,105 @@
 
 #include <Arduino.h>
 
-struct Parameter {
-    int index;
-    String name;
-    int defaultValue;
-    int value;
+// Every parameter, in NVS and CLI index order. The name is the NVS key, at
+// most 15 characters.
+// X(id, type, name, unit, defaultValue, minValue, maxValue)
+#define PARAMETER_LIST(X) \
+    X(PARAM_ODOMETER_COUNT,     int32_t,  "OdometerCount",    "km",       202600, 0,   9999999) \
+    X(PARAM_BLINK_SPEED,        uint32_t, "BlinkSpeed",       "ms",       500,    10,  10000) \
+    X(PARAM_PULSE_DELAY,        uint32_t, "PulseDelay",       "ms",       100,    10,  1000) /* Pulse counter window */ \
+    X(PARAM_SPEED_FACTOR,       uint32_t, "SpeedFactor",      "mm/pulse", 800,    1,   2000) \
+    X(PARAM_SPEED_CROSSOVER,    uint32_t, "SpeedCrossover",   "pulses",   8,      1,   1000) /* Per window, below it speed comes from the edge period */ \
+    X(PARAM_ZERO_SPEED_TIMEOUT, uint32_t, "ZeroSpeedDelay",   "ms",       2000,   100, 60000) /* Without an edge before the speed reads 0 */ \
+    X(PARAM_SPEED_RATIO,        uint32_t, "SpeedRatio",       "um/rev",   0,      0,   10000000) /* Learned from the wheel pulses, 0 = unknown */
+
+enum ParameterId : uint8_t {
+#define PARAMETER_ENUM(id, type, name, unit, defaultValue, minValue, maxValue) id,
+    PARAMETER_LIST(PARAMETER_ENUM)
+#undef PARAMETER_ENUM
+    NUM_PARAMETERS
+};
+
+struct ParameterInfo {
+    const char *name;
+    const char *unit;
+    int32_t defaultValue;
+    int32_t minValue;
+    int32_t maxValue;
+};
+
+constexpr ParameterInfo parameterInfo[NUM_PARAMETERS] = {
+#define PARAMETER_ENTRY(id, type, name, unit, defaultValue, minValue, maxValue) {name, unit, defaultValue, minValue, maxValue},
+    PARAMETER_LIST(PARAMETER_ENTRY)
+#undef PARAMETER_ENTRY
+};
+
+// C type of each parameter, for parameterValue
+template <ParameterId id> struct ParameterType;
+#define PARAMETER_TYPE(id, type, name, unit, defaultValue, minValue, maxValue) \
+    template <> struct ParameterType<id> { typedef type Type; };
+PARAMETER_LIST(PARAMETER_TYPE)
+#undef PARAMETER_TYPE
+
+// Current values. Change them with updateParameter or setParameter; only the
+// pulse counter and the odometer journal write the odometer count directly.
+extern int32_t parameterValues[NUM_PARAMETERS];
+
+// Value of a parameter in its own type, e.g. parameterValue<PARAM_BLINK_SPEED>()
+template <ParameterId id>
+inline typename ParameterType<id>::Type parameterValue() {
+    return (typename ParameterType<id>::Type)parameterValues[id];
+}
+
+// Quiet period after the last change before changed parameters are written
+#define PARAMETER_COMMIT_DELAY_MS 2000
+
+// One bit per parameter in the dirty mask
+#define MAX_PARAMETERS 32
+
+#define PARAMETER_MAX_LISTENERS 8
+
+typedef void (*ParameterCallback)(ParameterId id, int32_t value);
+
+struct ParameterListener {
+    ParameterId id;
+    ParameterCallback callback;
 };
 
-extern Parameter parameters[];
-extern const int numParameters;
+struct ParameterStoreStats {
+    uint32_t commits;       // NVS transactions committed since boot
+    uint32_t writes;        // Values written since boot
+    uint32_t skipped;       // Changed parameters not written because NVS already held the value
+    uint32_t errors;        // Failed opens, writes or commits
+    uint32_t pending;       // Bit n set when parameter n waits for the next commit
+};
 
 // Initialize parameters
 void initializeParameter();
 
+// Call callback with the current value now and with the new value after every
+// change, so a task can keep values derived from it. The callback runs in the
+// task that made the change (CLI, BLE or odometer journal) and must be short.
+// Call from setup(), after initializeParameter().
+void onParameterChange(ParameterId id, ParameterCallback callback);
+
+// Store a value without printing anything. False when it is out of range.
+bool updateParameter(ParameterId id, int32_t value);
+
 // Parameter functions
 void setParameter(int index, int value, Stream *output = nullptr);
 void getParameter(int index, Stream *output = nullptr);
-void storeParametersToNVS(int index = -1);
 void clearNVS(int index = -1, Stream *output = nullptr);
 void updateParametersFromNVS(int index = -1, Stream *output = nullptr);
 
+// Mark a parameter as changed. Changes are coalesced and written in one NVS
+// transaction PARAMETER_COMMIT_DELAY_MS after the last one.
+void markParameterChanged(int index);
+
+// Write the changed parameters now, in the calling task. Used by the odometer
+// journal task and before a restart.
+void commitParameters();
+
+ParameterStoreStats getParameterStoreStats();
+
 #endif // PARAMETER_H
@@ -3,73 +3,342 @@
 #include "PinAssignments.h"
 #include <driver/pcnt.h>
 #include "driveTelemetry.h"
+#include "GaugeControl.h"
+#include "OdometerJournal.h"
+#include "SpeedFusion.h"
+#include "TaskTable.h"
+#include "TelemetryBus.h"
+#include "Log.h"
 
-volatile uint32_t pulseCount = 0;
+// Wheel pulses are counted by the PCNT peripheral on both edges, like the
+// old polling loop did. The unit wraps to 0 at PCNT_HIGH_LIMIT and the
+// overflow interrupt keeps track of how many times that happened.
+#define PCNT_SPEED_UNIT     PCNT_UNIT_0
+#define PCNT_HIGH_LIMIT     32000   // Counter value that raises the overflow interrupt
+#define PCNT_FILTER_VALUE   1023    // Glitch filter in APB cycles, 1023 = 12.8 us (the maximum)
+#define PCNT_FILTER_MICROS  13      // The same filter rounded up to whole microseconds
+
+// Fastest the wheel can really turn (360 km/h). Faster samples are glitches and are
+// clamped, and rising edges closer than this speed allows are contact bounce.
+#define SPEED_MAX_MM_PER_S  100000
+
+volatile uint32_t pcntOverflows = 0;
+uint32_t lastPulseTotal = 0;
+
+// At low speed a window holds only a few pulses, so the speed is taken from
+// the time between rising edges instead. The edge interrupt is only attached
+// while below the crossover, at higher speeds PCNT does all the work.
+portMUX_TYPE edgeMux = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t lastEdgeMicros = 0;       // Time of the last rising edge, 0 = none since attaching
+volatile uint32_t edgePeriodMicros = 0;     // Time between the last two rising edges, 0 = unknown
+volatile uint32_t edgeBounces = 0;          // Rising edges rejected by the minimum period
+bool edgeCaptureEnabled = false;
 volatile uint32_t speed = 0;
+
+// Standing still there is nothing to sample, so the speed task parks until the
+// edge interrupt sees the wheel turn again
+TaskHandle_t speedTaskHandle = NULL;
+volatile bool speedTaskParked = false;
+
+// Odometer km (PARAM_ODOMETER_COUNT), accumulated_distance and trip_distance change
+// together under distanceMux so the journal always sees a consistent set
+portMUX_TYPE distanceMux = portMUX_INITIALIZER_UNLOCKED;
 volatile uint32_t accumulated_distance = 0;
 volatile uint32_t trip_distance = 0;
+uint32_t distanceSinceJournal = 0;
+int32_t publishedOdometerKm = -1;     // Odometer and trip as last published on TOPIC_DISTANCE
+uint32_t publishedTrip = 0;
+
+// Parameters of the speed task, derived once when they change instead of every window
+volatile uint32_t pulseDistanceMm = 0;      // SpeedFactor
+volatile uint32_t edgeSpeedFactor = 0;      // Two pulses in mm times 1000000, over the edge period in us gives mm/s
+volatile uint32_t minEdgeMicros = PCNT_FILTER_MICROS; // Edge period at SPEED_MAX_MM_PER_S, never below the PCNT filter
+volatile uint32_t crossoverPulses = 0;      // SpeedCrossover
+volatile uint32_t zeroSpeedMicros = 0;      // ZeroSpeedDelay in us
+volatile TickType_t windowTicks = 0;        // PulseDelay in ticks
 
 void calculate_speed_task(void *pvParameters);
-void pulse_reading_task(void *pvParameters);
+void initializePulseCounter();
+uint32_t readPulseCount();
+void setEdgeCapture(bool enable);
+uint32_t periodSpeed();
+uint32_t windowSpeed(uint32_t pulses, uint32_t distance, uint32_t elapsedMicros, uint32_t crossover);
+uint32_t addDistance(uint32_t pulses);
+uint32_t smoothSpeed(int32_t &smoothedSpeedQ, uint32_t local);
+uint32_t mmPerSToKmh(uint32_t mmPerS);
 void checkAndIncrementOdometer();
 void checkAndResetTripOdometer();
 
+// SpeedFactor is at most 2000 mm, so edgeSpeedFactor fits in 32 bits
+static_assert(2ULL * 2000 * 1000000 <= UINT32_MAX, "edgeSpeedFactor overflows");
+
+void onSpeedParameterChange(ParameterId id, int32_t value) {
+    switch (id) {
+        case PARAM_SPEED_FACTOR:
+            pulseDistanceMm = value;
+            edgeSpeedFactor = 2UL * value * 1000000UL;
+            minEdgeMicros = max(edgeSpeedFactor / SPEED_MAX_MM_PER_S, (uint32_t)PCNT_FILTER_MICROS);
+            break;
+        case PARAM_SPEED_CROSSOVER:
+            crossoverPulses = value;
+            break;
+        case PARAM_ZERO_SPEED_TIMEOUT:
+            zeroSpeedMicros = value * 1000UL;
+            break;
+        case PARAM_PULSE_DELAY:
+            windowTicks = pdMS_TO_TICKS(value);
+            setTaskPeriod(TASK_SPEED, value);
+            break;
+        default:
+            break;
+    }
+}
+
 void initializePulseCounterTask() {
+    onParameterChange(PARAM_SPEED_FACTOR, onSpeedParameterChange);
+    onParameterChange(PARAM_SPEED_CROSSOVER, onSpeedParameterChange);
+    onParameterChange(PARAM_ZERO_SPEED_TIMEOUT, onSpeedParameterChange);
+    onParameterChange(PARAM_PULSE_DELAY, onSpeedParameterChange);
+
     pinMode(PULSE_INPUT_PIN, INPUT);
+    initializePulseCounter();
+
+    setEdgeCapture(true);   // Standing still, so start in period mode
 
-    xTaskCreate(pulse_reading_task, "PulseReadingTask", 2048, NULL, 1, NULL);
-    xTaskCreate(calculate_speed_task, "CalculateSpeedTask", 2048, NULL, 2, NULL);
+    // Restore the distances from the journal before the first pulse is counted
+    initializeOdometerJournal();
+
+    createTask(TASK_SPEED, calculate_speed_task, &speedTaskHandle);
 }
 
-void pulse_reading_task(void *pvParameters) {
-    bool lastState = digitalRead(PULSE_INPUT_PIN);
-    for (;;) {
-        bool currentState = digitalRead(PULSE_INPUT_PIN);
-        if (currentState != lastState) {
-            pulseCount++;
-            lastState = currentState;
-        }
-        vTaskDelay(pdMS_TO_TICKS(1));
+void IRAM_ATTR pcntOverflowISR(void *arg) {
+    uint32_t status = 0;
+    pcnt_get_event_status(PCNT_SPEED_UNIT, &status);
+    if (status & PCNT_EVT_H_LIM) {
+        pcntOverflows++;
     }
 }
 
-void calculate_speed_task(void *pvParameters) {
-    TickType_t lastTime = xTaskGetTickCount(); // Initial time in ticks
-    float alpha = 0.1; // Smoothing factor for EMA, adjust as needed
-    float smoothedPulseCount = 0; // EMA of pulse count
+void initializePulseCounter() {
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = PULSE_INPUT_PIN;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.pos_mode = PCNT_COUNT_INC;    // Count rising edges
+    config.neg_mode = PCNT_COUNT_INC;    // and falling edges
+    config.counter_h_lim = PCNT_HIGH_LIMIT;
+    config.counter_l_lim = 0;
+    config.unit = PCNT_SPEED_UNIT;
+    config.channel = PCNT_CHANNEL_0;
 
-    for (;;) {
-        int PulseDistance = parameters[3].value; // Distance in mm per pulse
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        LOG(LOG_PULSE_COUNTER_FAILED);
+        return;
+    }
 
-        // Update the smoothed pulse count with an exponential moving average
-        smoothedPulseCount = alpha * pulseCount + (1 - alpha) * smoothedPulseCount;
-        pulseCount = 0; // Reset the pulse count for the next period
+    pcnt_set_filter_value(PCNT_SPEED_UNIT, PCNT_FILTER_VALUE);
+    pcnt_filter_enable(PCNT_SPEED_UNIT);
 
-        uint32_t distance = smoothedPulseCount * PulseDistance; // distance in mm
+    pcnt_event_enable(PCNT_SPEED_UNIT, PCNT_EVT_H_LIM);
+    pcnt_isr_service_install(0);
+    pcnt_isr_handler_add(PCNT_SPEED_UNIT, pcntOverflowISR, NULL);
 
-        accumulated_distance += distance;
-        trip_distance += distance;
+    pcnt_counter_pause(PCNT_SPEED_UNIT);
+    pcnt_counter_clear(PCNT_SPEED_UNIT);
+    pcnt_counter_resume(PCNT_SPEED_UNIT);
+}
 
-        checkAndIncrementOdometer();
-        checkAndResetTripOdometer();
+// Pulses counted since the previous call. The counter keeps running, so no
+// edges are lost between reading and clearing it.
+uint32_t readPulseCount() {
+    uint32_t overflows;
+    int16_t count;
+    do {
+        overflows = pcntOverflows;
+        pcnt_get_counter_value(PCNT_SPEED_UNIT, &count);
+    } while (overflows != pcntOverflows); // Retry if the counter wrapped while reading
 
-        TickType_t currentTime = xTaskGetTickCount();
-        TickType_t elapsedTime = currentTime - lastTime; // Elapsed time in ticks
-        lastTime = currentTime; // Update lastTime for the next cycle
+    uint32_t total = overflows * PCNT_HIGH_LIMIT + (uint16_t)count;
+    if ((int32_t)(total - lastPulseTotal) < 0) {
+        return 0;   // The counter wrapped but the overflow interrupt has not run yet
+    }
+    uint32_t pulses = total - lastPulseTotal;
+    lastPulseTotal = total;
+    return pulses;
+}
 
-        // Convert elapsed time from ticks to milliseconds
-        uint32_t elapsedTimeMs = (elapsedTime * 1000) / configTICK_RATE_HZ;
+// The GPIO interrupt has no glitch filter of its own, so an edge that follows
+// the last accepted one sooner than minEdgeMicros is dropped as a bounce.
+void IRAM_ATTR pulseEdgeISR() {
+    uint32_t now = micros();
+    portENTER_CRITICAL_ISR(&edgeMux);
+    if (lastEdgeMicros != 0 && now - lastEdgeMicros < minEdgeMicros) {
+        edgeBounces++;
+        portEXIT_CRITICAL_ISR(&edgeMux);
+        return;
+    }
+    if (lastEdgeMicros != 0) {
+        edgePeriodMicros = now - lastEdgeMicros;
+    }
+    lastEdgeMicros = now;
+    portEXIT_CRITICAL_ISR(&edgeMux);
 
-        // Calculate speed
-        uint32_t local = 0;
-        if (elapsedTimeMs > 0) {
-            local = distance * 1000 / elapsedTimeMs; // speed in mm/s
+    if (speedTaskParked) {
+        speedTaskParked = false;
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(speedTaskHandle, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+}
+
+void setEdgeCapture(bool enable) {
+    if (enable == edgeCaptureEnabled) {
+        return;
+    }
+    if (enable) {
+        // Old timestamps are meaningless after a stretch in count mode
+        portENTER_CRITICAL(&edgeMux);
+        lastEdgeMicros = 0;
+        edgePeriodMicros = 0;
+        portEXIT_CRITICAL(&edgeMux);
+        attachInterrupt(digitalPinToInterrupt(PULSE_INPUT_PIN), pulseEdgeISR, RISING);
+    } else {
+        detachInterrupt(digitalPinToInterrupt(PULSE_INPUT_PIN));
+    }
+    edgeCaptureEnabled = enable;
+}
+
+// Speed in mm/s from the period between rising edges (two counted pulses),
+// 0 when no edge arrived within the zero-speed timeout.
+uint32_t periodSpeed() {
+    portENTER_CRITICAL(&edgeMux);
+    uint32_t lastEdge = lastEdgeMicros;
+    uint32_t period = edgePeriodMicros;
+    portEXIT_CRITICAL(&edgeMux);
+
+    if (lastEdge == 0 || period == 0) {
+        return 0;
+    }
+    uint32_t sinceEdge = micros() - lastEdge;
+    if (sinceEdge >= zeroSpeedMicros) {
+        return 0;
+    }
+    if (sinceEdge > period) {
+        period = sinceEdge; // Slowing down: the next edge is at least this far away
+    }
+    return edgeSpeedFactor / period;
+}
+
+// Speed smoothing is an EMA in Q8 fixed point (mm/s << 8). SPEED_EMA_ALPHA
+// is the weight of a new sample out of 256, 26/256 is about 0.1.
+#define SPEED_Q_BITS        8
+#define SPEED_EMA_ALPHA     26
+
+// The clamped sample in Q8, and its difference to the smoothed value times alpha, fit in 32 bits
+static_assert((int64_t)SPEED_MAX_MM_PER_S * SPEED_EMA_ALPHA << SPEED_Q_BITS <= INT32_MAX, "Speed EMA overflows");
+
+// Speed of one window in mm/s, from the edge period at low speed and from the
+// pulse count above it, clamped to SPEED_MAX_MM_PER_S
+uint32_t windowSpeed(uint32_t pulses, uint32_t distance, uint32_t elapsedMicros, uint32_t crossover) {
+    uint64_t local = 0;
+    if (pulses < crossover) {
+        setEdgeCapture(true);
+        local = periodSpeed();
+    } else {
+        // Keep capturing edges up to twice the crossover so the mode does not flap
+        if (pulses >= 2 * crossover) {
+            setEdgeCapture(false);
         }
-        speed = local * 36 / 10000; // speed in km/h
+        if (elapsedMicros > 0) {
+            local = (uint64_t)distance * 1000000UL / elapsedMicros;
+        }
+    }
+    return (uint32_t)min(local, (uint64_t)SPEED_MAX_MM_PER_S);
+}
+
+// Add the pulses of one window to the odometer and trip, and publish or
+// journal the distances when due. Distance is exact: whole pulses times whole
+// millimetres, nothing is rounded away. Returns the distance in mm.
+uint32_t addDistance(uint32_t pulses) {
+    uint32_t distance = pulses * pulseDistanceMm;
+
+    portENTER_CRITICAL(&distanceMux);
+    accumulated_distance += distance;
+    trip_distance += distance;
+
+    checkAndIncrementOdometer();
+    checkAndResetTripOdometer();
+    portEXIT_CRITICAL(&distanceMux);
+
+    // The display shows whole km and 100 m of trip, publish when either moves
+    int32_t odometerKm = parameterValue<PARAM_ODOMETER_COUNT>();
+    uint32_t trip = getTripOdometer();
+    if (odometerKm != publishedOdometerKm || trip != publishedTrip) {
+        publishedOdometerKm = odometerKm;
+        publishedTrip = trip;
+        publishTelemetry(TOPIC_DISTANCE);
+    }
+
+    // Let the journal task record the distances every JOURNAL_INTERVAL_MM
+    distanceSinceJournal += distance;
+    if (distanceSinceJournal >= JOURNAL_INTERVAL_MM) {
+        distanceSinceJournal = 0;
+        requestOdometerJournalWrite();
+    }
+    return distance;
+}
+
+// smoothed += alpha * (sample - smoothed), in Q8. Returns the smoothed speed
+// rounded to whole mm/s.
+uint32_t smoothSpeed(int32_t &smoothedSpeedQ, uint32_t local) {
+    int32_t sampleQ = (int32_t)(local << SPEED_Q_BITS);
+    smoothedSpeedQ += ((sampleQ - smoothedSpeedQ) * SPEED_EMA_ALPHA) >> 8;
+    return (smoothedSpeedQ + (1 << (SPEED_Q_BITS - 1))) >> SPEED_Q_BITS;
+}
+
+// mm/s to km/h is * 3.6, rounded to the nearest km/h
+uint32_t mmPerSToKmh(uint32_t mmPerS) {
+    return (mmPerS * 36 + 5000) / 10000;
+}
+
+void calculate_speed_task(void *pvParameters) {
+    uint32_t lastMicros = micros();
+    int32_t smoothedSpeedQ = 0;   // Smoothed speed in mm/s, Q8
+
+    for (;;) {
+        uint32_t crossover = crossoverPulses;
+
+        uint32_t edgeAtSample = lastEdgeMicros;
+        uint32_t pulses = readPulseCount();
+        uint32_t distance = addDistance(pulses); // distance in mm
+
+        // Elapsed time in microseconds, so the window length does not round either
+        uint32_t currentMicros = micros();
+        uint32_t elapsedMicros = currentMicros - lastMicros;
+        lastMicros = currentMicros;
+
+        uint32_t local = windowSpeed(pulses, distance, elapsedMicros, crossover); // speed in mm/s
+
+        uint32_t smoothedMmPerS = smoothSpeed(smoothedSpeedQ, local);
+        speed = mmPerSToKmh(smoothedMmPerS); // speed in km/h
 
-        telemetryData.speed = speed;
+        // telemetryData.speed is the wheel speed fused with the motor RPM
+        updateFusionFromWheel(local, smoothedMmPerS, pulses >= crossover);
 
-        vTaskDelay(pdMS_TO_TICKS(parameters[2].value));
+        if (smoothedSpeedQ == 0 && pulses == 0 && edgeCaptureEnabled) {
+            // Fully stopped: sleep until the next wheel edge, unless one slipped in just now
+            markTaskIdle(TASK_SPEED);
+            speedTaskParked = true;
+            if (lastEdgeMicros == edgeAtSample) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            speedTaskParked = false;
+            lastMicros = micros();
+        } else {
+            vTaskDelay(windowTicks);
+        }
+        countTaskWakeup(TASK_SPEED);
     }
 }
 
@@ -79,17 +348,14 @@ uint32_t getSpeed() {
 
 void checkAndIncrementOdometer() {
     if (accumulated_distance >= 1000000) {
-        int OdometerCount = parameters[0].value;
-        OdometerCount += 1;
-        parameters[0].value = OdometerCount;
-        storeParametersToNVS(0);
+        parameterValues[PARAM_ODOMETER_COUNT]++; // Persisted by the odometer journal
         accumulated_distance -= 1000000;
     }
 }
 
 void checkAndResetTripOdometer() {
-    if (trip_distance >= 1000000000) { // 1000000000 mm = 100000 m = 100 km
-        trip_distance -= 1000000000;
+    if (trip_distance >= TRIP_ODOMETER_LIMIT * 100000UL) { // 1000000000 mm = 1000 km
+        trip_distance -= TRIP_ODOMETER_LIMIT * 100000UL;
     }
 }
 
@@ -98,9 +364,39 @@ uint32_t getTripOdometer() {
 }
 
 void resetTripOdometer() {
-    trip_distance = 0;
+    setTripOdometer(0);
 }
 
-void setTripOdometer(uint32_t value) {
+bool setTripOdometer(uint32_t value) {
+    if (value >= TRIP_ODOMETER_LIMIT) {
+        return false;
+    }
+    portENTER_CRITICAL(&distanceMux);
     trip_distance = value * 100000; // convert 100 m to mm
+    portEXIT_CRITICAL(&distanceMux);
+    requestOdometerJournalWrite();
+    publishTelemetry(TOPIC_DISTANCE);
+    return true;
+}
+
+void setOdometerKm(int32_t km) {
+    portENTER_CRITICAL(&distanceMux);
+    parameterValues[PARAM_ODOMETER_COUNT] = km;
+    portEXIT_CRITICAL(&distanceMux);
+}
+
+void restoreDistances(uint32_t odometerKm, uint32_t odometerMm, uint32_t tripMm) {
+    portENTER_CRITICAL(&distanceMux);
+    parameterValues[PARAM_ODOMETER_COUNT] = odometerKm;
+    accumulated_distance = odometerMm;
+    trip_distance = tripMm;
+    portEXIT_CRITICAL(&distanceMux);
+}
+
+void getDistanceSnapshot(uint32_t &odometerKm, uint32_t &odometerMm, uint32_t &tripMm) {
+    portENTER_CRITICAL(&distanceMux);
+    odometerKm = parameterValue<PARAM_ODOMETER_COUNT>();
+    odometerMm = accumulated_distance;
+    tripMm = trip_distance;
+    portEXIT_CRITICAL(&distanceMux);
 }
@@ -9,9 +9,19 @@ void initializePulseCounterTask();
 // Function to get the speed value
 uint32_t getSpeed();
 
+// The trip odometer counts in 100 m and wraps to 0 at 1000 km
+#define TRIP_ODOMETER_LIMIT 10000
+
 // Function for the trip odometer
 uint32_t getTripOdometer();
-void setTripOdometer(uint32_t value);
+bool setTripOdometer(uint32_t value);   // False when value is not below TRIP_ODOMETER_LIMIT
 void resetTripOdometer();
 
+// Set the whole-km odometer (PARAM_ODOMETER_COUNT) under the distance lock
+void setOdometerKm(int32_t km);
+
+// Odometer and trip distances, used by the odometer journal
+void restoreDistances(uint32_t odometerKm, uint32_t odometerMm, uint32_t tripMm);
+void getDistanceSnapshot(uint32_t &odometerKm, uint32_t &odometerMm, uint32_t &tripMm);
+
 #endif  // PULSE_COUNTER_TASK_H
@@ -1,22 +1,34 @@
 #include "Semaphores.h"
+#include "Log.h"
 
 SemaphoreHandle_t spiBusMutex = NULL;
 SemaphoreHandle_t buttonSemaphore = NULL;
 SemaphoreHandle_t buttonStateSemaphore = NULL;
+SemaphoreHandle_t outputRoomSemaphore = NULL;
+
+// Static storage, so the semaphores never come from the heap
+StaticSemaphore_t spiBusMutexBuffer;
+StaticSemaphore_t buttonSemaphoreBuffer;
+StaticSemaphore_t buttonStateSemaphoreBuffer;
+StaticSemaphore_t outputRoomSemaphoreBuffer;
 
 void createSemaphores() {
     // Create the SPI bus mutex before starting tasks
-    spiBusMutex = xSemaphoreCreateMutex(); // this mutex is no longer needed, since the SPI bus is now only used in the display task
-    buttonSemaphore = xSemaphoreCreateBinary();
-    buttonStateSemaphore = xSemaphoreCreateCounting(2, 0);
+    spiBusMutex = xSemaphoreCreateMutexStatic(&spiBusMutexBuffer); // this mutex is no longer needed, since the SPI bus is now only used in the display task
+    buttonSemaphore = xSemaphoreCreateBinaryStatic(&buttonSemaphoreBuffer);
+    buttonStateSemaphore = xSemaphoreCreateCountingStatic(2, 0, &buttonStateSemaphoreBuffer);
+    outputRoomSemaphore = xSemaphoreCreateBinaryStatic(&outputRoomSemaphoreBuffer);
     if (spiBusMutex == NULL) {
-        Serial.println("Failed to create SPI bus mutex");
+        LOG(LOG_SEMAPHORE_FAILED, "SPI bus mutex");
         while (1);
     } else if (buttonSemaphore == NULL) {
-        Serial.println("Failed to create button semaphore");
+        LOG(LOG_SEMAPHORE_FAILED, "button semaphore");
         while (1);
     } else if (buttonStateSemaphore == NULL) {
-        Serial.println("Failed to create button state semaphore");
+        LOG(LOG_SEMAPHORE_FAILED, "button state semaphore");
+        while (1);
+    } else if (outputRoomSemaphore == NULL) {
+        LOG(LOG_SEMAPHORE_FAILED, "output room semaphore");
         while (1);
     }
 }
@@ -7,6 +7,9 @@ extern SemaphoreHandle_t spiBusMutex; // Not used since switching to build in CA
                                       // but kept for compatibility with the display task
 extern SemaphoreHandle_t buttonSemaphore;
 extern SemaphoreHandle_t buttonStateSemaphore;
+extern SemaphoreHandle_t outputRoomSemaphore;    // Given by the output task when a full sink has room again
+
+#define NUM_SEMAPHORES 4
 
 void createSemaphores();
 
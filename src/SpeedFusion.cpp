@@ -0,0 +1,131 @@
+#include "SpeedFusion.h"
+#include "Parameter.h"
+#include "driveTelemetry.h"
+#include "TelemetryBus.h"
+
+// All speeds are mm/s in Q8 fixed point, the ratio is um per motor revolution in Q8
+#define FUSION_Q_BITS           8
+#define FUSION_WHEEL_GAIN       51      // Correction towards the wheel speed per window, 51/256 = 0.2
+#define FUSION_LEARN_SHIFT      6       // Ratio EMA weight 1/64 per reliable window
+#define FUSION_RPM_TIMEOUT_MS   500     // RPM older than this is ignored
+#define FUSION_LEARN_MIN_SPEED  2778    // mm/s (10 km/h), slower windows are too coarse to learn from
+#define FUSION_LEARN_MIN_RPM    300     // Below this the RPM resolution is too coarse to learn from
+#define FUSION_STORE_THRESHOLD  200     // Store the ratio when it moved more than 1/200 (0.5 %)
+
+portMUX_TYPE fusionMux = portMUX_INITIALIZER_UNLOCKED;
+int32_t fusedSpeedQ = 0;            // Fused speed, mm/s Q8
+int32_t lastRpmSpeedQ = 0;          // Speed implied by the last RPM frame, mm/s Q8
+int32_t lastRpm = 0;                // Absolute RPM of the last frame
+unsigned long lastRpmMillis = 0;    // When the last RPM frame arrived, 0 = never
+bool rpmSpeedValid = false;         // lastRpmSpeedQ holds a usable value
+int64_t learnedRatioQ = 0;          // um/rev Q8, 0 = unknown
+
+void publishFusedSpeed();
+
+uint32_t roundRatio(int64_t ratioQ) {
+    return (uint32_t)((ratioQ + (1 << (FUSION_Q_BITS - 1))) >> FUSION_Q_BITS);
+}
+
+// A ratio set with "p 6" or cleared with "p clear 6" replaces the learned one,
+// and the last RPM speed is no longer comparable with the next. Storing the
+// learned ratio comes back here with its own rounded value, which is ignored
+// so the fraction keeps learning.
+void onSpeedRatioChange(ParameterId id, int32_t value) {
+    portENTER_CRITICAL(&fusionMux);
+    if (roundRatio(learnedRatioQ) != (uint32_t)value) {
+        learnedRatioQ = (int64_t)value << FUSION_Q_BITS;
+        rpmSpeedValid = false;
+    }
+    portEXIT_CRITICAL(&fusionMux);
+}
+
+void initializeSpeedFusion() {
+    onParameterChange(PARAM_SPEED_RATIO, onSpeedRatioChange);
+}
+
+void updateFusionFromRpm(int16_t rpm) {
+    int32_t absRpm = abs(rpm);
+
+    portENTER_CRITICAL(&fusionMux);
+    int64_t ratioQ = learnedRatioQ;
+    // mm/s = rpm / 60 * um per rev / 1000
+    int32_t rpmSpeedQ = (int32_t)(absRpm * ratioQ / 60000);
+    bool fresh = rpmSpeedValid && (millis() - lastRpmMillis) < FUSION_RPM_TIMEOUT_MS;
+    if (ratioQ > 0 && fresh) {
+        // Predict: the speed changes exactly as much as the motor speed implies
+        fusedSpeedQ += rpmSpeedQ - lastRpmSpeedQ;
+        if (fusedSpeedQ < 0) fusedSpeedQ = 0;
+    }
+    lastRpmSpeedQ = rpmSpeedQ;
+    lastRpm = absRpm;
+    lastRpmMillis = millis();
+    rpmSpeedValid = ratioQ > 0;
+    portEXIT_CRITICAL(&fusionMux);
+
+    publishFusedSpeed();
+}
+
+void updateFusionFromWheel(uint32_t wheelMmPerS, uint32_t smoothedMmPerS, bool reliable) {
+    int32_t wheelQ = (int32_t)(wheelMmPerS << FUSION_Q_BITS);
+
+    portENTER_CRITICAL(&fusionMux);
+    bool rpmFresh = rpmSpeedValid && (millis() - lastRpmMillis) < FUSION_RPM_TIMEOUT_MS;
+
+    // Learn the ratio from steady, well resolved windows
+    if (reliable && wheelMmPerS >= FUSION_LEARN_MIN_SPEED && lastRpm >= FUSION_LEARN_MIN_RPM &&
+        (millis() - lastRpmMillis) < FUSION_RPM_TIMEOUT_MS) {
+        int64_t sampleQ = ((int64_t)wheelMmPerS * 60000 << FUSION_Q_BITS) / lastRpm;
+        int64_t ratioQ = learnedRatioQ;
+        if (ratioQ == 0) {
+            learnedRatioQ = sampleQ;   // First estimate
+        } else {
+            learnedRatioQ = ratioQ + ((sampleQ - ratioQ) >> FUSION_LEARN_SHIFT);
+        }
+    }
+
+    if (rpmFresh) {
+        // Correct: pull the RPM prediction towards the wheel speed
+        fusedSpeedQ += ((wheelQ - fusedSpeedQ) * FUSION_WHEEL_GAIN) >> 8;
+    } else {
+        // No RPM (motor off, frames lost or ratio unknown): wheel pulses only
+        fusedSpeedQ = (int32_t)(smoothedMmPerS << FUSION_Q_BITS);
+    }
+    if (fusedSpeedQ < 0) fusedSpeedQ = 0;
+    portEXIT_CRITICAL(&fusionMux);
+
+    publishFusedSpeed();
+}
+
+void publishFusedSpeed() {
+    Telemetry update;
+    portENTER_CRITICAL(&fusionMux);
+    uint32_t mmPerS = (fusedSpeedQ + (1 << (FUSION_Q_BITS - 1))) >> FUSION_Q_BITS;
+    update.speed = (mmPerS * 36 + 5000) / 10000;
+    // Still under the fusion lock, so the speeds land in the order they were fused
+    bool changed = writeTelemetry(update, TOPIC_SPEED) != 0;
+    portEXIT_CRITICAL(&fusionMux);
+
+    if (changed) {
+        publishTelemetry(TOPIC_SPEED);
+    }
+}
+
+void storeLearnedSpeedRatio() {
+    uint32_t ratio = getLearnedSpeedRatio();
+    int stored = parameterValue<PARAM_SPEED_RATIO>();
+    if (ratio == 0 || abs((int)ratio - stored) * FUSION_STORE_THRESHOLD <= stored) {
+        return;
+    }
+    updateParameter(PARAM_SPEED_RATIO, ratio);
+}
+
+uint32_t getFusedSpeedMmPerS() {
+    return (fusedSpeedQ + (1 << (FUSION_Q_BITS - 1))) >> FUSION_Q_BITS;
+}
+
+uint32_t getLearnedSpeedRatio() {
+    portENTER_CRITICAL(&fusionMux);
+    int64_t ratioQ = learnedRatioQ;
+    portEXIT_CRITICAL(&fusionMux);
+    return roundRatio(ratioQ);
+}
@@ -0,0 +1,27 @@
+#ifndef SPEED_FUSION_H
+#define SPEED_FUSION_H
+
+#include <Arduino.h>
+
+// Fuses wheel-pulse speed with motor RPM into telemetryData.speed.
+// RPM (CAN 0x06) gives fast updates through the fixed drivetrain ratio,
+// the wheel pulses correct drift and teach the ratio (parameter 6).
+
+// Follow the stored ratio, call after initializeParameter()
+void initializeSpeedFusion();
+
+// Called by the CAN listener for every motor frame
+void updateFusionFromRpm(int16_t rpm);
+
+// Called by the speed task every window. wheelMmPerS is the unsmoothed wheel
+// speed, smoothedMmPerS the EMA used when no RPM is available, and reliable
+// is true when the window held enough pulses to trust it for learning.
+void updateFusionFromWheel(uint32_t wheelMmPerS, uint32_t smoothedMmPerS, bool reliable);
+
+// Store the learned ratio in NVS if it moved noticeably, called on ignition off
+void storeLearnedSpeedRatio();
+
+uint32_t getFusedSpeedMmPerS();
+uint32_t getLearnedSpeedRatio();   // um of travel per motor revolution, 0 = not learned yet
+
+#endif // SPEED_FUSION_H
@@ -0,0 +1,307 @@
+#include "TaskTable.h"
+#include "Log.h"
+
+const TaskInfo taskTable[NUM_TASKS] = {
+#define TASK_INFO(id, name, core, priority, stack, period) {name, core, priority, stack, period},
+    TASK_LIST(TASK_INFO)
+#undef TASK_INFO
+};
+
+static_assert(TASK_STACK_TOTAL <= TASK_STACK_BUDGET, "Task stacks exceed TASK_STACK_BUDGET");
+
+// One static stack per task, sized by the table
+#define TASK_STACK(id, name, core, priority, stack, period) StackType_t id##_stack[stack];
+TASK_LIST(TASK_STACK)
+#undef TASK_STACK
+
+StackType_t *const taskStacks[NUM_TASKS] = {
+#define TASK_STACK_POINTER(id, name, core, priority, stack, period) id##_stack,
+    TASK_LIST(TASK_STACK_POINTER)
+#undef TASK_STACK_POINTER
+};
+
+StaticTask_t taskBuffers[NUM_TASKS];
+TaskHandle_t taskHandles[NUM_TASKS] = {NULL};   // NULL until the task is created
+
+// A task misses its deadline when it goes more than twice its period without waking
+#define TASK_DEADLINE_FACTOR 2
+
+// Each entry is only written by its own task
+struct TaskStats {
+    uint32_t wakeups;
+    uint32_t reportedWakeups;
+    unsigned long lastWakeup;   // millis() of the last wakeup, 0 = idle or not started
+    unsigned long maxGap;       // Longest time between wakeups while active
+    uint32_t deadlineMisses;
+};
+
+TaskStats taskStats[NUM_TASKS] = {};
+
+// Deadline periods, starting from the table and changed with setTaskPeriod()
+volatile uint32_t taskPeriods[NUM_TASKS] = {
+#define TASK_PERIOD(id, name, core, priority, stack, period) period,
+    TASK_LIST(TASK_PERIOD)
+#undef TASK_PERIOD
+};
+unsigned long lastWakeupReport = 0;
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    const TaskInfo &info = taskTable[task];
+    if (taskHandles[task] != NULL) {
+        LOG(LOG_TASK_EXISTS, info.name);
+        return false;
+    }
+
+    TaskHandle_t created = xTaskCreateStaticPinnedToCore(function, info.name, info.stackSize, parameter,
+                                                         info.priority, taskStacks[task], &taskBuffers[task], info.core);
+    if (created == NULL) {
+        LOG(LOG_TASK_FAILED, info.name);
+        return false;
+    }
+    taskHandles[task] = created;
+    if (handle != NULL) {
+        *handle = created;
+    }
+    return true;
+}
+
+void printTaskMemory(Stream &stream) {
+    for (int i = 0; i < NUM_TASKS; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "    %-26s %6lu%s", taskTable[i].name,
+                 (unsigned long)(taskTable[i].stackSize + sizeof(StaticTask_t)),
+                 taskHandles[i] != NULL ? "" : "  (not started)");
+        stream.println(line);
+    }
+}
+
+void countTaskWakeup(TaskId task) {
+    TaskStats &stats = taskStats[task];
+    stats.wakeups++;
+
+    unsigned long now = millis();
+    uint32_t period = taskPeriods[task];
+    if (period != 0 && stats.lastWakeup != 0) {
+        unsigned long gap = now - stats.lastWakeup;
+        if (gap > stats.maxGap) {
+            stats.maxGap = gap;
+        }
+        if (gap > period * TASK_DEADLINE_FACTOR) {
+            stats.deadlineMisses++;
+        }
+    }
+    stats.lastWakeup = now;
+}
+
+void markTaskIdle(TaskId task) {
+    taskStats[task].lastWakeup = 0;
+}
+
+void setTaskPeriod(TaskId task, uint32_t periodMs) {
+    taskPeriods[task] = periodMs;
+}
+
+void printTaskWakeups(Stream &stream) {
+    unsigned long now = millis();
+    unsigned long elapsed = now - lastWakeupReport;
+    if (elapsed == 0) elapsed = 1;
+
+    stream.print("Wakeups/s over the last ");
+    stream.print(elapsed / 1000.0, 1);
+    stream.println(" s:");
+
+    uint32_t totalRate = 0;
+    for (int i = 0; i < NUM_TASKS; i++) {
+        uint32_t count = taskStats[i].wakeups;
+        uint32_t rate = (uint64_t)(count - taskStats[i].reportedWakeups) * 1000 / elapsed;
+        taskStats[i].reportedWakeups = count;
+        totalRate += rate;
+
+        char line[48];
+        snprintf(line, sizeof(line), "  %-26s %6lu", taskTable[i].name, (unsigned long)rate);
+        stream.println(line);
+    }
+    stream.print("  Total: ");
+    stream.println(totalRate);
+
+    lastWakeupReport = now;
+}
+
+void printTaskDeadlines(Stream &stream) {
+    stream.println("  Task                       Core Prio Stack Period MaxGap Misses");
+    for (int i = 0; i < NUM_TASKS; i++) {
+        const TaskInfo &info = taskTable[i];
+        const TaskStats &stats = taskStats[i];
+        uint32_t period = taskPeriods[i];
+
+        char line[96];
+        if (period == 0) {
+            snprintf(line, sizeof(line), "  %-26s %4d %4u %5lu  event      -      -",
+                     info.name, (int)info.core, (unsigned)info.priority, (unsigned long)info.stackSize);
+        } else {
+            snprintf(line, sizeof(line), "  %-26s %4d %4u %5lu %6lu %6lu %6lu%s",
+                     info.name, (int)info.core, (unsigned)info.priority, (unsigned long)info.stackSize,
+                     (unsigned long)period, stats.maxGap, (unsigned long)stats.deadlineMisses,
+                     stats.deadlineMisses > 0 ? "  LATE" : "");
+        }
+        stream.println(line);
+    }
+}
+
+void resetTaskDeadlines() {
+    for (int i = 0; i < NUM_TASKS; i++) {
+        taskStats[i].maxGap = 0;
+        taskStats[i].deadlineMisses = 0;
+    }
+}
+
+// Stack recommendation: the deepest use seen plus a quarter, rounded up to 256 bytes
+#define STACK_MARGIN_DIVISOR    4
+#define STACK_ROUNDING          256
+#define STACK_MINIMUM           1024
+
+#if configUSE_TRACE_FACILITY == 1
+
+struct TaskSnapshot {
+    TaskStatus_t *tasks;
+    UBaseType_t count;
+    uint32_t totalRunTime;
+};
+
+bool takeTaskSnapshot(TaskSnapshot &snapshot) {
+    // Leave room for a few tasks created between counting and reading them
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    snapshot.tasks = (TaskStatus_t *)pvPortMalloc(capacity * sizeof(TaskStatus_t));
+    if (snapshot.tasks == NULL) {
+        snapshot.count = 0;
+        return false;
+    }
+    snapshot.count = uxTaskGetSystemState(snapshot.tasks, capacity, &snapshot.totalRunTime);
+    return true;
+}
+
+void freeTaskSnapshot(TaskSnapshot &snapshot) {
+    vPortFree(snapshot.tasks);
+    snapshot.tasks = NULL;
+}
+
+const TaskStatus_t *findTask(const TaskSnapshot &snapshot, TaskHandle_t handle) {
+    for (UBaseType_t i = 0; i < snapshot.count; i++) {
+        if (snapshot.tasks[i].xHandle == handle) {
+            return &snapshot.tasks[i];
+        }
+    }
+    return NULL;
+}
+
+char taskStateLetter(eTaskState state) {
+    switch (state) {
+        case eRunning:   return 'R';
+        case eReady:     return 'r';
+        case eBlocked:   return 'B';
+        case eSuspended: return 'S';
+        case eDeleted:   return 'D';
+        default:         return '?';
+    }
+}
+
+bool printTaskTop(Stream &stream, uint32_t intervalMs) {
+    TaskSnapshot before;
+    if (!takeTaskSnapshot(before)) {
+        stream.println("Not enough memory for the task list");
+        return false;
+    }
+    bool interrupted = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(intervalMs)) != 0;
+    TaskSnapshot after;
+    if (!takeTaskSnapshot(after)) {
+        freeTaskSnapshot(before);
+        stream.println("Not enough memory for the task list");
+        return interrupted;
+    }
+
+    stream.println("  Task             CPU%  State Core Prio FreeStack");
+    for (UBaseType_t i = 0; i < after.count; i++) {
+        const TaskStatus_t &task = after.tasks[i];
+
+        char cpu[8] = "    -";
+#if configGENERATE_RUN_TIME_STATS == 1
+        // The total is wall time, so 100% is one core fully busy, like top
+        uint32_t totalRunTime = after.totalRunTime - before.totalRunTime;
+        const TaskStatus_t *previous = findTask(before, task.xHandle);
+        if (previous != NULL && totalRunTime > 0) {
+            uint32_t used = task.ulRunTimeCounter - previous->ulRunTimeCounter;
+            snprintf(cpu, sizeof(cpu), "%5.1f", used * 100.0f / totalRunTime);
+        }
+#endif
+
+        BaseType_t core = xTaskGetAffinity(task.xHandle);
+        char coreText[4] = "*";
+        if (core != tskNO_AFFINITY) {
+            snprintf(coreText, sizeof(coreText), "%d", (int)core);
+        }
+
+        char line[80];
+        snprintf(line, sizeof(line), "  %-15s %s  %c     %-4s %4u %9lu",
+                 task.pcTaskName, cpu, taskStateLetter(task.eCurrentState), coreText,
+                 (unsigned)task.uxCurrentPriority, (unsigned long)task.usStackHighWaterMark);
+        stream.println(line);
+    }
+#if configGENERATE_RUN_TIME_STATS != 1
+    stream.println("CPU usage needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+#endif
+
+    freeTaskSnapshot(before);
+    freeTaskSnapshot(after);
+    return interrupted;
+}
+
+void printStackReport(Stream &stream) {
+    TaskSnapshot snapshot;
+    if (!takeTaskSnapshot(snapshot)) {
+        stream.println("Not enough memory for the task list");
+        return;
+    }
+
+    stream.println("  Task                       Stack  Used  Recommended");
+    int32_t reclaimable = 0;
+    for (int i = 0; i < NUM_TASKS; i++) {
+        const TaskInfo &info = taskTable[i];
+        // Matched by handle, the names FreeRTOS keeps are truncated and not unique
+        const TaskStatus_t *task = taskHandles[i] != NULL ? findTask(snapshot, taskHandles[i]) : NULL;
+
+        char line[80];
+        if (task == NULL) {
+            snprintf(line, sizeof(line), "  %-26s %5lu     -  (not running)", info.name, (unsigned long)info.stackSize);
+        } else {
+            // The high-water mark is in bytes on the ESP32
+            uint32_t used = info.stackSize - task->usStackHighWaterMark;
+            uint32_t recommended = used + used / STACK_MARGIN_DIVISOR;
+            recommended = (recommended + STACK_ROUNDING - 1) / STACK_ROUNDING * STACK_ROUNDING;
+            if (recommended < STACK_MINIMUM) {
+                recommended = STACK_MINIMUM;
+            }
+            reclaimable += (int32_t)info.stackSize - (int32_t)recommended;
+            snprintf(line, sizeof(line), "  %-26s %5lu %5lu  %5lu%s", info.name, (unsigned long)info.stackSize,
+                     (unsigned long)used, (unsigned long)recommended, recommended > info.stackSize ? "  LOW" : "");
+        }
+        stream.println(line);
+    }
+    stream.print("Reclaimable: ");
+    stream.print(reclaimable);
+    stream.println(" bytes. Exercise every feature first, the mark only covers the deepest use so far.");
+
+    freeTaskSnapshot(snapshot);
+}
+
+#else
+
+bool printTaskTop(Stream &stream, uint32_t intervalMs) {
+    stream.println("The task list needs CONFIG_FREERTOS_USE_TRACE_FACILITY");
+    return false;
+}
+
+void printStackReport(Stream &stream) {
+    stream.println("The task list needs CONFIG_FREERTOS_USE_TRACE_FACILITY");
+}
+
+#endif // configUSE_TRACE_FACILITY
@@ -0,0 +1,100 @@
+#ifndef TASK_TABLE_H
+#define TASK_TABLE_H
+
+#include <Arduino.h>
+#include "BleTelemetry.h"
+
+// Core plan: the Bluetooth controller and Bluedroid run on core 0, so CAN
+// reception, pulse counting and the gauges stay on core 1 (where the TWAI and
+// PCNT interrupts are installed from setup()). Bluetooth, CLI, display and the
+// other slow work share core 0.
+#define CORE_REALTIME   1
+#define CORE_IO         0
+
+// Every FreeRTOS task in the firmware. Stacks and task control blocks are
+// allocated statically from this table, stack sizes are in bytes.
+// periodMs is the longest a task may go without waking while it is active,
+// 0 for tasks that only run on events and have no deadline. Tasks whose
+// period is a parameter start at 0 and set it with setTaskPeriod().
+// X(id, name, core, priority, stack, periodMs)
+#ifdef ENABLE_BLE
+  #define TASK_LIST_BLE(X) X(TASK_BLE, "BLE Telemetry Task", CORE_IO, 1, BLE_TASK_STACK, 0) /* Rate set by the client */
+#else
+  #define TASK_LIST_BLE(X)
+#endif
+
+#define TASK_LIST(X) \
+    X(TASK_CAN_LISTENER,        "CAN Listener Task",        CORE_REALTIME,  5, 8192,     1000) \
+    X(TASK_SPEED,               "CalculateSpeedTask",       CORE_REALTIME,  4, 2048,     0) /* PulseDelay, set at runtime */ \
+    X(TASK_TIMER,               "TimerTask",                CORE_REALTIME,  4, 2048,     0) \
+    X(TASK_GAUGE_LINK,          "Gauge Link Task",          CORE_REALTIME,  3, 2048,     0) \
+    X(TASK_GAUGE_CONTROL,       "Gauge Control Task",       CORE_REALTIME,  3, 4096,     0) \
+    X(TASK_GAUGE_ANIMATION,     "Gauge Animating Task",     CORE_REALTIME,  2, 4096,     0) \
+    X(TASK_BUTTON,              "Button Task",              CORE_IO,        4, 2048,     0) \
+    X(TASK_TURN_ON,             "Turn On Task",             CORE_IO,        3, 2048,     200) \
+    X(TASK_HELPER,              "Helper Task",              CORE_IO,        2, 2048,     100) \
+    X(TASK_CLI,                 "CLI Task",                 CORE_IO,        2, 4096,     0) \
+    X(TASK_OUTPUT,              "Output Task",              CORE_IO,        2, 3072,     0) /* Formats log records */ \
+    X(TASK_DISPLAY_MODE,        "Display Mode Switch Task", CORE_IO,        2, 2048,     0) \
+    X(TASK_DISPLAY,             "Display Task",             CORE_IO,        1, 4096,     0) \
+    X(TASK_JOURNAL,             "Odometer Journal Task",    CORE_IO,        1, 3072,     0) \
+    X(TASK_STREAM,              "Telemetry Stream Task",    CORE_IO,        1, 3072,     0) /* Rate set by the stream command */ \
+    TASK_LIST_BLE(X) \
+    X(TASK_BLINK,               "Blink Task",               CORE_IO,        0, 1024,     0)
+
+enum TaskId {
+#define TASK_ENUM(id, name, core, priority, stack, period) id,
+    TASK_LIST(TASK_ENUM)
+#undef TASK_ENUM
+    NUM_TASKS
+};
+
+// All task stacks together must fit the budget, checked at build time.
+// The BLE task is optional and comes on top.
+#define TASK_STACK_BUDGET (48 * 1024 + BLE_TASK_STACK)
+
+#define TASK_STACK_SUM(id, name, core, priority, stack, period) + (stack)
+const uint32_t TASK_STACK_TOTAL = 0 TASK_LIST(TASK_STACK_SUM);
+#undef TASK_STACK_SUM
+
+struct TaskInfo {
+    const char *name;
+    BaseType_t core;
+    UBaseType_t priority;
+    uint32_t stackSize;
+    uint32_t periodMs;
+};
+
+extern const TaskInfo taskTable[NUM_TASKS];
+
+// Create a task pinned to the core and with the priority and stack from the table.
+// Every task has one static stack, so each can only be created once.
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle = NULL, void *parameter = NULL);
+
+// Print the static RAM (stack and control block) of every task
+void printTaskMemory(Stream &stream);
+
+// Call once each time a task comes out of its blocking wait
+void countTaskWakeup(TaskId task);
+
+// Call before a task blocks without a timeout, so that wait is not counted as a missed deadline
+void markTaskIdle(TaskId task);
+
+// Change the deadline period of a task, 0 = no deadline
+void setTaskPeriod(TaskId task, uint32_t periodMs);
+
+// Print wakeups per second of every task since the previous call
+void printTaskWakeups(Stream &stream);
+
+// Print the task plan with the longest gap between wakeups and the missed deadlines
+void printTaskDeadlines(Stream &stream);
+void resetTaskDeadlines();
+
+// Print CPU usage, state, core and free stack of every task over intervalMs.
+// Returns true when the wait was cut short by a notification of the calling task.
+bool printTaskTop(Stream &stream, uint32_t intervalMs);
+
+// Print the stack high-water mark of every task in the table with a right-sized stack
+void printStackReport(Stream &stream);
+
+#endif // TASK_TABLE_H
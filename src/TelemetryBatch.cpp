@@ -0,0 +1,89 @@
+#include "TelemetryBatch.h"
+#include <string.h>
+
+// Offsets in the header
+#define BATCH_SEQUENCE      0
+#define BATCH_COUNT         2
+#define BATCH_SAMPLE_SIZE   3
+#define BATCH_FIELD_MASK    4
+#define BATCH_FIRST_MILLIS  8
+
+// Byte by byte, so the layout does not depend on the host's byte order
+static void writeU16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void writeU32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static uint16_t readU16(const uint8_t *in) {
+    return in[0] | (uint16_t)in[1] << 8;
+}
+
+static uint32_t readU32(const uint8_t *in) {
+    return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+void startTelemetryBatch(TelemetryBatch &batch, uint8_t *buffer, size_t capacity,
+                         uint16_t sequence, uint32_t fieldMask, uint8_t sampleSize) {
+    batch.buffer = buffer;
+    batch.capacity = capacity;
+    batch.length = TELEMETRY_BATCH_HEADER;
+    batch.sampleSize = sampleSize;
+    batch.firstMillis = 0;
+    writeU16(buffer + BATCH_SEQUENCE, sequence);
+    buffer[BATCH_COUNT] = 0;
+    buffer[BATCH_SAMPLE_SIZE] = sampleSize;
+    writeU32(buffer + BATCH_FIELD_MASK, fieldMask);
+    writeU32(buffer + BATCH_FIRST_MILLIS, 0);
+}
+
+bool addTelemetrySample(TelemetryBatch &batch, uint32_t millis, const uint8_t *values) {
+    uint8_t count = batch.buffer[BATCH_COUNT];
+    if (telemetryBatchFull(batch)) {
+        return false;
+    }
+    if (count == 0) {
+        batch.firstMillis = millis;
+        writeU32(batch.buffer + BATCH_FIRST_MILLIS, millis);
+    } else if (millis - batch.firstMillis > 0xFFFF) {
+        return false;
+    }
+    writeU16(batch.buffer + batch.length, millis - batch.firstMillis);
+    memcpy(batch.buffer + batch.length + 2, values, batch.sampleSize);
+    batch.length += 2 + batch.sampleSize;
+    batch.buffer[BATCH_COUNT] = count + 1;
+    return true;
+}
+
+uint8_t telemetryBatchCount(const TelemetryBatch &batch) {
+    return batch.buffer[BATCH_COUNT];
+}
+
+bool telemetryBatchFull(const TelemetryBatch &batch) {
+    return batch.buffer[BATCH_COUNT] == 0xFF || batch.length + 2 + batch.sampleSize > batch.capacity;
+}
+
+bool readTelemetryBatch(const uint8_t *data, size_t length, TelemetryBatchHeader &header) {
+    if (length < TELEMETRY_BATCH_HEADER) {
+        return false;
+    }
+    header.sequence = readU16(data + BATCH_SEQUENCE);
+    header.count = data[BATCH_COUNT];
+    header.sampleSize = data[BATCH_SAMPLE_SIZE];
+    header.fieldMask = readU32(data + BATCH_FIELD_MASK);
+    header.firstMillis = readU32(data + BATCH_FIRST_MILLIS);
+    return length == TELEMETRY_BATCH_HEADER + (size_t)header.count * (2 + header.sampleSize);
+}
+
+const uint8_t *telemetryBatchSample(const uint8_t *data, const TelemetryBatchHeader &header,
+                                    uint8_t index, uint32_t &millis) {
+    const uint8_t *sample = data + TELEMETRY_BATCH_HEADER + (size_t)index * (2 + header.sampleSize);
+    millis = header.firstMillis + readU16(sample);
+    return sample + 2;
+}
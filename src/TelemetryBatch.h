@@ -0,0 +1,60 @@
+#ifndef TELEMETRY_BATCH_H
+#define TELEMETRY_BATCH_H
+
+// Packs telemetry samples into one notification sized batch and reads them
+// back. Plain C++ without Arduino, so a dashboard or host tool can build the
+// same file.
+//
+// Batch layout, little endian:
+//   u16 sequence
+//   u8  sample count
+//   u8  sample size, bytes of values per sample
+//   u32 field mask, bit n set for field n of TELEMETRY_FIELD_LIST
+//   u32 millis of the first sample
+//   then per sample: u16 milliseconds since the first sample, the values
+//   of the fields in the mask in table order
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_BATCH_HEADER 12
+
+struct TelemetryBatch {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    uint8_t sampleSize;
+    uint32_t firstMillis;
+};
+
+struct TelemetryBatchHeader {
+    uint16_t sequence;
+    uint8_t count;
+    uint8_t sampleSize;
+    uint32_t fieldMask;
+    uint32_t firstMillis;
+};
+
+// Start an empty batch in buffer, capacity is the notification payload size
+void startTelemetryBatch(TelemetryBatch &batch, uint8_t *buffer, size_t capacity,
+                         uint16_t sequence, uint32_t fieldMask, uint8_t sampleSize);
+
+// Append one sample of sampleSize bytes. Returns false, leaving the batch
+// unchanged, when it is full or the sample is too late for a 16 bit offset.
+bool addTelemetrySample(TelemetryBatch &batch, uint32_t millis, const uint8_t *values);
+
+// Samples in the batch so far
+uint8_t telemetryBatchCount(const TelemetryBatch &batch);
+
+// Whether another sample still fits
+bool telemetryBatchFull(const TelemetryBatch &batch);
+
+// Check a received batch and read its header. False if the length does not
+// match the header.
+bool readTelemetryBatch(const uint8_t *data, size_t length, TelemetryBatchHeader &header);
+
+// Values of sample index of a checked batch, and its millis
+const uint8_t *telemetryBatchSample(const uint8_t *data, const TelemetryBatchHeader &header,
+                                    uint8_t index, uint32_t &millis);
+
+#endif // TELEMETRY_BATCH_H
@@ -0,0 +1,171 @@
+#include "TelemetryBus.h"
+#include "Log.h"
+
+struct TelemetrySubscriber {
+    TaskHandle_t task;
+    uint32_t topics;
+    uint32_t pendingSourceMicros;   // Oldest unconsumed source time, 0 = none
+};
+
+portMUX_TYPE telemetryBusMux = portMUX_INITIALIZER_UNLOCKED;
+portMUX_TYPE telemetryDataMux = portMUX_INITIALIZER_UNLOCKED;    // Guards telemetryData
+TelemetrySubscriber subscribers[TELEMETRY_MAX_SUBSCRIBERS];
+volatile int numSubscribers = 0;
+
+void subscribeTelemetry(TaskHandle_t task, uint32_t topics) {
+    portENTER_CRITICAL(&telemetryBusMux);
+    // A task subscribing again adds topics to its subscription
+    for (int i = 0; i < numSubscribers; i++) {
+        if (subscribers[i].task == task) {
+            subscribers[i].topics |= topics;
+            portEXIT_CRITICAL(&telemetryBusMux);
+            return;
+        }
+    }
+    bool full = numSubscribers >= TELEMETRY_MAX_SUBSCRIBERS;
+    if (!full) {
+        subscribers[numSubscribers] = {task, topics, 0};
+        numSubscribers++;
+    }
+    portEXIT_CRITICAL(&telemetryBusMux);
+
+    if (full) {
+        LOG(LOG_TOO_MANY_SUBSCRIBERS);
+    }
+}
+
+void publishTelemetry(uint32_t topics, uint32_t sourceMicros) {
+    // Subscribers are only ever added, so the ones below the count are complete
+    int count = numSubscribers;
+    for (int i = 0; i < count; i++) {
+        TelemetrySubscriber &subscriber = subscribers[i];
+        uint32_t matched = topics & subscriber.topics;
+        if (matched == 0) {
+            continue;
+        }
+        if (sourceMicros != 0) {
+            portENTER_CRITICAL(&telemetryBusMux);
+            if (subscriber.pendingSourceMicros == 0) {
+                subscriber.pendingSourceMicros = sourceMicros;
+            }
+            portEXIT_CRITICAL(&telemetryBusMux);
+        }
+        xTaskNotify(subscriber.task, matched, eSetBits);
+    }
+}
+
+uint32_t takeTelemetrySourceMicros() {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    uint32_t sourceMicros = 0;
+    portENTER_CRITICAL(&telemetryBusMux);
+    for (int i = 0; i < numSubscribers; i++) {
+        if (subscribers[i].task == self) {
+            sourceMicros = subscribers[i].pendingSourceMicros;
+            subscribers[i].pendingSourceMicros = 0;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&telemetryBusMux);
+    return sourceMicros;
+}
+
+uint32_t diffTelemetryTopics(const Telemetry &before, const Telemetry &after) {
+    uint32_t topics = 0;
+    if (before.speed != after.speed) {
+        topics |= TOPIC_SPEED;
+    }
+    if (before.rpm != after.rpm) {
+        topics |= TOPIC_RPM;
+    }
+    if (before.DCVoltage != after.DCVoltage || before.DCCurrent != after.DCCurrent) {
+        topics |= TOPIC_POWER;
+    }
+    if (before.SoC != after.SoC || before.Charge != after.Charge || before.Current != after.Current) {
+        topics |= TOPIC_SOC;
+    }
+    if (before.motorTemp != after.motorTemp || before.inverterTemp != after.inverterTemp ||
+        before.BMSMinModTemp != after.BMSMinModTemp || before.BMSMaxModTemp != after.BMSMaxModTemp ||
+        before.BMSAverageModTemp != after.BMSAverageModTemp || before.BMSMinCellTemp != after.BMSMinCellTemp ||
+        before.BMSMaxCellTemp != after.BMSMaxCellTemp || before.BMSAverageCellTemp != after.BMSAverageCellTemp) {
+        topics |= TOPIC_TEMP;
+    }
+    if (before.powerUnitFlags != after.powerUnitFlags || before.motorFlags != after.motorFlags) {
+        topics |= TOPIC_MOTOR_STATE;
+    }
+    if (before.BMSInputSignalFlags != after.BMSInputSignalFlags || before.BMSOutputSignalFlags != after.BMSOutputSignalFlags ||
+        before.BMSNumberOfCells != after.BMSNumberOfCells || before.BMSChargingState != after.BMSChargingState ||
+        before.BMSCsDuration != after.BMSCsDuration || before.BMSLastChargingError != after.BMSLastChargingError ||
+        before.BMSProtectionFlags != after.BMSProtectionFlags || before.BMSReductionFlags != after.BMSReductionFlags ||
+        before.BMSBatteryStatusFlags != after.BMSBatteryStatusFlags) {
+        topics |= TOPIC_BMS_STATE;
+    }
+    if (before.BMSConsumptionEstimate != after.BMSConsumptionEstimate || before.BMSEstimatedEnergy != after.BMSEstimatedEnergy ||
+        before.BMSEstimatedDistanceLeft != after.BMSEstimatedDistanceLeft || before.BMSDistanceTraveled != after.BMSDistanceTraveled) {
+        topics |= TOPIC_BMS_ENERGY;
+    }
+    return topics;
+}
+
+// Copy the fields of topics from one snapshot to another
+void copyTelemetryTopics(Telemetry &to, const Telemetry &from, uint32_t topics) {
+    if (topics & TOPIC_SPEED) {
+        to.speed = from.speed;
+    }
+    if (topics & TOPIC_RPM) {
+        to.rpm = from.rpm;
+    }
+    if (topics & TOPIC_POWER) {
+        to.DCVoltage = from.DCVoltage;
+        to.DCCurrent = from.DCCurrent;
+    }
+    if (topics & TOPIC_SOC) {
+        to.SoC = from.SoC;
+        to.Charge = from.Charge;
+        to.Current = from.Current;
+    }
+    if (topics & TOPIC_TEMP) {
+        to.motorTemp = from.motorTemp;
+        to.inverterTemp = from.inverterTemp;
+        to.BMSMinModTemp = from.BMSMinModTemp;
+        to.BMSMaxModTemp = from.BMSMaxModTemp;
+        to.BMSAverageModTemp = from.BMSAverageModTemp;
+        to.BMSMinCellTemp = from.BMSMinCellTemp;
+        to.BMSMaxCellTemp = from.BMSMaxCellTemp;
+        to.BMSAverageCellTemp = from.BMSAverageCellTemp;
+    }
+    if (topics & TOPIC_MOTOR_STATE) {
+        to.powerUnitFlags = from.powerUnitFlags;
+        to.motorFlags = from.motorFlags;
+    }
+    if (topics & TOPIC_BMS_STATE) {
+        to.BMSInputSignalFlags = from.BMSInputSignalFlags;
+        to.BMSOutputSignalFlags = from.BMSOutputSignalFlags;
+        to.BMSNumberOfCells = from.BMSNumberOfCells;
+        to.BMSChargingState = from.BMSChargingState;
+        to.BMSCsDuration = from.BMSCsDuration;
+        to.BMSLastChargingError = from.BMSLastChargingError;
+        to.BMSProtectionFlags = from.BMSProtectionFlags;
+        to.BMSReductionFlags = from.BMSReductionFlags;
+        to.BMSBatteryStatusFlags = from.BMSBatteryStatusFlags;
+    }
+    if (topics & TOPIC_BMS_ENERGY) {
+        to.BMSConsumptionEstimate = from.BMSConsumptionEstimate;
+        to.BMSEstimatedEnergy = from.BMSEstimatedEnergy;
+        to.BMSEstimatedDistanceLeft = from.BMSEstimatedDistanceLeft;
+        to.BMSDistanceTraveled = from.BMSDistanceTraveled;
+    }
+}
+
+uint32_t writeTelemetry(const Telemetry &source, uint32_t topics) {
+    portENTER_CRITICAL(&telemetryDataMux);
+    uint32_t changed = diffTelemetryTopics(telemetryData, source) & topics;
+    copyTelemetryTopics(telemetryData, source, changed);
+    portEXIT_CRITICAL(&telemetryDataMux);
+    return changed;
+}
+
+void readTelemetry(Telemetry &out) {
+    portENTER_CRITICAL(&telemetryDataMux);
+    out = telemetryData;
+    portEXIT_CRITICAL(&telemetryDataMux);
+}
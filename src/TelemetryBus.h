@@ -0,0 +1,55 @@
+#ifndef TELEMETRY_BUS_H
+#define TELEMETRY_BUS_H
+
+#include <Arduino.h>
+#include "driveTelemetry.h"
+
+// Signal groups of telemetryData (and the derived values next to it). The
+// publishers write the fields and then publish the groups that changed, each
+// subscriber task is woken with those bits set in its notification value.
+#define TOPIC_SPEED         (1 << 0)    // speed, from the speed fusion
+#define TOPIC_RPM           (1 << 1)    // rpm
+#define TOPIC_POWER         (1 << 2)    // DCVoltage, DCCurrent
+#define TOPIC_SOC           (1 << 3)    // SoC, Charge, Current
+#define TOPIC_TEMP          (1 << 4)    // Motor, inverter, module and cell temperatures
+#define TOPIC_MOTOR_STATE   (1 << 5)    // powerUnitFlags, motorFlags
+#define TOPIC_BMS_STATE     (1 << 6)    // Signal flags, cell count, charging state, protection flags
+#define TOPIC_BMS_ENERGY    (1 << 7)    // Consumption estimate, energy, distance left and travelled
+#define TOPIC_DISTANCE      (1 << 8)    // Odometer km or trip 100 m, from the pulse counter
+#define TOPIC_RANGE         (1 << 9)    // Smoothed consumption and range, from the helper task
+#define TOPIC_ALL           ((1 << 10) - 1)
+
+// Notification bits from TELEMETRY_TASK_BITS upwards are free for a
+// subscriber's own events
+#define TELEMETRY_TASK_BITS 16
+
+#define TELEMETRY_MAX_SUBSCRIBERS 8
+
+// Wake task whenever one of topics is published. Call from setup().
+void subscribeTelemetry(TaskHandle_t task, uint32_t topics);
+
+// Wake the subscribers of the topics. sourceMicros is the micros() time the
+// data arrived, or 0 when there is no meaningful source time.
+void publishTelemetry(uint32_t topics, uint32_t sourceMicros = 0);
+
+// Source time of the oldest publish the calling task has not consumed yet,
+// 0 if none carried one. Clears it.
+uint32_t takeTelemetrySourceMicros();
+
+// Topics whose fields differ between two telemetry snapshots
+uint32_t diffTelemetryTopics(const Telemetry &before, const Telemetry &after);
+
+// Publishers write telemetryData with writeTelemetry() and subscribers read
+// it with readTelemetry(). Both hold one lock, so a group of fields such as
+// DCVoltage and DCCurrent is never seen half updated. The CLI still copies
+// telemetryData directly: its dumps are read by a person, and a torn value
+// is gone in the next one.
+
+// Copy the fields of topics from source into telemetryData in one step.
+// Returns the topics among them whose fields changed.
+uint32_t writeTelemetry(const Telemetry &source, uint32_t topics);
+
+// Consistent copy of telemetryData
+void readTelemetry(Telemetry &out);
+
+#endif // TELEMETRY_BUS_H
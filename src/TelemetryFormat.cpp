@@ -0,0 +1,262 @@
+#include "TelemetryFormat.h"
+#include <cstring>
+#include <cstddef>
+
+const char *const chargingStateNames[] = {
+    "Disconnected",
+    "Pre-heat",
+    "Pre-charge",
+    "Charging",
+    "Balancing",
+    "Finished",
+    "Error",
+    NULL
+};
+
+const char *const chargingErrorNames[] = {
+    "No error",
+    "No cell comm. at start/precharge (CAN charger)",
+    "No cell comm. (Non-CAN charger)",
+    "Max charging stage duration expired",
+    "Cell comm. lost during charging/balancing (CAN charger)",
+    "Cannot set balancing threshold",
+    "Cell/module temp too high",
+    "Cell comm. lost during pre-heating (CAN charger)",
+    "Cell count mismatch",
+    "Cell over-voltage",
+    "Cell protection event (see diagnostic codes)",
+    NULL
+};
+
+const TelemetryField telemetryFields[NUM_TELEMETRY_FIELDS] = {
+#define TELEMETRY_FIELD_INFO(id, member, label, type, scale, radix, width, unit, names) \
+    {#member, label, offsetof(Telemetry, member), type, scale, radix, width, unit, names},
+    TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_INFO)
+#undef TELEMETRY_FIELD_INFO
+};
+
+// The type column has to match the member, or the values are read wrong
+#define TELEMETRY_FIELD_CHECK(id, member, label, type, scale, radix, width, unit, names) \
+    static_assert(sizeof(Telemetry::member) == telemetryFieldSize(type), "Type of " #member " does not match TELEMETRY_FIELD_LIST");
+TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_CHECK)
+#undef TELEMETRY_FIELD_CHECK
+
+// Output is collected in a fixed buffer and written to the stream in large blocks
+#define SCRATCH_SIZE 512
+#define SCRATCH_ITEM_MAX 128    // Longest line or value appended at once
+
+struct Scratch {
+    char data[SCRATCH_SIZE];
+    size_t length;
+};
+
+void flushScratch(Scratch &scratch, Stream &stream) {
+    if (scratch.length > 0) {
+        stream.write((const uint8_t *)scratch.data, scratch.length);
+        scratch.length = 0;
+    }
+}
+
+// Room for the next item, the buffer is flushed first when it might not fit
+char *scratchTail(Scratch &scratch, Stream &stream) {
+    if (SCRATCH_SIZE - scratch.length < SCRATCH_ITEM_MAX) {
+        flushScratch(scratch, stream);
+    }
+    return scratch.data + scratch.length;
+}
+
+// Account for what was written at the tail, snprintf style
+void appendScratch(Scratch &scratch, int written) {
+    size_t room = SCRATCH_SIZE - scratch.length - 1;
+    if (written > 0) {
+        scratch.length += (size_t)written < room ? (size_t)written : room;
+    }
+}
+
+int32_t readTelemetryField(const Telemetry &data, TelemetryFieldId id) {
+    const TelemetryField &field = telemetryFields[id];
+    const uint8_t *source = (const uint8_t *)&data + field.offset;
+    switch (field.type) {
+        case FIELD_U8: {
+            uint8_t value;
+            memcpy(&value, source, sizeof(value));
+            return value;
+        }
+        case FIELD_I8: {
+            int8_t value;
+            memcpy(&value, source, sizeof(value));
+            return value;
+        }
+        case FIELD_U16: {
+            uint16_t value;
+            memcpy(&value, source, sizeof(value));
+            return value;
+        }
+        case FIELD_I16: {
+            int16_t value;
+            memcpy(&value, source, sizeof(value));
+            return value;
+        }
+        case FIELD_U32: {
+            uint32_t value;
+            memcpy(&value, source, sizeof(value));
+            return (int32_t)value;
+        }
+        case FIELD_FLOAT: {
+            float value;
+            memcpy(&value, source, sizeof(value));
+            return (int32_t)value;
+        }
+    }
+    return 0;
+}
+
+TelemetryFieldId findTelemetryField(const char *key) {
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        if (strcasecmp(key, telemetryFields[i].key) == 0) {
+            return (TelemetryFieldId)i;
+        }
+    }
+    return NUM_TELEMETRY_FIELDS;
+}
+
+int formatTelemetryField(char *out, size_t size, const Telemetry &data, TelemetryFieldId id, TelemetryFormat format) {
+    const TelemetryField &field = telemetryFields[id];
+    const char *unit = format == FORMAT_DUMP ? field.unit : "";
+
+    if (field.type == FIELD_FLOAT) {
+        float value;
+        memcpy(&value, (const uint8_t *)&data + field.offset, sizeof(value));
+        return snprintf(out, size, "%.*f%s", field.width, value / field.scale, unit);
+    }
+
+    int32_t raw = readTelemetryField(data, id);
+    if (format == FORMAT_DUMP && field.radix == 2) {
+        // Zero padded binary, most significant bit first
+        if (size <= field.width) {
+            return snprintf(out, size, "%s", "");
+        }
+        for (int bit = field.width - 1; bit >= 0; bit--) {
+            *out++ = (((uint32_t)raw >> bit) & 1) ? '1' : '0';
+        }
+        *out = '\0';
+        return field.width;
+    }
+    if (format == FORMAT_DUMP && field.names != NULL) {
+        const char *name = "Unknown";
+        for (int i = 0; field.names[i] != NULL; i++) {
+            if (i == raw) {
+                name = field.names[i];
+                break;
+            }
+        }
+        return snprintf(out, size, "%s%s", name, unit);
+    }
+    if (field.type == FIELD_U32) {
+        // Keep the top bit of unsigned masks and counters out of the sign
+        if (field.scale == 1) {
+            return snprintf(out, size, "%lu%s", (unsigned long)(uint32_t)raw, unit);
+        }
+        return snprintf(out, size, "%.*f%s", field.width, (float)(uint32_t)raw / field.scale, unit);
+    }
+    if (field.scale == 1) {
+        return snprintf(out, size, "%ld%s", (long)raw, unit);
+    }
+    return snprintf(out, size, "%.*f%s", field.width, (float)raw / field.scale, unit);
+}
+
+size_t packTelemetryValues(uint8_t *out, const Telemetry &data, uint32_t fieldMask) {
+    size_t length = 0;
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        if (fieldMask & (1UL << i)) {
+            const TelemetryField &field = telemetryFields[i];
+            uint8_t size = telemetryFieldSize(field.type);
+            memcpy(out + length, (const uint8_t *)&data + field.offset, size);
+            length += size;
+        }
+    }
+    return length;
+}
+
+size_t telemetryValuesSize(uint32_t fieldMask) {
+    size_t length = 0;
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        if (fieldMask & (1UL << i)) {
+            length += telemetryFieldSize(telemetryFields[i].type);
+        }
+    }
+    return length;
+}
+
+size_t packTelemetrySchema(uint8_t *out, size_t size, uint32_t fieldMask) {
+    if (size < 1) {
+        return 0;
+    }
+    size_t length = 1;
+    uint8_t count = 0;
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        if (!(fieldMask & (1UL << i))) {
+            continue;
+        }
+        const TelemetryField &field = telemetryFields[i];
+        size_t keyLength = strlen(field.key);
+        if (length + 5 + keyLength > size) {
+            return 0;
+        }
+        out[length++] = i;
+        out[length++] = field.type;
+        memcpy(out + length, &field.scale, sizeof(field.scale));
+        length += sizeof(field.scale);
+        out[length++] = keyLength;
+        memcpy(out + length, field.key, keyLength);
+        length += keyLength;
+        count++;
+    }
+    out[0] = count;
+    return length;
+}
+
+void printTelemetryDump(Stream &stream, const Telemetry &data) {
+    Scratch scratch;
+    scratch.length = 0;
+
+    appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, "Telemetry Data:\r\n"));
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        // "Label: ....... value", with the values lined up in column 32
+        char *line = scratchTail(scratch, stream);
+        int length = snprintf(line, SCRATCH_ITEM_MAX, "%s:", telemetryFields[i].label);
+        if (length < 30) {
+            line[length++] = ' ';
+            while (length < 31) {
+                line[length++] = '.';
+            }
+        }
+        line[length++] = ' ';
+        length += formatTelemetryField(line + length, SCRATCH_ITEM_MAX - length - 2, data, (TelemetryFieldId)i, FORMAT_DUMP);
+        length += snprintf(line + length, SCRATCH_ITEM_MAX - length, "\r\n");
+        appendScratch(scratch, length);
+    }
+    flushScratch(scratch, stream);
+}
+
+void printTelemetryCsv(Stream &stream, const Telemetry &data, bool header) {
+    Scratch scratch;
+    scratch.length = 0;
+
+    if (header) {
+        appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, "millis"));
+        for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+            appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, ",%s", telemetryFields[i].key));
+        }
+        appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, "\r\n"));
+    }
+
+    appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, "%lu", (unsigned long)millis()));
+    for (int i = 0; i < NUM_TELEMETRY_FIELDS; i++) {
+        char *tail = scratchTail(scratch, stream);
+        tail[0] = ',';
+        appendScratch(scratch, 1 + formatTelemetryField(tail + 1, SCRATCH_ITEM_MAX - 1, data, (TelemetryFieldId)i, FORMAT_CSV));
+    }
+    appendScratch(scratch, snprintf(scratchTail(scratch, stream), SCRATCH_ITEM_MAX, "\r\n"));
+    flushScratch(scratch, stream);
+}
@@ -0,0 +1,113 @@
+#ifndef TELEMETRY_FORMAT_H
+#define TELEMETRY_FORMAT_H
+
+#include <Arduino.h>
+#include "driveTelemetry.h"
+
+enum TelemetryFieldType : uint8_t {
+    FIELD_U8,
+    FIELD_I8,
+    FIELD_U16,
+    FIELD_I16,
+    FIELD_U32,
+    FIELD_FLOAT
+};
+
+// Every field of struct Telemetry and how to present it. The dump, the CSV
+// output and the binary stream are all driven by this list.
+// type:  storage type of the member
+// scale: the value shown is raw / scale
+// radix: 10, or 2 for bit masks printed as zero padded binary in the dump
+// width: decimals for radix 10, digits for radix 2
+// unit:  appended to the value in the dump
+// names: NULL terminated value names of an enumeration, or NULL
+// X(id, member, label, type, scale, radix, width, unit, names)
+#define TELEMETRY_FIELD_LIST(X) \
+    X(FIELD_SPEED,                  speed,                      "Speed",                            FIELD_U32,   10, 10,  1, "",         NULL) \
+    X(FIELD_MOTOR_TEMP,             motorTemp,                  "Motor Temperature",                FIELD_U8,     1, 10,  0, "",         NULL) \
+    X(FIELD_INVERTER_TEMP,          inverterTemp,               "Inverter Temperature",             FIELD_U8,     1, 10,  0, "",         NULL) \
+    X(FIELD_RPM,                    rpm,                        "Motor RPM",                        FIELD_I16,    1, 10,  0, "",         NULL) \
+    X(FIELD_DC_VOLTAGE,             DCVoltage,                  "Motor DC Voltage",                 FIELD_FLOAT,  1, 10,  1, "",         NULL) \
+    X(FIELD_DC_CURRENT,             DCCurrent,                  "Motor DC Current",                 FIELD_FLOAT,  1, 10,  1, "",         NULL) \
+    X(FIELD_POWER_UNIT_FLAGS,       powerUnitFlags,             "Power Unit Flags",                 FIELD_U16,    1,  2, 16, "",         NULL) \
+    X(FIELD_MOTOR_FLAGS,            motorFlags,                 "Motor Flags",                      FIELD_U16,    1,  2, 16, "",         NULL) \
+    X(FIELD_BMS_INPUT_FLAGS,        BMSInputSignalFlags,        "BMS Input Signal Flags",           FIELD_U8,     1,  2,  8, "",         NULL) \
+    X(FIELD_BMS_OUTPUT_FLAGS,       BMSOutputSignalFlags,       "BMS Output Signal Flags",          FIELD_U8,     1,  2,  8, "",         NULL) \
+    X(FIELD_BMS_CELLS,              BMSNumberOfCells,           "BMS Number of Cells",              FIELD_U16,    1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_CHARGING_STATE,     BMSChargingState,           "BMS Charging State",               FIELD_U8,     1, 10,  0, "",         chargingStateNames) \
+    X(FIELD_BMS_CS_DURATION,        BMSCsDuration,              "BMS Charging State Duration",      FIELD_U16,    1, 10,  0, " minutes", NULL) \
+    X(FIELD_BMS_LAST_ERROR,         BMSLastChargingError,       "BMS Last Charging Error",          FIELD_U8,     1, 10,  0, "",         chargingErrorNames) \
+    X(FIELD_BMS_PROTECTION_FLAGS,   BMSProtectionFlags,         "BMS Protection Flags",             FIELD_U32,    1,  2, 32, "",         NULL) \
+    X(FIELD_BMS_REDUCTION_FLAGS,    BMSReductionFlags,          "BMS Reduction Flags",              FIELD_U8,     1,  2,  8, "",         NULL) \
+    X(FIELD_BMS_STATUS_FLAGS,       BMSBatteryStatusFlags,      "BMS Battery Status Flags",         FIELD_U8,     1,  2,  8, "",         NULL) \
+    X(FIELD_BMS_MIN_MOD_TEMP,       BMSMinModTemp,              "BMS Minimum Module Temperature",   FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_MAX_MOD_TEMP,       BMSMaxModTemp,              "BMS Maximum Module Temperature",   FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_AVG_MOD_TEMP,       BMSAverageModTemp,          "BMS Average Module Temperature",   FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_MIN_CELL_TEMP,      BMSMinCellTemp,             "BMS Minimum Cell Temperature",     FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_MAX_CELL_TEMP,      BMSMaxCellTemp,             "BMS Maximum Cell Temperature",     FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_AVG_CELL_TEMP,      BMSAverageCellTemp,         "BMS Average Cell Temperature",     FIELD_I8,     1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_CURRENT,            Current,                    "BMS Current",                      FIELD_I16,   10, 10,  1, "",         NULL) \
+    X(FIELD_BMS_CHARGE,             Charge,                     "BMS Charge",                       FIELD_U16,   10, 10,  1, "",         NULL) \
+    X(FIELD_SOC,                    SoC,                        "BMS State of Charge (SoC)",        FIELD_U16,  100, 10,  2, "",         NULL) \
+    X(FIELD_BMS_CONSUMPTION,        BMSConsumptionEstimate,     "BMS Consumption Estimate",         FIELD_U16,    1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_ENERGY,             BMSEstimatedEnergy,         "BMS Estimated Energy",             FIELD_U16,    1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_DISTANCE_LEFT,      BMSEstimatedDistanceLeft,   "BMS Estimated Distance Left",      FIELD_U16,    1, 10,  0, "",         NULL) \
+    X(FIELD_BMS_DISTANCE_TRAVELED,  BMSDistanceTraveled,        "BMS Distance Traveled",            FIELD_U16,    1, 10,  0, "",         NULL)
+
+enum TelemetryFieldId : uint8_t {
+#define TELEMETRY_FIELD_ENUM(id, member, label, type, scale, radix, width, unit, names) id,
+    TELEMETRY_FIELD_LIST(TELEMETRY_FIELD_ENUM)
+#undef TELEMETRY_FIELD_ENUM
+    NUM_TELEMETRY_FIELDS
+};
+
+struct TelemetryField {
+    const char *key;        // Member name, used as CSV column and to select fields
+    const char *label;
+    uint16_t offset;        // offsetof(Telemetry, member)
+    TelemetryFieldType type;
+    uint16_t scale;
+    uint8_t radix;
+    uint8_t width;
+    const char *unit;
+    const char *const *names;
+};
+
+extern const TelemetryField telemetryFields[NUM_TELEMETRY_FIELDS];
+
+enum TelemetryFormat {
+    FORMAT_DUMP,    // Dotted label, binary flags and value names for people
+    FORMAT_CSV      // Plain scaled numbers for tools
+};
+
+// Size in bytes of a field of this type
+constexpr uint8_t telemetryFieldSize(TelemetryFieldType type) {
+    return (type == FIELD_U8 || type == FIELD_I8) ? 1 : (type == FIELD_U16 || type == FIELD_I16) ? 2 : 4;
+}
+
+// Raw value of an integer field, sign extended. Floats are converted.
+int32_t readTelemetryField(const Telemetry &data, TelemetryFieldId id);
+
+// Field id for a member name, or NUM_TELEMETRY_FIELDS if there is none
+TelemetryFieldId findTelemetryField(const char *key);
+
+// Write the value of one field into out, returns the length like snprintf
+int formatTelemetryField(char *out, size_t size, const Telemetry &data, TelemetryFieldId id, TelemetryFormat format);
+
+// Copy the raw little endian values of the fields in fieldMask into out, in
+// table order. Returns the bytes written, telemetryValuesSize(fieldMask).
+size_t packTelemetryValues(uint8_t *out, const Telemetry &data, uint32_t fieldMask);
+size_t telemetryValuesSize(uint32_t fieldMask);
+
+// Describe the fields in fieldMask for a decoder: the field count, then id,
+// type, scale (u16), name length and name of each. Returns the bytes
+// written, or 0 if they do not fit in size.
+size_t packTelemetrySchema(uint8_t *out, size_t size, uint32_t fieldMask);
+
+// The full dump, one labelled line per field
+void printTelemetryDump(Stream &stream, const Telemetry &data);
+
+// One CSV line with all fields, optionally preceded by the header line
+void printTelemetryCsv(Stream &stream, const Telemetry &data, bool header);
+
+#endif // TELEMETRY_FORMAT_H
@@ -0,0 +1,184 @@
+#include "TelemetryStream.h"
+#include "TelemetryFormat.h"
+#include "TelemetryBus.h"
+#include "TaskTable.h"
+#include <esp_rom_crc.h>
+#include <cstring>
+
+// The schema is repeated so a decoder started in the middle of a stream picks it up
+#define STREAM_SCHEMA_INTERVAL_MS 5000
+
+// Largest packet before framing, the schema with every field selected is the biggest
+#define STREAM_PACKET_MAX 640
+// COBS adds one byte per 254, plus the leading code and the zero delimiter
+#define STREAM_FRAME_MAX (STREAM_PACKET_MAX + STREAM_PACKET_MAX / 254 + 2)
+
+static_assert(NUM_TELEMETRY_FIELDS <= 32, "The field mask of a data packet holds 32 fields");
+
+TaskHandle_t streamTaskHandle = NULL;
+portMUX_TYPE streamMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Configuration, written by the CLI and read by the stream task under streamMux
+Stream *streamOutput = NULL;
+volatile bool streamRunning = false;
+uint32_t streamFieldMask = 0;
+uint8_t streamRateHz = 10;
+
+uint32_t streamPacketsSent = 0;
+uint32_t streamBytesSent = 0;
+uint16_t streamLastDataBytes = 0;
+uint16_t streamSequence = 0;
+
+// Only used by the stream task
+uint8_t streamPacket[STREAM_PACKET_MAX];
+uint8_t streamFrame[STREAM_FRAME_MAX];
+
+void telemetryStreamTask(void *parameter);
+
+void initializeTelemetryStream() {
+    createTask(TASK_STREAM, telemetryStreamTask, &streamTaskHandle);
+}
+
+void startTelemetryStream(Stream &output, uint32_t fieldMask, uint8_t rateHz) {
+    portENTER_CRITICAL(&streamMux);
+    streamOutput = &output;
+    streamFieldMask = fieldMask;
+    streamRateHz = rateHz;
+    streamRunning = true;
+    portEXIT_CRITICAL(&streamMux);
+    xTaskNotifyGive(streamTaskHandle);
+}
+
+void stopTelemetryStream() {
+    streamRunning = false;
+    xTaskNotifyGive(streamTaskHandle);
+}
+
+TelemetryStreamStatus getTelemetryStreamStatus() {
+    TelemetryStreamStatus status;
+    portENTER_CRITICAL(&streamMux);
+    status.running = streamRunning;
+    status.output = streamOutput;
+    status.fieldMask = streamFieldMask;
+    status.rateHz = streamRateHz;
+    status.packetsSent = streamPacketsSent;
+    status.bytesSent = streamBytesSent;
+    status.dataPacketBytes = streamLastDataBytes;
+    portEXIT_CRITICAL(&streamMux);
+    return status;
+}
+
+// Consistent Overhead Byte Stuffing: the encoded frame contains no zero
+// bytes, so a zero marks its end. Returns the frame length with the zero.
+size_t cobsEncode(const uint8_t *input, size_t length, uint8_t *output) {
+    size_t codeIndex = 0;
+    size_t outputIndex = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (input[i] == 0) {
+            output[codeIndex] = code;
+            codeIndex = outputIndex++;
+            code = 1;
+        } else {
+            output[outputIndex++] = input[i];
+            code++;
+            if (code == 0xFF) {
+                output[codeIndex] = code;
+                codeIndex = outputIndex++;
+                code = 1;
+            }
+        }
+    }
+    output[codeIndex] = code;
+    output[outputIndex++] = 0;
+    return outputIndex;
+}
+
+// Append the CRC32, frame the packet and write it out in one go.
+// Returns the bytes written.
+size_t sendStreamPacket(Stream &output, size_t length) {
+    uint32_t crc = esp_rom_crc32_le(0, streamPacket, length);
+    memcpy(streamPacket + length, &crc, sizeof(crc));
+    length += sizeof(crc);
+
+    size_t frameLength = cobsEncode(streamPacket, length, streamFrame);
+    output.write(streamFrame, frameLength);
+
+    portENTER_CRITICAL(&streamMux);
+    streamPacketsSent++;
+    streamBytesSent += frameLength;
+    portEXIT_CRITICAL(&streamMux);
+    return frameLength;
+}
+
+// Type, field count, then id, type, scale and name of each streamed field
+void sendSchemaPacket(Stream &output, uint32_t fieldMask) {
+    streamPacket[0] = STREAM_PACKET_SCHEMA;
+    // Leave room for the CRC
+    size_t length = packTelemetrySchema(streamPacket + 1, STREAM_PACKET_MAX - 1 - sizeof(uint32_t), fieldMask);
+    sendStreamPacket(output, 1 + length);
+}
+
+// Type, sequence, millis, field mask, then the raw little endian values of the
+// selected fields in table order
+void sendDataPacket(Stream &output, uint32_t fieldMask) {
+    Telemetry snapshot;
+    readTelemetry(snapshot);
+    uint32_t now = millis();
+
+    size_t length = 0;
+    streamPacket[length++] = STREAM_PACKET_DATA;
+    memcpy(streamPacket + length, &streamSequence, sizeof(streamSequence));
+    length += sizeof(streamSequence);
+    memcpy(streamPacket + length, &now, sizeof(now));
+    length += sizeof(now);
+    memcpy(streamPacket + length, &fieldMask, sizeof(fieldMask));
+    length += sizeof(fieldMask);
+    length += packTelemetryValues(streamPacket + length, snapshot, fieldMask);
+    streamSequence++;
+    streamLastDataBytes = sendStreamPacket(output, length);
+}
+
+void telemetryStreamTask(void *parameter) {
+    TickType_t nextPacket = xTaskGetTickCount();
+    unsigned long lastSchema = 0;
+    bool schemaDue = false;
+
+    for (;;) {
+        // Sleep until the next packet is due, or until the stream is started, stopped or changed
+        TickType_t timeout = portMAX_DELAY;
+        if (streamRunning) {
+            int32_t remaining = (int32_t)(nextPacket - xTaskGetTickCount());
+            timeout = remaining > 0 ? remaining : 0;
+        }
+        if (ulTaskNotifyTake(pdTRUE, timeout) > 0) {
+            nextPacket = xTaskGetTickCount();
+            schemaDue = true;
+        }
+        countTaskWakeup(TASK_STREAM);
+
+        portENTER_CRITICAL(&streamMux);
+        bool running = streamRunning;
+        Stream *output = streamOutput;
+        uint32_t fieldMask = streamFieldMask;
+        TickType_t period = pdMS_TO_TICKS(1000 / streamRateHz);
+        portEXIT_CRITICAL(&streamMux);
+
+        if (!running || output == NULL) {
+            continue;
+        }
+
+        if (schemaDue || millis() - lastSchema >= STREAM_SCHEMA_INTERVAL_MS) {
+            sendSchemaPacket(*output, fieldMask);
+            lastSchema = millis();
+            schemaDue = false;
+        }
+        sendDataPacket(*output, fieldMask);
+
+        // Keep a steady rate, but after falling behind (a blocked output) start afresh instead of bursting
+        nextPacket += period;
+        if ((int32_t)(xTaskGetTickCount() - nextPacket) > (int32_t)period) {
+            nextPacket = xTaskGetTickCount();
+        }
+    }
+}
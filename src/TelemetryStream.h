@@ -0,0 +1,37 @@
+#ifndef TELEMETRY_STREAM_H
+#define TELEMETRY_STREAM_H
+
+#include <Arduino.h>
+
+// Rates the stream command accepts
+#define STREAM_MIN_RATE_HZ 1
+#define STREAM_MAX_RATE_HZ 100
+
+// Packet types, the first byte of every decoded packet
+#define STREAM_PACKET_DATA      1   // sequence, millis, field mask, raw field values
+#define STREAM_PACKET_SCHEMA    2   // id, type, scale and name of every streamed field
+
+// Fields streamed when none are given
+#define STREAM_DEFAULT_FIELDS "speed,rpm,DCVoltage,DCCurrent,SoC"
+
+struct TelemetryStreamStatus {
+    bool running;
+    Stream *output;             // Where the packets go
+    uint32_t fieldMask;         // Bit n set streams field n of TELEMETRY_FIELD_LIST
+    uint8_t rateHz;
+    uint32_t packetsSent;
+    uint32_t bytesSent;
+    uint16_t dataPacketBytes;   // Size of the last data packet on the wire, framing included
+};
+
+// Create the stream task, it sleeps until a stream is started
+void initializeTelemetryStream();
+
+// Stream the fields in fieldMask rateHz times a second to output, as
+// COBS framed packets with a CRC32. Replaces a running stream.
+void startTelemetryStream(Stream &output, uint32_t fieldMask, uint8_t rateHz);
+void stopTelemetryStream();
+
+TelemetryStreamStatus getTelemetryStreamStatus();
+
+#endif // TELEMETRY_STREAM_H
@@ -1,53 +1,234 @@
 #include "Timers.h"
+#include "TaskTable.h"
+#include "Trace.h"
+#include "Log.h"
 
-std::vector<Timer*> Timer::_timers;
+Timer *Timer::_heap[TIMER_MAX_TIMERS];
+int Timer::_heapSize = 0;
+int Timer::_timerCount = 0;
+portMUX_TYPE Timer::_mux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t Timer::_taskHandle = NULL;
+esp_timer_handle_t Timer::_wakeTimer = NULL;
 
-Timer::Timer(unsigned long timeout, std::function<void()> callback, bool isWatchdog)
-    : _timeout(timeout), _callback(callback), _isWatchdog(isWatchdog), _isRunning(false), _lastResetTime(0) {
-    _timers.push_back(this);
+Timer::Timer(unsigned long timeout, void (*callback)(), bool isWatchdog)
+    : _timeoutMicros((int64_t)timeout * 1000), _isWatchdog(isWatchdog), _isRunning(false),
+      _plainCallback(callback), _callback(nullptr), _context(nullptr), _deadline(0), _heapIndex(-1) {
+    _timerCount++; // Timers are global objects, constructed before any task runs
+}
+
+Timer::Timer(unsigned long timeout, TimerCallback callback, void *context, bool isWatchdog)
+    : _timeoutMicros((int64_t)timeout * 1000), _isWatchdog(isWatchdog), _isRunning(false),
+      _plainCallback(nullptr), _callback(callback), _context(context), _deadline(0), _heapIndex(-1) {
+    _timerCount++;
 }
 
 Timer::~Timer() {
-    _timers.erase(std::remove(_timers.begin(), _timers.end(), this), _timers.end());
+    stop();
+    _timerCount--;
 }
 
 void Timer::start() {
-    _isRunning = true;
-    _lastResetTime = millis();
+    portENTER_CRITICAL(&_mux);
+    _isRunning = schedule(esp_timer_get_time());
+    bool first = _heapIndex == 0;
+    portEXIT_CRITICAL(&_mux);
+    if (!_isRunning) {
+        LOG(LOG_TOO_MANY_TIMERS);
+    } else if (first) {
+        wakeService(false);
+    }
 }
 
 void Timer::stop() {
+    portENTER_CRITICAL(&_mux);
     _isRunning = false;
+    unschedule();
+    portEXIT_CRITICAL(&_mux);
+    // An early wake-up for a stopped timer is harmless, so the service is not woken
 }
 
 void Timer::reset() {
-    _lastResetTime = millis();
+    portENTER_CRITICAL(&_mux);
+    bool first = false;
+    if (_isRunning) {
+        schedule(esp_timer_get_time());
+        first = _heapIndex == 0;
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (first) {
+        wakeService(false);
+    }
 }
 
 bool Timer::isRunning() const {
     return _isRunning;
 }
 
+void IRAM_ATTR Timer::startFromISR() {
+    portENTER_CRITICAL_ISR(&_mux);
+    _isRunning = schedule(esp_timer_get_time());
+    bool first = _heapIndex == 0;
+    portEXIT_CRITICAL_ISR(&_mux);
+    if (first) {
+        wakeService(true);
+    }
+}
+
+void IRAM_ATTR Timer::resetFromISR() {
+    portENTER_CRITICAL_ISR(&_mux);
+    bool first = false;
+    if (_isRunning) {
+        schedule(esp_timer_get_time());
+        first = _heapIndex == 0;
+    }
+    portEXIT_CRITICAL_ISR(&_mux);
+    if (first) {
+        wakeService(true);
+    }
+}
+
+// Set a new deadline and move the timer to its place in the heap. False when
+// the timer is not in the heap yet and the heap is full. Called with _mux held.
+bool IRAM_ATTR Timer::schedule(int64_t now) {
+    if (_heapIndex < 0 && _heapSize >= TIMER_MAX_TIMERS) {
+        return false;
+    }
+    int64_t previous = _deadline;
+    _deadline = now + _timeoutMicros;
+    if (_heapIndex < 0) {
+        _heapIndex = _heapSize++;
+        _heap[_heapIndex] = this;
+        heapSiftUp(_heapIndex);
+    } else if (_deadline < previous) {
+        heapSiftUp(_heapIndex);
+    } else {
+        heapSiftDown(_heapIndex);
+    }
+    return true;
+}
+
+// Take the timer out of the heap. Called with _mux held.
+void Timer::unschedule() {
+    if (_heapIndex < 0) {
+        return;
+    }
+    int index = _heapIndex;
+    _heapSize--;
+    if (index != _heapSize) {
+        heapSwap(index, _heapSize);
+        heapSiftUp(index);
+        heapSiftDown(index);
+    }
+    _heapIndex = -1;
+}
+
+void Timer::fire() {
+    TRACE(TRACE_TIMER_BEGIN, _timeoutMicros / 1000);   // The timeout in ms tells the timers apart
+    if (_callback) {
+        _callback(_context);
+    } else if (_plainCallback) {
+        _plainCallback();
+    }
+    TRACE(TRACE_TIMER_END, _timeoutMicros / 1000);
+}
+
+void IRAM_ATTR Timer::heapSwap(int a, int b) {
+    Timer *timer = _heap[a];
+    _heap[a] = _heap[b];
+    _heap[b] = timer;
+    _heap[a]->_heapIndex = a;
+    _heap[b]->_heapIndex = b;
+}
+
+void IRAM_ATTR Timer::heapSiftUp(int index) {
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (_heap[parent]->_deadline <= _heap[index]->_deadline) {
+            break;
+        }
+        heapSwap(index, parent);
+        index = parent;
+    }
+}
+
+void IRAM_ATTR Timer::heapSiftDown(int index) {
+    for (;;) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < _heapSize && _heap[left]->_deadline < _heap[smallest]->_deadline) smallest = left;
+        if (right < _heapSize && _heap[right]->_deadline < _heap[smallest]->_deadline) smallest = right;
+        if (smallest == index) {
+            break;
+        }
+        heapSwap(index, smallest);
+        index = smallest;
+    }
+}
+
+void IRAM_ATTR Timer::wakeService(bool fromISR) {
+    if (_taskHandle == NULL) {
+        return; // The service picks the heap up when it starts
+    }
+    if (fromISR) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(_taskHandle, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    } else {
+        xTaskNotifyGive(_taskHandle);
+    }
+}
+
+void Timer::onWakeTimer(void *arg) {
+    xTaskNotifyGive(_taskHandle);
+}
+
+int64_t Timer::runDueTimers() {
+    // Run every timer whose deadline has passed, without holding the lock during callbacks
+    for (;;) {
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&_mux);
+        Timer *timer = _heapSize > 0 ? _heap[0] : nullptr;
+        if (timer == nullptr || timer->_deadline > now) {
+            int64_t next = timer ? timer->_deadline : -1;
+            portEXIT_CRITICAL(&_mux);
+            return next;
+        }
+        if (timer->_isWatchdog) {
+            timer->schedule(now);
+        } else {
+            timer->_isRunning = false;
+            timer->unschedule();
+        }
+        portEXIT_CRITICAL(&_mux);
+        timer->fire();
+    }
+}
+
 void Timer::timerTask(void *pvParameters) {
     for (;;) {
-        for (auto& timer : _timers) {
-            // Check and update each timer
-            if (timer->_isRunning) {
-                unsigned long currentTime = millis();
-                if ((currentTime - timer->_lastResetTime) >= timer->_timeout) {
-                    timer->_callback();
-                    if (!timer->_isWatchdog) {
-                        timer->_isRunning = false;
-                    } else {
-                        timer->_lastResetTime = currentTime;
-                    }
-                }
-            }
+        int64_t next = runDueTimers();
+
+        // Sleep until the earliest deadline, or until a start/reset moves it
+        esp_timer_stop(_wakeTimer);
+        if (next >= 0) {
+            int64_t delay = next - esp_timer_get_time();
+            esp_timer_start_once(_wakeTimer, delay > 0 ? delay : 1);
         }
-        vTaskDelay(pdMS_TO_TICKS(10)); // Delay for a short while to prevent task from using all CPU time
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        countTaskWakeup(TASK_TIMER);
     }
 }
 
 void initializeTimerTask() {
-    xTaskCreate(Timer::timerTask, "TimerTask", 2048, nullptr, 3, nullptr);
-}
\ No newline at end of file
+    if (Timer::_timerCount > TIMER_MAX_TIMERS) {
+        LOG(LOG_TOO_MANY_TIMERS);
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = Timer::onWakeTimer;
+    args.name = "TimerWake";
+    esp_timer_create(&args, &Timer::_wakeTimer);
+
+    createTask(TASK_TIMER, Timer::timerTask, &Timer::_taskHandle);
+}
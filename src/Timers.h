@@ -2,31 +2,70 @@
 #define MY_TIMERS_H
 
 #include <Arduino.h>
-#include <functional>
-#include <vector>
+#include <esp_timer.h>
 
+// Maximum number of Timer objects, the deadline heap is sized for all of them
+// running at once. A start beyond it is refused and the timer stays stopped.
+#ifndef TIMER_MAX_TIMERS
+#define TIMER_MAX_TIMERS 32
+#endif
+
+typedef void (*TimerCallback)(void *context);
+
+// One-shot or watchdog (auto-restarting) timer. Running timers sit in a
+// min-heap ordered by deadline and a single service task sleeps until the
+// earliest one, woken by a high resolution esp_timer. start/stop/reset are
+// safe from any task, the FromISR variants from interrupts.
 class Timer {
 public:
-    Timer(unsigned long timeout, std::function<void()> callback, bool isWatchdog = false);
+    Timer(unsigned long timeout, void (*callback)(), bool isWatchdog = false);
+    Timer(unsigned long timeout, TimerCallback callback, void *context, bool isWatchdog = false);
     ~Timer();
 
-    void start();
+    void start();   // Check isRunning() afterwards if more than TIMER_MAX_TIMERS may exist
     void stop();
     void reset();
     bool isRunning() const;
 
+    void startFromISR();
+    void resetFromISR();
+
     static void timerTask(void *pvParameters);
 
+    // Fire every timer whose deadline has passed and return the earliest
+    // remaining deadline, -1 when none is running. Called by the service task.
+    static int64_t runDueTimers();
+
 private:
-    unsigned long _timeout;
-    bool _isRunning;
+    friend void initializeTimerTask();
+
+    int64_t _timeoutMicros;
     bool _isWatchdog;
-    std::function<void()> _callback;
-    unsigned long _lastResetTime;
+    volatile bool _isRunning;
+    void (*_plainCallback)();
+    TimerCallback _callback;
+    void *_context;
+    int64_t _deadline;      // esp_timer_get_time() value at which the timer fires
+    int _heapIndex;         // Position in the deadline heap, -1 when not scheduled
+
+    bool schedule(int64_t now);
+    void unschedule();
+    void fire();
+
+    static void heapSwap(int a, int b);
+    static void heapSiftUp(int index);
+    static void heapSiftDown(int index);
+    static void wakeService(bool fromISR);
+    static void onWakeTimer(void *arg);
 
-    static std::vector<Timer*> _timers;
+    static Timer *_heap[TIMER_MAX_TIMERS];
+    static int _heapSize;
+    static int _timerCount;
+    static portMUX_TYPE _mux;
+    static TaskHandle_t _taskHandle;
+    static esp_timer_handle_t _wakeTimer;
 };
 
 void initializeTimerTask();
 
-#endif // MY_TIMERS_H
\ No newline at end of file
+#endif // MY_TIMERS_H
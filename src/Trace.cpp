@@ -0,0 +1,81 @@
+#include "Trace.h"
+
+const char *const traceEventNames[NUM_TRACE_EVENTS] = {
+#define TRACE_NAME(id, name, phase) name,
+    TRACE_EVENT_LIST(TRACE_NAME)
+#undef TRACE_NAME
+};
+
+const char traceEventPhases[NUM_TRACE_EVENTS] = {
+#define TRACE_PHASE(id, name, phase) phase,
+    TRACE_EVENT_LIST(TRACE_PHASE)
+#undef TRACE_PHASE
+};
+
+#ifdef ENABLE_TRACE
+
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+TraceRecord traceRing[TRACE_CAPACITY];
+volatile uint32_t traceHead = 0;
+volatile bool traceRunning = true;
+
+void dumpTrace(Stream &stream) {
+    // Stop recording so the ring holds still while it is printed
+    bool wasRunning = traceRunning;
+    traceRunning = false;
+    vTaskDelay(1);  // Let a writer that already claimed a slot finish it
+
+    // Header: the cycle rate and the event names, so the tool needs no copy of this file
+    stream.println("# trace");
+    stream.print("# cpu_mhz ");
+    stream.println(getCpuFrequencyMhz());
+    for (int i = 0; i < NUM_TRACE_EVENTS; i++) {
+        stream.print("# event ");
+        stream.print(i);
+        stream.print(" ");
+        stream.print(traceEventPhases[i]);
+        stream.print(" ");
+        stream.println(traceEventNames[i]);
+    }
+
+    // Records: cycles core event arg, oldest first
+    uint32_t head = traceHead;
+    uint32_t count = head < TRACE_CAPACITY ? head : TRACE_CAPACITY;
+    for (uint32_t i = head - count; i != head; i++) {
+        const TraceRecord &record = traceRing[i & (TRACE_CAPACITY - 1)];
+        char line[48];
+        snprintf(line, sizeof(line), "%lu %u %u %lu", (unsigned long)record.cycles, (unsigned)record.core,
+                 (unsigned)record.event, (unsigned long)record.arg);
+        stream.println(line);
+    }
+    stream.print("# end ");
+    stream.print(count);
+    stream.print(" of ");
+    stream.println(head);
+
+    traceRunning = wasRunning;
+}
+
+void clearTrace() {
+    bool wasRunning = traceRunning;
+    traceRunning = false;
+    traceHead = 0;
+    traceRunning = wasRunning;
+}
+
+void setTraceRunning(bool running) {
+    traceRunning = running;
+}
+
+#else
+
+void dumpTrace(Stream &stream) {
+    stream.println("Tracing is disabled, define ENABLE_TRACE in Trace.h");
+}
+
+void clearTrace() {}
+
+void setTraceRunning(bool running) {}
+
+#endif // ENABLE_TRACE
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <xtensa/hal.h>
+
+// Define to enable the event tracer
+// Comment out this line and every TRACE() compiles to nothing
+#define ENABLE_TRACE
+
+// Ring size in records, a power of two. Each record is 12 bytes.
+#define TRACE_CAPACITY 512
+
+// Every traced event.
+// phase is the Chrome trace phase: 'B' begin, 'E' end, 'i' instant.
+// X(id, name, phase)
+#define TRACE_EVENT_LIST(X) \
+    X(TRACE_CAN_RX,             "CAN rx",           'i') \
+    X(TRACE_CAN_DECODE_BEGIN,   "CAN decode",       'B') \
+    X(TRACE_CAN_DECODE_END,     "CAN decode",       'E') \
+    X(TRACE_RENDER_BEGIN,       "Display render",   'B') \
+    X(TRACE_RENDER_END,         "Display render",   'E') \
+    X(TRACE_SEND_BUFFER_BEGIN,  "sendBuffer",       'B') \
+    X(TRACE_SEND_BUFFER_END,    "sendBuffer",       'E') \
+    X(TRACE_GAUGE_TX,           "Gauge UART tx",    'i') \
+    X(TRACE_TIMER_BEGIN,        "Timer callback",   'B') \
+    X(TRACE_TIMER_END,          "Timer callback",   'E') \
+    X(TRACE_BUTTON_ISR,         "Button ISR",       'i')
+
+enum TraceEvent : uint16_t {
+#define TRACE_ENUM(id, name, phase) id,
+    TRACE_EVENT_LIST(TRACE_ENUM)
+#undef TRACE_ENUM
+    NUM_TRACE_EVENTS
+};
+
+struct TraceRecord {
+    uint32_t cycles;    // CPU cycle counter of the core that logged the event
+    uint16_t event;
+    uint16_t core;
+    uint32_t arg;
+};
+
+#ifdef ENABLE_TRACE
+
+extern TraceRecord traceRing[TRACE_CAPACITY];
+extern volatile uint32_t traceHead;
+extern volatile bool traceRunning;
+
+// Claim a slot with one atomic add and fill it in, safe from any core and from ISRs
+inline void traceEvent(TraceEvent event, uint32_t arg) {
+    if (!traceRunning) {
+        return;
+    }
+    uint32_t slot = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED) & (TRACE_CAPACITY - 1);
+    TraceRecord &record = traceRing[slot];
+    record.cycles = xthal_get_ccount();
+    record.event = event;
+    record.core = xPortGetCoreID();
+    record.arg = arg;
+}
+
+#define TRACE(event, arg) traceEvent(event, (uint32_t)(arg))
+
+#else
+
+#define TRACE(event, arg) ((void)0)
+
+#endif // ENABLE_TRACE
+
+// Print the ring oldest first, in the format read by tools/trace_to_chrome.py
+void dumpTrace(Stream &stream);
+
+// Empty the ring
+void clearTrace();
+
+// Pause or resume recording
+void setTraceRunning(bool running);
+
+#endif // TRACE_H
@@ -4,6 +4,7 @@
 #include "BlinkTask.h"
 #include "DisplayTask.h"
 #include "PulseCounterTask.h"
+#include "SpeedFusion.h"
 #include "CANListenerTask.h"
 #include "Semaphores.h"
 #include "GaugeControl.h"
@@ -11,31 +12,44 @@
 #include "Timers.h"
 #include "Bluetooth.h"
 #include "HelperTasks.h"
+#include "MemoryBudget.h"
+#include "TelemetryStream.h"
+#include "BleTelemetry.h"
+#include "OutputQueue.h"
 
 void setup() {
+    // Start Serial and the output task first, everything printed goes through it
+    initializeOutput();
+
     // Initialize semaphores
     createSemaphores();
 
     // Initialize other components
     initializeParameter();
+    initializeSpeedFusion();
     initializeGaugeControl();
 
-    // Initialize tasks
-    initializeTimerTask();          // priority 3
-    initializeCLI();                // priority 2
-    // initializeBlinkTask();          // priority 0
-    initializeDisplayTask();        // priority 1
-    initializePulseCounterTask();   // priority 2
-    initializeCANListenerTask();    // priority 3
-    initializeButtonTask();         // priority 4
-    initializeBluetooth();          // priority 1
-    initializeHelperTasks();         // priority 3
+    // Initialize tasks, their cores, priorities and stacks are in TaskTable.h
+    initializeTimerTask();
+    initializeCLI();
+    // initializeBlinkTask();
+    initializeDisplayTask();
+    initializePulseCounterTask();
+    initializeCANListenerTask();
+    initializeButtonTask();
+    initializeBluetooth();
+    initializeBleTelemetry();
+    initializeHelperTasks();
+    initializeTelemetryStream();
+
+    // Everything RTOS is allocated by now, report where the RAM went
+    printMemoryBudget(SerialOut);
 
 }
 
 void loop() {
-    // Empty loop
-    // with yield() function
-    // to allow other tasks to run
-    yield();
+    // Every task is event driven and started in setup(). The Arduino loop
+    // task would only spin here and keep IDLE1 from running, so it deletes
+    // itself. The idle task then frees its heap stack.
+    vTaskDelete(NULL);
 }
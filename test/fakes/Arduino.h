@@ -0,0 +1,241 @@
+#ifndef FAKE_ARDUINO_H
+#define FAKE_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino core the firmware uses, so a
+// test can compile a source file from src/ as it is. Every test is a single
+// translation unit, the fakes are header only.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+// glibc only has strlcpy since 2.38
+inline size_t fakeStrlcpy(char *dst, const char *src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return length;
+}
+#define strlcpy fakeStrlcpy
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 1
+#define OUTPUT 2
+#define INPUT_PULLUP 3
+#define CHANGE 3
+#define RISING 1
+#define FALLING 2
+#define HEX 16
+#define DEC 10
+#define BIN 2
+#define LED_BUILTIN 13
+#define IRAM_ATTR
+#define SERIAL_8N1 0x800001c
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// Simulated clock, only moves when a test advances it (or a delay runs)
+inline uint64_t &fakeClockMicros() {
+    static uint64_t now = 1000000;
+    return now;
+}
+
+inline void advanceFakeMicros(uint64_t micros) {
+    fakeClockMicros() += micros;
+}
+
+inline void advanceFakeMillis(uint64_t millis) {
+    fakeClockMicros() += millis * 1000;
+}
+
+inline unsigned long micros() {
+    return (unsigned long)(uint32_t)fakeClockMicros();
+}
+
+inline unsigned long millis() {
+    return (unsigned long)(uint32_t)(fakeClockMicros() / 1000);
+}
+
+inline void delay(unsigned long ms) {
+    advanceFakeMillis(ms);
+}
+
+inline void yield() {}
+
+#include "FakeFreeRTOS.h"
+
+// Pins read as the test sets them
+inline int *fakePinLevels() {
+    static int levels[64];
+    return levels;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline int digitalRead(uint8_t pin) { return fakePinLevels()[pin & 63]; }
+inline void digitalWrite(uint8_t pin, uint8_t value) { fakePinLevels()[pin & 63] = value; }
+inline uint16_t analogRead(uint8_t pin) { return fakePinLevels()[pin & 63]; }
+
+#define digitalPinToInterrupt(p) (p)
+inline void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) {}
+inline void detachInterrupt(uint8_t pin) {}
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+struct EspClass {
+    void restart() {}
+    uint32_t getHeapSize() { return 320 * 1024; }
+    uint32_t getFreeHeap() { return 200 * 1024; }
+    uint32_t getCpuFreqMHz() { return 240; }
+};
+static EspClass ESP;
+
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+
+typedef enum {
+    UART_NO_ERROR,
+    UART_BREAK_ERROR,
+    UART_BUFFER_FULL_ERROR,
+    UART_FIFO_OVF_ERROR,
+    UART_FRAME_ERROR,
+    UART_PARITY_ERROR
+} hardwareSerial_error_t;
+
+class String {
+public:
+    String() {}
+    String(const char *text) : s(text ? text : "") {}
+    String(const std::string &text) : s(text) {}
+    explicit String(char c) : s(1, c) {}
+    String(int value, unsigned char base = 10) { s = format((long)value, base); }
+    String(unsigned value, unsigned char base = 10) { s = format((unsigned long)value, base); }
+    String(long value, unsigned char base = 10) { s = format(value, base); }
+    String(unsigned long value, unsigned char base = 10) { s = format(value, base); }
+    String(double value, unsigned decimals = 2) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+        s = buffer;
+    }
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    String substring(unsigned from) const { return s.substr(from); }
+    String substring(unsigned from, unsigned to) const { return s.substr(from, to - from); }
+    bool startsWith(const String &other) const { return s.compare(0, other.s.size(), other.s) == 0; }
+    int indexOf(char c) const { size_t at = s.find(c); return at == std::string::npos ? -1 : (int)at; }
+    long toInt() const { return atol(s.c_str()); }
+    void trim() {
+        size_t first = s.find_first_not_of(" \t\r\n");
+        size_t last = s.find_last_not_of(" \t\r\n");
+        s = first == std::string::npos ? "" : s.substr(first, last - first + 1);
+    }
+    void remove(unsigned index) { s.erase(index); }
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    String &operator+=(const char *other) { s += other; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator!=(const String &other) const { return s != other.s; }
+    char operator[](unsigned index) const { return s[index]; }
+
+    std::string s;
+
+private:
+    static std::string format(long value, unsigned char base) {
+        if (value < 0 && base == 10) {
+            return "-" + format((unsigned long)-value, base);
+        }
+        return format((unsigned long)value, base);
+    }
+    static std::string format(unsigned long value, unsigned char base) {
+        char buffer[40];
+        if (base == 16) {
+            snprintf(buffer, sizeof(buffer), "%lX", value);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%lu", value);
+        }
+        return buffer;
+    }
+};
+
+inline String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+inline String operator+(const String &a, const char *b) { return String(a.s + b); }
+inline String operator+(const char *a, const String &b) { return String(a + b.s); }
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) {
+            n += write(*buffer++);
+        }
+        return n;
+    }
+    size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char *text) { return write(text); }
+    size_t print(const String &text) { return write(text.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(unsigned long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(double value, int decimals = 2) { return print(String(value, (unsigned)decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value) { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(const T &value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char *format, ...) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return write((const uint8_t *)buffer, min(length, (int)sizeof(buffer) - 1));
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+    size_t readBytes(uint8_t *buffer, size_t length) {
+        size_t n = 0;
+        while (n < length && available() > 0) {
+            buffer[n++] = read();
+        }
+        return n;
+    }
+    void setTimeout(unsigned long timeout) {}
+};
+
+#include "HardwareSerial.h"
+
+#endif // FAKE_ARDUINO_H
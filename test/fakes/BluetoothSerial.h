@@ -0,0 +1,63 @@
+#ifndef FAKE_BLUETOOTH_SERIAL_H
+#define FAKE_BLUETOOTH_SERIAL_H
+
+#include <Arduino.h>
+
+typedef int esp_spp_cb_event_t;
+struct esp_spp_cb_param_t {};
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+#define ESP_SPP_CLOSE_EVT 27
+#define ESP_SPP_DATA_IND_EVT 30
+#define ESP_SPP_SRV_OPEN_EVT 34
+
+// The SPP link as a byte transport: writes collect in tx, the test queues
+// received bytes with receive(). Writes fail while no client is connected.
+class BluetoothSerial : public Stream {
+public:
+    bool begin(String name, bool isMaster = false) { return true; }
+    void end() {}
+    bool hasClient() { return connected; }
+    void disconnect() { connected = false; }
+    bool register_callback(esp_spp_cb_t callback) { return true; }
+
+    int available() { return rx.size(); }
+    int read() {
+        if (rx.empty()) {
+            return -1;
+        }
+        int c = (uint8_t)rx.front();
+        rx.pop_front();
+        return c;
+    }
+    int peek() { return rx.empty() ? -1 : (uint8_t)rx.front(); }
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) {
+        if (!connected) {
+            return 0;
+        }
+        tx.append((const char *)buffer, size);
+        writes++;
+        return size;
+    }
+    using Print::write;
+    void flush() {}
+
+    // Test side: queue bytes as if the client sent them
+    void receive(const char *text) { rx.insert(rx.end(), text, text + strlen(text)); }
+
+    // Test side: take everything written so far
+    std::string takeTx() {
+        std::string sent = tx;
+        tx.clear();
+        return sent;
+    }
+
+    bool connected = false;
+    std::string tx;
+    std::deque<char> rx;
+    uint32_t writes = 0;
+};
+
+#endif // FAKE_BLUETOOTH_SERIAL_H
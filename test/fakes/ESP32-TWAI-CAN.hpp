@@ -0,0 +1,7 @@
+#ifndef FAKE_ESP32_TWAI_CAN_HPP
+#define FAKE_ESP32_TWAI_CAN_HPP
+
+// Only included for the types in the module headers, nothing from the
+// library is called by the code under test
+
+#endif // FAKE_ESP32_TWAI_CAN_HPP
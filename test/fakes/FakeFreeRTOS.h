@@ -0,0 +1,118 @@
+#ifndef FAKE_FREERTOS_H
+#define FAKE_FREERTOS_H
+
+// FreeRTOS as seen from one thread: critical sections do nothing, delays
+// move the simulated clock, notifications are only counted and waits
+// return at once. Tests call the work functions of a task directly instead
+// of running its loop, and can do the work of other tasks while a semaphore
+// take would block.
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffUL
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define tskNO_AFFINITY 0x7fffffff
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+#define pdTICKS_TO_MS(x) ((uint32_t)(x))
+#define configMAX_PRIORITIES 25
+#define configMAX_TASK_NAME_LEN 16
+#define portNUM_PROCESSORS 2
+
+typedef struct { int owner; int count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+
+// Nesting depth, so a test can check that a section was left again
+inline int &fakeCriticalDepth() {
+    static int depth = 0;
+    return depth;
+}
+
+inline void portENTER_CRITICAL(portMUX_TYPE *mux) { mux->count++; fakeCriticalDepth()++; }
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) { mux->count--; fakeCriticalDepth()--; }
+inline void portENTER_CRITICAL_ISR(portMUX_TYPE *mux) { portENTER_CRITICAL(mux); }
+inline void portEXIT_CRITICAL_ISR(portMUX_TYPE *mux) { portEXIT_CRITICAL(mux); }
+#define portYIELD_FROM_ISR(...)
+
+typedef struct { uint8_t data[100]; } StaticTask_t;
+typedef struct { uint8_t data[100]; } StaticSemaphore_t;
+
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite } eNotifyAction;
+
+inline uint32_t &fakeNotifyCount() {
+    static uint32_t count = 0;
+    return count;
+}
+
+inline TickType_t xTaskGetTickCount() { return (TickType_t)(fakeClockMicros() / 1000); }
+inline TickType_t xTaskGetTickCountFromISR() { return xTaskGetTickCount(); }
+inline void vTaskDelay(TickType_t ticks) { advanceFakeMillis(ticks); }
+inline BaseType_t xPortGetCoreID() { return 0; }
+inline uint32_t xthal_get_ccount() { return (uint32_t)(fakeClockMicros() * 240); }
+
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    fakeNotifyCount()++;
+    return pdPASS;
+}
+inline BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *woken) {
+    return xTaskNotify(task, value, action);
+}
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) { return xTaskNotify(task, 0, eIncrement); }
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) { xTaskNotifyGive(task); }
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) { return 0; }
+inline BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t timeout) {
+    if (value) {
+        *value = 0;
+    }
+    return pdFALSE;
+}
+// The task the code under test runs as
+inline TaskHandle_t &fakeCurrentTask() {
+    static TaskHandle_t task = (TaskHandle_t)1;
+    return task;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return fakeCurrentTask(); }
+inline UBaseType_t uxTaskGetNumberOfTasks() { return 12; }
+inline size_t xPortGetFreeHeapSize() { return 200 * 1024; }
+inline size_t xPortGetMinimumEverFreeHeapSize() { return 180 * 1024; }
+
+inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) { return buffer; }
+inline SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) { return buffer; }
+inline uint32_t &fakeSemaphoreGives() {
+    static uint32_t gives = 0;
+    return gives;
+}
+
+// Runs in place of the other tasks while a take with a timeout would block.
+// Returns true if the semaphore was given meanwhile, false for a timeout.
+// Without it a take succeeds at once.
+inline std::function<bool(TickType_t)> &fakeBlockingTake() {
+    static std::function<bool(TickType_t)> take;
+    return take;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    if (timeout > 0 && fakeBlockingTake()) {
+        return fakeBlockingTake()(timeout) ? pdTRUE : pdFALSE;
+    }
+    return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    fakeSemaphoreGives()++;
+    return pdTRUE;
+}
+inline UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore) { return 0; }
+
+#endif // FAKE_FREERTOS_H
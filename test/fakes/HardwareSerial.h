@@ -0,0 +1,76 @@
+#ifndef FAKE_HARDWARE_SERIAL_H
+#define FAKE_HARDWARE_SERIAL_H
+
+#include <Arduino.h>
+
+// A UART whose transmitted bytes collect in tx and whose received bytes are
+// queued by the test with receive(). Baud changes are recorded.
+class HardwareSerial : public Stream {
+public:
+    explicit HardwareSerial(int uart) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) {
+        baudRate = baud;
+    }
+    void end() {}
+    void updateBaudRate(unsigned long baud) {
+        baudRate = baud;
+        baudChanges.push_back(baud);
+    }
+    void onReceive(std::function<void(void)> callback, bool onlyOnTimeout = false) { receiveCallback = callback; }
+    void onReceiveError(std::function<void(hardwareSerial_error_t)> callback) { errorCallback = callback; }
+    size_t setRxBufferSize(size_t size) { return size; }
+    size_t setTxBufferSize(size_t size) { return size; }
+
+    int available() { return rx.size(); }
+    int read() {
+        if (rx.empty()) {
+            return -1;
+        }
+        int c = (uint8_t)rx.front();
+        rx.pop_front();
+        return c;
+    }
+    int peek() { return rx.empty() ? -1 : (uint8_t)rx.front(); }
+
+    size_t write(uint8_t c) {
+        tx += (char)c;
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size) {
+        tx.append((const char *)buffer, size);
+        writes++;
+        return size;
+    }
+    using Print::write;
+    int availableForWrite() { return 128; }
+    void flush() {}
+    operator bool() const { return true; }
+
+    // Test side: queue bytes as if they arrived on the wire
+    void receive(const char *text) {
+        rx.insert(rx.end(), text, text + strlen(text));
+        if (receiveCallback) {
+            receiveCallback();
+        }
+    }
+
+    // Test side: take everything written so far
+    std::string takeTx() {
+        std::string sent = tx;
+        tx.clear();
+        return sent;
+    }
+
+    unsigned long baudRate = 0;
+    std::vector<unsigned long> baudChanges;
+    std::string tx;
+    std::deque<char> rx;
+    uint32_t writes = 0;
+    std::function<void(void)> receiveCallback;
+    std::function<void(hardwareSerial_error_t)> errorCallback;
+};
+
+static HardwareSerial Serial(0);
+
+#endif // FAKE_HARDWARE_SERIAL_H
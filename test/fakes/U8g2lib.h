@@ -0,0 +1,7 @@
+#ifndef FAKE_U8G2LIB_H
+#define FAKE_U8G2LIB_H
+
+// Only included for the types in the module headers, nothing from the
+// library is called by the code under test
+
+#endif // FAKE_U8G2LIB_H
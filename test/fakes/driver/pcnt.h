@@ -0,0 +1,68 @@
+#ifndef FAKE_DRIVER_PCNT_H
+#define FAKE_DRIVER_PCNT_H
+
+#include <esp_err.h>
+
+// One pulse counter unit whose value the test sets. Configuration calls
+// succeed unless fakePcntConfigResult says otherwise.
+
+typedef int pcnt_unit_t;
+typedef int pcnt_channel_t;
+typedef int pcnt_evt_type_t;
+typedef int pcnt_count_mode_t;
+typedef int pcnt_ctrl_mode_t;
+
+#define PCNT_UNIT_0 0
+#define PCNT_CHANNEL_0 0
+#define PCNT_PIN_NOT_USED -1
+#define PCNT_COUNT_DIS 0
+#define PCNT_COUNT_INC 1
+#define PCNT_COUNT_DEC 2
+#define PCNT_MODE_KEEP 0
+#define PCNT_EVT_H_LIM 0x10
+
+typedef struct {
+    int pulse_gpio_num;
+    int ctrl_gpio_num;
+    pcnt_ctrl_mode_t lctrl_mode;
+    pcnt_ctrl_mode_t hctrl_mode;
+    pcnt_count_mode_t pos_mode;
+    pcnt_count_mode_t neg_mode;
+    int16_t counter_h_lim;
+    int16_t counter_l_lim;
+    pcnt_unit_t unit;
+    pcnt_channel_t channel;
+} pcnt_config_t;
+
+inline int16_t &fakePcntCounter() {
+    static int16_t counter = 0;
+    return counter;
+}
+
+inline esp_err_t &fakePcntConfigResult() {
+    static esp_err_t result = ESP_OK;
+    return result;
+}
+
+inline esp_err_t pcnt_unit_config(const pcnt_config_t *config) { return fakePcntConfigResult(); }
+inline esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t value) { return ESP_OK; }
+inline esp_err_t pcnt_filter_enable(pcnt_unit_t unit) { return ESP_OK; }
+inline esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t event) { return ESP_OK; }
+inline esp_err_t pcnt_isr_service_install(int flags) { return ESP_OK; }
+inline esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*handler)(void *), void *arg) { return ESP_OK; }
+inline esp_err_t pcnt_counter_pause(pcnt_unit_t unit) { return ESP_OK; }
+inline esp_err_t pcnt_counter_resume(pcnt_unit_t unit) { return ESP_OK; }
+inline esp_err_t pcnt_counter_clear(pcnt_unit_t unit) {
+    fakePcntCounter() = 0;
+    return ESP_OK;
+}
+inline esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t *count) {
+    *count = fakePcntCounter();
+    return ESP_OK;
+}
+inline esp_err_t pcnt_get_event_status(pcnt_unit_t unit, uint32_t *status) {
+    *status = PCNT_EVT_H_LIM;
+    return ESP_OK;
+}
+
+#endif // FAKE_DRIVER_PCNT_H
@@ -0,0 +1,6 @@
+#ifndef FAKE_ESP_BT_MAIN_H
+#define FAKE_ESP_BT_MAIN_H
+
+// Nothing from the Bluetooth stack is called by the code under test
+
+#endif // FAKE_ESP_BT_MAIN_H
@@ -0,0 +1,20 @@
+#ifndef FAKE_ESP_ERR_H
+#define FAKE_ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_INVALID_ARG             0x102
+#define ESP_ERR_INVALID_SIZE            0x104
+#define ESP_ERR_NVS_NOT_FOUND           0x1102
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    0x1105
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1110
+#define ESP_ERR_NVS_KEY_TOO_LONG        0x1113
+
+inline const char *esp_err_to_name(esp_err_t error) {
+    return error == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+#endif // FAKE_ESP_ERR_H
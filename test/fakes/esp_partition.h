@@ -0,0 +1,131 @@
+#ifndef FAKE_ESP_PARTITION_H
+#define FAKE_ESP_PARTITION_H
+
+#include <esp_err.h>
+#include <vector>
+
+// One data partition on simulated NOR flash. An erase sets a whole sector to
+// 0xFF and counts towards its wear, a write can only clear bits. A power cut
+// can be scheduled after a number of bytes: the operation that reaches it is
+// left half done and everything after it fails until fakeFlashPowerOn().
+
+typedef int esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+
+#define ESP_PARTITION_TYPE_APP 0x00
+#define ESP_PARTITION_TYPE_DATA 0x01
+
+#define FAKE_FLASH_SECTOR_SIZE 4096
+
+struct esp_partition_t {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+};
+
+struct FakeFlash {
+    esp_partition_t partition;
+    bool present;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> erases;   // Per sector
+    uint32_t bytesWritten;
+    int64_t cutAfterBytes;          // Bytes written or erased before the power fails, -1 = never
+    bool powered;
+};
+
+inline FakeFlash &fakeFlash() {
+    static FakeFlash flash;
+    return flash;
+}
+
+// A fresh partition of the given size, erased as it comes from the factory
+inline void fakeFlashFormat(const char *label, esp_partition_subtype_t subtype, uint32_t size) {
+    FakeFlash &flash = fakeFlash();
+    flash.partition.type = ESP_PARTITION_TYPE_DATA;
+    flash.partition.subtype = subtype;
+    flash.partition.address = 0x3E0000;
+    flash.partition.size = size;
+    snprintf(flash.partition.label, sizeof(flash.partition.label), "%s", label);
+    flash.present = true;
+    flash.data.assign(size, 0xFF);
+    flash.erases.assign(size / FAKE_FLASH_SECTOR_SIZE, 0);
+    flash.bytesWritten = 0;
+    flash.cutAfterBytes = -1;
+    flash.powered = true;
+}
+
+inline void fakeFlashCutPowerAfter(int64_t bytes) {
+    fakeFlash().cutAfterBytes = bytes;
+}
+
+inline void fakeFlashPowerOn() {
+    fakeFlash().cutAfterBytes = -1;
+    fakeFlash().powered = true;
+}
+
+// Bytes of an operation of length size that get done before the power fails
+inline size_t fakeFlashBudget(size_t size) {
+    FakeFlash &flash = fakeFlash();
+    if (!flash.powered) {
+        return 0;
+    }
+    if (flash.cutAfterBytes >= 0 && (int64_t)size > flash.cutAfterBytes) {
+        size_t done = (size_t)flash.cutAfterBytes;
+        flash.cutAfterBytes = -1;
+        flash.powered = false;
+        return done;
+    }
+    if (flash.cutAfterBytes >= 0) {
+        flash.cutAfterBytes -= size;
+    }
+    return size;
+}
+
+inline const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    FakeFlash &flash = fakeFlash();
+    if (!flash.present || flash.partition.type != type || flash.partition.subtype != subtype ||
+        (label && strcmp(label, flash.partition.label) != 0)) {
+        return NULL;
+    }
+    return &flash.partition;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *buffer, size_t size) {
+    FakeFlash &flash = fakeFlash();
+    if (offset + size > flash.data.size()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(buffer, &flash.data[offset], size);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *buffer, size_t size) {
+    FakeFlash &flash = fakeFlash();
+    if (offset + size > flash.data.size()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t done = fakeFlashBudget(size);
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    for (size_t i = 0; i < done; i++) {
+        flash.data[offset + i] &= bytes[i];
+    }
+    flash.bytesWritten += done;
+    return done == size ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    FakeFlash &flash = fakeFlash();
+    if (offset % FAKE_FLASH_SECTOR_SIZE || size % FAKE_FLASH_SECTOR_SIZE || offset + size > flash.data.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t done = fakeFlashBudget(size);
+    memset(&flash.data[offset], 0xFF, done);
+    for (size_t sector = offset / FAKE_FLASH_SECTOR_SIZE; sector < (offset + size) / FAKE_FLASH_SECTOR_SIZE; sector++) {
+        flash.erases[sector]++;
+    }
+    return done == size ? ESP_OK : ESP_FAIL;
+}
+
+#endif // FAKE_ESP_PARTITION_H
@@ -0,0 +1,18 @@
+#ifndef FAKE_ESP_ROM_CRC_H
+#define FAKE_ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+// Same result as the ROM routine: CRC-32 (IEEE), bitwise
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *data, uint32_t length) {
+    crc = ~crc;
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+#endif // FAKE_ESP_ROM_CRC_H
@@ -0,0 +1,33 @@
+#ifndef FAKE_ESP_TIMER_H
+#define FAKE_ESP_TIMER_H
+
+#include <Arduino.h>
+#include "esp_err.h"
+
+// The high resolution timer reads the simulated clock. One-shot timers are
+// only recorded, a test fires them by calling their work directly.
+typedef void *esp_timer_handle_t;
+
+typedef struct {
+    void (*callback)(void *arg);
+    void *arg;
+    int dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+inline int64_t esp_timer_get_time() {
+    return (int64_t)fakeClockMicros();
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+    static int timers = 0;
+    *handle = (esp_timer_handle_t)(intptr_t)++timers;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutMicros) { return ESP_OK; }
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodMicros) { return ESP_OK; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) { return ESP_OK; }
+
+#endif // FAKE_ESP_TIMER_H
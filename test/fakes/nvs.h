@@ -0,0 +1,118 @@
+#ifndef FAKE_NVS_H
+#define FAKE_NVS_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+// One NVS namespace of i32 values. A set is held by the handle until the
+// commit, and the sets and commits are counted to show how often flash is
+// written. An open, a set or a commit can be made to fail.
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+#define NVS_KEY_NAME_MAX_SIZE   16      // With the terminating NUL
+#define FAKE_NVS_HANDLE         1
+
+struct FakeNvs {
+    bool exists;                                // Created by the first read-write open
+    std::map<std::string, int32_t> stored;      // What flash holds
+    std::map<std::string, int32_t> pending;     // Set and not yet committed
+    uint32_t sets;
+    uint32_t commits;
+    uint32_t opens;                             // Open handles
+    esp_err_t openError;                        // Returned by the next opens while not ESP_OK
+    esp_err_t setError;                         // The same for sets
+    esp_err_t commitError;                      // And commits, which then store nothing
+    bool initialized;
+};
+
+inline FakeNvs &fakeNvs() {
+    static FakeNvs nvs;
+    return nvs;
+}
+
+// Empty flash, as after nvs_flash_erase
+inline void fakeNvsReset() {
+    fakeNvs() = FakeNvs();
+}
+
+inline esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle) {
+    FakeNvs &nvs = fakeNvs();
+    if (nvs.openError != ESP_OK) {
+        return nvs.openError;
+    }
+    if (!nvs.exists) {
+        if (mode == NVS_READONLY) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        nvs.exists = true;
+    }
+    nvs.opens++;
+    *handle = FAKE_NVS_HANDLE;
+    return ESP_OK;
+}
+
+inline void nvs_close(nvs_handle_t handle) {
+    FakeNvs &nvs = fakeNvs();
+    nvs.opens--;
+    nvs.pending.clear();    // Uncommitted sets are lost
+}
+
+inline esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value) {
+    FakeNvs &nvs = fakeNvs();
+    std::map<std::string, int32_t>::const_iterator it = nvs.stored.find(key);
+    if (it == nvs.stored.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *value = it->second;
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value) {
+    FakeNvs &nvs = fakeNvs();
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (nvs.setError != ESP_OK) {
+        return nvs.setError;
+    }
+    nvs.sets++;
+    nvs.pending[key] = value;
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    FakeNvs &nvs = fakeNvs();
+    if (nvs.stored.erase(key) == 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    fakeNvs().stored.clear();
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_commit(nvs_handle_t handle) {
+    FakeNvs &nvs = fakeNvs();
+    if (nvs.commitError != ESP_OK) {
+        return nvs.commitError;
+    }
+    nvs.commits++;
+    for (std::map<std::string, int32_t>::const_iterator it = nvs.pending.begin(); it != nvs.pending.end(); ++it) {
+        nvs.stored[it->first] = it->second;
+    }
+    nvs.pending.clear();
+    return ESP_OK;
+}
+
+#endif // FAKE_NVS_H
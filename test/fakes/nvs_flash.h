@@ -0,0 +1,16 @@
+#ifndef FAKE_NVS_FLASH_H
+#define FAKE_NVS_FLASH_H
+
+#include <nvs.h>
+
+inline esp_err_t nvs_flash_init() {
+    fakeNvs().initialized = true;
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_flash_erase() {
+    fakeNvsReset();
+    return ESP_OK;
+}
+
+#endif // FAKE_NVS_FLASH_H
@@ -0,0 +1,6 @@
+#ifndef FAKE_XTENSA_HAL_H
+#define FAKE_XTENSA_HAL_H
+
+// xthal_get_ccount() comes with the FreeRTOS fake
+
+#endif // FAKE_XTENSA_HAL_H
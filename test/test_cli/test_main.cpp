@@ -0,0 +1,674 @@
+// CLI front end: the in-place tokenizer with blanks and quotes, lookup in
+// the command table, argument counts checked against it, and lines longer
+// than the line buffer. Serial and Bluetooth sessions typed into at the same
+// time over the fake transports, also while one of them runs top or streams.
+
+#include <unity.h>
+
+#include "CLI.cpp"
+#include "OutputQueue.cpp"
+
+// Modules CLI.cpp talks to. Only what the tests look at does anything.
+Telemetry telemetryData;
+const TelemetryField telemetryFields[NUM_TELEMETRY_FIELDS] = {};
+uint8_t logLevels[NUM_LOG_MODULES];
+const char *const logModuleNames[NUM_LOG_MODULES] = {};
+const char *const logLevelNames[LOG_DEBUG + 1] = {};
+DisplayMode currentDisplayMode = EMPTY;
+SemaphoreHandle_t buttonSemaphore = NULL;
+SemaphoreHandle_t buttonStateSemaphore = NULL;
+SemaphoreHandle_t outputRoomSemaphore = NULL;
+BluetoothSerial SerialBT;
+
+Gauge Speedometer("Speedometer", Serial, GaugeRange(0, 200, 106, 353));
+Gauge Tachometer("Tachometer", Serial, GaugeRange(0, 9000, 96, 340));
+Gauge Dynamometer("Dynamometer", Serial, GaugeRange(-60, 90, 107, 235));
+Gauge Chargeometer("Chargeometer", Serial, GaugeRange(0, 100, 99, 191));
+Gauge Thermometer("Thermometer", Serial, GaugeRange(-20, 100, 99, 194));
+
+int setParameterCalls = 0;
+int lastIndex = 0;
+int lastValue = 0;
+Stream *lastOutput = NULL;
+
+void setParameter(int index, int value, Stream *output) {
+    setParameterCalls++;
+    lastIndex = index;
+    lastValue = value;
+    lastOutput = output;
+}
+
+void getParameter(int index, Stream *output) {}
+void clearNVS(int index, Stream *output) {}
+void updateParametersFromNVS(int index, Stream *output) {}
+void commitParameters() {}
+ParameterStoreStats getParameterStoreStats() { return ParameterStoreStats(); }
+
+uint32_t getSpeed() { return 0; }
+uint32_t getTripOdometer() { return 0; }
+bool setTripOdometer(uint32_t tenths) { return true; }
+void resetTripOdometer() {}
+uint32_t getFusedSpeedMmPerS() { return 0; }
+uint32_t getLearnedSpeedRatio() { return 0; }
+JournalStats getOdometerJournalStats() { return JournalStats(); }
+
+void sendGaugeFrame(HardwareSerial &serial, const char *payload, bool reliable) {}
+void sendStandbyCommand(bool enable) {}
+void enableAutoUpdate(bool enable) {}
+bool getAutoUpdate() { return false; }
+GaugeLatencyStats getGaugeLatencyStats() { return GaugeLatencyStats(); }
+void setGaugeAckEnabled(bool enable) {}
+bool getGaugeAckEnabled() { return false; }
+GaugeLinkStats getGaugeLinkStats() { return GaugeLinkStats(); }
+void resetGaugeLinkStats() {}
+uint32_t getGaugeLinkRttPercentile(uint8_t percentile) { return 0; }
+uint32_t getGaugeLinkRttSampleCount() { return 0; }
+const char *getGaugeLastStatus() { return ""; }
+void startGaugeBaudNegotiation() {}
+void fallBackGaugeBaud() {}
+uint32_t getGaugeBaudRate() { return 9600; }
+bool isGaugeBaudNegotiated() { return false; }
+
+void setDisplayMode(DisplayMode mode) { currentDisplayMode = mode; }
+void setIgnitionOverride(bool enabled) {}
+bool getIgnitionOverride() { return false; }
+void setIgnitionState(bool on) {}
+bool getIgnitionState() { return false; }
+
+CanStats getCanStats() { return CanStats(); }
+std::vector<Print *> canMonitors;
+
+bool addCANMonitor(Print &output, uint32_t filterID) {
+    canMonitors.push_back(&output);
+    return true;
+}
+
+void removeCANMonitor(Print &output) {
+    canMonitors.erase(std::remove(canMonitors.begin(), canMonitors.end(), &output), canMonitors.end());
+}
+
+bool isCANMonitor(Print &output) {
+    return std::find(canMonitors.begin(), canMonitors.end(), &output) != canMonitors.end();
+}
+
+bool isBTConnected() { return SerialBT.connected; }
+void setBTInputTask(TaskHandle_t task) {}
+BTStats getBTStats() { return BTStats(); }
+
+void printTelemetryDump(Stream &stream, const Telemetry &data) {}
+void printTelemetryCsv(Stream &stream, const Telemetry &data, bool header) {}
+TelemetryFieldId findTelemetryField(const char *key) { return NUM_TELEMETRY_FIELDS; }
+TelemetryStreamStatus streamStatus;
+
+void startTelemetryStream(Stream &output, uint32_t fieldMask, uint8_t rateHz) {
+    streamStatus.running = true;
+    streamStatus.output = &output;
+}
+
+void stopTelemetryStream() {
+    streamStatus.running = false;
+}
+
+TelemetryStreamStatus getTelemetryStreamStatus() { return streamStatus; }
+
+void printTaskWakeups(Stream &stream) {}
+void printTaskDeadlines(Stream &stream) {}
+void resetTaskDeadlines() {}
+void printStackReport(Stream &stream) {}
+
+// top waits for its next refresh in printTaskTop. Each wait takes the next
+// step: the bytes that arrive on each transport meanwhile, or the Bluetooth
+// client going away. A wait that gets any of them returns early, as the CLI
+// task's notification cuts it short.
+struct TopStep {
+    const char *serial;
+    const char *bt;
+    bool btLeaves;
+};
+
+std::vector<TopStep> topSteps;
+size_t topRefreshes = 0;
+
+bool printTaskTop(Stream &stream, uint32_t intervalMs) {
+    stream.println("tasks");
+    // More refreshes than steps means top did not stop
+    TEST_ASSERT_TRUE(topRefreshes < topSteps.size());
+    const TopStep &step = topSteps[topRefreshes++];
+    if (step.serial) {
+        Serial.receive(step.serial);
+    }
+    if (step.bt) {
+        SerialBT.receive(step.bt);
+    }
+    if (step.btLeaves) {
+        SerialBT.connected = false;
+    }
+    return step.serial || step.bt || step.btLeaves;
+}
+void printMemoryBudget(Stream &stream) {}
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) { return true; }
+void countTaskWakeup(TaskId task) {}
+
+void dumpTrace(Stream &stream) {}
+void clearTrace() {}
+void setTraceRunning(bool running) {}
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {}
+void printPendingLogs() {}
+uint32_t logSinks = 0;
+
+void setLogSink(OutputSink sink, bool enabled) {
+    if (enabled) {
+        logSinks |= 1 << sink;
+    } else {
+        logSinks &= ~(1 << sink);
+    }
+}
+
+bool isLogSink(OutputSink sink) { return logSinks & (1 << sink); }
+void setLogLevel(LogModule module, uint8_t level) {}
+bool findLogModule(const char *name, LogModule &module) { return false; }
+bool findLogLevel(const char *name, uint8_t &level) { return false; }
+LogStats getLogStats() { return LogStats(); }
+
+// Everything queued for a sink so far
+std::string takeQueued(OutputSink sink) {
+    std::string out;
+    uint8_t chunk[OUTPUT_CHUNK];
+    size_t count;
+    while ((count = takeOutput(sink, chunk, sizeof(chunk))) > 0) {
+        out.append((const char *)chunk, count);
+    }
+    return out;
+}
+
+// Run one line as typed on Serial and return what it printed
+std::string run(const char *text) {
+    char line[CLI_MAX_LINE];
+    strlcpy(line, text, sizeof(line));
+    handleInput(line, SerialOut);
+    return takeQueued(OUTPUT_SERIAL);
+}
+
+// argv with a guard entry behind it, to catch a write past CLI_MAX_ARGS
+char *argv[CLI_MAX_ARGS + 1];
+char guard[] = "guard";
+int argc;
+
+const Command *parse(char *line) {
+    argv[CLI_MAX_ARGS] = guard;
+    const Command *command = parseCommand(line, argc, argv);
+    TEST_ASSERT_EQUAL_PTR(guard, argv[CLI_MAX_ARGS]);
+    return command;
+}
+
+// Run the CLI task for one wakeup, then the output task until both ports got everything
+void service() {
+    while (serviceSessions()) {
+    }
+    while (sendOutput()) {
+    }
+}
+
+void setUp() {
+    setParameterCalls = 0;
+    lastOutput = NULL;
+    canMonitors.clear();
+    topSteps.clear();
+    topRefreshes = 0;
+    SerialBT.connected = false;
+    service();
+    stopSessionStream();
+    for (int i = 0; i < numCliSessions; i++) {
+        cliSessions[i].echo = true;
+        cliSessions[i].length = 0;
+        setLogSink(cliSessions[i].sink, true);
+    }
+    Serial.rx.clear();
+    SerialBT.rx.clear();
+    Serial.takeTx();
+    SerialBT.takeTx();
+    takeQueued(OUTPUT_SERIAL);
+}
+
+void tearDown() {}
+
+void test_blank_lines_are_ignored() {
+    const char *blanks[] = {"", " ", "\t", "  \t  "};
+    for (const char *blank : blanks) {
+        char line[16];
+        strcpy(line, blank);
+        TEST_ASSERT_NULL(parse(line));
+        TEST_ASSERT_EQUAL_INT(0, argc);
+        TEST_ASSERT_EQUAL_STRING("", run(blank).c_str());
+    }
+}
+
+void test_splits_on_blanks_in_place() {
+    char line[] = "  p   3\t120  ";
+    const Command *command = parse(line);
+    TEST_ASSERT_NOT_NULL(command);
+    TEST_ASSERT_EQUAL_STRING("p", command->name);
+    TEST_ASSERT_EQUAL_INT(3, argc);
+    TEST_ASSERT_EQUAL_STRING("p", argv[0]);
+    TEST_ASSERT_EQUAL_STRING("3", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("120", argv[2]);
+    // The tokens point into the line itself
+    TEST_ASSERT_TRUE(argv[0] >= line && argv[2] < line + sizeof(line));
+
+    run("p 3 120");
+    TEST_ASSERT_EQUAL_INT(1, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(3, lastIndex);
+    TEST_ASSERT_EQUAL_INT(120, lastValue);
+}
+
+void test_quoted_arguments() {
+    char blanks[] = "p \"3\"  \"1 2\t0\" ";
+    parse(blanks);
+    TEST_ASSERT_EQUAL_INT(3, argc);
+    TEST_ASSERT_EQUAL_STRING("3", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("1 2\t0", argv[2]);
+
+    char empty[] = "p \"\" 5";
+    parse(empty);
+    TEST_ASSERT_EQUAL_INT(3, argc);
+    TEST_ASSERT_EQUAL_STRING("", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("5", argv[2]);
+
+    // No closing quote: the rest of the line is the token
+    char open[] = "p 3 \"120 km";
+    parse(open);
+    TEST_ASSERT_EQUAL_INT(3, argc);
+    TEST_ASSERT_EQUAL_STRING("120 km", argv[2]);
+
+    // A quote inside a token is an ordinary character
+    char inside[] = "p a\"b";
+    parse(inside);
+    TEST_ASSERT_EQUAL_INT(2, argc);
+    TEST_ASSERT_EQUAL_STRING("a\"b", argv[1]);
+
+    // A quoted command name is looked up like any other
+    char name[] = "\"p\" 3 120";
+    TEST_ASSERT_NOT_NULL(parse(name));
+    TEST_ASSERT_EQUAL_STRING("p", argv[0]);
+
+    run("p \"3\" \"120\"");
+    TEST_ASSERT_EQUAL_INT(1, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(120, lastValue);
+}
+
+void test_rest_of_line_argument_is_not_split() {
+    char line[] = "echo   \"hello  world\"\tagain  ";
+    const Command *command = parse(line);
+    TEST_ASSERT_EQUAL_UINT8(CLI_ARGS_LINE, command->maxArgs);
+    TEST_ASSERT_EQUAL_INT(2, argc);
+    TEST_ASSERT_EQUAL_STRING("\"hello  world\"\tagain", argv[1]);
+
+    TEST_ASSERT_EQUAL_STRING("a  b\r\n", run("echo a  b").c_str());
+    TEST_ASSERT_EQUAL_STRING("\r\n", run("echo   ").c_str());
+}
+
+void test_every_table_entry_is_found() {
+    for (int i = 0; i < numCommands; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), " %s ", commands[i].name);
+        TEST_ASSERT_EQUAL_PTR(&commands[i], parse(line));
+        TEST_ASSERT_EQUAL_INT(1, argc);
+    }
+}
+
+void test_unknown_commands() {
+    const char *unknown[] = {"x", "tri", "trips", "HELP", "p3", "\"\""};
+    for (const char *name : unknown) {
+        char line[16];
+        strcpy(line, name);
+        TEST_ASSERT_NULL(parse(line));
+        TEST_ASSERT_EQUAL_INT(1, argc);
+        TEST_ASSERT_EQUAL_STRING("Unknown command. Type 'help' for a list of commands.\r\n", run(name).c_str());
+    }
+}
+
+void test_argument_count_is_checked() {
+    TEST_ASSERT_EQUAL_STRING("Usage: p [subcommand]\r\n", run("p 1 2 3").c_str());
+    TEST_ASSERT_EQUAL_STRING("Usage: help \r\n", run("help me").c_str());
+    TEST_ASSERT_EQUAL_INT(0, setParameterCalls);
+
+    // Tokens that do not fit in argv are still counted, and nothing is written past it
+    char line[] = "p 1 2 3 4 5 6 7 8 9";
+    parse(line);
+    TEST_ASSERT_EQUAL_INT(10, argc);
+    TEST_ASSERT_EQUAL_STRING("5", argv[CLI_MAX_ARGS - 1]);
+    TEST_ASSERT_EQUAL_STRING("Usage: p [subcommand]\r\n", run("p 1 2 3 4 5 6 7 8 9").c_str());
+}
+
+void test_overlong_line_is_cut_off() {
+    CliSession &session = cliSessions[0];
+    session.echo = false;
+    session.length = 0;
+
+    // Typed past the end of the line buffer: the rest of the line is dropped
+    std::string typed = "echo ";
+    typed.append(300, 'x');
+    for (char ch : typed) {
+        processCharacter(ch, session);
+    }
+    TEST_ASSERT_EQUAL_UINT32(CLI_MAX_LINE - 1, session.length);
+    processCharacter('\r', session);
+    std::string expected(CLI_MAX_LINE - 1 - strlen("echo "), 'x');
+    TEST_ASSERT_EQUAL_STRING((expected + "\r\n").c_str(), takeQueued(OUTPUT_SERIAL).c_str());
+
+    // The next line starts afresh
+    for (char ch : std::string("p 4 7\n")) {
+        processCharacter(ch, session);
+    }
+    TEST_ASSERT_EQUAL_INT(1, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(7, lastValue);
+
+    // A full line of tokens
+    char line[CLI_MAX_LINE];
+    memset(line, ' ', sizeof(line));
+    memcpy(line, "p", 1);
+    for (size_t at = 2; at + 1 < sizeof(line); at += 2) {
+        line[at] = '1';
+    }
+    line[sizeof(line) - 1] = '\0';
+    parse(line);
+    TEST_ASSERT_EQUAL_INT(CLI_MAX_LINE / 2, argc);
+    session.echo = true;
+}
+
+void test_help_is_generated_from_the_table() {
+    std::string help = run("h");
+    TEST_ASSERT_EQUAL_STRING(help.c_str(), run("help").c_str());
+    int lines = 0;
+    for (int i = 0; i < numCommands; i++) {
+        if (commands[i].help != NULL) {
+            lines++;
+            TEST_ASSERT_TRUE(help.find(commands[i].help) != std::string::npos);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(lines + 1, std::count(help.begin(), help.end(), '\n'));
+}
+
+void test_interleaved_sessions_keep_their_own_lines() {
+    SerialBT.connected = true;
+    service();
+    CliSession &serial = cliSessions[0];
+    CliSession &bt = cliSessions[1];
+
+    Serial.receive("p 1");
+    SerialBT.receive("p 2");
+    service();
+    Serial.receive(" 10");
+    SerialBT.receive(" 20");
+    service();
+    TEST_ASSERT_EQUAL_UINT32(6, serial.length);
+    TEST_ASSERT_EQUAL_UINT32(6, bt.length);
+    TEST_ASSERT_EQUAL_INT(0, setParameterCalls);
+
+    // Each Enter runs its own session's line, with output to that session
+    SerialBT.receive("\r");
+    service();
+    TEST_ASSERT_EQUAL_INT(1, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(2, lastIndex);
+    TEST_ASSERT_EQUAL_INT(20, lastValue);
+    TEST_ASSERT_EQUAL_PTR(&BTOut, lastOutput);
+    TEST_ASSERT_EQUAL_UINT32(6, serial.length);
+
+    Serial.receive("\r");
+    service();
+    TEST_ASSERT_EQUAL_INT(2, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(1, lastIndex);
+    TEST_ASSERT_EQUAL_INT(10, lastValue);
+    TEST_ASSERT_EQUAL_PTR(&SerialOut, lastOutput);
+
+    // Typing is echoed to the session it came from only
+    TEST_ASSERT_EQUAL_STRING("p 1 10\r\n", Serial.takeTx().c_str());
+    TEST_ASSERT_EQUAL_STRING("p 2 20\r\n", SerialBT.takeTx().c_str());
+}
+
+void test_byte_by_byte_interleaving() {
+    SerialBT.connected = true;
+    service();
+    const char *serialLine = "echo from serial\r";
+    const char *btLine = "echo  from bluetooth\x7f\x7fh\n";
+    size_t serialLength = strlen(serialLine);
+    size_t btLength = strlen(btLine);
+    for (size_t i = 0; i < serialLength || i < btLength; i++) {
+        char byte[2] = {0, 0};
+        if (i < serialLength) {
+            byte[0] = serialLine[i];
+            Serial.receive(byte);
+        }
+        if (i < btLength) {
+            byte[0] = btLine[i];
+            SerialBT.receive(byte);
+        }
+        service();
+    }
+    TEST_ASSERT_EQUAL_STRING("echo from serial\r\nfrom serial\r\n", Serial.takeTx().c_str());
+    TEST_ASSERT_EQUAL_STRING("echo  from bluetooth\x7f\x7fh\r\nfrom bluetooh\r\n", SerialBT.takeTx().c_str());
+}
+
+void test_echo_is_per_session() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("session echo off\r");
+    service();
+    TEST_ASSERT_EQUAL_STRING("session echo off\r\nEcho off.\r\n", SerialBT.takeTx().c_str());
+    TEST_ASSERT_FALSE(cliSessions[1].echo);
+    TEST_ASSERT_TRUE(cliSessions[0].echo);
+
+    SerialBT.receive("echo x\r");
+    Serial.receive("echo y\r");
+    service();
+    TEST_ASSERT_EQUAL_STRING("x\r\n", SerialBT.takeTx().c_str());
+    TEST_ASSERT_EQUAL_STRING("echo y\r\ny\r\n", Serial.takeTx().c_str());
+}
+
+void test_bluetooth_reconnect_starts_afresh() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("session echo off\rcanmonitor\rp 9");
+    Serial.receive("p 3");
+    service();
+    TEST_ASSERT_TRUE(isCANMonitor(BTOut));
+    TEST_ASSERT_EQUAL_UINT32(3, cliSessions[1].length);
+
+    // The client goes away halfway through a line and comes back
+    SerialBT.connected = false;
+    service();
+    SerialBT.connected = true;
+    service();
+    TEST_ASSERT_EQUAL_UINT32(0, cliSessions[1].length);
+    TEST_ASSERT_TRUE(cliSessions[1].echo);
+    TEST_ASSERT_FALSE(isCANMonitor(BTOut));
+    SerialBT.takeTx();
+
+    // Its half line is gone, the Serial one is not
+    SerialBT.receive(" 99\r");
+    Serial.receive(" 4\r");
+    service();
+    TEST_ASSERT_EQUAL_INT(1, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(3, lastIndex);
+    TEST_ASSERT_EQUAL_INT(4, lastValue);
+    TEST_ASSERT_EQUAL_STRING(" 99\r\nUnknown command. Type 'help' for a list of commands.\r\n", SerialBT.takeTx().c_str());
+}
+
+void test_can_monitor_is_per_session() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("canmonitor\r");
+    service();
+    TEST_ASSERT_EQUAL_UINT32(1, canMonitors.size());
+    TEST_ASSERT_EQUAL_PTR(&BTOut, canMonitors[0]);
+
+    // An empty line stops it only in the session that started it
+    Serial.receive("\r");
+    service();
+    TEST_ASSERT_TRUE(isCANMonitor(BTOut));
+    SerialBT.takeTx();
+    SerialBT.receive("\r");
+    service();
+    TEST_ASSERT_FALSE(isCANMonitor(BTOut));
+    TEST_ASSERT_EQUAL_STRING("\r\nCAN monitoring stopped.\r\n", SerialBT.takeTx().c_str());
+}
+
+void test_session_list() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("canmonitor\r");
+    service();
+    Serial.receive("session\r");
+    service();
+    std::string list = Serial.takeTx();
+    TEST_ASSERT_TRUE(list.find("* serial  connected     echo on ") != std::string::npos);
+    TEST_ASSERT_TRUE(list.find("  bt      connected     echo on   canmonitor") != std::string::npos);
+}
+
+void test_other_session_runs_during_top() {
+    SerialBT.connected = true;
+    service();
+    topSteps = {
+        {"p 1 10\r", NULL, false},     // Typed on Serial while Bluetooth watches top
+        {NULL, NULL, false},
+        {"p 2", NULL, false},
+        {" 20\r", "x", false},         // Any key in the Bluetooth session ends it
+    };
+    SerialBT.receive("top 1\r");
+    service();
+    TEST_ASSERT_EQUAL_UINT32(4, topRefreshes);
+    TEST_ASSERT_EQUAL_INT(2, setParameterCalls);
+    TEST_ASSERT_EQUAL_INT(2, lastIndex);
+    TEST_ASSERT_EQUAL_INT(20, lastValue);
+    TEST_ASSERT_EQUAL_PTR(&SerialOut, lastOutput);
+    TEST_ASSERT_EQUAL_STRING("p 1 10\r\np 2 20\r\n", Serial.takeTx().c_str());
+
+    // The key that ended top stays in its session's line
+    TEST_ASSERT_EQUAL_UINT32(1, cliSessions[1].length);
+    TEST_ASSERT_EQUAL_UINT32(0, Serial.available());
+    TEST_ASSERT_EQUAL_UINT32(0, SerialBT.available());
+}
+
+void test_bluetooth_runs_during_top_in_serial() {
+    SerialBT.connected = true;
+    service();
+    // Bluetooth types a line in the same wait that ends top
+    topSteps = {
+        {NULL, "session echo off\r", false},
+        {"\r", "echo hi\r", false},
+    };
+    Serial.receive("top 2\r");
+    service();
+    TEST_ASSERT_EQUAL_UINT32(2, topRefreshes);
+    TEST_ASSERT_FALSE(cliSessions[1].echo);
+    TEST_ASSERT_EQUAL_STRING("session echo off\r\nEcho off.\r\nhi\r\n", SerialBT.takeTx().c_str());
+    TEST_ASSERT_EQUAL_UINT32(0, SerialBT.available());
+}
+
+void test_top_stops_when_its_client_goes() {
+    SerialBT.connected = true;
+    service();
+    topSteps = {
+        {NULL, NULL, false},
+        {NULL, NULL, true},
+    };
+    SerialBT.receive("top 1\r");
+    service();
+    TEST_ASSERT_EQUAL_UINT32(2, topRefreshes);
+    TEST_ASSERT_FALSE(cliSessions[1].connected);
+}
+
+void test_streaming_session_has_no_echo_or_log_lines() {
+    SerialBT.connected = true;
+    service();
+    Serial.receive("log off\r");
+    SerialBT.receive("stream 10 all\r");
+    service();
+    TEST_ASSERT_TRUE(streamStatus.running);
+    TEST_ASSERT_EQUAL_PTR(&BTOut, streamStatus.output);
+    TEST_ASSERT_FALSE(cliSessions[1].echo);
+    TEST_ASSERT_FALSE(isLogSink(OUTPUT_BT));
+    SerialBT.takeTx();
+
+    // Typing goes unechoed, the frames are all the client gets
+    SerialBT.receive("stream");
+    service();
+    TEST_ASSERT_EQUAL_STRING("", SerialBT.takeTx().c_str());
+    SerialBT.receive(" stop\r");
+    service();
+    TEST_ASSERT_FALSE(streamStatus.running);
+    TEST_ASSERT_TRUE(cliSessions[1].echo);
+    TEST_ASSERT_TRUE(isLogSink(OUTPUT_BT));
+    TEST_ASSERT_EQUAL_STRING("Stream stopped.\r\n", SerialBT.takeTx().c_str());
+
+    // Serial keeps what it had before streaming
+    Serial.receive("session echo off\rstream 5 all\r");
+    service();
+    TEST_ASSERT_EQUAL_PTR(&SerialOut, streamStatus.output);
+    Serial.receive("stream stop\r");
+    service();
+    TEST_ASSERT_FALSE(cliSessions[0].echo);
+    TEST_ASSERT_FALSE(isLogSink(OUTPUT_SERIAL));
+}
+
+void test_stream_moving_to_the_other_session() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("stream 10 all\r");
+    service();
+    Serial.receive("stream 20 all\r");
+    service();
+    TEST_ASSERT_EQUAL_PTR(&SerialOut, streamStatus.output);
+    TEST_ASSERT_TRUE(cliSessions[1].echo);
+    TEST_ASSERT_TRUE(isLogSink(OUTPUT_BT));
+    TEST_ASSERT_FALSE(cliSessions[0].echo);
+    TEST_ASSERT_FALSE(isLogSink(OUTPUT_SERIAL));
+
+    // Restarted at another rate, it still restores the settings from before
+    Serial.receive("stream 50 all\r");
+    service();
+    Serial.receive("stream stop\r");
+    service();
+    TEST_ASSERT_TRUE(cliSessions[0].echo);
+    TEST_ASSERT_TRUE(isLogSink(OUTPUT_SERIAL));
+}
+
+void test_bluetooth_leaving_stops_its_stream() {
+    SerialBT.connected = true;
+    service();
+    SerialBT.receive("stream 10 all\r");
+    service();
+    SerialBT.connected = false;
+    service();
+    TEST_ASSERT_FALSE(streamStatus.running);
+    TEST_ASSERT_FALSE(cliSessions[1].streaming);
+    TEST_ASSERT_TRUE(cliSessions[1].echo);
+    TEST_ASSERT_TRUE(isLogSink(OUTPUT_BT));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_blank_lines_are_ignored);
+    RUN_TEST(test_splits_on_blanks_in_place);
+    RUN_TEST(test_quoted_arguments);
+    RUN_TEST(test_rest_of_line_argument_is_not_split);
+    RUN_TEST(test_every_table_entry_is_found);
+    RUN_TEST(test_unknown_commands);
+    RUN_TEST(test_argument_count_is_checked);
+    RUN_TEST(test_overlong_line_is_cut_off);
+    RUN_TEST(test_help_is_generated_from_the_table);
+    RUN_TEST(test_interleaved_sessions_keep_their_own_lines);
+    RUN_TEST(test_byte_by_byte_interleaving);
+    RUN_TEST(test_echo_is_per_session);
+    RUN_TEST(test_bluetooth_reconnect_starts_afresh);
+    RUN_TEST(test_can_monitor_is_per_session);
+    RUN_TEST(test_session_list);
+    RUN_TEST(test_other_session_runs_during_top);
+    RUN_TEST(test_bluetooth_runs_during_top_in_serial);
+    RUN_TEST(test_top_stops_when_its_client_goes);
+    RUN_TEST(test_streaming_session_has_no_echo_or_log_lines);
+    RUN_TEST(test_stream_moving_to_the_other_session);
+    RUN_TEST(test_bluetooth_leaving_stops_its_stream);
+    return UNITY_END();
+}
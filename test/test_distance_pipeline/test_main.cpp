@@ -0,0 +1,179 @@
+// The fixed-point wheel pipeline over a synthetic 1000 km drive: odometer
+// and trip stay exact to the millimetre, the speed EMA settles on the true
+// speed and back to 0, and a benchmark of one speed task window.
+
+#include <unity.h>
+#include <chrono>
+
+#include "PulseCounterTask.cpp"
+
+// Modules PulseCounterTask.cpp talks to
+int32_t parameterValues[NUM_PARAMETERS];
+uint8_t logLevels[NUM_LOG_MODULES];
+uint32_t journalRequests = 0;
+uint32_t distancePublishes = 0;
+
+void onParameterChange(ParameterId id, ParameterCallback callback) {
+    callback(id, parameterValues[id]);
+}
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {}
+void initializeOdometerJournal() {}
+void requestOdometerJournalWrite(bool syncNVS) { journalRequests++; }
+void publishTelemetry(uint32_t topics, uint32_t sourceMicros) { distancePublishes++; }
+void updateFusionFromWheel(uint32_t wheelMmPerS, uint32_t smoothedMmPerS, bool reliable) {}
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) { return true; }
+void countTaskWakeup(TaskId task) {}
+void markTaskIdle(TaskId task) {}
+void setTaskPeriod(TaskId task, uint32_t periodMs) {}
+
+#define START_KM 202600
+#define DRIVE_MM (1000 * 1000000ULL)
+
+void setSpeedFactor(uint32_t mm) {
+    parameterValues[PARAM_SPEED_FACTOR] = mm;
+    onSpeedParameterChange(PARAM_SPEED_FACTOR, mm);
+}
+
+uint64_t totalMm() {
+    uint32_t km, odometerMm, tripMm;
+    getDistanceSnapshot(km, odometerMm, tripMm);
+    return km * 1000000ULL + odometerMm;
+}
+
+// Pulses of one 100 ms window on a drive that speeds up and slows down
+// between standstill and about 130 km/h
+uint32_t drivePulses(uint32_t window, uint32_t pulseMm) {
+    uint32_t phase = window % 6000;
+    uint32_t mmPerS = phase < 3000 ? phase * 12 : (6000 - phase) * 12;
+    uint32_t base = mmPerS / 10 / pulseMm;
+    return base + rand() % 3;
+}
+
+void setUp() {
+    restoreDistances(START_KM, 0, 0);
+    distanceSinceJournal = 0;
+    journalRequests = 0;
+    distancePublishes = 0;
+    setSpeedFactor(800);
+    srand(42);
+}
+
+void tearDown() {}
+
+void test_1000_km_is_exact() {
+    // A wheel circumference that does not divide a kilometre
+    setSpeedFactor(797);
+    uint64_t pulses = 0;
+    uint64_t start = totalMm();
+    for (uint32_t window = 0; pulses * 797 < DRIVE_MM; window++) {
+        uint32_t n = drivePulses(window, 797);
+        addDistance(n);
+        pulses += n;
+    }
+
+    uint64_t driven = pulses * 797;
+    TEST_ASSERT_TRUE(totalMm() - start == driven);
+    uint32_t km, odometerMm, tripMm;
+    getDistanceSnapshot(km, odometerMm, tripMm);
+    TEST_ASSERT_EQUAL_UINT32(START_KM + driven / 1000000, km);
+    TEST_ASSERT_EQUAL_UINT32(driven % 1000000, odometerMm);
+    TEST_ASSERT_EQUAL_UINT32(driven % 1000000000, tripMm);
+
+    // A journal record per 50 m or a little more, and a publish per 100 m at most
+    TEST_ASSERT_TRUE(journalRequests <= driven / JOURNAL_INTERVAL_MM);
+    TEST_ASSERT_TRUE(journalRequests >= driven / (JOURNAL_INTERVAL_MM + 60 * 797));
+    TEST_ASSERT_TRUE(distancePublishes <= driven / 100000 + driven / 1000000 + 1);
+}
+
+void test_every_speed_factor_is_exact() {
+    for (uint32_t factor = 1; factor <= 2000; factor += 37) {
+        setUp();
+        setSpeedFactor(factor);
+        uint64_t pulses = 0;
+        for (uint32_t window = 0; pulses * factor < 20 * 1000000ULL; window++) {
+            uint32_t n = drivePulses(window, factor);
+            addDistance(n);
+            pulses += n;
+        }
+        TEST_ASSERT_TRUE(totalMm() - START_KM * 1000000ULL == pulses * factor);
+    }
+}
+
+void test_trip_wraps_at_1000_km() {
+    setTripOdometer(TRIP_ODOMETER_LIMIT - 1);   // 999.9 km
+    setSpeedFactor(1000);
+    for (int i = 0; i < 105; i++) {
+        addDistance(1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, getTripOdometer());
+    uint32_t km, odometerMm, tripMm;
+    getDistanceSnapshot(km, odometerMm, tripMm);
+    TEST_ASSERT_EQUAL_UINT32(5000, tripMm);
+}
+
+void test_steady_speed_settles_exactly() {
+    for (uint32_t kmh = 1; kmh <= 250; kmh++) {
+        uint32_t mmPerS = kmh * 10000 / 36;
+        int32_t smoothedSpeedQ = 0;
+        uint32_t smoothed = 0;
+        for (int i = 0; i < 200; i++) {
+            smoothed = smoothSpeed(smoothedSpeedQ, mmPerS);
+        }
+        TEST_ASSERT_UINT32_WITHIN(1, mmPerS, smoothed);
+        TEST_ASSERT_EQUAL_UINT32(kmh, mmPerSToKmh(smoothed));
+    }
+}
+
+void test_speed_settles_back_to_zero() {
+    int32_t smoothedSpeedQ = 0;
+    for (int i = 0; i < 200; i++) {
+        smoothSpeed(smoothedSpeedQ, SPEED_MAX_MM_PER_S);
+    }
+    // The speed task only parks once the EMA is exactly 0
+    int windows = 0;
+    while (smoothedSpeedQ != 0 && windows < 1000) {
+        smoothSpeed(smoothedSpeedQ, 0);
+        windows++;
+    }
+    TEST_ASSERT_EQUAL_INT32(0, smoothedSpeedQ);
+    TEST_ASSERT_TRUE(windows < 300);    // Under 30 s at 100 ms windows
+}
+
+void test_benchmark_window() {
+    setSpeedFactor(800);
+    int32_t smoothedSpeedQ = 0;
+    uint32_t windows = 0;
+    uint64_t pulses = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (pulses * 800 < DRIVE_MM) {
+        uint32_t n = drivePulses(windows, 800);
+        uint32_t distance = addDistance(n);
+        smoothSpeed(smoothedSpeedQ, windowSpeed(n, distance, 100000, crossoverPulses));
+        pulses += n;
+        windows++;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char message[96];
+    snprintf(message, sizeof(message), "1000 km in %u windows, %.1f ns per window on the host",
+             windows, (double)elapsed / windows);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(totalMm() - START_KM * 1000000ULL == pulses * 800);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 0; i < NUM_PARAMETERS; i++) {
+        parameterValues[i] = parameterInfo[i].defaultValue;
+    }
+    initializePulseCounterTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_1000_km_is_exact);
+    RUN_TEST(test_every_speed_factor_is_exact);
+    RUN_TEST(test_trip_wraps_at_1000_km);
+    RUN_TEST(test_steady_speed_settles_exactly);
+    RUN_TEST(test_speed_settles_back_to_zero);
+    RUN_TEST(test_benchmark_window);
+    return UNITY_END();
+}
@@ -0,0 +1,442 @@
+// Gauge link against a mock gauge controller: acknowledgements, RTT,
+// retransmits, NAKs, the link counters and the baud negotiation.
+
+#include <unity.h>
+#include <string>
+#include <vector>
+
+#include "GaugeControl.cpp"
+#include "Trace.cpp"
+
+// Modules GaugeControl.cpp talks to
+void readTelemetry(Telemetry &out) { out = Telemetry(); }
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    if (handle) {
+        *handle = (TaskHandle_t)(intptr_t)(task + 1);
+    }
+    return true;
+}
+
+void countTaskWakeup(TaskId task) {}
+void subscribeTelemetry(TaskHandle_t task, uint32_t topics) {}
+uint32_t takeTelemetrySourceMicros() { return 0; }
+
+bool hasTimePassed(unsigned long &lastTime, unsigned long interval) {
+    unsigned long currentTime = millis();
+    if (currentTime - lastTime >= interval) {
+        lastTime = currentTime;
+        return true;
+    }
+    return false;
+}
+
+// The gauge controller on the other end of GaugeSerial. It reads every line
+// the firmware sent and queues its replies on the receive side.
+struct MockGauge {
+    enum Mode {
+        ACK,        // Acknowledge every frame
+        NAK_FIRST,  // Reject the first copy of each frame, acknowledge the resend
+        SILENT      // Never answer
+    };
+
+    Mode mode = ACK;
+    std::vector<std::string> lines;     // Lines received, oldest first
+    std::vector<unsigned> naked;        // Sequence numbers rejected once
+    std::vector<unsigned long> rates;   // Rates it agrees to
+    std::vector<unsigned long> broken;  // Rates it agrees to but cannot receive at
+    unsigned long rate = GAUGE_BASE_BAUD;
+
+    void reset() {
+        mode = ACK;
+        lines.clear();
+        naked.clear();
+        rates.clear();
+        broken.clear();
+        rate = GAUGE_BASE_BAUD;
+    }
+
+    static bool contains(const std::vector<unsigned long> &list, unsigned long value) {
+        return std::find(list.begin(), list.end(), value) != list.end();
+    }
+
+    // Read what was sent since the last call and answer it
+    void process() {
+        std::string sent = GaugeSerial.takeTx();
+        size_t start = 0;
+        for (size_t end = sent.find('\n'); end != std::string::npos; end = sent.find('\n', start)) {
+            std::string line = sent.substr(start, end - start);
+            start = end + 1;
+            lines.push_back(line);
+            answer(line);
+        }
+    }
+
+    void answer(const std::string &line) {
+        if (line.compare(0, 5, "BAUD:") == 0) {
+            // Echo a rate it supports at the old rate, then switch. The
+            // base rate is a fallback and is not echoed.
+            unsigned long proposed = strtoul(line.c_str() + 5, NULL, 10);
+            if (proposed == GAUGE_BASE_BAUD) {
+                rate = GAUGE_BASE_BAUD;
+            } else if (contains(rates, proposed)) {
+                GaugeSerial.receive((line + "\n").c_str());
+                rate = proposed;
+            }
+            return;
+        }
+        if (line == "PING") {
+            if (rate == GaugeSerial.baudRate && !contains(broken, rate)) {
+                GaugeSerial.receive("PONG\n");
+            }
+            return;
+        }
+
+        size_t hash = line.rfind('#');
+        if (hash == std::string::npos || mode == SILENT) {
+            return;
+        }
+        unsigned seq = strtoul(line.c_str() + hash + 1, NULL, 10);
+        char reply[24];
+        if (mode == NAK_FIRST && std::find(naked.begin(), naked.end(), seq) == naked.end()) {
+            naked.push_back(seq);
+            snprintf(reply, sizeof(reply), "NAK:%u\n", seq);
+        } else {
+            snprintf(reply, sizeof(reply), "ACK:%u\n", seq);
+        }
+        GaugeSerial.receive(reply);
+    }
+
+    // Copies of a payload seen on the wire
+    int count(const char *payload) {
+        int n = 0;
+        for (const std::string &line : lines) {
+            if (line.compare(0, strlen(payload), payload) == 0) {
+                n++;
+            }
+        }
+        return n;
+    }
+};
+
+MockGauge gauge;
+
+// One pass of the link task
+void runLink() {
+    gauge.process();
+    readGaugeReplies();
+    checkPendingFrames();
+    runGaugeBaudStateMachine();
+}
+
+// Run the link task every 10 ms for a while
+void runLinkFor(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        runLink();
+        advanceFakeMillis(10);
+    }
+}
+
+void setUp(void) {
+    gaugeBaudState = BAUD_BASE;
+    gaugeBaudNegotiationRequested = false;
+    gaugeBaudFallbackRequested = false;
+    gaugeBaudRate = GAUGE_BASE_BAUD;
+    GaugeSerial.baudRate = GAUGE_BASE_BAUD;
+    GaugeSerial.baudChanges.clear();
+    GaugeSerial.takeTx();
+    GaugeSerial.rx.clear();
+    gaugeRxLength = 0;
+    gaugeRxOverlong = false;
+    setGaugeAckEnabled(false);
+    resetGaugeLinkStats();
+    gauge.reset();
+}
+
+void tearDown(void) {}
+
+void test_frame_without_ack(void) {
+    sendGaugeFrame(GaugeSerial, "Speedometer:106");
+
+    TEST_ASSERT_EQUAL_STRING("Speedometer:106\n", GaugeSerial.takeTx().c_str());
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkStats().framesSent);
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+void test_ack_measures_rtt(void) {
+    setGaugeAckEnabled(true);
+    sendGaugeFrame(GaugeSerial, "Tachometer:96");
+    advanceFakeMicros(3000);
+    gauge.process();
+    readGaugeReplies();
+
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.framesSent);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.acksReceived);
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkRttSampleCount());
+    TEST_ASSERT_EQUAL_UINT32(3000, getGaugeLinkRttPercentile(50));
+    TEST_ASSERT_FALSE(checkPendingFrames());
+}
+
+void test_reliable_frame_retransmitted_then_lost(void) {
+    setGaugeAckEnabled(true);
+    gauge.mode = MockGauge::SILENT;
+    sendGaugeFrame(GaugeSerial, "STBY:1", true);
+    gauge.process();
+
+    for (int retry = 1; retry <= GAUGE_MAX_RETRIES; retry++) {
+        advanceFakeMillis(GAUGE_ACK_TIMEOUT_MS);
+        TEST_ASSERT_TRUE(checkPendingFrames());
+        gauge.process();
+    }
+    advanceFakeMillis(GAUGE_ACK_TIMEOUT_MS);
+    TEST_ASSERT_FALSE(checkPendingFrames());
+
+    // Every copy carries the same sequence number
+    TEST_ASSERT_EQUAL_INT(1 + GAUGE_MAX_RETRIES, gauge.count("STBY:1#"));
+    for (const std::string &line : gauge.lines) {
+        TEST_ASSERT_EQUAL_STRING(gauge.lines[0].c_str(), line.c_str());
+    }
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_MAX_RETRIES, stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(1 + GAUGE_MAX_RETRIES, stats.framesSent);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.framesLost);
+}
+
+void test_unreliable_frame_times_out(void) {
+    setGaugeAckEnabled(true);
+    gauge.mode = MockGauge::SILENT;
+    sendGaugeFrame(GaugeSerial, "Chargeometer:99");
+    advanceFakeMillis(GAUGE_ACK_TIMEOUT_MS);
+    TEST_ASSERT_FALSE(checkPendingFrames());
+
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.ackTimeouts);
+}
+
+void test_nak_resends_at_once(void) {
+    setGaugeAckEnabled(true);
+    gauge.mode = MockGauge::NAK_FIRST;
+    sendGaugeFrame(GaugeSerial, "STBY:0", true);
+    gauge.process();
+    readGaugeReplies();     // NAK, the frame goes out again without waiting for the timeout
+    gauge.process();
+    readGaugeReplies();     // ACK of the resend
+
+    TEST_ASSERT_EQUAL_INT(2, gauge.count("STBY:0#"));
+    TEST_ASSERT_EQUAL_STRING(gauge.lines[0].c_str(), gauge.lines[1].c_str());
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.acksReceived);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.framesLost);
+    TEST_ASSERT_FALSE(checkPendingFrames());
+}
+
+void test_evicts_oldest_when_slots_are_full(void) {
+    setGaugeAckEnabled(true);
+    gauge.mode = MockGauge::SILENT;
+    for (int i = 0; i <= GAUGE_PENDING_SLOTS; i++) {
+        sendGaugeFrame(GaugeSerial, "Thermometer:99");
+        advanceFakeMicros(100);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkStats().ackTimeouts);
+}
+
+void test_status_and_bad_replies(void) {
+    GaugeSerial.receive("STAT:OK\r\n");
+    GaugeSerial.receive("ACK:999\n");                               // Nothing outstanding
+    GaugeSerial.receive("HELLO\n");                                 // Unknown
+    GaugeSerial.receive("ACK:12x\n");                               // Not a number
+    GaugeSerial.receive("0123456789012345678901234567890123456789\n");  // Overlong
+    readGaugeReplies();
+
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.statusReports);
+    TEST_ASSERT_EQUAL_STRING("OK", getGaugeLastStatus());
+    TEST_ASSERT_EQUAL_UINT32(4, stats.rxErrors);
+}
+
+void test_reply_split_across_reads(void) {
+    setGaugeAckEnabled(true);
+    sendGaugeFrame(GaugeSerial, "Speedometer:200");
+    std::string sent = GaugeSerial.takeTx();
+    std::string reply = "K:" + sent.substr(sent.find('#') + 1);
+    GaugeSerial.receive("AC");
+    readGaugeReplies();
+    TEST_ASSERT_EQUAL_UINT32(0, getGaugeLinkStats().acksReceived);
+    GaugeSerial.receive(reply.c_str());
+    readGaugeReplies();
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkStats().acksReceived);
+}
+
+void test_uart_errors_counted(void) {
+    TEST_ASSERT_TRUE((bool)GaugeSerial.errorCallback);
+    GaugeSerial.errorCallback(UART_FRAME_ERROR);
+    GaugeSerial.errorCallback(UART_FIFO_OVF_ERROR);
+
+    TEST_ASSERT_EQUAL_UINT32(2, getGaugeLinkStats().uartErrors);
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+void test_negotiates_fastest_agreed_rate(void) {
+    gauge.rates = {57600, 38400};
+    startGaugeBaudNegotiation();
+    runLinkFor(500);
+
+    TEST_ASSERT_TRUE(isGaugeBaudNegotiated());
+    TEST_ASSERT_EQUAL_UINT32(57600, getGaugeBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(57600, GaugeSerial.baudRate);
+    TEST_ASSERT_EQUAL_UINT32(57600, gauge.rate);
+    GaugeLinkStats stats = getGaugeLinkStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.baudSwitches);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.baudFailures);   // 115200 was not echoed
+    TEST_ASSERT_EQUAL_INT(1, gauge.count("BAUD:115200"));
+}
+
+void test_stays_at_base_rate_without_answer(void) {
+    startGaugeBaudNegotiation();
+    runLinkFor(1000);
+
+    TEST_ASSERT_FALSE(isGaugeBaudNegotiated());
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, getGaugeBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(numGaugeBaudRates, getGaugeLinkStats().baudFailures);
+    TEST_ASSERT_TRUE(GaugeSerial.baudChanges.empty());
+    TEST_ASSERT_EQUAL_INT(BAUD_BASE, gaugeBaudState);
+}
+
+void test_rate_without_pong_falls_back_and_tries_next(void) {
+    gauge.rates = {115200, 57600};
+    gauge.broken = {115200};
+    startGaugeBaudNegotiation();
+    runLinkFor(1000);
+
+    TEST_ASSERT_TRUE(isGaugeBaudNegotiated());
+    TEST_ASSERT_EQUAL_UINT32(57600, getGaugeBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkStats().baudFailures);
+    // Up to 115200, back to the base rate to propose again, then 57600
+    TEST_ASSERT_EQUAL_INT(3, GaugeSerial.baudChanges.size());
+    TEST_ASSERT_EQUAL_UINT32(115200, GaugeSerial.baudChanges[0]);
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, GaugeSerial.baudChanges[1]);
+    TEST_ASSERT_EQUAL_UINT32(57600, GaugeSerial.baudChanges[2]);
+}
+
+void test_error_burst_falls_back_to_base_rate(void) {
+    gauge.rates = {115200};
+    startGaugeBaudNegotiation();
+    runLinkFor(300);
+    TEST_ASSERT_TRUE(isGaugeBaudNegotiated());
+
+    for (int i = 0; i <= GAUGE_BAUD_ERROR_LIMIT; i++) {
+        GaugeSerial.receive("garbled\n");
+    }
+    runLinkFor(GAUGE_BAUD_CHECK_INTERVAL_MS + 10);
+
+    TEST_ASSERT_FALSE(isGaugeBaudNegotiated());
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, getGaugeBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, gauge.rate);
+    TEST_ASSERT_EQUAL_UINT32(1, getGaugeLinkStats().baudFallbacks);
+    TEST_ASSERT_EQUAL_INT(1, gauge.count("BAUD:9600"));
+}
+
+void test_few_errors_keep_negotiated_rate(void) {
+    gauge.rates = {115200};
+    startGaugeBaudNegotiation();
+    runLinkFor(300);
+
+    GaugeSerial.receive("garbled\n");
+    runLinkFor(3 * GAUGE_BAUD_CHECK_INTERVAL_MS);
+
+    TEST_ASSERT_TRUE(isGaugeBaudNegotiated());
+    TEST_ASSERT_EQUAL_UINT32(0, getGaugeLinkStats().baudFallbacks);
+}
+
+void test_manual_fallback(void) {
+    gauge.rates = {38400};
+    startGaugeBaudNegotiation();
+    runLinkFor(1000);
+    TEST_ASSERT_EQUAL_UINT32(38400, getGaugeBaudRate());
+
+    fallBackGaugeBaud();
+    runLink();
+    gauge.process();
+
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, getGaugeBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(GAUGE_BASE_BAUD, gauge.rate);
+    TEST_ASSERT_EQUAL_INT(BAUD_BASE, gaugeBaudState);
+}
+
+void test_needles_held_back_while_switching(void) {
+    gauge.rates = {115200};
+    startGaugeBaudNegotiation();
+    runGaugeBaudStateMachine();
+    TEST_ASSERT_EQUAL_INT(BAUD_PROPOSED, gaugeBaudState);
+    GaugeSerial.takeTx();
+
+    sendGaugeFrame(GaugeSerial, "Speedometer:150");
+    TEST_ASSERT_EQUAL_STRING("", GaugeSerial.takeTx().c_str());
+    sendGaugeFrame(GaugeSerial, "STBY:1", true);
+    TEST_ASSERT_EQUAL_STRING("STBY:1\n", GaugeSerial.takeTx().c_str());
+}
+
+// Bytes and writes of the TRACE_GAUGE_TX events since clearTrace()
+uint32_t tracedTxBytes(uint32_t &writes) {
+    uint32_t bytes = 0;
+    writes = 0;
+    for (uint32_t i = 0; i < traceHead && i < TRACE_CAPACITY; i++) {
+        if (traceRing[i].event == TRACE_GAUGE_TX) {
+            bytes += traceRing[i].arg;
+            writes++;
+        }
+    }
+    return bytes;
+}
+
+void test_every_write_is_traced(void) {
+    clearTrace();
+    setGaugeAckEnabled(true);
+    gauge.mode = MockGauge::SILENT;
+
+    // A frame, its resends and a baud negotiation
+    sendGaugeFrame(GaugeSerial, "STBY:1", true);
+    for (int retry = 1; retry <= GAUGE_MAX_RETRIES; retry++) {
+        advanceFakeMillis(GAUGE_ACK_TIMEOUT_MS);
+        checkPendingFrames();
+    }
+    gauge.rates.push_back(115200);
+    startGaugeBaudNegotiation();
+    runLinkFor(50);
+    std::string sent = GaugeSerial.tx;
+    for (const std::string &line : gauge.lines) {
+        sent += line + "\n";
+    }
+
+    uint32_t writes;
+    uint32_t bytes = tracedTxBytes(writes);
+    TEST_ASSERT_EQUAL_UINT32(sent.size(), bytes);
+    TEST_ASSERT_TRUE(writes >= 1 + GAUGE_MAX_RETRIES + 1);
+}
+
+int main(int argc, char **argv) {
+    initializeGaugeControl();   // Installs the UART callbacks
+
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_without_ack);
+    RUN_TEST(test_ack_measures_rtt);
+    RUN_TEST(test_reliable_frame_retransmitted_then_lost);
+    RUN_TEST(test_unreliable_frame_times_out);
+    RUN_TEST(test_nak_resends_at_once);
+    RUN_TEST(test_evicts_oldest_when_slots_are_full);
+    RUN_TEST(test_status_and_bad_replies);
+    RUN_TEST(test_reply_split_across_reads);
+    RUN_TEST(test_uart_errors_counted);
+    RUN_TEST(test_negotiates_fastest_agreed_rate);
+    RUN_TEST(test_stays_at_base_rate_without_answer);
+    RUN_TEST(test_rate_without_pong_falls_back_and_tries_next);
+    RUN_TEST(test_error_burst_falls_back_to_base_rate);
+    RUN_TEST(test_few_errors_keep_negotiated_rate);
+    RUN_TEST(test_manual_fallback);
+    RUN_TEST(test_needles_held_back_while_switching);
+    RUN_TEST(test_every_write_is_traced);
+    return UNITY_END();
+}
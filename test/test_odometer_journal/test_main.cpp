@@ -0,0 +1,261 @@
+// Odometer journal on simulated NOR flash: recovery after a reboot, wrapping
+// around the partition, wear over 1000 km and power cuts in every byte of a
+// record write and in a sector erase.
+
+#include <unity.h>
+
+#include "OdometerJournal.cpp"
+
+#define PARTITION_SIZE 0x10000  // As in partitions.csv
+
+// Modules OdometerJournal.cpp talks to
+int32_t parameterValues[NUM_PARAMETERS];
+uint8_t logLevels[NUM_LOG_MODULES];
+uint32_t parametersMarked = 0;
+uint32_t parameterCommits = 0;
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {}
+void markParameterChanged(int index) { parametersMarked |= 1UL << index; }
+void commitParameters() { parameterCommits++; }
+void countTaskWakeup(TaskId task) {}
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    if (handle) {
+        *handle = (TaskHandle_t)(intptr_t)(task + 1);
+    }
+    return true;
+}
+
+// The pulse counter: distances as the car drives, and what the journal restored
+uint32_t carKm = 0;
+uint32_t carMm = 0;
+uint32_t carTripMm = 0;
+
+bool restored = false;
+uint32_t restoredKm = 0;
+uint32_t restoredMm = 0;
+uint32_t restoredTripMm = 0;
+
+void getDistanceSnapshot(uint32_t &odometerKm, uint32_t &odometerMm, uint32_t &tripMm) {
+    odometerKm = carKm;
+    odometerMm = carMm;
+    tripMm = carTripMm;
+}
+
+void restoreDistances(uint32_t odometerKm, uint32_t odometerMm, uint32_t tripMm) {
+    restored = true;
+    restoredKm = odometerKm;
+    restoredMm = odometerMm;
+    restoredTripMm = tripMm;
+}
+
+// Drive in steps of the journal interval, writing a record after each one
+void drive(uint32_t mm) {
+    for (uint32_t driven = 0; driven < mm; driven += JOURNAL_INTERVAL_MM) {
+        carMm += JOURNAL_INTERVAL_MM;
+        carTripMm = (carTripMm + JOURNAL_INTERVAL_MM) % 1000000000;
+        if (carMm >= 1000000) {
+            carMm -= 1000000;
+            carKm++;
+        }
+        handleJournalRequests(JOURNAL_REQUEST_RECORD);
+    }
+}
+
+// Power comes back: everything in RAM is gone, NVS still holds nvsKm
+void reboot(uint32_t nvsKm) {
+    fakeFlashPowerOn();
+    journalPartition = NULL;
+    journalSectors = 0;
+    journalNextSlot = 0;
+    lastRecord = JournalRecord();
+    journalStats = JournalStats();
+    journalTaskHandle = NULL;
+    restored = false;
+    parameterValues[PARAM_ODOMETER_COUNT] = nvsKm;
+    initializeOdometerJournal();
+}
+
+void assertRestored(uint32_t km, uint32_t mm, uint32_t tripMm) {
+    TEST_ASSERT_TRUE(restored);
+    TEST_ASSERT_EQUAL_UINT32(km, restoredKm);
+    TEST_ASSERT_EQUAL_UINT32(mm, restoredMm);
+    TEST_ASSERT_EQUAL_UINT32(tripMm, restoredTripMm);
+}
+
+// Continue driving from what was restored, as the pulse counter would
+void resumeFromRestored() {
+    carKm = restoredKm;
+    carMm = restoredMm;
+    carTripMm = restoredTripMm;
+}
+
+void setUp() {
+    fakeFlashFormat(JOURNAL_PARTITION_NAME, JOURNAL_PARTITION_TYPE, PARTITION_SIZE);
+    carKm = 1000;
+    carMm = 0;
+    carTripMm = 0;
+    parametersMarked = 0;
+    parameterCommits = 0;
+    reboot(1000);
+}
+
+void tearDown() {}
+
+void test_empty_partition_is_seeded_from_nvs() {
+    TEST_ASSERT_FALSE(restored);
+    TEST_ASSERT_TRUE(journalStats.available);
+    TEST_ASSERT_EQUAL_UINT32(1, journalStats.recordsWritten);
+    reboot(0);
+    assertRestored(1000, 0, 0);
+}
+
+void test_missing_partition() {
+    fakeFlash().present = false;
+    reboot(1000);
+    TEST_ASSERT_FALSE(journalStats.available);
+    TEST_ASSERT_NULL(journalTaskHandle);
+    TEST_ASSERT_FALSE(restored);
+}
+
+void test_restores_after_reboot() {
+    drive(12345 * 1000);
+    reboot(1000);
+    assertRestored(carKm, carMm, carTripMm);
+    TEST_ASSERT_EQUAL_UINT32(1012, restoredKm);
+}
+
+void test_unchanged_distances_write_nothing() {
+    drive(1000000);
+    uint32_t written = journalStats.recordsWritten;
+    handleJournalRequests(JOURNAL_REQUEST_RECORD);
+    handleJournalRequests(JOURNAL_REQUEST_RECORD);
+    TEST_ASSERT_EQUAL_UINT32(written, journalStats.recordsWritten);
+}
+
+void test_wraps_around_the_partition() {
+    uint32_t slots = PARTITION_SIZE / sizeof(JournalRecord);
+    drive((slots * 3 / 2) * JOURNAL_INTERVAL_MM);
+    TEST_ASSERT_TRUE(journalStats.sequence > slots);
+    uint32_t sequence = journalStats.sequence;
+    reboot(1000);
+    assertRestored(carKm, carMm, carTripMm);
+    TEST_ASSERT_EQUAL_UINT32(sequence, journalStats.sequence);
+}
+
+void test_wear_over_1000_km() {
+    drive(1000 * 1000000UL);
+    TEST_ASSERT_EQUAL_UINT32(0, journalStats.writeErrors);
+
+    uint32_t most = 0;
+    uint32_t least = UINT32_MAX;
+    for (uint32_t erases : fakeFlash().erases) {
+        most = max(most, erases);
+        least = min(least, erases);
+    }
+    // 20000 records over 2048 slots, every sector erased about 10 times
+    TEST_ASSERT_TRUE(most - least <= 1);
+    TEST_ASSERT_TRUE(most <= 11);
+
+    // Sectors last at least 100000 erase cycles
+    char message[96];
+    snprintf(message, sizeof(message), "%u erases per sector per 1000 km, flash lasts %lu km",
+             most, 100000UL / most * 1000);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(100000UL / most * 1000 >= 5000000);
+}
+
+void test_power_cut_in_every_byte_of_a_record() {
+    for (uint32_t cut = 0; cut <= sizeof(JournalRecord); cut++) {
+        setUp();
+        drive(20 * JOURNAL_INTERVAL_MM);
+        uint32_t beforeKm = carKm, beforeMm = carMm, beforeTrip = carTripMm;
+
+        fakeFlashCutPowerAfter(cut);
+        drive(JOURNAL_INTERVAL_MM);
+        reboot(1000);
+
+        if (cut == sizeof(JournalRecord)) {
+            assertRestored(carKm, carMm, carTripMm);
+        } else {
+            // The torn record is ignored, only the distance since the last one is lost
+            assertRestored(beforeKm, beforeMm, beforeTrip);
+        }
+
+        // The journal carries on past the torn slot
+        resumeFromRestored();
+        drive(5 * JOURNAL_INTERVAL_MM);
+        reboot(1000);
+        assertRestored(carKm, carMm, carTripMm);
+    }
+}
+
+void test_power_cut_during_a_sector_erase() {
+    uint32_t slots = PARTITION_SIZE / sizeof(JournalRecord);
+    // Fill the partition once, so the next sector to erase holds old records
+    drive((slots - 1) * JOURNAL_INTERVAL_MM);
+    TEST_ASSERT_EQUAL_UINT32(0, journalNextSlot);
+    uint32_t beforeKm = carKm, beforeMm = carMm, beforeTrip = carTripMm;
+
+    fakeFlashCutPowerAfter(JOURNAL_SECTOR_SIZE / 3);
+    drive(JOURNAL_INTERVAL_MM);
+    TEST_ASSERT_EQUAL_UINT32(1, journalStats.writeErrors);
+    reboot(1000);
+    assertRestored(beforeKm, beforeMm, beforeTrip);
+
+    resumeFromRestored();
+    drive(10 * JOURNAL_INTERVAL_MM);
+    reboot(1000);
+    assertRestored(carKm, carMm, carTripMm);
+}
+
+void test_power_cut_at_random_points_while_driving() {
+    srand(1234);
+    for (int run = 0; run < 200; run++) {
+        uint64_t startTotal = carKm * 1000000ULL + carMm;
+        fakeFlashCutPowerAfter(rand() % (40 * sizeof(JournalRecord) + JOURNAL_SECTOR_SIZE));
+        drive(60 * JOURNAL_INTERVAL_MM);
+        bool cut = !fakeFlash().powered;
+        reboot(1000);
+
+        // Never goes back, and without a cut nothing is lost
+        TEST_ASSERT_TRUE(restored);
+        uint64_t restoredTotal = restoredKm * 1000000ULL + restoredMm;
+        TEST_ASSERT_TRUE(restoredTotal >= startTotal);
+        if (!cut) {
+            assertRestored(carKm, carMm, carTripMm);
+        }
+        resumeFromRestored();
+    }
+}
+
+void test_ignition_off_syncs_nvs() {
+    drive(3 * 1000000);
+    handleJournalRequests(JOURNAL_REQUEST_RECORD | JOURNAL_REQUEST_NVS);
+    TEST_ASSERT_EQUAL_UINT32(1UL << PARAM_ODOMETER_COUNT, parametersMarked);
+    TEST_ASSERT_EQUAL_UINT32(1, parameterCommits);
+
+    // Same km again: nothing to mark, but the commit still runs for other parameters
+    parametersMarked = 0;
+    handleJournalRequests(JOURNAL_REQUEST_NVS);
+    TEST_ASSERT_EQUAL_UINT32(0, parametersMarked);
+    TEST_ASSERT_EQUAL_UINT32(2, parameterCommits);
+
+    handleJournalRequests(JOURNAL_REQUEST_PARAMETERS);
+    TEST_ASSERT_EQUAL_UINT32(3, parameterCommits);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_partition_is_seeded_from_nvs);
+    RUN_TEST(test_missing_partition);
+    RUN_TEST(test_restores_after_reboot);
+    RUN_TEST(test_unchanged_distances_write_nothing);
+    RUN_TEST(test_wraps_around_the_partition);
+    RUN_TEST(test_wear_over_1000_km);
+    RUN_TEST(test_power_cut_in_every_byte_of_a_record);
+    RUN_TEST(test_power_cut_during_a_sector_erase);
+    RUN_TEST(test_power_cut_at_random_points_while_driving);
+    RUN_TEST(test_ignition_off_syncs_nvs);
+    return UNITY_END();
+}
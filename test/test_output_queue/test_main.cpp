@@ -0,0 +1,220 @@
+// Output rings: other writers drop the oldest bytes and never wait, the
+// interactive task waits for room so a long command output arrives whole,
+// and gives up waiting on a port that stopped taking bytes.
+
+#include <unity.h>
+
+#include "OutputQueue.cpp"
+
+#define CLI_TASK ((TaskHandle_t)5)
+#define CAN_TASK ((TaskHandle_t)6)
+
+// Modules OutputQueue.cpp talks to
+BluetoothSerial SerialBT;
+StaticSemaphore_t outputRoomBuffer;
+SemaphoreHandle_t outputRoomSemaphore = &outputRoomBuffer;
+
+bool isBTConnected() { return SerialBT.connected; }
+void printPendingLogs() {}
+void countTaskWakeup(TaskId task) {}
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    if (handle) {
+        *handle = (TaskHandle_t)(intptr_t)(task + 1);
+    }
+    return true;
+}
+
+uint32_t waits = 0;
+
+// The output task runs while the writer waits, until it gives the semaphore or has nothing left to send
+bool runOutputTask(TickType_t timeout) {
+    waits++;
+    uint32_t gives = fakeSemaphoreGives();
+    while (fakeSemaphoreGives() == gives) {
+        if (!sendOutput()) {
+            advanceFakeMillis(timeout);
+            return false;
+        }
+    }
+    return true;
+}
+
+// A port that takes nothing: every wait times out
+bool stalledPort(TickType_t timeout) {
+    waits++;
+    advanceFakeMillis(timeout);
+    return false;
+}
+
+void drainOutput() {
+    while (sendOutput()) {
+    }
+}
+
+// A line of the trace dump, numbered so lost or reordered lines show
+std::string traceLine(int i) {
+    char line[48];
+    snprintf(line, sizeof(line), "%06d,1,42,123456789,0x0000abcd", i);
+    return line;
+}
+
+std::string writeTrace(Print &out, int lines) {
+    std::string written;
+    for (int i = 0; i < lines; i++) {
+        std::string line = traceLine(i);
+        out.println(line.c_str());
+        written += line + "\r\n";
+    }
+    return written;
+}
+
+void setUp() {
+    drainOutput();
+    for (OutputRing &ring : outputRings) {
+        ring.waiting = false;
+        ring.stalled = false;
+        ring.stats = OutputStats();
+    }
+    Serial.takeTx();
+    SerialBT.connected = true;
+    SerialBT.takeTx();
+    fakeCurrentTask() = CLI_TASK;
+    fakeBlockingTake() = runOutputTask;
+    waits = 0;
+}
+
+void tearDown() {
+    fakeBlockingTake() = nullptr;
+}
+
+void test_other_writers_drop_the_oldest_bytes() {
+    fakeCurrentTask() = CAN_TASK;
+    std::string written = writeTrace(SerialOut, 200);
+    TEST_ASSERT_TRUE(written.size() > OUTPUT_SERIAL_BUFFER);
+    TEST_ASSERT_EQUAL_UINT32(0, waits);
+
+    drainOutput();
+    OutputStats stats = getOutputStats(OUTPUT_SERIAL);
+    TEST_ASSERT_EQUAL_UINT32(written.size() - OUTPUT_SERIAL_BUFFER, stats.dropped);
+    TEST_ASSERT_EQUAL_UINT32(OUTPUT_SERIAL_BUFFER, stats.highWater);
+    TEST_ASSERT_TRUE(Serial.takeTx() == written.substr(written.size() - OUTPUT_SERIAL_BUFFER));
+}
+
+void test_interactive_output_arrives_whole() {
+    setInteractiveOutputTask(CLI_TASK);
+    // About what trace dumps, three times the Serial ring
+    std::string written = writeTrace(SerialOut, 400);
+    TEST_ASSERT_TRUE(written.size() > 3 * OUTPUT_SERIAL_BUFFER);
+    drainOutput();
+
+    TEST_ASSERT_TRUE(Serial.takeTx() == written);
+    OutputStats stats = getOutputStats(OUTPUT_SERIAL);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.stalls);
+    // A quarter of the ring stays free for the other writers
+    TEST_ASSERT_EQUAL_UINT32(OUTPUT_SERIAL_BUFFER * 3 / 4, stats.highWater);
+    // Woken once half the ring is free, not for every chunk
+    TEST_ASSERT_TRUE(waits > 0);
+    TEST_ASSERT_TRUE(waits <= written.size() / (OUTPUT_SERIAL_BUFFER / 2) + 1);
+}
+
+void test_interactive_output_over_bluetooth() {
+    setInteractiveOutputTask(CLI_TASK);
+    std::string written = writeTrace(BTOut, 400);
+    std::string help(3000, 'h');
+    BTOut.write((const uint8_t *)help.data(), help.size());     // One write larger than the ring
+    drainOutput();
+
+    TEST_ASSERT_TRUE(SerialBT.takeTx() == written + help);
+    TEST_ASSERT_EQUAL_UINT32(0, getOutputStats(OUTPUT_BT).dropped);
+    TEST_ASSERT_EQUAL_STRING("", Serial.takeTx().c_str());
+}
+
+void test_other_writers_never_wait_while_the_cli_does() {
+    setInteractiveOutputTask(CLI_TASK);
+    // The CAN monitor prints a frame on the same session whenever the output task runs
+    std::string frames;
+    fakeBlockingTake() = [&frames](TickType_t timeout) {
+        uint32_t before = waits;
+        fakeCurrentTask() = CAN_TASK;
+        std::string frame = "99B50500 8 01 02 03 04 05 06 07 08\r\n";
+        SerialOut.print(frame.c_str());
+        frames += frame;
+        fakeCurrentTask() = CLI_TASK;
+        bool given = runOutputTask(timeout);
+        TEST_ASSERT_EQUAL_UINT32(before + 1, waits);
+        return given;
+    };
+    std::string written = writeTrace(SerialOut, 400);
+    drainOutput();
+
+    // Every frame arrives, and without them the trace is whole and in order
+    std::string sent = Serial.takeTx();
+    TEST_ASSERT_EQUAL_UINT32(written.size() + frames.size(), sent.size());
+    TEST_ASSERT_EQUAL_UINT32(0, getOutputStats(OUTPUT_SERIAL).dropped);
+    std::string frame = frames.substr(0, frames.find('\n') + 1);
+    size_t at;
+    while ((at = sent.find(frame)) != std::string::npos) {
+        sent.erase(at, frame.size());
+    }
+    TEST_ASSERT_TRUE(sent == written);
+}
+
+void test_stalled_port_stops_the_wait() {
+    setInteractiveOutputTask(CLI_TASK);
+    fakeBlockingTake() = stalledPort;
+    uint64_t start = fakeClockMicros();
+    std::string written = writeTrace(BTOut, 400);
+
+    // One wait, then the rest drops the oldest bytes like any other writer
+    TEST_ASSERT_EQUAL_UINT32(1, waits);
+    TEST_ASSERT_TRUE(fakeClockMicros() - start == OUTPUT_WAIT_MS * 1000ULL);
+    OutputStats stats = getOutputStats(OUTPUT_BT);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.stalls);
+    TEST_ASSERT_EQUAL_UINT32(written.size() - OUTPUT_BT_BUFFER, stats.dropped);
+
+    // Once the port takes bytes again the next command waits again
+    drainOutput();
+    TEST_ASSERT_TRUE(SerialBT.takeTx() == written.substr(written.size() - OUTPUT_BT_BUFFER));
+    fakeBlockingTake() = runOutputTask;
+    std::string next = writeTrace(BTOut, 400);
+    drainOutput();
+    TEST_ASSERT_TRUE(SerialBT.takeTx() == next);
+    TEST_ASSERT_EQUAL_UINT32(1, getOutputStats(OUTPUT_BT).stalls);
+}
+
+void test_output_without_a_client_is_dropped() {
+    setInteractiveOutputTask(CLI_TASK);
+    SerialBT.connected = false;
+    std::string written = writeTrace(BTOut, 400);
+    drainOutput();
+
+    TEST_ASSERT_EQUAL_STRING("", SerialBT.takeTx().c_str());
+    OutputStats stats = getOutputStats(OUTPUT_BT);
+    TEST_ASSERT_EQUAL_UINT32(written.size(), stats.dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.stalls);
+}
+
+void test_console_output_reaches_both_ports() {
+    setInteractiveOutputTask(CLI_TASK);
+    std::string written = writeTrace(ConsoleOut, 400);
+    drainOutput();
+    TEST_ASSERT_TRUE(Serial.takeTx() == written);
+    TEST_ASSERT_TRUE(SerialBT.takeTx() == written);
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+int main(int argc, char **argv) {
+    initializeOutput();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_other_writers_drop_the_oldest_bytes);
+    RUN_TEST(test_interactive_output_arrives_whole);
+    RUN_TEST(test_interactive_output_over_bluetooth);
+    RUN_TEST(test_other_writers_never_wait_while_the_cli_does);
+    RUN_TEST(test_stalled_port_stops_the_wait);
+    RUN_TEST(test_output_without_a_client_is_dropped);
+    RUN_TEST(test_console_output_reaches_both_ports);
+    return UNITY_END();
+}
@@ -0,0 +1,510 @@
+// Parameter store on a fake NVS that counts sets and commits: changes are
+// coalesced into one commit after the quiet period, a value NVS already
+// holds is not written again, and a failed open, set or commit keeps the
+// changes and tries again after the quiet period.
+// The schema: range checks, change listeners and typed accessors.
+
+#include <unity.h>
+#include <type_traits>
+
+#include "Parameter.cpp"
+#include "Timers.cpp"
+#include "Trace.cpp"
+
+// Modules Parameter.cpp talks to
+uint8_t logLevels[NUM_LOG_MODULES];
+std::string consoleOutput;
+uint32_t journalWrites = 0;
+bool journalTaskRunning = false;    // requestParameterCommit hands the commit to it
+uint32_t commitRequests = 0;
+uint32_t odometerSets = 0;
+uint32_t tooManyListeners = 0;
+
+size_t ConsoleOutput::write(uint8_t c) {
+    consoleOutput += (char)c;
+    return 1;
+}
+
+size_t ConsoleOutput::write(const uint8_t *buffer, size_t size) {
+    consoleOutput.append((const char *)buffer, size);
+    return size;
+}
+
+ConsoleOutput ConsoleOut;
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {
+    if (id == LOG_TOO_MANY_PARAMETER_LISTENERS) {
+        tooManyListeners++;
+    }
+}
+
+void setOdometerKm(int32_t km) {
+    odometerSets++;
+    parameterValues[PARAM_ODOMETER_COUNT] = km;
+}
+void requestOdometerJournalWrite(bool syncNVS) { journalWrites++; }
+
+bool requestParameterCommit() {
+    commitRequests++;
+    return journalTaskRunning;
+}
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    if (handle) {
+        *handle = (TaskHandle_t)(intptr_t)(task + 1);
+    }
+    return true;
+}
+
+void countTaskWakeup(TaskId task) {}
+
+// Let the timer service run as it would until ms from now
+void runFor(uint32_t ms) {
+    int64_t end = esp_timer_get_time() + ms * 1000LL;
+    for (;;) {
+        int64_t next = Timer::runDueTimers();
+        if (next < 0 || next > end) {
+            break;
+        }
+        fakeClockMicros() = next;
+    }
+    fakeClockMicros() = end;
+    Timer::runDueTimers();
+}
+
+int32_t storedValue(ParameterId id) {
+    return fakeNvs().stored[parameterInfo[id].name];
+}
+
+// Every listener call, with the listener that got it
+struct Change {
+    char listener;
+    ParameterId id;
+    int32_t value;
+};
+
+std::vector<Change> changes;
+
+void listenerA(ParameterId id, int32_t value) { changes.push_back({'A', id, value}); }
+void listenerB(ParameterId id, int32_t value) { changes.push_back({'B', id, value}); }
+
+void assertChange(size_t index, char listener, ParameterId id, int32_t value) {
+    TEST_ASSERT_TRUE(index < changes.size());
+    TEST_ASSERT_EQUAL_INT(listener, changes[index].listener);
+    TEST_ASSERT_EQUAL_INT(id, changes[index].id);
+    TEST_ASSERT_EQUAL_INT32(value, changes[index].value);
+}
+
+void setUp() {
+    fakeNvsReset();
+    parameterListenerCount = 0;
+    initializeParameter();
+    parameterStoreStats = ParameterStoreStats();
+    journalTaskRunning = false;
+    journalWrites = 0;
+    commitRequests = 0;
+    odometerSets = 0;
+    tooManyListeners = 0;
+    changes.clear();
+    Serial.takeTx();
+}
+
+void tearDown() {
+    parameterCommitTimer.stop();
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().opens);
+}
+
+void test_changes_are_coalesced_into_one_commit() {
+    TEST_ASSERT_TRUE(updateParameter(PARAM_BLINK_SPEED, 300));
+    TEST_ASSERT_TRUE(updateParameter(PARAM_PULSE_DELAY, 200));
+    TEST_ASSERT_TRUE(updateParameter(PARAM_BLINK_SPEED, 400));
+    TEST_ASSERT_TRUE(updateParameter(PARAM_SPEED_FACTOR, 700));
+    TEST_ASSERT_EQUAL_UINT32((1UL << PARAM_BLINK_SPEED) | (1UL << PARAM_PULSE_DELAY) | (1UL << PARAM_SPEED_FACTOR),
+                             getParameterStoreStats().pending);
+
+    // Nothing reaches NVS during the quiet period
+    runFor(PARAMETER_COMMIT_DELAY_MS - 1);
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().commits);
+
+    // Then one transaction with the last value of each
+    runFor(1);
+    TEST_ASSERT_EQUAL_UINT32(3, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(400, storedValue(PARAM_BLINK_SPEED));
+    TEST_ASSERT_EQUAL_INT32(200, storedValue(PARAM_PULSE_DELAY));
+    TEST_ASSERT_EQUAL_INT32(700, storedValue(PARAM_SPEED_FACTOR));
+    ParameterStoreStats stats = getParameterStoreStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.commits);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.writes);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.pending);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.errors);
+
+    // And nothing more after it
+    runFor(10 * PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+}
+
+void test_each_change_restarts_the_quiet_period() {
+    // A value dragged for 10 s, a change every 500 ms
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT_TRUE(updateParameter(PARAM_BLINK_SPEED, 100 + i * 10));
+        runFor(500);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().commits);
+    runFor(PARAMETER_COMMIT_DELAY_MS - 500);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(290, storedValue(PARAM_BLINK_SPEED));
+}
+
+void test_unchanged_value_is_not_written() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+
+    // Changed and changed back before the commit
+    updateParameter(PARAM_BLINK_SPEED, 800);
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_UINT32(1, getParameterStoreStats().skipped);
+
+    // Set to the value it already has
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(2, getParameterStoreStats().skipped);
+
+    // Only the one that differs in a mixed batch
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    updateParameter(PARAM_PULSE_DELAY, 250);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(2, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(2, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_UINT32(2, getParameterStoreStats().writes);
+}
+
+void test_values_loaded_at_boot_are_not_written_again() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    updateParameter(PARAM_SPEED_RATIO, 2000000);
+    commitParameters();
+
+    // Reboot: the same values come back from NVS
+    parameterValues[PARAM_BLINK_SPEED] = 1;
+    parameterValues[PARAM_SPEED_RATIO] = 1;
+    storedParameters = 0;
+    initializeParameter();
+    TEST_ASSERT_EQUAL_UINT32(300, parameterValue<PARAM_BLINK_SPEED>());
+    TEST_ASSERT_EQUAL_UINT32(2000000, parameterValue<PARAM_SPEED_RATIO>());
+
+    uint32_t sets = fakeNvs().sets;
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    updateParameter(PARAM_SPEED_RATIO, 2000000);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(sets, fakeNvs().sets);
+
+    // A default NVS does not hold yet is written once
+    updateParameter(PARAM_PULSE_DELAY, parameterInfo[PARAM_PULSE_DELAY].defaultValue);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(sets + 1, fakeNvs().sets);
+}
+
+void test_write_counts_over_a_drive() {
+    // The odometer every km for 100 km, the journal task commits as it does
+    // on every tenth km, with a speed ratio update now and then
+    uint32_t km = parameterValues[PARAM_ODOMETER_COUNT];
+    for (int i = 1; i <= 100; i++) {
+        updateParameter(PARAM_ODOMETER_COUNT, km + i);
+        if (i % 25 == 0) {
+            updateParameter(PARAM_SPEED_RATIO, 2000000 + i);
+        }
+        if (i % 10 == 0) {
+            commitParameters();
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(100, journalWrites);
+    TEST_ASSERT_EQUAL_UINT32(10, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_UINT32(10 + 4, fakeNvs().sets);
+    ParameterStoreStats stats = getParameterStoreStats();
+    TEST_ASSERT_EQUAL_UINT32(10, stats.commits);
+    TEST_ASSERT_EQUAL_UINT32(14, stats.writes);
+    TEST_ASSERT_EQUAL_INT32(km + 100, storedValue(PARAM_ODOMETER_COUNT));
+}
+
+void test_timer_hands_the_commit_to_the_journal_task() {
+    journalTaskRunning = true;
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, commitRequests);
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_UINT32(1UL << PARAM_BLINK_SPEED, getParameterStoreStats().pending);
+
+    // As the journal task does when woken
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+}
+
+void test_failed_open_keeps_the_changes() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    fakeNvs().openError = ESP_FAIL;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    ParameterStoreStats stats = getParameterStoreStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.errors);
+    TEST_ASSERT_EQUAL_UINT32(1UL << PARAM_BLINK_SPEED, stats.pending);
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().sets);
+
+    // Written together with the next change
+    fakeNvs().openError = ESP_OK;
+    updateParameter(PARAM_PULSE_DELAY, 200);
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(2, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(300, storedValue(PARAM_BLINK_SPEED));
+}
+
+void test_failed_open_is_retried() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    fakeNvs().openError = ESP_FAIL;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, getParameterStoreStats().errors);
+
+    // Tried again without another change
+    fakeNvs().openError = ESP_OK;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(300, storedValue(PARAM_BLINK_SPEED));
+    TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+}
+
+void test_failed_set_is_retried() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    fakeNvs().setError = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    ParameterStoreStats stats = getParameterStoreStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.errors);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.commits);
+    TEST_ASSERT_EQUAL_UINT32(1UL << PARAM_BLINK_SPEED, stats.pending);
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().commits);
+
+    // Keeps trying after every quiet period until it gets through
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(2, getParameterStoreStats().errors);
+    fakeNvs().setError = ESP_OK;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(300, storedValue(PARAM_BLINK_SPEED));
+    TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+}
+
+void test_failed_commit_does_not_update_the_shadow() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().commits);
+
+    updateParameter(PARAM_BLINK_SPEED, 400);
+    updateParameter(PARAM_PULSE_DELAY, 200);
+    fakeNvs().commitError = ESP_FAIL;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    ParameterStoreStats stats = getParameterStoreStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.errors);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.writes);
+    TEST_ASSERT_EQUAL_UINT32((1UL << PARAM_BLINK_SPEED) | (1UL << PARAM_PULSE_DELAY), stats.pending);
+    TEST_ASSERT_EQUAL_INT32(300, storedValue(PARAM_BLINK_SPEED));
+
+    // Back to the value flash holds: nothing to write for it
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    fakeNvs().commitError = ESP_OK;
+    uint32_t sets = fakeNvs().sets;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(sets + 1, fakeNvs().sets);
+    TEST_ASSERT_EQUAL_UINT32(2, fakeNvs().commits);
+    TEST_ASSERT_EQUAL_INT32(200, storedValue(PARAM_PULSE_DELAY));
+    TEST_ASSERT_EQUAL_INT32(300, storedValue(PARAM_BLINK_SPEED));
+    TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+}
+
+void test_clear_drops_pending_changes() {
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    updateParameter(PARAM_PULSE_DELAY, 200);
+    commitParameters();
+    updateParameter(PARAM_BLINK_SPEED, 400);
+
+    clearNVS(PARAM_BLINK_SPEED, &Serial);
+    TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+    TEST_ASSERT_EQUAL_UINT32(parameterInfo[PARAM_BLINK_SPEED].defaultValue, parameterValue<PARAM_BLINK_SPEED>());
+    TEST_ASSERT_EQUAL_UINT32(0, fakeNvs().stored.count(parameterInfo[PARAM_BLINK_SPEED].name));
+    TEST_ASSERT_EQUAL_UINT32(1, fakeNvs().stored.count(parameterInfo[PARAM_PULSE_DELAY].name));
+
+    // The default goes back to NVS once it is changed again
+    uint32_t sets = fakeNvs().sets;
+    runFor(PARAMETER_COMMIT_DELAY_MS);
+    TEST_ASSERT_EQUAL_UINT32(sets, fakeNvs().sets);
+    updateParameter(PARAM_BLINK_SPEED, 400);
+    commitParameters();
+    TEST_ASSERT_EQUAL_UINT32(sets + 1, fakeNvs().sets);
+
+    clearNVS(-1, &Serial);
+    TEST_ASSERT_TRUE(fakeNvs().stored.empty());
+    TEST_ASSERT_EQUAL_UINT32(parameterInfo[PARAM_PULSE_DELAY].defaultValue, parameterValue<PARAM_PULSE_DELAY>());
+}
+
+void test_values_out_of_range_are_refused() {
+    for (int i = 0; i < NUM_PARAMETERS; i++) {
+        ParameterId id = (ParameterId)i;
+        const ParameterInfo &info = parameterInfo[i];
+        TEST_ASSERT_TRUE(updateParameter(id, info.minValue));
+        TEST_ASSERT_EQUAL_INT32(info.minValue, parameterValues[i]);
+        TEST_ASSERT_TRUE(updateParameter(id, info.maxValue));
+        TEST_ASSERT_EQUAL_INT32(info.maxValue, parameterValues[i]);
+        commitParameters();
+
+        // Refused without a change, a listener call or a write
+        onParameterChange(id, listenerA);
+        changes.clear();
+        TEST_ASSERT_FALSE(updateParameter(id, info.minValue - 1));
+        TEST_ASSERT_FALSE(updateParameter(id, info.maxValue + 1));
+        TEST_ASSERT_EQUAL_INT32(info.maxValue, parameterValues[i]);
+        TEST_ASSERT_EQUAL_UINT32(0, changes.size());
+        TEST_ASSERT_EQUAL_UINT32(0, getParameterStoreStats().pending);
+    }
+    TEST_ASSERT_FALSE(updateParameter(NUM_PARAMETERS, 0));
+}
+
+void test_set_parameter_reports_the_range() {
+    setParameter(PARAM_BLINK_SPEED, 9, &Serial);
+    TEST_ASSERT_EQUAL_STRING("Error: BlinkSpeed must be 10 to 10000 ms\r\n", Serial.takeTx().c_str());
+    TEST_ASSERT_EQUAL_UINT32(500, parameterValue<PARAM_BLINK_SPEED>());
+
+    setParameter(PARAM_BLINK_SPEED, 250, &Serial);
+    TEST_ASSERT_EQUAL_STRING("Set BlinkSpeed to 250 ms\r\n", Serial.takeTx().c_str());
+    TEST_ASSERT_EQUAL_UINT32(250, parameterValue<PARAM_BLINK_SPEED>());
+
+    setParameter(NUM_PARAMETERS, 1, &Serial);
+    TEST_ASSERT_EQUAL_STRING("Invalid index\r\n", Serial.takeTx().c_str());
+    setParameter(-1, 1, &Serial);
+    TEST_ASSERT_EQUAL_STRING("Invalid index\r\n", Serial.takeTx().c_str());
+}
+
+void test_out_of_range_value_in_nvs_loads_the_default() {
+    fakeNvs().exists = true;
+    fakeNvs().stored["BlinkSpeed"] = 5;
+    fakeNvs().stored["PulseDelay"] = 300;
+    updateParametersFromNVS(-1, &Serial);
+    TEST_ASSERT_EQUAL_UINT32(parameterInfo[PARAM_BLINK_SPEED].defaultValue, parameterValue<PARAM_BLINK_SPEED>());
+    TEST_ASSERT_EQUAL_UINT32(300, parameterValue<PARAM_PULSE_DELAY>());
+
+    // Setting the default replaces what NVS holds
+    updateParameter(PARAM_BLINK_SPEED, parameterInfo[PARAM_BLINK_SPEED].defaultValue);
+    commitParameters();
+    TEST_ASSERT_EQUAL_INT32(parameterInfo[PARAM_BLINK_SPEED].defaultValue, storedValue(PARAM_BLINK_SPEED));
+}
+
+void test_listeners_get_the_current_value_and_every_change() {
+    onParameterChange(PARAM_BLINK_SPEED, listenerA);
+    assertChange(0, 'A', PARAM_BLINK_SPEED, 500);
+    onParameterChange(PARAM_BLINK_SPEED, listenerB);
+    onParameterChange(PARAM_PULSE_DELAY, listenerB);
+    TEST_ASSERT_EQUAL_UINT32(3, changes.size());
+    changes.clear();
+
+    // Both listeners of the changed parameter, in the order they registered
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    TEST_ASSERT_EQUAL_UINT32(2, changes.size());
+    assertChange(0, 'A', PARAM_BLINK_SPEED, 300);
+    assertChange(1, 'B', PARAM_BLINK_SPEED, 300);
+
+    // Not for the same value, nor for another parameter
+    changes.clear();
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    updateParameter(PARAM_SPEED_FACTOR, 700);
+    TEST_ASSERT_EQUAL_UINT32(0, changes.size());
+
+    // Loads and clears are changes too
+    commitParameters();
+    clearNVS(PARAM_BLINK_SPEED, &Serial);
+    assertChange(0, 'A', PARAM_BLINK_SPEED, 500);
+    assertChange(1, 'B', PARAM_BLINK_SPEED, 500);
+    changes.clear();
+    fakeNvs().stored["PulseDelay"] = 40;
+    updateParametersFromNVS(PARAM_PULSE_DELAY, &Serial);
+    TEST_ASSERT_EQUAL_UINT32(1, changes.size());
+    assertChange(0, 'B', PARAM_PULSE_DELAY, 40);
+}
+
+void test_too_many_listeners() {
+    for (int i = 0; i < PARAMETER_MAX_LISTENERS; i++) {
+        onParameterChange(PARAM_SPEED_RATIO, listenerA);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, tooManyListeners);
+    onParameterChange(PARAM_SPEED_RATIO, listenerB);
+    TEST_ASSERT_EQUAL_UINT32(1, tooManyListeners);
+
+    // The one that did not fit is never called
+    changes.clear();
+    updateParameter(PARAM_SPEED_RATIO, 1000);
+    TEST_ASSERT_EQUAL_UINT32(PARAMETER_MAX_LISTENERS, changes.size());
+    for (const Change &change : changes) {
+        TEST_ASSERT_EQUAL_INT('A', change.listener);
+    }
+}
+
+void test_typed_accessors() {
+    static_assert(std::is_same<decltype(parameterValue<PARAM_ODOMETER_COUNT>()), int32_t>::value, "Odometer is signed");
+    static_assert(std::is_same<decltype(parameterValue<PARAM_BLINK_SPEED>()), uint32_t>::value, "Blink speed is unsigned");
+    static_assert(std::is_same<decltype(parameterValue<PARAM_SPEED_RATIO>()), uint32_t>::value, "Speed ratio is unsigned");
+
+    updateParameter(PARAM_SPEED_RATIO, 10000000);
+    TEST_ASSERT_EQUAL_UINT32(10000000, parameterValue<PARAM_SPEED_RATIO>());
+    updateParameter(PARAM_ODOMETER_COUNT, 0);
+    TEST_ASSERT_EQUAL_INT32(0, parameterValue<PARAM_ODOMETER_COUNT>());
+
+    // Names are NVS keys: unique, and every one can be written
+    for (int i = 0; i < NUM_PARAMETERS; i++) {
+        TEST_ASSERT_TRUE(strlen(parameterInfo[i].name) < NVS_KEY_NAME_MAX_SIZE);
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT_TRUE(strcmp(parameterInfo[i].name, parameterInfo[j].name) != 0);
+        }
+    }
+}
+
+void test_odometer_goes_through_the_pulse_counter() {
+    TEST_ASSERT_TRUE(updateParameter(PARAM_ODOMETER_COUNT, 210000));
+    TEST_ASSERT_EQUAL_UINT32(1, odometerSets);
+    TEST_ASSERT_EQUAL_UINT32(1, journalWrites);
+    TEST_ASSERT_EQUAL_INT32(210000, parameterValue<PARAM_ODOMETER_COUNT>());
+
+    // Other parameters leave both alone
+    updateParameter(PARAM_BLINK_SPEED, 300);
+    TEST_ASSERT_EQUAL_UINT32(1, odometerSets);
+    TEST_ASSERT_EQUAL_UINT32(1, journalWrites);
+}
+
+int main(int argc, char **argv) {
+    memset(logLevels, LOG_DEBUG, sizeof(logLevels));
+    initializeTimerTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_changes_are_coalesced_into_one_commit);
+    RUN_TEST(test_each_change_restarts_the_quiet_period);
+    RUN_TEST(test_unchanged_value_is_not_written);
+    RUN_TEST(test_values_loaded_at_boot_are_not_written_again);
+    RUN_TEST(test_write_counts_over_a_drive);
+    RUN_TEST(test_timer_hands_the_commit_to_the_journal_task);
+    RUN_TEST(test_failed_open_keeps_the_changes);
+    RUN_TEST(test_failed_open_is_retried);
+    RUN_TEST(test_failed_set_is_retried);
+    RUN_TEST(test_failed_commit_does_not_update_the_shadow);
+    RUN_TEST(test_clear_drops_pending_changes);
+    RUN_TEST(test_values_out_of_range_are_refused);
+    RUN_TEST(test_set_parameter_reports_the_range);
+    RUN_TEST(test_out_of_range_value_in_nvs_loads_the_default);
+    RUN_TEST(test_listeners_get_the_current_value_and_every_change);
+    RUN_TEST(test_too_many_listeners);
+    RUN_TEST(test_typed_accessors);
+    RUN_TEST(test_odometer_goes_through_the_pulse_counter);
+    return UNITY_END();
+}
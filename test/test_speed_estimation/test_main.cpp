@@ -0,0 +1,270 @@
+// Wheel speed estimation against a simulated pulse train: period and count
+// mode, contact bounce on the edge interrupt and the clamp on glitches. Also
+// the trip and odometer setters.
+
+#include <unity.h>
+
+#include "PulseCounterTask.cpp"
+
+// Modules PulseCounterTask.cpp talks to
+int32_t parameterValues[NUM_PARAMETERS];
+uint8_t logLevels[NUM_LOG_MODULES];
+
+void onParameterChange(ParameterId id, ParameterCallback callback) {
+    callback(id, parameterValues[id]);
+}
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {}
+void initializeOdometerJournal() {}
+void requestOdometerJournalWrite(bool syncNVS) {}
+void publishTelemetry(uint32_t topics, uint32_t sourceMicros) {}
+void updateFusionFromWheel(uint32_t wheelMmPerS, uint32_t smoothedMmPerS, bool reliable) {}
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) { return true; }
+void countTaskWakeup(TaskId task) {}
+void markTaskIdle(TaskId task) {}
+
+uint32_t taskPeriods[NUM_TASKS];
+void setTaskPeriod(TaskId task, uint32_t periodMs) {
+    taskPeriods[task] = periodMs;
+}
+
+// The wheel: a pulse every SpeedFactor mm, counted by PCNT on both edges, and
+// a rising edge on the GPIO interrupt every second pulse
+#define SIM_WINDOW_MS 100
+
+uint64_t nextPulseMicros = 0;
+uint32_t simulatedPulses = 0;
+
+void setSpeedParameter(ParameterId id, int32_t value) {
+    parameterValues[id] = value;
+    onSpeedParameterChange(id, value);
+}
+
+void countSimulatedPulse() {
+    if (++fakePcntCounter() == PCNT_HIGH_LIMIT) {
+        fakePcntCounter() = 0;
+        pcntOverflowISR(NULL);
+    }
+}
+
+// Drive one window at mmPerS. A bouncy contact adds two short glitches after
+// every rising edge, too short for the PCNT filter but not for the GPIO
+// interrupt. Returns the window speed as the speed task computes it.
+uint32_t driveWindow(uint32_t mmPerS, bool bouncy) {
+    uint64_t windowEnd = fakeClockMicros() + SIM_WINDOW_MS * 1000ULL;
+    uint64_t pulseMicros = mmPerS ? (uint64_t)pulseDistanceMm * 1000000ULL / mmPerS : 0;
+    while (mmPerS && nextPulseMicros <= windowEnd) {
+        fakeClockMicros() = nextPulseMicros;
+        countSimulatedPulse();
+        if (simulatedPulses++ % 2 == 0 && edgeCaptureEnabled) {
+            pulseEdgeISR();
+            if (bouncy) {
+                advanceFakeMicros(3);
+                pulseEdgeISR();
+                advanceFakeMicros(5);
+                pulseEdgeISR();
+            }
+        }
+        nextPulseMicros += pulseMicros;
+    }
+    fakeClockMicros() = windowEnd;
+    if (!mmPerS) {
+        nextPulseMicros = windowEnd;
+    }
+
+    uint32_t pulses = readPulseCount();
+    return windowSpeed(pulses, pulses * pulseDistanceMm, SIM_WINDOW_MS * 1000, crossoverPulses);
+}
+
+// Drive for a while at mmPerS and return the last window speed
+uint32_t driveSteady(uint32_t mmPerS, bool bouncy, int windows = 30) {
+    uint32_t local = 0;
+    for (int i = 0; i < windows; i++) {
+        local = driveWindow(mmPerS, bouncy);
+    }
+    return local;
+}
+
+uint32_t kmhToMmPerS(uint32_t kmh) {
+    return kmh * 10000 / 36;
+}
+
+void setUp() {
+    setSpeedParameter(PARAM_SPEED_FACTOR, 100);
+    setSpeedParameter(PARAM_SPEED_CROSSOVER, 8);
+    setSpeedParameter(PARAM_ZERO_SPEED_TIMEOUT, 2000);
+    setSpeedParameter(PARAM_PULSE_DELAY, SIM_WINDOW_MS);
+    setEdgeCapture(false);
+    setEdgeCapture(true);
+    readPulseCount();
+    edgeBounces = 0;
+    nextPulseMicros = fakeClockMicros();
+    simulatedPulses = 0;
+}
+
+void tearDown() {}
+
+void test_period_mode_at_low_speed() {
+    for (uint32_t kmh = 2; kmh <= 25; kmh += 3) {
+        uint32_t expected = kmhToMmPerS(kmh);
+        uint32_t local = driveSteady(expected, false);
+        TEST_ASSERT_TRUE(edgeCaptureEnabled);
+        TEST_ASSERT_UINT32_WITHIN(expected / 100 + 1, expected, local);
+    }
+}
+
+void test_count_mode_at_high_speed() {
+    for (uint32_t kmh = 60; kmh <= 200; kmh += 35) {
+        uint32_t expected = kmhToMmPerS(kmh);
+        uint32_t local = driveSteady(expected, false);
+        TEST_ASSERT_FALSE(edgeCaptureEnabled);
+        // One pulse more or less in a window
+        TEST_ASSERT_UINT32_WITHIN(pulseDistanceMm * 1000 / SIM_WINDOW_MS, expected, local);
+    }
+}
+
+void test_bounces_do_not_change_the_speed() {
+    for (uint32_t kmh = 2; kmh <= 25; kmh += 3) {
+        uint32_t expected = kmhToMmPerS(kmh);
+        uint32_t local = driveSteady(expected, true);
+        TEST_ASSERT_UINT32_WITHIN(expected / 100 + 1, expected, local);
+    }
+    TEST_ASSERT_TRUE(edgeBounces > 0);
+}
+
+void test_bounce_rejected_after_each_edge() {
+    driveSteady(kmhToMmPerS(10), true, 20);
+    // Two glitches follow every accepted edge
+    TEST_ASSERT_EQUAL_UINT32((simulatedPulses + 1) / 2 * 2, edgeBounces);
+}
+
+void test_bounce_from_standstill_is_no_speed() {
+    pulseEdgeISR();
+    advanceFakeMicros(5);
+    pulseEdgeISR();
+    TEST_ASSERT_EQUAL_UINT32(0, edgePeriodMicros);
+    TEST_ASSERT_EQUAL_UINT32(0, periodSpeed());
+    TEST_ASSERT_EQUAL_UINT32(1, edgeBounces);
+}
+
+void test_min_edge_period_follows_speed_factor() {
+    setSpeedParameter(PARAM_SPEED_FACTOR, 800);
+    TEST_ASSERT_EQUAL_UINT32(16000, minEdgeMicros);     // 1600 mm at 100 m/s
+    setSpeedParameter(PARAM_SPEED_FACTOR, 1);
+    TEST_ASSERT_EQUAL_UINT32(20, minEdgeMicros);
+    TEST_ASSERT_TRUE(minEdgeMicros >= PCNT_FILTER_MICROS);
+
+    // An edge just after the minimum is a real one
+    setSpeedParameter(PARAM_SPEED_FACTOR, 800);
+    pulseEdgeISR();
+    advanceFakeMicros(15999);
+    pulseEdgeISR();
+    TEST_ASSERT_EQUAL_UINT32(1, edgeBounces);
+    advanceFakeMicros(1);
+    pulseEdgeISR();
+    TEST_ASSERT_EQUAL_UINT32(16000, edgePeriodMicros);
+    TEST_ASSERT_EQUAL_UINT32(SPEED_MAX_MM_PER_S, periodSpeed());
+}
+
+void test_deadline_follows_pulse_delay() {
+    TEST_ASSERT_EQUAL_UINT32(SIM_WINDOW_MS, taskPeriods[TASK_SPEED]);
+    setSpeedParameter(PARAM_PULSE_DELAY, 250);
+    TEST_ASSERT_EQUAL_UINT32(250, taskPeriods[TASK_SPEED]);
+    TEST_ASSERT_EQUAL_UINT32(pdMS_TO_TICKS(250), windowTicks);
+}
+
+void test_speed_drops_to_zero_after_timeout() {
+    driveSteady(kmhToMmPerS(5), false);
+    TEST_ASSERT_TRUE(periodSpeed() > 0);
+    uint32_t local = driveSteady(0, false, 2000 / SIM_WINDOW_MS + 1);
+    TEST_ASSERT_EQUAL_UINT32(0, local);
+}
+
+void test_slowing_down_uses_time_since_edge() {
+    driveSteady(kmhToMmPerS(10), false);
+    uint32_t before = periodSpeed();
+    // No edge for twice the period: the speed is at most half of it
+    advanceFakeMicros(2 * edgePeriodMicros);
+    TEST_ASSERT_TRUE(periodSpeed() <= before / 2 + 1);
+}
+
+void test_count_glitch_is_clamped() {
+    setEdgeCapture(false);
+    // Thousands of pulses in one short window, e.g. a PCNT glitch storm
+    uint32_t local = windowSpeed(30000, 30000 * 2000, 1000, 8);
+    TEST_ASSERT_EQUAL_UINT32(SPEED_MAX_MM_PER_S, local);
+    // Even a pulse in a 1 us window stays in range
+    TEST_ASSERT_EQUAL_UINT32(SPEED_MAX_MM_PER_S, windowSpeed(16, 16 * 2000, 1, 8));
+}
+
+void test_clamped_sample_fits_the_q8_ema() {
+    int32_t smoothedSpeedQ = 0;
+    for (int i = 0; i < 200; i++) {
+        smoothSpeed(smoothedSpeedQ, windowSpeed(30000, 30000 * 2000, 1, 8));
+        TEST_ASSERT_TRUE(smoothedSpeedQ >= 0);
+    }
+    TEST_ASSERT_INT32_WITHIN(1 << SPEED_Q_BITS, SPEED_MAX_MM_PER_S << SPEED_Q_BITS, smoothedSpeedQ);
+}
+
+void test_pulse_count_survives_pcnt_overflow() {
+    // About 33000 pulses, across the PCNT high limit
+    uint32_t expected = kmhToMmPerS(100);
+    setSpeedParameter(PARAM_SPEED_FACTOR, 1);
+    driveSteady(expected, false, 12);
+    uint32_t local = driveWindow(expected, false);
+    TEST_ASSERT_UINT32_WITHIN(10, expected, local);
+    TEST_ASSERT_TRUE(pcntOverflows > 0);
+}
+
+void test_set_trip_odometer() {
+    TEST_ASSERT_TRUE(setTripOdometer(1234));
+    TEST_ASSERT_EQUAL_UINT32(1234, getTripOdometer());
+    TEST_ASSERT_TRUE(setTripOdometer(TRIP_ODOMETER_LIMIT - 1));
+    TEST_ASSERT_EQUAL_UINT32(TRIP_ODOMETER_LIMIT - 1, getTripOdometer());
+
+    // Values whose mm overflow 32 bits used to wrap to a random trip
+    TEST_ASSERT_FALSE(setTripOdometer(TRIP_ODOMETER_LIMIT));
+    TEST_ASSERT_FALSE(setTripOdometer(42950));
+    TEST_ASSERT_FALSE(setTripOdometer(UINT32_MAX));
+    TEST_ASSERT_EQUAL_UINT32(TRIP_ODOMETER_LIMIT - 1, getTripOdometer());
+
+    resetTripOdometer();
+    TEST_ASSERT_EQUAL_UINT32(0, getTripOdometer());
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+void test_distances_change_together() {
+    restoreDistances(1234, 5678, 9000);
+    setOdometerKm(4321);
+    uint32_t km, odometerMm, tripMm;
+    getDistanceSnapshot(km, odometerMm, tripMm);
+    TEST_ASSERT_EQUAL_UINT32(4321, km);
+    TEST_ASSERT_EQUAL_UINT32(5678, odometerMm);
+    TEST_ASSERT_EQUAL_UINT32(9000, tripMm);
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+    TEST_ASSERT_EQUAL_INT(0, distanceMux.count);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 0; i < NUM_PARAMETERS; i++) {
+        parameterValues[i] = parameterInfo[i].defaultValue;
+    }
+    initializePulseCounterTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_period_mode_at_low_speed);
+    RUN_TEST(test_count_mode_at_high_speed);
+    RUN_TEST(test_bounces_do_not_change_the_speed);
+    RUN_TEST(test_bounce_rejected_after_each_edge);
+    RUN_TEST(test_bounce_from_standstill_is_no_speed);
+    RUN_TEST(test_min_edge_period_follows_speed_factor);
+    RUN_TEST(test_deadline_follows_pulse_delay);
+    RUN_TEST(test_speed_drops_to_zero_after_timeout);
+    RUN_TEST(test_slowing_down_uses_time_since_edge);
+    RUN_TEST(test_count_glitch_is_clamped);
+    RUN_TEST(test_clamped_sample_fits_the_q8_ema);
+    RUN_TEST(test_pulse_count_survives_pcnt_overflow);
+    RUN_TEST(test_set_trip_odometer);
+    RUN_TEST(test_distances_change_together);
+    return UNITY_END();
+}
@@ -0,0 +1,152 @@
+// Speed fusion: learning the drivetrain ratio from the wheel, storing it on
+// ignition off, and following a ratio set or cleared from the CLI.
+
+#include <unity.h>
+
+#include "SpeedFusion.cpp"
+
+// Modules SpeedFusion.cpp talks to. Parameters behave as in Parameter.cpp:
+// a change is stored and passed to the listeners.
+uint32_t writeTelemetry(const Telemetry &source, uint32_t topics) { return topics; }
+int32_t parameterValues[NUM_PARAMETERS];
+ParameterCallback ratioListener = NULL;
+uint32_t ratioUpdates = 0;
+
+void onParameterChange(ParameterId id, ParameterCallback callback) {
+    TEST_ASSERT_EQUAL(PARAM_SPEED_RATIO, id);
+    ratioListener = callback;
+    callback(id, parameterValues[id]);
+}
+
+bool updateParameter(ParameterId id, int32_t value) {
+    ratioUpdates++;
+    if (parameterValues[id] != value) {
+        parameterValues[id] = value;
+        ratioListener(id, value);
+    }
+    return true;
+}
+
+void publishTelemetry(uint32_t topics, uint32_t sourceMicros) {}
+
+#define WHEEL_MM_PER_S 10000
+#define MOTOR_RPM 3000
+#define TRUE_RATIO (WHEEL_MM_PER_S * 60000 / MOTOR_RPM)    // 200000 um/rev
+
+// Steady driving, an RPM frame and a reliable wheel window every 100 ms
+void drive(int windows, uint32_t wheelMmPerS = WHEEL_MM_PER_S, int16_t rpm = MOTOR_RPM) {
+    for (int i = 0; i < windows; i++) {
+        updateFusionFromRpm(rpm);
+        updateFusionFromWheel(wheelMmPerS, wheelMmPerS, true);
+        advanceFakeMillis(100);
+    }
+}
+
+// Power cycle with the given ratio in NVS
+void boot(int32_t storedRatio) {
+    parameterValues[PARAM_SPEED_RATIO] = storedRatio;
+    learnedRatioQ = 0;
+    fusedSpeedQ = 0;
+    lastRpmSpeedQ = 0;
+    lastRpm = 0;
+    lastRpmMillis = 0;
+    rpmSpeedValid = false;
+    ratioUpdates = 0;
+    initializeSpeedFusion();
+}
+
+void setUp() {
+    boot(0);
+}
+
+void tearDown() {}
+
+void test_first_window_gives_first_estimate() {
+    TEST_ASSERT_EQUAL_UINT32(0, getLearnedSpeedRatio());
+    drive(1);
+    TEST_ASSERT_EQUAL_UINT32(TRUE_RATIO, getLearnedSpeedRatio());
+}
+
+void test_boot_starts_from_stored_ratio() {
+    boot(123456);
+    TEST_ASSERT_EQUAL_UINT32(123456, getLearnedSpeedRatio());
+}
+
+void test_ignition_off_stores_learned_ratio() {
+    drive(50);
+    storeLearnedSpeedRatio();
+    TEST_ASSERT_EQUAL_INT32(TRUE_RATIO, parameterValues[PARAM_SPEED_RATIO]);
+
+    // Storing it must not throw away the fraction still being learned
+    drive(20, WHEEL_MM_PER_S * 102 / 100);
+    int64_t ratioQ = learnedRatioQ;
+    TEST_ASSERT_TRUE(ratioQ % (1 << FUSION_Q_BITS) != 0);
+    uint32_t updates = ratioUpdates;
+    storeLearnedSpeedRatio();
+    TEST_ASSERT_EQUAL_UINT32(updates + 1, ratioUpdates);
+    TEST_ASSERT_EQUAL_INT32(roundRatio(ratioQ), parameterValues[PARAM_SPEED_RATIO]);
+    TEST_ASSERT_TRUE(ratioQ == learnedRatioQ);
+}
+
+void test_small_changes_are_not_stored() {
+    drive(50);
+    storeLearnedSpeedRatio();
+    uint32_t updates = ratioUpdates;
+    drive(5, WHEEL_MM_PER_S + 10);     // Well under 0.5 %
+    storeLearnedSpeedRatio();
+    TEST_ASSERT_EQUAL_UINT32(updates, ratioUpdates);
+}
+
+void test_set_ratio_replaces_learned_one() {
+    drive(50);
+    storeLearnedSpeedRatio();
+
+    // p 6 150000
+    parameterValues[PARAM_SPEED_RATIO] = 150000;
+    ratioListener(PARAM_SPEED_RATIO, 150000);
+    TEST_ASSERT_EQUAL_UINT32(150000, getLearnedSpeedRatio());
+
+    // Ignition off keeps the user's value instead of writing the old one back
+    storeLearnedSpeedRatio();
+    TEST_ASSERT_EQUAL_INT32(150000, parameterValues[PARAM_SPEED_RATIO]);
+}
+
+void test_clear_ratio_learns_again() {
+    drive(50);
+    storeLearnedSpeedRatio();
+
+    // p clear 6
+    parameterValues[PARAM_SPEED_RATIO] = 0;
+    ratioListener(PARAM_SPEED_RATIO, 0);
+    TEST_ASSERT_EQUAL_UINT32(0, getLearnedSpeedRatio());
+    storeLearnedSpeedRatio();
+    TEST_ASSERT_EQUAL_INT32(0, parameterValues[PARAM_SPEED_RATIO]);
+
+    // The next reliable window is a fresh first estimate
+    drive(1, 2 * WHEEL_MM_PER_S);
+    TEST_ASSERT_EQUAL_UINT32(2 * TRUE_RATIO, getLearnedSpeedRatio());
+}
+
+void test_ratio_change_does_not_jump_the_speed() {
+    drive(50);
+    uint32_t before = getFusedSpeedMmPerS();
+    TEST_ASSERT_UINT32_WITHIN(5, WHEEL_MM_PER_S, before);
+
+    // Halving the ratio halves the RPM speed; the next frame must not be taken as a change in speed
+    ratioListener(PARAM_SPEED_RATIO, TRUE_RATIO / 2);
+    updateFusionFromRpm(MOTOR_RPM);
+    TEST_ASSERT_UINT32_WITHIN(5, before, getFusedSpeedMmPerS());
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_window_gives_first_estimate);
+    RUN_TEST(test_boot_starts_from_stored_ratio);
+    RUN_TEST(test_ignition_off_stores_learned_ratio);
+    RUN_TEST(test_small_changes_are_not_stored);
+    RUN_TEST(test_set_ratio_replaces_learned_one);
+    RUN_TEST(test_clear_ratio_learns_again);
+    RUN_TEST(test_ratio_change_does_not_jump_the_speed);
+    return UNITY_END();
+}
@@ -0,0 +1,179 @@
+// Telemetry batches as sent in BLE notifications: the byte layout, round
+// trips through readTelemetryBatch, and the samples a batch must refuse.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "TelemetryBatch.cpp"
+
+#define PAYLOAD 244     // Notification payload at the MTU BleTelemetry asks for
+
+uint8_t buffer[1024];
+uint8_t values[64];
+
+void fillValues(uint8_t seed, uint8_t size) {
+    for (uint8_t i = 0; i < size; i++) {
+        values[i] = seed * 31 + i;
+    }
+}
+
+// The batch as it is, to check that a refused sample changed nothing
+std::vector<uint8_t> snapshot(const TelemetryBatch &batch) {
+    return std::vector<uint8_t>(batch.buffer, batch.buffer + batch.length);
+}
+
+void setUp() {
+    memset(buffer, 0xAA, sizeof(buffer));
+}
+
+void tearDown() {}
+
+void test_byte_layout() {
+    TelemetryBatch batch;
+    startTelemetryBatch(batch, buffer, PAYLOAD, 0x1234, 0x80000005, 3);
+    const uint8_t first[3] = {1, 2, 3};
+    const uint8_t second[3] = {4, 5, 6};
+    TEST_ASSERT_TRUE(addTelemetrySample(batch, 0x01020304, first));
+    TEST_ASSERT_TRUE(addTelemetrySample(batch, 0x01020304 + 0x0102, second));
+
+    const uint8_t expected[] = {
+        0x34, 0x12,                 // sequence
+        2, 3,                       // count, sample size
+        0x05, 0x00, 0x00, 0x80,     // field mask
+        0x04, 0x03, 0x02, 0x01,     // first millis
+        0x00, 0x00, 1, 2, 3,
+        0x02, 0x01, 4, 5, 6,
+    };
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), batch.length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buffer, sizeof(expected));
+}
+
+void test_round_trip() {
+    srand(5);
+    for (uint8_t sampleSize = 0; sampleSize <= 40; sampleSize += 4) {
+        for (size_t capacity = TELEMETRY_BATCH_HEADER; capacity <= PAYLOAD; capacity += 29) {
+            TelemetryBatch batch;
+            uint32_t mask = rand();
+            uint16_t sequence = rand();
+            startTelemetryBatch(batch, buffer, capacity, sequence, mask, sampleSize);
+
+            // Start just before millis wraps, offsets up to a second apart
+            std::vector<uint32_t> times;
+            uint32_t now = 0xFFFFFFFF - 1500;
+            while (!telemetryBatchFull(batch)) {
+                fillValues(times.size(), sampleSize);
+                TEST_ASSERT_TRUE(addTelemetrySample(batch, now, values));
+                times.push_back(now);
+                now += rand() % 1000;
+            }
+            TEST_ASSERT_TRUE(batch.length <= capacity);
+            TEST_ASSERT_EQUAL_UINT8(times.size(), telemetryBatchCount(batch));
+
+            TelemetryBatchHeader header;
+            TEST_ASSERT_TRUE(readTelemetryBatch(buffer, batch.length, header));
+            TEST_ASSERT_EQUAL_UINT16(sequence, header.sequence);
+            TEST_ASSERT_EQUAL_UINT32(mask, header.fieldMask);
+            TEST_ASSERT_EQUAL_UINT8(sampleSize, header.sampleSize);
+            TEST_ASSERT_EQUAL_UINT8(times.size(), header.count);
+            for (uint8_t i = 0; i < header.count; i++) {
+                uint32_t millis;
+                const uint8_t *sample = telemetryBatchSample(buffer, header, i, millis);
+                TEST_ASSERT_EQUAL_UINT32(times[i], millis);
+                fillValues(i, sampleSize);
+                if (sampleSize > 0) {
+                    TEST_ASSERT_EQUAL_MEMORY(values, sample, sampleSize);
+                }
+            }
+        }
+    }
+}
+
+void test_full_batch_refuses_a_sample() {
+    TelemetryBatch batch;
+    startTelemetryBatch(batch, buffer, PAYLOAD, 7, 1, 20);
+    int added = 0;
+    while (addTelemetrySample(batch, 1000 + added, values)) {
+        added++;
+    }
+    // 12 bytes of header and 22 per sample in 244
+    TEST_ASSERT_EQUAL_INT((PAYLOAD - TELEMETRY_BATCH_HEADER) / 22, added);
+    TEST_ASSERT_TRUE(telemetryBatchFull(batch));
+    std::vector<uint8_t> before = snapshot(batch);
+    TEST_ASSERT_FALSE(addTelemetrySample(batch, 2000, values));
+    TEST_ASSERT_TRUE(snapshot(batch) == before);
+    TEST_ASSERT_EQUAL_UINT8(0xAA, buffer[batch.length]);
+
+    // Empty samples stop at the 255 the count byte holds
+    startTelemetryBatch(batch, buffer, sizeof(buffer), 8, 0, 0);
+    added = 0;
+    while (addTelemetrySample(batch, added, values)) {
+        added++;
+    }
+    TEST_ASSERT_EQUAL_INT(255, added);
+    TEST_ASSERT_EQUAL_UINT32(TELEMETRY_BATCH_HEADER + 255 * 2, batch.length);
+
+    // Not even the header fits
+    startTelemetryBatch(batch, buffer, TELEMETRY_BATCH_HEADER + 2 + 3, 9, 1, 4);
+    TEST_ASSERT_TRUE(telemetryBatchFull(batch));
+    TEST_ASSERT_FALSE(addTelemetrySample(batch, 0, values));
+    TEST_ASSERT_EQUAL_UINT8(0, telemetryBatchCount(batch));
+}
+
+void test_late_sample_is_refused() {
+    TelemetryBatch batch;
+    startTelemetryBatch(batch, buffer, PAYLOAD, 1, 1, 4);
+    uint32_t first = 0xFFFF0000;
+    TEST_ASSERT_TRUE(addTelemetrySample(batch, first, values));
+    TEST_ASSERT_TRUE(addTelemetrySample(batch, first + 0xFFFF, values));
+
+    // One millisecond more does not fit the 16 bit offset, nor does one from before the first
+    std::vector<uint8_t> before = snapshot(batch);
+    TEST_ASSERT_FALSE(addTelemetrySample(batch, first + 0x10000, values));
+    TEST_ASSERT_FALSE(addTelemetrySample(batch, first - 1, values));
+    TEST_ASSERT_TRUE(snapshot(batch) == before);
+
+    TelemetryBatchHeader header;
+    TEST_ASSERT_TRUE(readTelemetryBatch(buffer, batch.length, header));
+    uint32_t millis;
+    telemetryBatchSample(buffer, header, 1, millis);
+    TEST_ASSERT_EQUAL_UINT32(first + 0xFFFF, millis);
+}
+
+void test_length_mismatch_is_rejected() {
+    TelemetryBatch batch;
+    startTelemetryBatch(batch, buffer, PAYLOAD, 3, 0xFF, 6);
+    for (int i = 0; i < 5; i++) {
+        addTelemetrySample(batch, i * 100, values);
+    }
+    TelemetryBatchHeader header;
+    TEST_ASSERT_TRUE(readTelemetryBatch(buffer, batch.length, header));
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, batch.length - 1, header));
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, batch.length + 1, header));
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, batch.length + 8, header));    // One sample too many
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, TELEMETRY_BATCH_HEADER - 1, header));
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, 0, header));
+
+    // A count or sample size that does not match the bytes received
+    buffer[2]++;
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, batch.length, header));
+    buffer[2]--;
+    buffer[3]++;
+    TEST_ASSERT_FALSE(readTelemetryBatch(buffer, batch.length, header));
+    buffer[3]--;
+
+    // An empty batch is just the header
+    startTelemetryBatch(batch, buffer, PAYLOAD, 4, 1, 6);
+    TEST_ASSERT_TRUE(readTelemetryBatch(buffer, TELEMETRY_BATCH_HEADER, header));
+    TEST_ASSERT_EQUAL_UINT8(0, header.count);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_byte_layout);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_full_batch_refuses_a_sample);
+    RUN_TEST(test_late_sample_is_refused);
+    RUN_TEST(test_length_mismatch_is_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,93 @@
+// Telemetry bus writes and reads: a write copies only the fields of the
+// topics it is given and reports the ones that changed, so the CAN listener
+// and the speed fusion never overwrite each other's fields.
+
+#include <unity.h>
+#include <string.h>
+
+#include "TelemetryBus.cpp"
+
+// Modules TelemetryBus.cpp talks to
+Telemetry telemetryData;
+uint8_t logLevels[NUM_LOG_MODULES];
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {}
+
+// A snapshot where every field differs from a zeroed one
+Telemetry changedTelemetry() {
+    Telemetry source;
+    memset(&source, 0x5A, sizeof(source));
+    return source;
+}
+
+void setUp() {
+    memset(&telemetryData, 0, sizeof(telemetryData));
+}
+
+void tearDown() {
+    TEST_ASSERT_EQUAL_INT(0, telemetryDataMux.count);
+    TEST_ASSERT_EQUAL_INT(0, fakeCriticalDepth());
+}
+
+void test_write_copies_only_the_given_topics() {
+    Telemetry source = changedTelemetry();
+    TEST_ASSERT_EQUAL_UINT32(TOPIC_POWER, writeTelemetry(source, TOPIC_POWER));
+    Telemetry data;
+    readTelemetry(data);
+    TEST_ASSERT_TRUE(data.DCVoltage == source.DCVoltage);
+    TEST_ASSERT_TRUE(data.DCCurrent == source.DCCurrent);
+    // Distance and range are published from state outside Telemetry
+    TEST_ASSERT_EQUAL_UINT32(TOPIC_ALL & ~TOPIC_POWER & ~TOPIC_DISTANCE & ~TOPIC_RANGE,
+                             diffTelemetryTopics(data, source));
+}
+
+void test_every_field_of_a_topic_is_copied() {
+    Telemetry source = changedTelemetry();
+    for (uint32_t topic = 1; topic & TOPIC_ALL; topic <<= 1) {
+        writeTelemetry(source, topic);
+        TEST_ASSERT_EQUAL_UINT32(0, diffTelemetryTopics(telemetryData, source) & topic);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, diffTelemetryTopics(telemetryData, source));
+}
+
+void test_write_reports_only_changed_topics() {
+    Telemetry source;
+    readTelemetry(source);
+    source.rpm = 1200;
+    source.speed = 42;
+    // As the CAN listener writes a frame: everything but the fused speed
+    TEST_ASSERT_EQUAL_UINT32(TOPIC_RPM, writeTelemetry(source, TOPIC_ALL & ~TOPIC_SPEED));
+    TEST_ASSERT_EQUAL_INT(1200, telemetryData.rpm);
+    TEST_ASSERT_EQUAL_UINT32(0, telemetryData.speed);
+
+    // The same values again change nothing
+    TEST_ASSERT_EQUAL_UINT32(0, writeTelemetry(source, TOPIC_ALL & ~TOPIC_SPEED));
+}
+
+void test_speed_and_frame_writers_keep_their_fields() {
+    // The speed fusion writes from a snapshot that is older than the frame
+    Telemetry speedUpdate;
+    readTelemetry(speedUpdate);
+    Telemetry frame;
+    readTelemetry(frame);
+    frame.DCVoltage = 52.5f;
+    frame.DCCurrent = -12.0f;
+    writeTelemetry(frame, TOPIC_ALL & ~TOPIC_SPEED);
+    speedUpdate.speed = 30;
+    TEST_ASSERT_EQUAL_UINT32(TOPIC_SPEED, writeTelemetry(speedUpdate, TOPIC_SPEED));
+
+    Telemetry data;
+    readTelemetry(data);
+    TEST_ASSERT_EQUAL_UINT32(30, data.speed);
+    TEST_ASSERT_TRUE(data.DCVoltage == 52.5f);
+    TEST_ASSERT_TRUE(data.DCCurrent == -12.0f);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_write_copies_only_the_given_topics);
+    RUN_TEST(test_every_field_of_a_topic_is_copied);
+    RUN_TEST(test_write_reports_only_changed_topics);
+    RUN_TEST(test_speed_and_frame_writers_keep_their_fields);
+    return UNITY_END();
+}
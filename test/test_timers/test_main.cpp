@@ -0,0 +1,219 @@
+// Timer service with hundreds of timers: deadlines fire in order and on
+// time, watchdogs restart, a full heap refuses a start, and a benchmark of
+// reset and the service.
+
+#include <unity.h>
+#include <chrono>
+
+#define TIMER_MAX_TIMERS 512
+
+#include "Timers.cpp"
+#include "Trace.cpp"
+
+// Modules Timers.cpp talks to
+uint8_t logLevels[NUM_LOG_MODULES];
+uint32_t tooManyTimers = 0;
+
+void writeLog(LogMessageId id, const uint32_t *args, uint8_t argCount) {
+    if (id == LOG_TOO_MANY_TIMERS) {
+        tooManyTimers++;
+    }
+}
+
+bool createTask(TaskId task, TaskFunction_t function, TaskHandle_t *handle, void *parameter) {
+    if (handle) {
+        *handle = (TaskHandle_t)(intptr_t)(task + 1);
+    }
+    return true;
+}
+
+void countTaskWakeup(TaskId task) {}
+
+// Every fire is recorded with the time it happened
+struct Fired {
+    int id;
+    int64_t at;
+};
+
+std::vector<Fired> fired;
+
+void recordFire(void *context) {
+    fired.push_back({(int)(intptr_t)context, esp_timer_get_time()});
+}
+
+std::vector<Timer *> timers;
+
+Timer *makeTimer(int id, unsigned long timeoutMs, bool isWatchdog = false) {
+    Timer *timer = new Timer(timeoutMs, recordFire, (void *)(intptr_t)id, isWatchdog);
+    timers.push_back(timer);
+    return timer;
+}
+
+// Let the service run as it would: jump to each deadline it reports until endMicros
+void runUntil(int64_t endMicros) {
+    for (;;) {
+        int64_t next = Timer::runDueTimers();
+        if (next < 0 || next > endMicros) {
+            break;
+        }
+        fakeClockMicros() = next;
+    }
+    fakeClockMicros() = endMicros;
+    Timer::runDueTimers();
+}
+
+void setUp() {
+    for (Timer *timer : timers) {
+        delete timer;
+    }
+    timers.clear();
+    fired.clear();
+    tooManyTimers = 0;
+}
+
+void tearDown() {}
+
+void test_one_shot_fires_once_on_time() {
+    Timer *timer = makeTimer(1, 250);
+    int64_t started = esp_timer_get_time();
+    timer->start();
+    TEST_ASSERT_TRUE(timer->isRunning());
+    runUntil(started + 1000000);
+    TEST_ASSERT_EQUAL_UINT32(1, fired.size());
+    TEST_ASSERT_TRUE(fired[0].at == started + 250000);
+    TEST_ASSERT_FALSE(timer->isRunning());
+}
+
+void test_watchdog_restarts_and_reset_delays_it() {
+    Timer *timer = makeTimer(1, 100, true);
+    int64_t started = esp_timer_get_time();
+    timer->start();
+    runUntil(started + 350000);
+    TEST_ASSERT_EQUAL_UINT32(3, fired.size());
+
+    // Fed every 50 ms it never fires
+    fired.clear();
+    for (int i = 0; i < 20; i++) {
+        timer->reset();
+        runUntil(esp_timer_get_time() + 50000);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, fired.size());
+    timer->stop();
+}
+
+void test_hundreds_of_timers_fire_in_deadline_order() {
+    srand(7);
+    int64_t started = esp_timer_get_time();
+    std::vector<int64_t> deadlines;
+    for (int i = 0; i < 400; i++) {
+        unsigned long timeout = 1 + rand() % 5000;
+        makeTimer(i, timeout)->start();
+        deadlines.push_back(started + timeout * 1000);
+    }
+    runUntil(started + 6000000);
+
+    TEST_ASSERT_EQUAL_UINT32(400, fired.size());
+    for (size_t i = 0; i < fired.size(); i++) {
+        // Exactly at its own deadline, and never before an earlier one
+        TEST_ASSERT_TRUE(fired[i].at == deadlines[fired[i].id]);
+        if (i > 0) {
+            TEST_ASSERT_TRUE(fired[i].at >= fired[i - 1].at);
+        }
+    }
+}
+
+void test_stop_and_reset_in_the_middle_of_the_heap() {
+    srand(11);
+    int64_t started = esp_timer_get_time();
+    for (int i = 0; i < 300; i++) {
+        makeTimer(i, 100 + rand() % 900)->start();
+    }
+    // Stop every third, and 50 ms later restart the count of every fifth
+    for (int i = 0; i < 300; i += 3) {
+        timers[i]->stop();
+    }
+    advanceFakeMillis(50);
+    for (int i = 0; i < 300; i += 5) {
+        timers[i]->reset();
+    }
+    runUntil(started + 3000000);
+
+    std::vector<int> count(300, 0);
+    for (const Fired &f : fired) {
+        count[f.id]++;
+    }
+    for (int i = 0; i < 300; i++) {
+        TEST_ASSERT_EQUAL_INT(i % 3 == 0 ? 0 : 1, count[i]);
+    }
+    for (size_t i = 1; i < fired.size(); i++) {
+        TEST_ASSERT_TRUE(fired[i].at >= fired[i - 1].at);
+    }
+}
+
+void test_full_heap_refuses_a_start() {
+    for (int i = 0; i < TIMER_MAX_TIMERS; i++) {
+        makeTimer(i, 1000)->start();
+    }
+    Timer *extra = makeTimer(TIMER_MAX_TIMERS, 10);
+    extra->start();
+    TEST_ASSERT_FALSE(extra->isRunning());
+    TEST_ASSERT_EQUAL_UINT32(1, tooManyTimers);
+
+    // From an interrupt too, and a reset of a stopped timer does not sneak it in
+    extra->startFromISR();
+    TEST_ASSERT_FALSE(extra->isRunning());
+    extra->reset();
+    TEST_ASSERT_FALSE(extra->isRunning());
+
+    // Restarting a running timer still works, and so does the extra one once there is room
+    timers[0]->start();
+    TEST_ASSERT_TRUE(timers[0]->isRunning());
+    timers[1]->stop();
+    extra->start();
+    TEST_ASSERT_TRUE(extra->isRunning());
+
+    runUntil(esp_timer_get_time() + 2000000);
+    TEST_ASSERT_EQUAL_UINT32(TIMER_MAX_TIMERS, fired.size());
+    TEST_ASSERT_EQUAL_INT(TIMER_MAX_TIMERS, fired[0].id);   // The 10 ms one first
+}
+
+void test_benchmark() {
+    const int count = 500;
+    srand(3);
+    for (int i = 0; i < count; i++) {
+        makeTimer(i, 10 + rand() % 2000, i % 2 == 0)->start();
+    }
+
+    // Reset a random running timer, as the CAN task feeds its watchdogs
+    const int resets = 200000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < resets; i++) {
+        timers[rand() % count]->reset();
+    }
+    auto resetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // Ten simulated seconds of the service
+    start = std::chrono::steady_clock::now();
+    runUntil(esp_timer_get_time() + 10000000);
+    auto serviceNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char message[128];
+    snprintf(message, sizeof(message), "%d timers: reset %.0f ns, %u fires at %.0f ns each on the host",
+             count, (double)resetNs / resets, (unsigned)fired.size(), (double)serviceNs / fired.size());
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(fired.size() > (size_t)count);
+}
+
+int main(int argc, char **argv) {
+    memset(logLevels, LOG_DEBUG, sizeof(logLevels));
+    initializeTimerTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_one_shot_fires_once_on_time);
+    RUN_TEST(test_watchdog_restarts_and_reset_delays_it);
+    RUN_TEST(test_hundreds_of_timers_fire_in_deadline_order);
+    RUN_TEST(test_stop_and_reset_in_the_middle_of_the_heap);
+    RUN_TEST(test_full_heap_refuses_a_start);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Decode the binary telemetry of the `stream` CLI command to CSV.
+
+Start a stream in the terminal, for example `stream 50 speed,rpm,SoC`,
+then read the same port with this script:
+
+    python3 tools/stream_to_csv.py /dev/cu.usbserial-028987C8 > drive.csv
+    python3 tools/stream_to_csv.py capture.bin > drive.csv
+
+A serial port is opened with pyserial at 115200 baud, anything else is read
+as a raw capture file. Packets are COBS framed and end in a zero byte,
+with a CRC32 at the end. The firmware repeats a schema packet every few
+seconds naming the streamed fields, so no field table is needed here.
+CLI text mixed into the capture fails the CRC and is skipped.
+Counts of packets, CRC errors and lost packets go to stderr at the end.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import zlib
+
+PACKET_DATA = 1
+PACKET_SCHEMA = 2
+
+# TelemetryFieldType in src/TelemetryFormat.h
+FIELD_FORMATS = {0: "<B", 1: "<b", 2: "<H", 3: "<h", 4: "<I", 5: "<f"}
+FIELD_FLOAT = 5
+
+
+def cobs_decode(frame):
+    output = bytearray()
+    index = 0
+    while index < len(frame):
+        code = frame[index]
+        if code == 0 or index + code > len(frame):
+            raise ValueError("bad COBS code")
+        output += frame[index + 1:index + code]
+        index += code
+        if code < 0xFF and index < len(frame):
+            output.append(0)
+    return bytes(output)
+
+
+def read_frames(source):
+    buffer = bytearray()
+    while True:
+        chunk = source.read(256)
+        if not chunk:
+            break
+        buffer += chunk
+        while True:
+            end = buffer.find(b"\0")
+            if end < 0:
+                break
+            frame = bytes(buffer[:end])
+            del buffer[:end + 1]
+            if frame:
+                yield frame
+
+
+def parse_schema(packet):
+    fields = {}
+    count = packet[1]
+    index = 2
+    for _ in range(count):
+        field_id, field_type, scale, name_length = struct.unpack_from("<BBHB", packet, index)
+        index += 5
+        name = packet[index:index + name_length].decode("ascii")
+        index += name_length
+        fields[field_id] = (name, field_type, scale)
+    return fields
+
+
+def parse_data(packet, fields):
+    sequence, millis, mask = struct.unpack_from("<HII", packet, 1)
+    index = 11
+    values = []
+    for field_id in range(32):
+        if not mask & (1 << field_id):
+            continue
+        if field_id not in fields:
+            return None  # Schema does not match this packet yet
+        name, field_type, scale = fields[field_id]
+        fmt = FIELD_FORMATS[field_type]
+        (raw,) = struct.unpack_from(fmt, packet, index)
+        index += struct.calcsize(fmt)
+        if field_type == FIELD_FLOAT or scale != 1:
+            values.append(round(raw / scale, 6))
+        else:
+            values.append(raw)
+    return sequence, millis, mask, values
+
+
+def open_source(path, baud):
+    if path == "-":
+        return sys.stdin.buffer
+    if path.startswith("/dev/") or path.upper().startswith("COM"):
+        import serial  # pyserial, only needed for live capture
+        return serial.Serial(path, baud, timeout=1)
+    return open(path, "rb")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="serial port, capture file, or - for stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    writer = csv.writer(sys.stdout)
+    fields = {}
+    header_mask = None
+    last_sequence = None
+    packets = crc_errors = lost = 0
+
+    try:
+        for frame in read_frames(open_source(args.source, args.baud)):
+            try:
+                packet = cobs_decode(frame)
+            except ValueError:
+                crc_errors += 1
+                continue
+            if len(packet) < 5 or zlib.crc32(packet[:-4]) != struct.unpack("<I", packet[-4:])[0]:
+                crc_errors += 1
+                continue
+            packet = packet[:-4]
+            packets += 1
+
+            if packet[0] == PACKET_SCHEMA:
+                fields = parse_schema(packet)
+            elif packet[0] == PACKET_DATA:
+                decoded = parse_data(packet, fields)
+                if decoded is None:
+                    continue
+                sequence, millis, mask, values = decoded
+                if last_sequence is not None:
+                    lost += (sequence - last_sequence - 1) & 0xFFFF
+                last_sequence = sequence
+                if mask != header_mask:
+                    # New field selection, start a new header
+                    names = [fields[i][0] for i in range(32) if mask & (1 << i)]
+                    writer.writerow(["millis", "sequence"] + names)
+                    header_mask = mask
+                writer.writerow([millis, sequence] + values)
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+
+    print("%d packets, %d CRC errors, %d lost" % (packets, crc_errors, lost), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
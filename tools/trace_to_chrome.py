@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Convert the output of the `trace` CLI command to Chrome trace JSON.
+
+Capture the dump from the serial monitor into a file, then:
+
+    python3 tools/trace_to_chrome.py trace.txt > trace.json
+
+and open trace.json in https://ui.perfetto.dev or chrome://tracing.
+Every core is a separate track. Timestamps are the CPU cycle counters of
+the two cores, which are not synchronised, so compare events across
+cores with some care.
+"""
+
+import argparse
+import json
+import sys
+
+CYCLE_COUNTER_RANGE = 1 << 32
+
+# Records can be this much older than the one before them (about 1 s at
+# 240 MHz), a bigger step back is the counter wrapping
+LATE_RECORD_CYCLES = 1 << 28
+
+
+def parse_dump(lines):
+    cpu_mhz = 240
+    events = {}
+    records = []
+    for line in lines:
+        line = line.strip()
+        if not line:
+            continue
+        if line.startswith("#"):
+            fields = line[1:].split(None, 3)
+            if len(fields) >= 2 and fields[0] == "cpu_mhz":
+                cpu_mhz = int(fields[1])
+            elif len(fields) == 4 and fields[0] == "event":
+                events[int(fields[1])] = (fields[3], fields[2])
+            continue
+        fields = line.split()
+        if len(fields) != 4 or not all(field.isdigit() for field in fields):
+            continue  # Other CLI output mixed into the capture
+        records.append(tuple(int(field) for field in fields))
+    return cpu_mhz, events, records
+
+
+def to_chrome(cpu_mhz, events, records):
+    trace_events = []
+    last_cycles = {}
+    last_total = {}
+    for cycles, core, event, arg in records:
+        # The cycle counter wraps every 2^32 cycles, unwrap it per core from
+        # the step since the previous record. A writer interrupted between
+        # claiming its slot and reading the counter stores a time a little
+        # older than the record before it, so a short step back is such a
+        # late record and not a wrap.
+        if core in last_cycles:
+            step = (cycles - last_cycles[core]) % CYCLE_COUNTER_RANGE
+            if step > CYCLE_COUNTER_RANGE - LATE_RECORD_CYCLES:
+                total_cycles = last_total[core] + step - CYCLE_COUNTER_RANGE
+            else:
+                total_cycles = last_total[core] + step
+                last_cycles[core] = cycles
+                last_total[core] = total_cycles
+        else:
+            total_cycles = cycles
+            last_cycles[core] = cycles
+            last_total[core] = total_cycles
+
+        name, phase = events.get(event, ("event %d" % event, "i"))
+        entry = {
+            "name": name,
+            "ph": phase,
+            "ts": total_cycles / cpu_mhz,
+            "pid": 0,
+            "tid": core,
+            "args": {"arg": arg, "hex": "0x%X" % arg},
+        }
+        if phase == "i":
+            entry["s"] = "t"
+        trace_events.append(entry)
+
+    # Put those late records back in time order, so begin and end events nest
+    trace_events.sort(key=lambda entry: (entry["tid"], entry["ts"]))
+
+    metadata = [
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": core, "args": {"name": "Core %d" % core}}
+        for core in sorted(last_cycles)
+    ]
+    return {"traceEvents": metadata + trace_events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", nargs="?", help="captured `trace` output, stdin when omitted")
+    parser.add_argument("-o", "--output", help="JSON file to write, stdout when omitted")
+    args = parser.parse_args()
+
+    source = open(args.dump) if args.dump else sys.stdin
+    with source:
+        cpu_mhz, events, records = parse_dump(source)
+
+    chrome = to_chrome(cpu_mhz, events, records)
+    if args.output:
+        with open(args.output, "w") as output:
+            json.dump(chrome, output)
+    else:
+        json.dump(chrome, sys.stdout)
+    print("%d records converted" % len(records), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()